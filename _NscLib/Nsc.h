@@ -51,6 +51,7 @@
 #include "NwnDefines.h"
 #include "NwnStreams.h"
 #include "NwnLoader.h"
+#include "NscResourceCache.h"
 #include <set>
 //-----------------------------------------------------------------------------
 //
@@ -61,6 +62,9 @@
 class CNscContext;
 struct NscCompilerState;
 class NscCompiler;
+class NscCompileWorkspace;
+class NscActionTable;
+struct NscScriptCost;
 
 //-----------------------------------------------------------------------------
 //
@@ -74,6 +78,7 @@ enum NscConstants
 	NscMaxScript		= 0x4000000,
 	NscMaxHash			= 64,
 	NscMaxLabelSize		= 16,		// internal setting only, don't sweat it
+	NscMaxInlineCost	= 16,		// PCode operations in an inlined function
 };
 
 //-----------------------------------------------------------------------------
@@ -147,6 +152,7 @@ enum NscCompilerFlags
 	NscCompilerFlag_GenerateMakeDeps	= 0x00000010,
     NscCompilerFlag_SuppressWarnings   	= 0x00000020,
     NscCompilerFlag_DisableDoubleQuote  = 0x00000040,
+	NscCompilerFlag_OptimizeLevel2		= 0x00000080,
 };
 
 //-----------------------------------------------------------------------------
@@ -630,7 +636,7 @@ struct NscPCodeCase
 	size_t			nOpSize;
 	NscPCode		nOpCode;
 	NscType			nType;
-	char			szLabel [NscMaxLabelSize];
+	int				nLabel;
 	size_t			nCaseOffset;
 	size_t			nCaseSize;
 	int				nFile;
@@ -912,9 +918,10 @@ NscResult NscCompileScript (CNwnLoader *pLoader, const char *pszName,
                             CNwnStream *pCodeOutput, CNwnStream *pDebugOutput,
                             CNwnStream *pErrorOuput, NscCompiler *pCompiler,
 							UINT32 ulCompilerFlags);
-void NscScriptDecompile (CNwnStream &sStream, 
-	unsigned char *pauchData, unsigned long ulSize, NscCompiler *pCompiler);
+void NscScriptDecompile (std::string &strText, 
+	const unsigned char *pauchData, size_t nSize, const NscActionTable &sActions);
 const char *NscGetActionName (int nAction, NscCompiler *pCompiler);
+UINT64 NscGetTimestamp ();
 
 
 typedef std::vector< NscType > NscTypeVec;
@@ -930,6 +937,25 @@ struct NscPrototypeDefinition
 	NscTypeVec         ParameterTypes;
 };
 
+//
+// Define the time spent in each stage of the last compilation, in
+// nanoseconds (see NscGetTimestamp).  The include counters cover the
+// #include loads of both parse phases; a load served from the resource cache
+// is also counted as a cache hit.
+//
+
+struct NscCompileTimings
+{
+	UINT64             NWScriptInitTime; // Only if this compile parsed nwscript
+	UINT64             Phase1Time;
+	UINT64             Phase2Time;
+	UINT64             CodeGenerationTime;
+	UINT64             SymbolsTime;      // NDB emission
+	UINT64             IncludeTime;
+	UINT32             IncludeLoads;
+	UINT32             IncludeCacheHits;
+};
+
 //
 // Define the script compiler wrapper.  Note that only one concurrent usage is
 // permitted.
@@ -1021,6 +1047,29 @@ public:
 		 std::set<std::string> & Dependencies
 		);
 
+	// @cmember Compile script from in-memory source text to output streams.
+
+	//
+	// Compile a script from a raw memory buffer, writing the compiled
+	// instruction set code and the debug symbols straight to caller supplied
+	// streams.  Debug symbols are only generated if a symbols stream is given.
+	//
+
+	NscResult
+	NscCompileScript (
+		 const NWN::ResRef32 & ScriptName,
+		 const void * ScriptText,
+		 size_t ScriptTextLength,
+		 int CompilerVersion,
+		 bool Optimize,
+		 bool IgnoreIncludes,
+		 IDebugTextOut * ErrorOutput,
+		 UINT32 CompilerFlags,
+		 CNwnStream * CodeOutput,
+		 CNwnStream * SymbolsOutput,
+		 std::set<std::string> & Dependencies
+		);
+
 	// @cmember Disassemble script from in-memory instruction stream.
 
 	//
@@ -1034,6 +1083,45 @@ public:
 		 std::string & Disassembly
 		);
 
+	// @cmember Verify a compiled script.
+
+	//
+	// Verify the instruction stream of a compiled script: decoding, branch
+	// targets, stack depths along all paths and calls against the routine
+	// prototypes in the (optional) debug symbols.  Errors are written to the
+	// text out interface.  Returns true if the script verified.
+	//
+
+	bool
+	NscVerifyScript (
+		 const char * ScriptName,
+		 const void * Code,
+		 size_t CodeLength,
+		 const void * Symbols,
+		 size_t SymbolsLength,
+		 IDebugTextOut * TextOut
+		);
+
+	// @cmember Analyze the static cost of a compiled script.
+
+	//
+	// Walk the code of a compiled script function by function, counting the
+	// instructions by opcode class and the actions called, and finding the
+	// deepest stack and loop nesting of each function.  The functions come
+	// from the (optional) debug symbols.  Returns false if the script could
+	// not be decoded.
+	//
+
+	bool
+	NscAnalyzeScriptCost (
+		 const char * ScriptName,
+		 const void * Code,
+		 size_t CodeLength,
+		 const void * Symbols,
+		 size_t SymbolsLength,
+		 NscScriptCost & Cost
+		);
+
 	// @cmember Lookup name of an action service handler by ordinal.
 
 	//
@@ -1046,6 +1134,19 @@ public:
 		 int Action
 		);
 
+	// @cmember Parse nwscript.nss, if not yet done.
+
+	//
+	// Parse nwscript.nss so that the action names and prototypes are
+	// available without compiling a script first.
+	//
+
+	bool
+	NscParseNWScript (
+		 int CompilerVersion,
+		 IDebugTextOut * TextOut
+		);
+
 	// @cmember Return prototype information for an action service handler.
 
 	//
@@ -1148,7 +1249,9 @@ public:
 
 	//
 	// Enable or disable the compiler's resource cache.  If disabling the cache
-	// then cached items are flushed.
+	// then cached items are flushed, unless the cache is shared with another
+	// compiler instance, in which case only this compiler's references to
+	// cached items are released.
 	//
 
 	void
@@ -1156,6 +1259,57 @@ public:
 		 bool EnableCache
 		);
 
+	// @cmember Share a resource cache with other compiler instances.
+
+	//
+	// Replace the compiler's resource cache with the supplied cache, which
+	// may be shared by several compiler instances (including instances used
+	// on other threads).  Resources already handed out from the previous
+	// cache remain valid until the current compilation completes.
+	//
+
+	void
+	NscSetResourceCache (
+		 const std::shared_ptr< NscResourceCache > & Cache
+		);
+
+	// @cmember Return the resource cache in use by the compiler.
+
+	//
+	// Return the resource cache, e.g. for setting its memory budget, sharing
+	// it with another compiler instance or querying its usage counters.
+	//
+
+	inline
+	const std::shared_ptr< NscResourceCache > &
+	NscGetResourceCache (
+		) const
+	{
+		return m_ResourceCache;
+	}
+
+	// @cmember Return the compile workspace of the compiler.
+
+	//
+	// Return the workspace that keeps the compiler's code generation buffers
+	// between compilations, e.g. for querying its usage counters.
+	//
+
+	const NscCompileWorkspace &
+	NscGetCompileWorkspace (
+		) const;
+
+	// @cmember Return the stage timings of the last compilation.
+
+	//
+	// Return the time spent in each stage of the last compilation, e.g. for
+	// reporting where the time of a batch build goes.
+	//
+
+	const NscCompileTimings &
+	NscGetCompileTimings (
+		) const;
+
 
 	//
 	// Note, remaining routines are for internal use only.
@@ -1211,48 +1365,6 @@ public:
 
 private:
 
-	//
-	// The resource cache is used to avoid reloading commonly referenced
-	// include files for multiple compilation sessions.
-	//
-
-	struct ResourceCacheKey
-	{
-		NWN::ResRef32 ResRef;
-		NWN::ResType  ResType;
-
-		inline
-		bool
-		operator< (
-			 const ResourceCacheKey & other
-			) const
-		{
-			return (ResType < other .ResType) ||
-				(memcmp (&ResRef, &other .ResRef, sizeof (ResRef)) < 0);
-		}
-
-		inline
-		bool
-		operator== (
-			 const ResourceCacheKey & other
-			) const
-		{
-			return (ResType == other .ResType) &&
-				(memcmp (&ResRef, &other .ResRef, sizeof (ResRef)) == 0);
-		}
-	};
-
-	struct ResourceCacheEntry
-	{
-		bool                Allocated;
-		unsigned char     * Contents;
-		UINT32              Size;
-		std::string         Location;
-	};
-
-	typedef std::map< ResourceCacheKey, ResourceCacheEntry > ResourceCache;
-
-
 	// @cmember Initialize compiler and parse nwscript.nss
 
 	//
@@ -1315,13 +1427,29 @@ private:
 	// @cmember Flush the resource cache.
 
 	//
-	// Release all references to cached resources.
+	// Release this compiler's references to cached resources, and flush the
+	// cache if no other compiler instance shares it.
 	//
 
 	void
 	NscFlushResourceCache (
 		);
 
+	// @cmember Release resources pinned by the last compilation.
+
+	//
+	// Drop the references to cached resources that were handed out while
+	// compiling, allowing the cache to free them once evicted.
+	//
+
+	inline
+	void
+	NscReleasePinnedResources (
+		)
+	{
+		m_PinnedResources .clear ();
+	}
+
 	ResourceManager             & m_ResourceManager;
 	bool 						  m_StrictModeEnabled;
 	bool                          m_EnableExtensions;
@@ -1338,7 +1466,8 @@ private:
 	ResLoadFileProc               m_ResLoadFile;
 	ResUnloadFileProc             m_ResUnloadFile;
 	bool                          m_CacheResources;
-	ResourceCache                 m_ResourceCache;
+	std::shared_ptr< NscResourceCache > m_ResourceCache;
+	std::vector< std::shared_ptr< unsigned char > > m_PinnedResources;
 	IDebugTextOut               * m_ErrorOutput;
 
 };
@@ -0,0 +1,304 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscActionTable.cpp - Engine action table |
+//
+// This module contains the engine action table.  The scan only tokenizes
+// nwscript.nss: comments, preprocessor lines and the bodies of braces are
+// skipped, and each remaining declaration of the form "type name (...)" is
+// an action.  As in the compiler, a name declared twice keeps its first
+// number.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "NscActionTable.h"
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscActionTable> constructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscActionTable::NscActionTable ()
+{
+	m_fLoaded = false;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscActionTable> destructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscActionTable::~NscActionTable ()
+{
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Build the table from the text of nwscript.nss
+//
+// @parm const unsigned char * | pauchText | Text of nwscript.nss
+//
+// @parm size_t | nSize | Size of the text
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscActionTable::Scan (const unsigned char *pauchText, size_t nSize)
+{
+	const char *pch = (const char *) pauchText;
+	const char *pchEnd = pch + nSize;
+	std::vector <Token> asTokens;
+	std::set <std::string> setNames;
+	int nBraces = 0;
+	bool fLineStart = true;
+
+	m_asActions .clear ();
+	while (pch < pchEnd)
+	{
+		char c = *pch;
+
+		//
+		// Skip white space, comments and preprocessor lines
+		//
+
+		if (c == '\n')
+		{
+			fLineStart = true;
+			pch++;
+			continue;
+		}
+		if (c == ' ' || c == '\t' || c == '\r' || c == '\f' || c == '\v')
+		{
+			pch++;
+			continue;
+		}
+		if (c == '/' && pch + 1 < pchEnd && pch [1] == '/')
+		{
+			while (pch < pchEnd && *pch != '\n')
+				pch++;
+			continue;
+		}
+		if (c == '/' && pch + 1 < pchEnd && pch [1] == '*')
+		{
+			pch += 2;
+			while (pch < pchEnd && !(pch [0] == '*' &&
+				pch + 1 < pchEnd && pch [1] == '/'))
+				pch++;
+			pch += 2;
+			continue;
+		}
+		if (c == '#' && fLineStart)
+		{
+			while (pch < pchEnd && *pch != '\n')
+				pch++;
+			continue;
+		}
+		fLineStart = false;
+
+		//
+		// Get the next token
+		//
+
+		Token sToken;
+		sToken .pszText = pch;
+		sToken .fIdentifier = false;
+		if (c == '"')
+		{
+			pch++;
+			while (pch < pchEnd && *pch != '"' && *pch != '\n')
+			{
+				if (*pch == '\\' && pch + 1 < pchEnd)
+					pch++;
+				pch++;
+			}
+			if (pch < pchEnd && *pch == '"')
+				pch++;
+		}
+		else if (isalnum ((unsigned char) c) || c == '_')
+		{
+			sToken .fIdentifier = !isdigit ((unsigned char) c);
+			while (pch < pchEnd && (isalnum ((unsigned char) *pch) ||
+				*pch == '_' || *pch == '.'))
+				pch++;
+		}
+		else
+			pch++;
+		sToken .nLength = pch - sToken .pszText;
+
+		//
+		// Declarations end at a semicolon or at the body of a function or
+		// structure.  Only the declarations outside of braces matter.
+		//
+
+		if (c == '{')
+		{
+			if (nBraces++ == 0)
+			{
+				AddDeclaration (asTokens, setNames);
+				asTokens .clear ();
+			}
+		}
+		else if (c == '}')
+		{
+			if (nBraces > 0)
+				nBraces--;
+		}
+		else if (nBraces == 0)
+		{
+			if (c == ';')
+			{
+				AddDeclaration (asTokens, setNames);
+				asTokens .clear ();
+			}
+			else
+				asTokens .push_back (sToken);
+		}
+	}
+	m_fLoaded = true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Add the action declared by a declaration, if it is one
+//
+// @parm const std::vector <Token> & | asTokens | Tokens of the declaration
+//
+// @parm std::set <std::string> & | setNames | Names declared so far
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscActionTable::AddDeclaration (const std::vector <Token> &asTokens,
+	std::set <std::string> &setNames)
+{
+
+	//
+	// A function is "type name (parameters)", anything else (i.e. a
+	// constant, which has an '=' before any parenthesis) is not an action
+	//
+
+	size_t nOpen = 0;
+	while (nOpen < asTokens .size () && !(asTokens [nOpen] .nLength == 1 &&
+		asTokens [nOpen] .pszText [0] == '('))
+		nOpen++;
+	if (nOpen < 2 || nOpen >= asTokens .size ())
+		return;
+	const Token &sLast = asTokens .back ();
+	if (sLast .nLength != 1 || sLast .pszText [0] != ')')
+		return;
+	const Token &sName = asTokens [nOpen - 1];
+	if (!sName .fIdentifier)
+		return;
+
+	Action sAction;
+	sAction .strName .assign (sName .pszText, sName .nLength);
+	if (!GetTypeText (asTokens, 0, nOpen - 1, sAction .strReturnType))
+		return;
+
+	//
+	// Split the parameters at the commas, ignoring any default values
+	//
+
+	size_t nEnd = asTokens .size () - 1;
+	size_t nStart = nOpen + 1;
+	size_t nValue = 0;
+	int nNesting = 0;
+	for (size_t i = nStart; i <= nEnd; i++)
+	{
+		char c = asTokens [i] .nLength == 1 ? asTokens [i] .pszText [0] : 0;
+		if (i < nEnd && (c == '(' || c == '['))
+			nNesting++;
+		else if (i < nEnd && (c == ')' || c == ']'))
+			nNesting--;
+		else if (i < nEnd && c == '=' && nNesting == 0 && nValue == 0)
+			nValue = i;
+		else if ((i == nEnd || c == ',') && nNesting == 0)
+		{
+			size_t nTypeEnd = (nValue != 0 ? nValue : i);
+			if (nTypeEnd > nStart)
+			{
+
+				//
+				// The parameter name is optional, and "name (void)" has no
+				// parameters
+				//
+
+				std::string strType;
+				if (nTypeEnd - nStart == 1)
+				{
+					if (!GetTypeText (asTokens, nStart, nTypeEnd, strType))
+						return;
+					if (strType == "void" && i == nEnd &&
+						sAction .astrParameterTypes .empty ())
+						break;
+				}
+				else if (!GetTypeText (asTokens, nStart, nTypeEnd - 1, strType))
+					return;
+				sAction .astrParameterTypes .push_back (strType);
+			}
+			else if (i != nEnd || !sAction .astrParameterTypes .empty ())
+				return;
+			nStart = i + 1;
+			nValue = 0;
+		}
+	}
+
+	//
+	// The first declaration of a name numbers it
+	//
+
+	if (!setNames .insert (sAction .strName) .second)
+		return;
+	m_asActions .push_back (sAction);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the text of a type given by a range of tokens
+//
+// @parm const std::vector <Token> & | asTokens | Tokens of a declaration
+//
+// @parm size_t | nStart | First token of the type
+//
+// @parm size_t | nEnd | Token following the type
+//
+// @parm std::string & | strType | Receives the type
+//
+// @rdesc true if the tokens form a type.
+//
+//-----------------------------------------------------------------------------
+
+bool NscActionTable::GetTypeText (const std::vector <Token> &asTokens,
+	size_t nStart, size_t nEnd, std::string &strType)
+{
+	strType .clear ();
+	if (nStart >= nEnd)
+		return false;
+	for (size_t i = nStart; i < nEnd; i++)
+	{
+		if (!asTokens [i] .fIdentifier)
+			return false;
+		if (i > nStart)
+			strType += ' ';
+		strType .append (asTokens [i] .pszText, asTokens [i] .nLength);
+	}
+	return true;
+}
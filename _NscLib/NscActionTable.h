@@ -0,0 +1,150 @@
+#ifndef ETS_NSCACTIONTABLE_H
+#define ETS_NSCACTIONTABLE_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscActionTable.h - Engine action table |
+//
+// This module contains the definition of the engine action table.  The
+// table holds the names and prototypes of the engine actions, numbered in
+// declaration order as the compiler numbers them.  It is built by a quick
+// scan of the prototypes in nwscript.nss rather than by a full parse, which
+// is all that the disassembler needs to name ACTION instructions.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include <set>
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscActionTable
+{
+// @access Public types
+public:
+
+	//
+	// An engine action.  Types are as written in nwscript.nss ("int",
+	// "struct foo", "effect").
+	//
+
+	struct Action
+	{
+		std::string					strName;
+		std::string					strReturnType;
+		std::vector <std::string>	astrParameterTypes;
+	};
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscActionTable ();
+
+	// @cmember Destructor
+
+	~NscActionTable ();
+
+// @access Public methods
+public:
+
+	// @cmember Build the table from the text of nwscript.nss
+
+	void Scan (const unsigned char *pauchText, size_t nSize);
+
+	// @cmember Remove all actions
+
+	void Reset ()
+	{
+		m_asActions .clear ();
+		m_fLoaded = false;
+	}
+
+	// @cmember Return true if the table was built
+
+	bool IsLoaded () const
+	{
+		return m_fLoaded;
+	}
+
+	// @cmember Get the number of actions
+
+	int GetCount () const
+	{
+		return (int) m_asActions .size ();
+	}
+
+	// @cmember Get an action, NULL if there is no such action
+
+	const Action *GetAction (int nAction) const
+	{
+		if (nAction < 0 || nAction >= (int) m_asActions .size ())
+			return NULL;
+		return &m_asActions [nAction];
+	}
+
+	// @cmember Get the name of an action, "UnknownAction" if there is no
+	//		such action
+
+	const char *GetName (int nAction) const
+	{
+		const Action *pAction = GetAction (nAction);
+		return pAction != NULL ? pAction ->strName .c_str () : "UnknownAction";
+	}
+
+// @access Protected types
+protected:
+
+	//
+	// A token of a declaration.  Punctuation is a single character token.
+	//
+
+	struct Token
+	{
+		const char			*pszText;
+		size_t				nLength;
+		bool				fIdentifier;
+	};
+
+// @access Protected methods
+protected:
+
+	// @cmember Add the action declared by a declaration, if it is one
+
+	void AddDeclaration (const std::vector <Token> &asTokens,
+		std::set <std::string> &setNames);
+
+	// @cmember Get the text of a type given by a range of tokens
+
+	static bool GetTypeText (const std::vector <Token> &asTokens,
+		size_t nStart, size_t nEnd, std::string &strType);
+
+// @access Protected members
+protected:
+
+	// @cmember Actions in declaration order
+
+	std::vector <Action>		m_asActions;
+
+	// @cmember true if the table was built
+
+	bool						m_fLoaded;
+};
+
+#endif // ETS_NSCACTIONTABLE_H
@@ -39,10 +39,14 @@
 //-----------------------------------------------------------------------------
 
 #include <vector>
+#include <algorithm>
+#include <climits>
 #include "Precomp.h"
 #include "Nsc.h"
 #include "NscPCodeEnumerator.h"
 #include "NscCodeGenerator.h"
+#include "NscDebugTextWriter.h"
+#include "NscTrace.h"
 
 //
 // Externals
@@ -56,22 +60,27 @@
 //
 // @parm int | nVersion | Compilation version (game version)
 //
-// @parm bool | fEnableOptimizations | If true, enable optimizations
+// @parm int | nOptimizationLevel | Optimization level (0 = none, 1 = the
+//		classic optimizations, 2 = also those that trade code size for speed)
 //
 // @rdesc None.
 //
 //-----------------------------------------------------------------------------
 
 CNscCodeGenerator::CNscCodeGenerator (CNscContext *pCtx, 
-	int nVersion, bool fEnableOptimizations)
+	int nVersion, int nOptimizationLevel)
 {
+	bool fEnableOptimizations = nOptimizationLevel > 0;
 
 	//
 	// General initialization
 	//
 
 	m_pauchCode = NULL;
+	m_pWorkspace = NULL;
+	m_pauchBlockList = NULL;
 	m_pCtx = pCtx;
+	m_ulSymbolsTime = 0;
 
 	//
 	// Setup optimization flags
@@ -92,6 +101,13 @@ CNscCodeGenerator::CNscCodeGenerator (CNscContext *pCtx,
 	m_fOptFor = fEnableOptimizations;
 	m_fOptDeclaration = fEnableOptimizations;
 	m_fOptConditional = fEnableOptimizations;
+	m_fOptSwitch = nOptimizationLevel >= 2;
+	m_fOptInline = nOptimizationLevel >= 2;
+	m_fOptPure = nOptimizationLevel >= 2;
+	m_fOptSlots = nOptimizationLevel >= 2;
+	m_fOptPeephole = fEnableOptimizations;
+	m_fOptConstants = nOptimizationLevel >= 2;
+	m_fOptTailReturn = nOptimizationLevel >= 2;
 
 	//
 	// If we need to turn declaration optimizations off, i.e. to support
@@ -118,10 +134,21 @@ CNscCodeGenerator::~CNscCodeGenerator ()
 {
 
 	//
-	// Delete the code
+	// Delete the code or hand the buffers back to the workspace
 	//
 
-	if (m_pauchCode)
+	if (m_pWorkspace)
+	{
+		m_pWorkspace ->ReleaseCode (m_pauchCode, 
+			m_pauchCodeEnd - m_pauchCode, m_pauchOut - m_pauchCode);
+		m_pWorkspace ->ReleaseTable (NscCompileWorkspace::Table_Linker, 
+			m_sLinker);
+		m_pWorkspace ->ReleaseTable (NscCompileWorkspace::Table_LocalSymbols, 
+			m_sLocalSymbols);
+		m_pWorkspace ->ReleaseLines (m_asLines);
+		m_pWorkspace ->ReleaseDebugText (m_achDebugText);
+	}
+	else if (m_pauchCode)
 		delete [] m_pauchCode;
 }
 
@@ -206,17 +233,34 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 	}
 
 	//
-	// Initialize the label count
+	// Initialize the labels
 	//
 
-	m_nNextLabel = 1;
+	m_asLabels .clear ();
+	m_asLabelLinks .clear ();
 
 	//
 	// Initialize the output
 	//
 
-	m_pauchCode = new unsigned char [NscInitialScript];
-	m_pauchCodeEnd = &m_pauchCode [NscInitialScript];
+	m_pWorkspace = m_pCtx ->GetWorkspace ();
+	if (m_pWorkspace)
+	{
+		size_t nSize;
+		m_pauchCode = m_pWorkspace ->AcquireCode (&nSize);
+		m_pauchCodeEnd = &m_pauchCode [nSize];
+		m_pWorkspace ->AcquireTable (NscCompileWorkspace::Table_Linker, 
+			m_sLinker);
+		m_pWorkspace ->AcquireTable (NscCompileWorkspace::Table_LocalSymbols, 
+			m_sLocalSymbols);
+		m_pWorkspace ->AcquireLines (m_asLines);
+		m_pWorkspace ->AcquireDebugText (m_achDebugText);
+	}
+	else
+	{
+		m_pauchCode = new unsigned char [NscInitialScript];
+		m_pauchCodeEnd = &m_pauchCode [NscInitialScript];
+	}
 	m_pauchOut = m_pauchCode;
 	m_pauchOut [0] = 'N';
 	m_pauchOut [1] = 'C';
@@ -263,6 +307,18 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 		GatherUsed(pSymbol);
 	}
 
+	//
+	// Pick the functions to inline.  This can drop functions whose every
+	// call will be inlined.
+	//
+
+	m_anInlineFunctions .clear ();
+	m_asInlinedFrames .clear ();
+	m_asPureValues .clear ();
+	m_anFreeSlots .clear ();
+	if (m_fOptInline)
+		SelectInlineFunctions (pSymbol);
+
 	//
 	// Initialize the stack depths
 	//
@@ -271,6 +327,9 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 	m_nSPDepth = 0;
 	m_nBPDepth = 0;
 	m_nReturnSize = 0;
+	m_nFrameBase = 0;
+	m_fInlinedFrame = false;
+	m_fTailCall = false;
 
 	//
 	// Test to see if we should create a global routine
@@ -608,6 +667,20 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 	if (pSymbol == NULL)
 		return true;
 
+	//
+	// Run the peephole pass and move our own offsets along with the code
+	//
+
+	if (m_fOptPeephole)
+	{
+		OptimizeCode ();
+		nLoaderStart = RemapOffset (nLoaderStart);
+		nLoaderEnd = RemapOffset (nLoaderEnd);
+		nGlobalsStart = RemapOffset (nGlobalsStart);
+		nGlobalsEnd = RemapOffset (nGlobalsEnd);
+		nRetValPos = RemapOffset (nRetValPos);
+	}
+
 	UINT32 ulSize = (UINT32) (m_pauchOut - m_pauchCode);
 	WriteINT32 (&m_pauchCode [9], ulSize);
 	pCodeOutput ->Write (m_pauchCode, m_pauchOut - m_pauchCode);
@@ -619,6 +692,9 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 	if (pDebugOutput)
 	{
         char szType [32];
+		CNscDebugTextWriter sText (m_achDebugText);
+		NscTraceScope sTrace ("NDB emission", "codegen");
+		UINT64 ulStart = NscGetTimestamp ();
 
 		//
 		// Count the number of global variables
@@ -641,19 +717,24 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 		int nGlobalFunctions = 1 + (int) m_pCtx ->GetGlobalFunctionCount ();
 		if (fCreateGlobal)
 			nGlobalFunctions++;
+		nGlobalFunctions += (int) m_asInlinedFrames .size ();
 
 		//
 		// Write the header
 		//
 
-		pDebugOutput ->WriteLine ("NDB V1.0");
-		sprintf (m_pachCode, "%07d %07d %07d %07d %07d",
-			m_pCtx ->GetUsedFiles (),
-			m_pCtx ->GetStructCount () + 1, 
-			nGlobalFunctions,
-			nGlobalVariables,
-			m_asLines .size ());
-		pDebugOutput ->WriteLine (m_pachCode);
+		sText .String ("NDB V1.0");
+		sText .EndLine ();
+		sText .Decimal (m_pCtx ->GetUsedFiles (), 7);
+		sText .Char (' ');
+		sText .Decimal (m_pCtx ->GetStructCount () + 1, 7);
+		sText .Char (' ');
+		sText .Decimal (nGlobalFunctions, 7);
+		sText .Char (' ');
+		sText .Decimal (nGlobalVariables, 7);
+		sText .Char (' ');
+		sText .Decimal ((int) m_asLines .size (), 7);
+		sText .EndLine ();
 
 		//
 		// Write the file list 
@@ -661,20 +742,21 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 
 		for (int i = 0; i < m_pCtx ->GetUsedFiles (); i++)
 		{
-			sprintf (m_pachCode, "%c%02d %s",
-				m_pCtx ->GetUsedFileMainStatus (i) ? 'N' : 'n',
-				i, m_pCtx ->GetUsedFileName (i));
-			pDebugOutput ->WriteLine (m_pachCode);
+			sText .Char (m_pCtx ->GetUsedFileMainStatus (i) ? 'N' : 'n');
+			sText .Decimal (i, 2);
+			sText .Char (' ');
+			sText .String (m_pCtx ->GetUsedFileName (i));
+			sText .EndLine ();
 		}
 
 		//
 		// Write the vector structure
 		//
 
-		pDebugOutput ->WriteLine ("s 03 vector");
-		pDebugOutput ->WriteLine ("sf f x");
-		pDebugOutput ->WriteLine ("sf f y");
-		pDebugOutput ->WriteLine ("sf f z");
+		sText .String ("s 03 vector\r\n");
+		sText .String ("sf f x\r\n");
+		sText .String ("sf f y\r\n");
+		sText .String ("sf f z\r\n");
 
 		//
 		// Write the structure list
@@ -688,15 +770,21 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 			NscSymbolStructExtra *pExtra = (NscSymbolStructExtra *) pauchData;
 			pauchData += sizeof (NscSymbolStructExtra);
 			int nCount = pExtra ->nElementCount;
-			sprintf (m_pachCode, "s %02d %s", nCount, pSymbol ->szString);
-			pDebugOutput ->WriteLine (m_pachCode);
+			sText .String ("s ");
+			sText .Decimal (nCount, 2);
+			sText .Char (' ');
+			sText .String (pSymbol ->szString);
+			sText .EndLine ();
 			while (nCount-- > 0)
 			{
 				NscPCodeDeclaration *p = (NscPCodeDeclaration *) pauchData;
 				assert (p ->nOpCode == NscPCode_Declaration);
 				GetDebugTypeText (p ->nType, szType);
-				sprintf (m_pachCode, "sf %s %s", szType, p ->szString);
-				pDebugOutput ->WriteLine (m_pachCode);
+				sText .String ("sf ");
+				sText .String (szType);
+				sText .Char (' ');
+				sText .String (p ->szString);
+				sText .EndLine ();
 				pauchData += p ->nOpSize;
 			}
 		}
@@ -725,27 +813,13 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 				pauchFnData += sizeof (NscSymbolFunctionExtra);
 
 				//
-				// Write the main function information
-				//
-
-				GetDebugTypeText (pSymbol ->nType, szType);
-				sprintf (m_pachCode, "f %08x %08x %03d %s %s",
-					pSymbol ->nCompiledStart, pSymbol ->nCompiledEnd,
-					pExtra ->nArgCount, szType, pSymbol ->szString);
-				pDebugOutput ->WriteLine (m_pachCode);
-
-				//
-				// Write the arguments
+				// Write the main function information and the arguments
 				//
 
-				for (int nArg = 0; nArg < pExtra ->nArgCount; nArg++)
-				{
-					NscPCodeHeader *pArg = (NscPCodeHeader *) pauchFnData;
-					GetDebugTypeText (pArg ->nType, szType);
-					sprintf (m_pachCode, "fp %s", szType);
-					pDebugOutput ->WriteLine (m_pachCode);
-					pauchFnData += pArg ->nOpSize;
-				}
+				WriteDebugFunction (sText, pSymbol ->nCompiledStart, 
+					pSymbol ->nCompiledEnd, pExtra ->nArgCount, 
+					pSymbol ->nType, pSymbol ->szString);
+				WriteDebugArguments (sText, pauchFnData, pExtra ->nArgCount);
 			}
 			
 			//
@@ -754,11 +828,8 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 
 			else if (pSymbol ->nSymType == NscSymType_Variable)
 			{
-				GetDebugTypeText (pSymbol ->nType, szType);
-				sprintf (m_pachCode, "f %08x %08x %03d %s %s",
-					0xffffffff, 0xffffffff, 0, 
-					szType, pSymbol ->szString);
-				pDebugOutput ->WriteLine (m_pachCode);
+				WriteDebugFunction (sText, 0xffffffff, 0xffffffff, 0, 
+					pSymbol ->nType, pSymbol ->szString);
 			}
 
 			//
@@ -773,18 +844,31 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 		// Add the loader and global routine
 		//
 
-		GetDebugTypeText (fIsMain ? NscType_Void : NscType_Integer, szType);
-		sprintf (m_pachCode, "f %08x %08x %03d %s %s",
-			nLoaderStart, nLoaderEnd, 0, szType, "#loader");
-		pDebugOutput ->WriteLine (m_pachCode);
+		WriteDebugFunction (sText, nLoaderStart, nLoaderEnd, 0, 
+			fIsMain ? NscType_Void : NscType_Integer, "#loader");
 		if (fCreateGlobal)
 		{
-			//sprintf (m_pachCode, "f %08x %08x %03d %s %s",
-			//	nGlobalsStart, nGlobalsEnd, 0, szType, "#globals");
 			// It seems Bioware's compiler always marks globals as void
-			sprintf (m_pachCode, "f %08x %08x %03d %s %s",
-				nGlobalsStart, nGlobalsEnd, 0, "v", "#globals");
-			pDebugOutput ->WriteLine (m_pachCode);
+			WriteDebugFunction (sText, nGlobalsStart, nGlobalsEnd, 0, 
+				NscType_Void, "#globals");
+		}
+
+		//
+		// Add the inlined calls.  Each one is written as a function
+		// covering the inlined code, nested within its caller.
+		//
+
+		for (size_t i = 0; i < m_asInlinedFrames .size (); i++)
+		{
+			NscSymbol *pSymbol = m_pCtx ->GetSymbol (
+				m_asInlinedFrames [i] .nFnSymbol);
+			unsigned char *pauchFnData = m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+			NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *) pauchFnData;
+			pauchFnData += sizeof (NscSymbolFunctionExtra);
+			WriteDebugFunction (sText, m_asInlinedFrames [i] .nCompiledStart, 
+				m_asInlinedFrames [i] .nCompiledEnd, pExtra ->nArgCount, 
+				pSymbol ->nType, pSymbol ->szString);
+			WriteDebugArguments (sText, pauchFnData, pExtra ->nArgCount);
 		}
 
 		//
@@ -793,9 +877,8 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 
 		if (!fIsMain)
 		{
-			sprintf (m_pachCode, "v %08x %08x %08x %s %s",
-				nRetValPos, 0xffffffff, 0, "i", "#retval");
-			pDebugOutput ->WriteLine (m_pachCode);
+			WriteDebugVariable (sText, nRetValPos, 0xffffffff, 0, 
+				NscType_Integer, "#retval");
 		}
 
 		//
@@ -807,11 +890,9 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 			NscSymbol *pSymbol = m_pCtx ->GetGlobalVariable (i);
 			if ((pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) == 0)
 			{
-				GetDebugTypeText (pSymbol ->nType, szType);
-				sprintf (m_pachCode, "v %08x %08x %08x %s %s",
-					pSymbol ->nCompiledStart, pSymbol ->nCompiledEnd, 
-					pSymbol ->nStackOffset * 4, szType, pSymbol ->szString);
-				pDebugOutput ->WriteLine (m_pachCode);
+				WriteDebugVariable (sText, pSymbol ->nCompiledStart, 
+					pSymbol ->nCompiledEnd, pSymbol ->nStackOffset * 4, 
+					pSymbol ->nType, pSymbol ->szString);
 			}
 		}
 
@@ -822,11 +903,9 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 		for (size_t i = 0; i < m_anLocalVars .size (); i++)
 		{
 			NscSymbol *pSymbol = m_sLocalSymbols .GetSymbol (m_anLocalVars [i]);
-			GetDebugTypeText (pSymbol ->nType, szType);
-			sprintf (m_pachCode, "v %08x %08x %08x %s %s",
-				pSymbol ->nCompiledStart, pSymbol ->nCompiledEnd, 
-				pSymbol ->nStackOffset * 4, szType, pSymbol ->szString);
-			pDebugOutput ->WriteLine (m_pachCode);
+			WriteDebugVariable (sText, pSymbol ->nCompiledStart, 
+				pSymbol ->nCompiledEnd, pSymbol ->nStackOffset * 4, 
+				pSymbol ->nType, pSymbol ->szString);
 		}
 
 		//
@@ -835,11 +914,19 @@ bool CNscCodeGenerator::GenerateOutput (CNwnStream *pCodeOutput,
 
 		for (size_t i = 0; i < m_asLines .size (); i++)
 		{
-			sprintf (m_pachCode, "l%02d %07d %08x %08x",
-				m_asLines [i] .nFile, m_asLines [i] .nLine,
-				m_asLines [i] .nCompiledStart, m_asLines [i] .nCompiledEnd);
-			pDebugOutput ->WriteLine (m_pachCode);
+			sText .Char ('l');
+			sText .Decimal (m_asLines [i] .nFile, 2);
+			sText .Char (' ');
+			sText .Decimal (m_asLines [i] .nLine, 7);
+			sText .Char (' ');
+			sText .Hex ((UINT32) m_asLines [i] .nCompiledStart);
+			sText .Char (' ');
+			sText .Hex ((UINT32) m_asLines [i] .nCompiledEnd);
+			sText .EndLine ();
 		}
+		pDebugOutput ->Write ((void *) sText .GetData (), sText .GetSize ());
+		m_achDebugText .resize (sText .GetSize ());
+		m_ulSymbolsTime = NscGetTimestamp () - ulStart;
 	}
 	return true;
 }
@@ -1443,6 +1530,37 @@ bool CNscCodeGenerator::CodeJSR (const char *pszRoutine, int nArgs, int nArgSize
 //
 // @mfunc Encode a JMP
 //
+// @parm int | nLabel | Destination label
+//
+// @rdesc TRUE if output was generated.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::CodeJMP (int nLabel)
+{
+
+	//
+	// Make sure there is room
+	//
+
+	if (m_pauchOut + 6 > m_pauchCodeEnd)
+		ExpandOutputBuffer ();
+
+	//
+	// Add the codes
+	//
+
+	m_pauchOut [0] = NscCode_JMP;
+	m_pauchOut [1] = 0;
+	ReferenceLabel (nLabel);
+	m_pauchOut += 6;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Encode a JMP to a routine
+//
 // @parm const char * | pszRoutine | Name of the destination routine
 //
 // @rdesc TRUE if output was generated.
@@ -1474,13 +1592,13 @@ bool CNscCodeGenerator::CodeJMP (const char *pszRoutine)
 //
 // @mfunc Encode a JZ
 //
-// @parm const char * | pszRoutine | Name of the destination routine
+// @parm int | nLabel | Destination label
 //
 // @rdesc TRUE if output was generated.
 //
 //-----------------------------------------------------------------------------
 
-bool CNscCodeGenerator::CodeJZ (const char *pszRoutine)
+bool CNscCodeGenerator::CodeJZ (int nLabel)
 {
 
 	//
@@ -1496,7 +1614,7 @@ bool CNscCodeGenerator::CodeJZ (const char *pszRoutine)
 
 	m_pauchOut [0] = NscCode_JZ;
 	m_pauchOut [1] = 0;
-	ReferenceLabel (pszRoutine);
+	ReferenceLabel (nLabel);
 	m_pauchOut += 6;
 	m_nExpDepth--;
 	return true;
@@ -1506,13 +1624,13 @@ bool CNscCodeGenerator::CodeJZ (const char *pszRoutine)
 //
 // @mfunc Encode a JNZ
 //
-// @parm const char * | pszRoutine | Name of the destination routine
+// @parm int | nLabel | Destination label
 //
 // @rdesc TRUE if output was generated.
 //
 //-----------------------------------------------------------------------------
 
-bool CNscCodeGenerator::CodeJNZ (const char *pszRoutine)
+bool CNscCodeGenerator::CodeJNZ (int nLabel)
 {
 
 	//
@@ -1528,7 +1646,7 @@ bool CNscCodeGenerator::CodeJNZ (const char *pszRoutine)
 
 	m_pauchOut [0] = NscCode_JNZ;
 	m_pauchOut [1] = 0;
-	ReferenceLabel (pszRoutine);
+	ReferenceLabel (nLabel);
 	m_pauchOut += 6;
 	m_nExpDepth--;
 	return true;
@@ -1633,7 +1751,8 @@ bool CNscCodeGenerator::CodeCP (bool fTop, NscSymbol *pSymbol, NscType nType,
 	{
 		fSP = true;
 		nCode = fTop ? NscCode_CPTOPSP : NscCode_CPDOWNSP;
-		nOffset = m_nSPDepth + m_nExpDepth - nStackOffset;
+		nOffset = m_nSPDepth + m_nExpDepth - nStackOffset - 
+			GetPureValueShift (nStackOffset);
 	}
 
 	//
@@ -2309,6 +2428,13 @@ bool CNscCodeGenerator::CodeIntrinsicReadPC (int nArgs, int nArgSize)
 
 	i = (INT32) (m_pauchOut - (m_pauchCode + 8 + 5));
 
+	//
+	// The PC is now baked into the code, so the peephole pass must not
+	// move anything
+	//
+
+	m_fOptPeephole = false;
+
 	CodeCONST (NscType_Integer, &i);
 	CodeCP (NscCode_CPDOWNSP, 2, 1);
 	CodeMOVSP (1, &m_nExpDepth);
@@ -2637,9 +2763,9 @@ bool CNscCodeGenerator::CodeRoutine (const char *pszName, NscType nRetType,
 	// Generate the return label
 	//
 
-	char szReturn [NscMaxLabelSize];
-	ForwardLabel (szReturn);
-    m_pszReturnLabel = szReturn;
+	int nReturn;
+	nReturn = ForwardLabel ();
+    m_nReturnLabel = nReturn;
 	m_nReturnSize = m_pCtx ->GetTypeSize (nRetType);
 
 	//
@@ -2647,65 +2773,7 @@ bool CNscCodeGenerator::CodeRoutine (const char *pszName, NscType nRetType,
 	//
 
 	if (m_fMakeDebugFile)
-	{
-
-		//
-		// Add the return type if not void
-		//
-
-		if (nRetType != NscType_Void)
-		{
-			NscSymbol *pSymbol = AddLocalVariable ("#retval", nRetType);
-			pSymbol ->nCompiledStart = m_pauchOut - m_pauchCode;
-			pSymbol ->nStackOffset = 0;
-			m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
-			pReturnSymbol = pSymbol;
-		}
-
-		//
-		// Add the argument list
-		//
-
-		if (nArgCount > 0)
-		{
-
-			//
-			// Get a list of the arguments
-			//
-
-			NscPCodeDeclaration **ppArgs = (NscPCodeDeclaration **) 
-				alloca (sizeof (NscPCodeHeader *) * nArgCount);
-			for (size_t i = 0; i < nArgCount; i++)
-			{
-				NscPCodeDeclaration *pArg = (NscPCodeDeclaration *) pauchArgData;
-				ppArgs [i] = pArg;
-				pauchArgData += pArg ->nOpSize;
-			}
-
-			//
-			// Add the local variables in reverse order
-			//
-
-			int nOffset = m_nReturnSize;
-			for (size_t i = nArgCount; i-- > 0; i)
-			{
-				NscPCodeDeclaration *pArg = ppArgs [i];
-				char *pszString;
-				if (pArg ->nAltStringOffset != 0)
-				{
-					pszString = (char *) m_pCtx ->
-						GetSymbolData (pArg ->nAltStringOffset);
-				}
-				else
-					pszString = pArg ->szString;
-				NscSymbol *pSymbol = AddLocalVariable (pszString, pArg ->nType);
-				pSymbol ->nCompiledStart = m_pauchOut - m_pauchCode;
-				pSymbol ->nStackOffset = nOffset;
-				m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
-				nOffset += m_pCtx ->GetTypeSize (pArg ->nType);
-			}
-		}
-	}
+		pReturnSymbol = AddFrameVariables (nRetType, pauchArgData, nArgCount);
 
 	//
 	// Generate the code
@@ -2740,7 +2808,7 @@ bool CNscCodeGenerator::CodeRoutine (const char *pszName, NscType nRetType,
 	// Resolve the return
 	//
 
-	ForwardResolve (szReturn);
+	ForwardResolve (nReturn);
 
 	//
 	// Purge the argument list
@@ -2775,355 +2843,2537 @@ bool CNscCodeGenerator::CodeRoutine (const char *pszName, NscType nRetType,
 
 //-----------------------------------------------------------------------------
 //
-// @mfunc Code executable data
+// @mfunc Add the return value and arguments of a routine to the debug 
+//		variables
 //
-// @parm unsigned char * | pauchData | Pointer to code
+// @parm NcsType | nRetType | Return type
 //
-// @parm size_t | nDataSize | Size of code
+// @parm unsigned char * | pauchArgData | Argument data
 //
-// @rdesc TRUE if output was generated.
+// @parm size_t | nArgCount | Argument count
+//
+// @rdesc Symbol of the return value or NULL if there is none.
 //
 //-----------------------------------------------------------------------------
 
-bool CNscCodeGenerator::CodeData (unsigned char *pauchData, size_t nDataSize)
+NscSymbol *CNscCodeGenerator::AddFrameVariables (NscType nRetType, 
+	unsigned char *pauchArgData, size_t nArgCount)
 {
+	NscSymbol *pReturnSymbol = NULL;
 
 	//
-	// Loop through the data
+	// Add the return type if not void
 	//
 
-	unsigned char *pauchEnd = &pauchData [nDataSize];
-	while (pauchData < pauchEnd)
+	if (nRetType != NscType_Void)
+	{
+		NscSymbol *pSymbol = AddLocalVariable ("#retval", nRetType);
+		pSymbol ->nCompiledStart = m_pauchOut - m_pauchCode;
+		pSymbol ->nStackOffset = m_nFrameBase;
+		m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
+		pReturnSymbol = pSymbol;
+	}
+
+	//
+	// Add the argument list
+	//
+
+	if (nArgCount > 0)
 	{
-		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
-		if (m_pauchOut >= m_pauchCodeEnd)
-			ExpandOutputBuffer ();
 
 		//
-		// Switch based on the opcode
+		// Get a list of the arguments
 		//
 
-		NscCode nOp;
-		switch (pHeader ->nOpCode)
+		NscPCodeDeclaration **ppArgs = (NscPCodeDeclaration **) 
+			alloca (sizeof (NscPCodeHeader *) * nArgCount);
+		for (size_t i = 0; i < nArgCount; i++)
 		{
+			NscPCodeDeclaration *pArg = (NscPCodeDeclaration *) pauchArgData;
+			ppArgs [i] = pArg;
+			pauchArgData += pArg ->nOpSize;
+		}
 
-			//
-			// If this is a variable
-			//
+		//
+		// Add the local variables in reverse order
+		//
 
-			case NscPCode_Variable:
-				{
-					NscPCodeVariable *pVar = (NscPCodeVariable *) pHeader;
-					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pVar ->nSymbol);
-					if ((pVar ->ulFlags & NscSymFlag_Global) != 0 &&
-						(pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) != 0)
-					{
-						unsigned char *pauchInit = m_pCtx ->GetSymbolData (pSymbol ->nExtra);
-						NscSymbolVariableExtra *pExtra = (NscSymbolVariableExtra *) pauchInit;
-						pauchInit += sizeof (NscSymbolVariableExtra);
-						CodeData (pauchInit, pExtra ->nInitSize);
-					}
-					else
-					{
-						CodeCP (true, pSymbol, pVar ->nType, pVar ->nSourceType,
-							pVar ->ulFlags, pVar ->nElement, pVar ->nStackOffset);
-					}
-				}
-				break;
+		int nOffset = m_nFrameBase + m_nReturnSize;
+		for (size_t i = nArgCount; i-- > 0;)
+		{
+			NscPCodeDeclaration *pArg = ppArgs [i];
+			char *pszString;
+			if (pArg ->nAltStringOffset != 0)
+			{
+				pszString = (char *) m_pCtx ->
+					GetSymbolData (pArg ->nAltStringOffset);
+			}
+			else
+				pszString = pArg ->szString;
+			NscSymbol *pSymbol = AddLocalVariable (pszString, pArg ->nType);
+			pSymbol ->nCompiledStart = m_pauchOut - m_pauchCode;
+			pSymbol ->nStackOffset = nOffset;
+			m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
+			nOffset += m_pCtx ->GetTypeSize (pArg ->nType);
+		}
+	}
+	return pReturnSymbol;
+}
 
-			//
-			// If this is a declaration
-			// 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code a call by expanding the body of the routine in place.
+//
+//		The caller has already reserved the return value and pushed the
+//		arguments, so the top of the stack is laid out exactly like the 
+//		frame of a called routine.  The body is coded against that frame
+//		and the JSR/RETN pair is replaced by a jump to the end of the 
+//		expansion.
+//
+// @parm NscSymbol * | pSymbol | Symbol of the routine
+//
+// @parm NscType | nRetType | Return type
+//
+// @rdesc TRUE if output was generated.
+//
+//-----------------------------------------------------------------------------
 
-			case NscPCode_Declaration:
-				{
-					NscPCodeDeclaration *pDecl = (NscPCodeDeclaration *) pHeader;
-					size_t nOffset;
-					int nDepth = m_nSPDepth + m_nReturnSize;
-					CodeDeclaration (pDecl ->nType, &m_nSPDepth,
-						&pauchData [pDecl ->nDataOffset],
-						pDecl ->nDataSize, &nOffset, pDecl ->ulSymFlags);
-					if (m_fMakeDebugFile)
-					{
-						NscSymbol *pSymbol = AddLocalVariable (
-							pDecl ->szString, pDecl ->nType);
-						pSymbol ->nCompiledStart = nOffset;
-						pSymbol ->nStackOffset = nDepth;
-						m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
-					}
-				}
-				break;
+bool CNscCodeGenerator::CodeInline (NscSymbol *pSymbol, NscType nRetType)
+{
+	NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+		m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+	unsigned char *pauchCode = m_pCtx ->GetSymbolData (pExtra ->nCodeOffset);
+	unsigned char *pauchArgData = m_pCtx ->GetSymbolData (
+		pSymbol ->nExtra + sizeof (NscSymbolFunctionExtra));
+	int nArgSize = pExtra ->nArgSize;
+	int nReturnSize = m_pCtx ->GetTypeSize (nRetType);
+
+	//
+	// Save the state of the current frame
+	//
+
+	int nSPDepthSave = m_nSPDepth;
+	int nExpDepthSave = m_nExpDepth;
+	int nReturnSizeSave = m_nReturnSize;
+	int nArgumentSizeSave = m_nArgumentSize;
+	int nFrameBaseSave = m_nFrameBase;
+	int nBreakBlockDepthSave = m_nBreakBlockDepth;
+	int nContinueBlockDepthSave = m_nContinueBlockDepth;
+	int nReturnLabelSave = m_nReturnLabel;
+	int nBreakLabelSave = m_nBreakLabel;
+	int nContinueLabelSave = m_nContinueLabel;
+	bool fInlinedFrameSave = m_fInlinedFrame;
+	std::vector <PureValue> asPureValuesSave;
+	asPureValuesSave .swap (m_asPureValues);
+	std::vector <NscType> anFreeSlotsSave;
+	anFreeSlotsSave .swap (m_anFreeSlots);
+
+	//
+	// Set up the frame of the inlined routine
+	//
+
+	InlinedFrame sFrame;
+	sFrame .nFnSymbol = m_pCtx ->GetSymbolOffset (pSymbol);
+	sFrame .nCompiledStart = m_pauchOut - m_pauchCode;
+
+	int nReturn;
+	nReturn = ForwardLabel ();
+	m_nReturnLabel = nReturn;
+	m_nFrameBase += m_nReturnSize + m_nSPDepth + m_nExpDepth - 
+		nArgSize - nReturnSize;
+	m_nReturnSize = nReturnSize;
+	m_fInlinedFrame = true;
+	if (m_fMakeDebugFile)
+		AddFrameVariables (nRetType, pauchArgData, pExtra ->nArgCount);
 
-			//
-			// If this is an argument
-			//
+	//
+	// Generate the code
+	//
 
-			case NscPCode_Argument:
-				{
-					NscPCodeArgument *pArg = (NscPCodeArgument *) pHeader;
-					CodeData (&pauchData [pArg ->nDataOffset],
-						pArg ->nDataSize);
-				}
-				break;
+	m_nArgumentSize = nArgSize;
+	m_nSPDepth = nArgSize;
+	m_nBreakBlockDepth = nArgSize;
+	m_nContinueBlockDepth = nArgSize;
+	m_nExpDepth = 0;
+	CodeData (pauchCode, pExtra ->nCodeSize);
 
-			//
-			// If this is a statement
-			//
+	//
+	// Resolve the return and remove the arguments
+	//
 
-			case NscPCode_Statement:
-				{
-					assert (m_nExpDepth == 0);
-					NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
-					CodeData (&pauchData [pCode ->nDataOffset],
-						pCode ->nDataSize);
-					if (pCode ->nLocals != 0)
-					{
-						if (m_fMakeDebugFile)
-						{
-							PurgeVariables (m_nReturnSize + 
-								m_nSPDepth - pCode ->nLocals);
-						}
-						CodeMOVSP (pCode ->nLocals, &m_nSPDepth);
-						m_pauchLineStart = m_pauchOut;
-					}
-					assert (m_nExpDepth == 0);
-				}
-				break;
+	ForwardResolve (nReturn);
+	if (m_fMakeDebugFile)
+		PurgeVariables (m_nFrameBase + m_nReturnSize);
+	m_pauchLineStart = m_pauchOut;
+	if (nArgSize)
+		CodeMOVSP (nArgSize, &m_nSPDepth);
+	if (m_fMakeDebugFile)
+		PurgeVariables (m_nFrameBase);
+	sFrame .nCompiledEnd = m_pauchOut - m_pauchCode;
+	m_asInlinedFrames .push_back (sFrame);
+
+	//
+	// Restore the state, leaving the return value on the stack as
+	// a JSR would
+	//
+
+	m_nSPDepth = nSPDepthSave;
+	m_nExpDepth = nExpDepthSave - nArgSize;
+	m_nReturnSize = nReturnSizeSave;
+	m_nArgumentSize = nArgumentSizeSave;
+	m_nFrameBase = nFrameBaseSave;
+	m_nBreakBlockDepth = nBreakBlockDepthSave;
+	m_nContinueBlockDepth = nContinueBlockDepthSave;
+	m_nReturnLabel = nReturnLabelSave;
+	m_nBreakLabel = nBreakLabelSave;
+	m_nContinueLabel = nContinueLabelSave;
+	m_fInlinedFrame = fInlinedFrameSave;
+	m_asPureValues .swap (asPureValuesSave);
+	m_anFreeSlots .swap (anFreeSlotsSave);
+	return true;
+}
 
-			//
-			// If this is an call
-			//
+//-----------------------------------------------------------------------------
+//
+// @mfunc Select the functions to be inlined.
+//
+//		A function is inlined if it is small enough, does not call an 
+//		intrinsic and can not reach itself through its calls.  Calls made
+//		at global scope are never inlined (BP isn't set up yet), so the
+//		bodies of inlined functions are still generated if they are called
+//		from a global initializer.  All other inlined functions are removed 
+//		from the list of functions to generate.
+//
+// @parm NscSymbol * | pEntrySymbol | Entry point (can be NULL)
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
 
-			case NscPCode_Call:
-				{
+void CNscCodeGenerator::SelectInlineFunctions (NscSymbol *pEntrySymbol)
+{
 
-					//
-					// Get information about the call
-					//
+	//
+	// Gather the cost and the calls of each function
+	//
 
-					NscPCodeCall *pCall = (NscPCodeCall *) pHeader;
-					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pCall ->nFnSymbol);
-					NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+	size_t nCount = m_anFunctions .size ();
+	std::vector <bool> afInline (nCount, false);
+	std::vector <std::vector <size_t> > aanCalls (nCount);
+	for (size_t i = 0; i < nCount; i++)
+	{
+		NscSymbol *pSymbol = m_pCtx ->GetSymbol (m_anFunctions [i]);
+		NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+			m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+		int nCost = 0;
+		bool fInline = GatherInlineInfo (
+			m_pCtx ->GetSymbolData (pExtra ->nCodeOffset), 
+			pExtra ->nCodeSize, &nCost, aanCalls [i]);
+		afInline [i] = fInline && nCost <= NscMaxInlineCost &&
+			pSymbol != pEntrySymbol &&
+			(pExtra ->ulFunctionFlags & NscFuncFlag_Defined) != 0;
+	}
+
+	//
+	// Reject recursive functions
+	//
+
+	for (size_t i = 0; i < nCount; i++)
+	{
+		if (!afInline [i])
+			continue;
+		std::vector <bool> afVisited (nCount, false);
+		std::vector <size_t> anStack (aanCalls [i]);
+		while (!anStack .empty () && afInline [i])
+		{
+			size_t nCallee = std::find (m_anFunctions .begin (), 
+				m_anFunctions .end (), anStack .back ()) - m_anFunctions .begin ();
+			anStack .pop_back ();
+			if (nCallee >= nCount || afVisited [nCallee])
+				continue;
+			if (nCallee == i)
+				afInline [i] = false;
+			afVisited [nCallee] = true;
+			anStack .insert (anStack .end (), 
+				aanCalls [nCallee] .begin (), aanCalls [nCallee] .end ());
+		}
+	}
+
+	//
+	// Collect the functions called at global scope
+	//
+
+	std::vector <size_t> anGlobalCalls;
+	for (size_t i = 0; i < m_pCtx ->GetGlobalVariableCount (); i++)
+	{
+		NscSymbol *pSymbol = m_pCtx ->GetGlobalVariable (i);
+		unsigned char *pauchInit = m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+		NscSymbolVariableExtra *pExtra = (NscSymbolVariableExtra *) pauchInit;
+		pauchInit += sizeof (NscSymbolVariableExtra);
+		int nCost = 0;
+		GatherInlineInfo (pauchInit, pExtra ->nInitSize, &nCost, anGlobalCalls);
+	}
+
+	//
+	// Build the inline list and drop the functions that are no longer 
+	// called
+	//
+
+	std::vector <size_t> anFunctions;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		if (afInline [i])
+			m_anInlineFunctions .push_back (m_anFunctions [i]);
+		if (!afInline [i] || std::find (anGlobalCalls .begin (), 
+			anGlobalCalls .end (), m_anFunctions [i]) != anGlobalCalls .end ())
+			anFunctions .push_back (m_anFunctions [i]);
+	}
+	std::sort (m_anInlineFunctions .begin (), m_anInlineFunctions .end ());
+	m_anFunctions .swap (anFunctions);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Gather the inlining cost and the calls of a block of data
+//
+// @parm unsigned char * | pauchData | Pointer to the data
+//
+// @parm size_t | nDataSize | Size of the data
+//
+// @parm int * | pnCost | Incremented by the number of operations
+//
+// @parm std::vector <size_t> & | anCalls | Receives the symbols of the
+//		user functions called
+//
+// @rdesc TRUE if nothing in the data prevents inlining.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::GatherInlineInfo (unsigned char *pauchData, 
+	size_t nDataSize, int *pnCost, std::vector <size_t> &anCalls)
+{
+	bool fInline = true;
+
+	//
+	// Loop through the data
+	//
+
+	unsigned char *pauchEnd = &pauchData [nDataSize];
+	while (pauchData < pauchEnd)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+		(*pnCost)++;
+
+		//
+		// If this is a simple operator
+		// 
+
+		if (pHeader ->nOpCode >= NscPCode__First_Simple)
+		{
+			// Do nothing
+		}
+
+		//
+		// If this is an assignment
+		//
+
+		else if (pHeader ->nOpCode >= NscPCode__First_Assignment)
+		{
+			NscPCodeAssignment *pAsn = (NscPCodeAssignment *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pAsn ->nDataOffset],
+				pAsn ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// If this is a 5 block
+		//
+
+		else if (pHeader ->nOpCode >= NscPCode__First_5Block)
+		{
+			NscPCode5Block *p5Block = (NscPCode5Block *) pHeader;
+			for (int i = 0; i < 5; i++)
+			{
+				if (!GatherInlineInfo (&pauchData [p5Block ->anOffset [i]],
+					p5Block ->anSize [i], pnCost, anCalls))
+					fInline = false;
+			}
+		}
+
+		//
+		// If this is a declaration
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Declaration)
+		{
+			NscPCodeDeclaration *pDecl = (NscPCodeDeclaration *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pDecl ->nDataOffset],
+				pDecl ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// If this is an argument
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Argument)
+		{
+			NscPCodeArgument *pArg = (NscPCodeArgument *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pArg ->nDataOffset],
+				pArg ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// If this is a statement
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Statement)
+		{
+			NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pCode ->nDataOffset],
+				pCode ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// If this is a call.  The intrinsics work on the real frame and PC,
+		// so a function using them is never inlined.
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Call)
+		{
+			NscPCodeCall *pCall = (NscPCodeCall *) pHeader;
+			NscSymbol *pSymbol = m_pCtx ->GetSymbol (pCall ->nFnSymbol);
+			if (!GatherInlineInfo (&pauchData [pCall ->nDataOffset],
+				pCall ->nDataSize, pnCost, anCalls))
+				fInline = false;
+			if ((pSymbol ->ulFlags & NscSymFlag_Intrinsic) != 0)
+				fInline = false;
+			else if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) == 0)
+				anCalls .push_back (pCall ->nFnSymbol);
+		}
+
+		//
+		// Element access
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Element)
+		{
+			NscPCodeElement *pElement = (NscPCodeElement *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pElement ->nDataOffset],
+				pElement ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// Return statement
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Return)
+		{
+			NscPCodeReturn *pReturn = (NscPCodeReturn *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pReturn ->nDataOffset],
+				pReturn ->nDataSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// Case/Default statement
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_Case ||
+			pHeader ->nOpCode == NscPCode_Default)
+		{
+			NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pCase ->nCaseOffset],
+				pCase ->nCaseSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// Logical AND/OR
+		//
+
+		else if (pHeader ->nOpCode == NscPCode_LogicalAND ||
+			pHeader ->nOpCode == NscPCode_LogicalOR)
+		{
+			NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
+			if (!GatherInlineInfo (&pauchData [pLogOp ->nLhsOffset],
+				pLogOp ->nLhsSize, pnCost, anCalls))
+				fInline = false;
+			if (!GatherInlineInfo (&pauchData [pLogOp ->nRhsOffset],
+				pLogOp ->nRhsSize, pnCost, anCalls))
+				fInline = false;
+		}
+
+		//
+		// Move onto the next operator
+		//
+
+		pauchData += pHeader ->nOpSize;
+	}
+	return fInline;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Plan the loop invariant pure calls of a loop.
+//
+//		A pure function can still fail at run time, so only the calls 
+//		made on every iteration are planned: those made unconditionally
+//		by the test.  The caller codes a first test, computes the values
+//		with ComputePureValue once it has passed, and must release the 
+//		values after the end of the loop.
+//
+// @parm unsigned char * | pauchData | Pointer to the data
+//
+// @parm NscPCode5Block * | pBlock | Loop
+//
+// @rdesc Number of pure values computed.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::HoistPureCalls (unsigned char *pauchData, 
+	NscPCode5Block *pBlock)
+{
+
+	//
+	// Collect the stores of the loop and the calls of the test
+	//
+
+	CNscPCodeStoreCollector sStores (m_pCtx);
+	for (int i = 1; i <= 3; i++)
+	{
+		sStores .ProcessPCodeBlock (&pauchData [pBlock ->anOffset [i]], 
+			pBlock ->anSize [i]);
+	}
+	CNscPCodePureCallCollector sCalls (m_pCtx);
+	sCalls .ProcessPCodeBlock (&pauchData [pBlock ->anOffset [1]], 
+		pBlock ->anSize [1]);
+
+	//
+	// Plan the invariant calls, innermost first so that outer calls 
+	// can use the inner values
+	//
+
+	int nDepth = m_nSPDepth - GetPureValueSize ();
+	size_t nFirst = m_asPureValues .size ();
+	const std::vector <CNscPCodePureCallCollector::PureCall> &asCalls = 
+		sCalls .GetCalls ();
+	for (size_t i = asCalls .size (); i-- > 0;)
+	{
+		NscPCodeCall *pCall = (NscPCodeCall *) asCalls [i] .pCall;
+		if (asCalls [i] .fConditional || FindPureValue (pCall) != NULL)
+			continue;
+		bool fPlanned = false;
+		for (size_t j = nFirst; j < m_asPureValues .size () && !fPlanned; j++)
+		{
+			NscPCodeCall *pOther = m_asPureValues [j] .pCall;
+			fPlanned = IsSameExpression ((unsigned char *) pCall, pCall ->nOpSize,
+				(unsigned char *) pOther, pOther ->nOpSize);
+		}
+		if (fPlanned)
+			continue;
+		CNscPCodeInvariantChecker sInvariant (m_pCtx, &sStores, nDepth);
+		if (!sInvariant .ProcessPCodeBlock ((unsigned char *) pCall, 
+			pCall ->nOpSize))
+			continue;
+		PureValue sValue;
+		sValue .pCall = pCall;
+		sValue .pauchFirst = NULL;
+		sValue .pauchLast = NULL;
+		sValue .nDepth = -1;
+		sValue .fActive = false;
+		m_asPureValues .push_back (sValue);
+	}
+	return m_asPureValues .size () - nFirst;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Plan the pure calls to compute once in a block.
+//
+//		The statements of the block are split into runs that contain no
+//		flow control.  A pure call made more than once within a run, at
+//		least once unconditionally, and whose result can't change between
+//		the calls is computed into a hidden stack slot at the start of the 
+//		statement that first makes it.  The caller must release the values 
+//		at the end of the block.
+//
+// @parm unsigned char * | pauchData | Pointer to the data
+//
+// @parm size_t | nDataSize | Size of the data
+//
+// @rdesc Number of pure values planned.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::PlanPureValues (unsigned char *pauchData, 
+	size_t nDataSize)
+{
+	struct Statement
+	{
+		unsigned char	*pauchStart;
+		unsigned char	*pauchLast;
+		size_t			nSize;
+		int				nDepth;
+		bool			fPlain;
+	};
+	struct Occurrence
+	{
+		size_t			nStatement;
+		bool			fConditional;
+	};
+	struct Candidate
+	{
+		NscPCodeCall				*pCall;
+		std::vector <Occurrence>	asOccurrences;
+	};
+
+	//
+	// Split the block into statements.  Each statement ends with a line,
+	// except for blocks and control statements which carry their own.
+	//
+
+	std::vector <Statement> asStatements;
+	int nDepth = m_nSPDepth - GetPureValueSize () - GetFreeSlotSize ();
+	unsigned char *pauchEnd = &pauchData [nDataSize];
+	unsigned char *pauchStart = pauchData;
+	bool fPlain = true;
+	int nStartDepth = nDepth;
+	while (pauchData < pauchEnd)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+		NscPCode nOpCode = pHeader ->nOpCode;
+		bool fBlock = nOpCode == NscPCode_Statement || 
+			(nOpCode >= NscPCode__First_5Block && 
+			nOpCode <= NscPCode__Last_5Block && 
+			nOpCode != NscPCode_Conditional);
+		if (nOpCode == NscPCode_Declaration)
+			nDepth += m_pCtx ->GetTypeSize (pHeader ->nType);
+		else if (fBlock || nOpCode == NscPCode_Break ||
+			nOpCode == NscPCode_Continue || nOpCode == NscPCode_Return ||
+			nOpCode == NscPCode_Case || nOpCode == NscPCode_Default)
+			fPlain = false;
+		pauchData += pHeader ->nOpSize;
+		if (nOpCode == NscPCode_Line || fBlock || pauchData >= pauchEnd)
+		{
+			Statement sStatement;
+			sStatement .pauchStart = pauchStart;
+			sStatement .pauchLast = (unsigned char *) pHeader;
+			sStatement .nSize = pauchData - pauchStart;
+			sStatement .nDepth = nStartDepth;
+			sStatement .fPlain = fPlain;
+			asStatements .push_back (sStatement);
+			pauchStart = pauchData;
+			nStartDepth = nDepth;
+			fPlain = true;
+		}
+	}
+
+	//
+	// Loop through the runs of plain statements
+	//
+
+	size_t nFirstValue = m_asPureValues .size ();
+	size_t nRunStart = 0;
+	while (nRunStart < asStatements .size ())
+	{
+		if (!asStatements [nRunStart] .fPlain)
+		{
+			nRunStart++;
+			continue;
+		}
+		size_t nRunEnd = nRunStart;
+		while (nRunEnd < asStatements .size () && asStatements [nRunEnd] .fPlain)
+			nRunEnd++;
+
+		//
+		// Collect the stores and pure calls of each statement of the run
+		//
+
+		std::vector <CNscPCodeStoreCollector> asStores;
+		std::vector <Candidate> asCandidates;
+		for (size_t nStatement = nRunStart; nStatement < nRunEnd; nStatement++)
+		{
+			Statement &sStatement = asStatements [nStatement];
+			asStores .push_back (CNscPCodeStoreCollector (m_pCtx));
+			asStores .back () .ProcessPCodeBlock (sStatement .pauchStart, sStatement .nSize);
+			CNscPCodePureCallCollector sCalls (m_pCtx);
+			sCalls .ProcessPCodeBlock (sStatement .pauchStart, sStatement .nSize);
+			const std::vector <CNscPCodePureCallCollector::PureCall> &asCalls = 
+				sCalls .GetCalls ();
+			for (size_t i = 0; i < asCalls .size (); i++)
+			{
+				NscPCodeCall *pCall = (NscPCodeCall *) asCalls [i] .pCall;
+				size_t nCandidate;
+				for (nCandidate = 0; nCandidate < asCandidates .size (); nCandidate++)
+				{
+					NscPCodeCall *pOther = asCandidates [nCandidate] .pCall;
+					if (IsSameExpression ((unsigned char *) pCall, pCall ->nOpSize,
+						(unsigned char *) pOther, pOther ->nOpSize))
+						break;
+				}
+				if (nCandidate == asCandidates .size ())
+				{
+					asCandidates .push_back (Candidate ());
+					asCandidates .back () .pCall = pCall;
+				}
+				Occurrence sOccurrence;
+				sOccurrence .nStatement = nStatement;
+				sOccurrence .fConditional = asCalls [i] .fConditional;
+				asCandidates [nCandidate] .asOccurrences .push_back (sOccurrence);
+			}
+		}
+
+		//
+		// Plan the calls made more than once, innermost first.  The
+		// occurrences are split into groups over which the arguments 
+		// don't change, and each group gets its own value.
+		//
+
+		for (size_t i = asCandidates .size (); i-- > 0;)
+		{
+			Candidate &sCandidate = asCandidates [i];
+			NscPCodeCall *pCall = sCandidate .pCall;
+			if (sCandidate .asOccurrences .size () < 2 ||
+				FindPureValue (pCall) != NULL)
+				continue;
+			size_t nOccurrence = 0;
+			while (nOccurrence < sCandidate .asOccurrences .size ())
+			{
+				size_t nFirst = sCandidate .asOccurrences [nOccurrence] .nStatement;
+				size_t nLast = nFirst;
+				int nCount = 0;
+				bool fUnconditional = false;
+				size_t nChecked = nFirst;
+				while (nOccurrence < sCandidate .asOccurrences .size ())
+				{
+					const Occurrence &sOccurrence = sCandidate .asOccurrences [nOccurrence];
+					bool fInvariant = true;
+					for (; nChecked <= sOccurrence .nStatement && fInvariant; nChecked++)
+					{
+						CNscPCodeInvariantChecker sInvariant (m_pCtx, 
+							&asStores [nChecked - nRunStart], 
+							asStatements [nFirst] .nDepth);
+						fInvariant = sInvariant .ProcessPCodeBlock (
+							(unsigned char *) pCall, pCall ->nOpSize);
+					}
+					if (!fInvariant)
+						break;
+					nLast = sOccurrence .nStatement;
+					nCount++;
+					if (!sOccurrence .fConditional)
+						fUnconditional = true;
+					nOccurrence++;
+				}
+				if (nCount == 0)
+				{
+					nOccurrence++;
+					continue;
+				}
+				if (nCount < 2 || !fUnconditional)
+					continue;
+				PureValue sValue;
+				sValue .pCall = pCall;
+				sValue .pauchFirst = asStatements [nFirst] .pauchStart;
+				sValue .pauchLast = asStatements [nLast] .pauchLast;
+				sValue .nDepth = -1;
+				sValue .fActive = false;
+				m_asPureValues .push_back (sValue);
+			}
+		}
+		nRunStart = nRunEnd;
+	}
+	return m_asPureValues .size () - nFirstValue;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Compute a pure value into its stack slot
+//
+// @parm size_t | nIndex | Index of the value
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::ComputePureValue (size_t nIndex)
+{
+	assert (m_nExpDepth == 0);
+	FlushFreeSlots ();
+
+	//
+	// Code the call.  The value stays on the stack.  (The call can be the
+	// first operator of the statement, so clear the start first.)
+	//
+
+	m_asPureValues [nIndex] .pauchFirst = NULL;
+	NscPCodeCall *pCall = m_asPureValues [nIndex] .pCall;
+	int nDepth = m_nSPDepth - GetPureValueSize ();
+	int nSlot = m_nSPDepth;
+	int nSize = m_pCtx ->GetTypeSize (pCall ->nType);
+	CodeData ((unsigned char *) pCall, pCall ->nOpSize);
+	m_nExpDepth -= nSize;
+	m_nSPDepth += nSize;
+
+	//
+	// Activate the value
+	//
+
+	PureValue &sValue = m_asPureValues [nIndex];
+	sValue .nDepth = nDepth;
+	sValue .nSlot = nSlot;
+	sValue .nSize = nSize;
+	sValue .fActive = true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Find the active pure value of a call
+//
+// @parm NscPCodeCall * | pCall | Call
+//
+// @rdesc Pointer to the value or NULL if the call has no value.
+//
+//-----------------------------------------------------------------------------
+
+CNscCodeGenerator::PureValue *CNscCodeGenerator::FindPureValue (
+	NscPCodeCall *pCall)
+{
+	for (size_t i = 0; i < m_asPureValues .size (); i++)
+	{
+		PureValue &sValue = m_asPureValues [i];
+		if (sValue .fActive && IsSameExpression (
+			(unsigned char *) sValue .pCall, sValue .pCall ->nOpSize,
+			(unsigned char *) pCall, pCall ->nOpSize))
+			return &sValue;
+	}
+	return NULL;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Release the last pure values
+//
+// @parm size_t | nCount | Number of values to release
+//
+// @rdesc Stack size of the values that were computed.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::ReleasePureValues (size_t nCount)
+{
+	int nSize = 0;
+	for (size_t i = m_asPureValues .size () - nCount; 
+		i < m_asPureValues .size (); i++)
+	{
+		if (m_asPureValues [i] .nDepth != -1)
+			nSize += m_asPureValues [i] .nSize;
+	}
+	m_asPureValues .resize (m_asPureValues .size () - nCount);
+	return nSize;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the size of the computed pure values
+//
+// @rdesc Stack size of the values.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::GetPureValueSize () const
+{
+	int nSize = 0;
+	for (size_t i = 0; i < m_asPureValues .size (); i++)
+	{
+		if (m_asPureValues [i] .nDepth != -1)
+			nSize += m_asPureValues [i] .nSize;
+	}
+	return nSize;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the stack adjustment of a local for the pure values.
+//
+//		The parser doesn't know about the pure value slots, so every
+//		local declared after a slot was pushed is really deeper in the
+//		stack by the size of the slot.
+//
+// @parm int | nStackOffset | Stack offset of the local from the parser
+//
+// @rdesc Number of elements to add to the stack offset.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::GetPureValueShift (int nStackOffset) const
+{
+	int nShift = 0;
+	for (size_t i = 0; i < m_asPureValues .size (); i++)
+	{
+		const PureValue &sValue = m_asPureValues [i];
+		if (sValue .nDepth != -1 && sValue .nDepth <= nStackOffset)
+			nShift += sValue .nSize;
+	}
+	return nShift;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the size of the free local slots
+//
+// @rdesc Stack size of the slots.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::GetFreeSlotSize () const
+{
+	int nSize = 0;
+	for (size_t i = 0; i < m_anFreeSlots .size (); i++)
+		nSize += m_pCtx ->GetTypeSize (m_anFreeSlots [i]);
+	return nSize;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Remove the free local slots from the stack
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::FlushFreeSlots ()
+{
+	if (m_anFreeSlots .empty ())
+		return;
+	CodeMOVSP (GetFreeSlotSize (), &m_nSPDepth);
+	m_anFreeSlots .clear ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Test if a new local is assigned before it is read.
+//
+//		Only the simplest case is recognized, the statement following
+//		the declaration (or the initialization of a for loop) assigning 
+//		the whole variable without reading it.  Simple values aren't 
+//		accepted since the peephole pass already folds those into the
+//		declaration.
+//
+// @parm unsigned char * | pauchData | Data following the declaration
+//
+// @parm unsigned char * | pauchEnd | End of the statement list
+//
+// @parm int | nStackOffset | Stack offset of the local
+//
+// @rdesc TRUE if the local is assigned first.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::IsAssignedBeforeUse (unsigned char *pauchData, 
+	unsigned char *pauchEnd, int nStackOffset)
+{
+	while (pauchData < pauchEnd && 
+		((NscPCodeHeader *) pauchData) ->nOpCode == NscPCode_Line)
+		pauchData += ((NscPCodeHeader *) pauchData) ->nOpSize;
+	if (pauchData >= pauchEnd)
+		return false;
+
+	//
+	// Step into the initialization of a for loop
+	//
+
+	NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+	if (pHeader ->nOpCode == NscPCode_For)
+	{
+		NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+		if (pBlock ->anSize [0] == 0)
+			return false;
+		pHeader = (NscPCodeHeader *) &pauchData [pBlock ->anOffset [0]];
+	}
+
+	//
+	// It must be a plain assignment of the whole local
+	//
+
+	if (pHeader ->nOpCode != NscPCode_Assignment)
+		return false;
+	NscPCodeAssignment *pAsn = (NscPCodeAssignment *) pHeader;
+	if ((pAsn ->ulFlags & NscSymFlag_Global) != 0 ||
+		pAsn ->nStackOffset != nStackOffset || pAsn ->nElement != -1)
+		return false;
+
+	//
+	// The value must not be a single constant or variable and must not 
+	// reference the local
+	//
+
+	unsigned char *pauchValue = &((unsigned char *) pAsn) [pAsn ->nDataOffset];
+	NscPCodeHeader *pValue = (NscPCodeHeader *) pauchValue;
+	if (pAsn ->nDataSize == 0 || (pValue ->nOpSize == pAsn ->nDataSize && 
+		(pValue ->nOpCode == NscPCode_Constant || 
+		pValue ->nOpCode == NscPCode_Variable)))
+		return false;
+	CNscPCodeLocalReferenceChecker sChecker (m_pCtx, nStackOffset);
+	return sChecker .ProcessPCodeBlock (pauchValue, pAsn ->nDataSize);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Test two expressions for equality.
+//
+//		Only the operations that can appear in an invariant expression
+//		are compared, anything else is taken as different.
+//
+// @parm const unsigned char * | pauchData1 | First expression
+//
+// @parm size_t | nDataSize1 | Size of the first expression
+//
+// @parm const unsigned char * | pauchData2 | Second expression
+//
+// @parm size_t | nDataSize2 | Size of the second expression
+//
+// @rdesc TRUE if the expressions are the same.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::IsSameExpression (const unsigned char *pauchData1, 
+	size_t nDataSize1, const unsigned char *pauchData2, size_t nDataSize2)
+{
+	const unsigned char *pauchEnd1 = &pauchData1 [nDataSize1];
+	const unsigned char *pauchEnd2 = &pauchData2 [nDataSize2];
+	while (pauchData1 < pauchEnd1 && pauchData2 < pauchEnd2)
+	{
+		const NscPCodeHeader *p1 = (const NscPCodeHeader *) pauchData1;
+		const NscPCodeHeader *p2 = (const NscPCodeHeader *) pauchData2;
+		if (p1 ->nOpCode != p2 ->nOpCode || p1 ->nType != p2 ->nType)
+			return false;
+
+		switch (p1 ->nOpCode)
+		{
+
+			//
+			// Constants
+			//
+
+			case NscPCode_Constant:
+				switch (p1 ->nType)
+				{
+					case NscType_Integer:
+					case NscType_Engine_2:
+						if (((NscPCodeConstantInteger *) p1) ->lValue !=
+							((NscPCodeConstantInteger *) p2) ->lValue)
+							return false;
+						break;
+					case NscType_Float:
+						if (memcmp (&((NscPCodeConstantFloat *) p1) ->fValue,
+							&((NscPCodeConstantFloat *) p2) ->fValue, sizeof (float)) != 0)
+							return false;
+						break;
+					case NscType_String:
+					case NscType_Engine_7:
+						{
+							NscPCodeConstantString *ps1 = (NscPCodeConstantString *) p1;
+							NscPCodeConstantString *ps2 = (NscPCodeConstantString *) p2;
+							if (ps1 ->nLength != ps2 ->nLength || memcmp (
+								ps1 ->szString, ps2 ->szString, ps1 ->nLength) != 0)
+								return false;
+						}
+						break;
+					case NscType_Object:
+						if (((NscPCodeConstantObject *) p1) ->ulid !=
+							((NscPCodeConstantObject *) p2) ->ulid)
+							return false;
+						break;
+					case NscType_Vector:
+						if (memcmp (((NscPCodeConstantVector *) p1) ->v,
+							((NscPCodeConstantVector *) p2) ->v, sizeof (float) * 3) != 0)
+							return false;
+						break;
+					default:
+						break;
+				}
+				break;
+
+			//
+			// Variables
+			//
+
+			case NscPCode_Variable:
+				{
+					NscPCodeVariable *pv1 = (NscPCodeVariable *) p1;
+					NscPCodeVariable *pv2 = (NscPCodeVariable *) p2;
+					if (pv1 ->nSourceType != pv2 ->nSourceType ||
+						pv1 ->nSymbol != pv2 ->nSymbol ||
+						pv1 ->nElement != pv2 ->nElement ||
+						pv1 ->nStackOffset != pv2 ->nStackOffset ||
+						((pv1 ->ulFlags ^ pv2 ->ulFlags) & 
+						(NscSymFlag_Global | NscSymFlag_Increments)) != 0)
+						return false;
+				}
+				break;
+
+			//
+			// Calls
+			//
+
+			case NscPCode_Call:
+				{
+					NscPCodeCall *pc1 = (NscPCodeCall *) p1;
+					NscPCodeCall *pc2 = (NscPCodeCall *) p2;
+					if (pc1 ->nFnSymbol != pc2 ->nFnSymbol ||
+						pc1 ->nArgCount != pc2 ->nArgCount ||
+						!IsSameExpression (&pauchData1 [pc1 ->nDataOffset], 
+						pc1 ->nDataSize, &pauchData2 [pc2 ->nDataOffset], 
+						pc2 ->nDataSize))
+						return false;
+				}
+				break;
+
+			//
+			// Arguments
+			//
+
+			case NscPCode_Argument:
+				{
+					NscPCodeArgument *pa1 = (NscPCodeArgument *) p1;
+					NscPCodeArgument *pa2 = (NscPCodeArgument *) p2;
+					if (!IsSameExpression (&pauchData1 [pa1 ->nDataOffset], 
+						pa1 ->nDataSize, &pauchData2 [pa2 ->nDataOffset], 
+						pa2 ->nDataSize))
+						return false;
+				}
+				break;
+
+			//
+			// Element access
+			//
+
+			case NscPCode_Element:
+				{
+					NscPCodeElement *pe1 = (NscPCodeElement *) p1;
+					NscPCodeElement *pe2 = (NscPCodeElement *) p2;
+					if (pe1 ->nLhsType != pe2 ->nLhsType ||
+						pe1 ->nElement != pe2 ->nElement ||
+						!IsSameExpression (&pauchData1 [pe1 ->nDataOffset], 
+						pe1 ->nDataSize, &pauchData2 [pe2 ->nDataOffset], 
+						pe2 ->nDataSize))
+						return false;
+				}
+				break;
+
+			//
+			// Logical AND/OR
+			//
+
+			case NscPCode_LogicalAND:
+			case NscPCode_LogicalOR:
+				{
+					NscPCodeLogicalOp *pl1 = (NscPCodeLogicalOp *) p1;
+					NscPCodeLogicalOp *pl2 = (NscPCodeLogicalOp *) p2;
+					if (!IsSameExpression (&pauchData1 [pl1 ->nLhsOffset], 
+						pl1 ->nLhsSize, &pauchData2 [pl2 ->nLhsOffset], 
+						pl2 ->nLhsSize) ||
+						!IsSameExpression (&pauchData1 [pl1 ->nRhsOffset], 
+						pl1 ->nRhsSize, &pauchData2 [pl2 ->nRhsOffset], 
+						pl2 ->nRhsSize))
+						return false;
+				}
+				break;
+
+			//
+			// Simple operators
+			//
+
+			default:
+				if (p1 ->nOpCode < NscPCode__First_Simple ||
+					p1 ->nOpCode == NscPCode_ExpressionEnd ||
+					p1 ->nOpSize != p2 ->nOpSize)
+					return false;
+				if (p1 ->nOpSize >= sizeof (NscPCodeBinaryOp))
+				{
+					NscPCodeBinaryOp *pb1 = (NscPCodeBinaryOp *) p1;
+					NscPCodeBinaryOp *pb2 = (NscPCodeBinaryOp *) p2;
+					if (pb1 ->nLhsType != pb2 ->nLhsType ||
+						pb1 ->nRhsType != pb2 ->nRhsType)
+						return false;
+				}
+				break;
+		}
+
+		//
+		// Move onto the next operator
+		//
+
+		pauchData1 += p1 ->nOpSize;
+		pauchData2 += p2 ->nOpSize;
+	}
+	return pauchData1 == pauchEnd1 && pauchData2 == pauchEnd2;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Evaluate the constant expression at the start of pcode.
+//
+//		The pcode of an expression is in postfix order, so the longest
+//		run of constants, constant globals and operators on them that
+//		leaves a single value is a complete constant sub-expression.
+//		The operators are folded the same way the parser folds them 
+//		for literals.
+//
+// @parm unsigned char * | pauchData | Pointer to the pcode
+//
+// @parm size_t | nDataSize | Size of the pcode
+//
+// @parm ConstantValue * | psValue | Receives the value
+//
+// @parm bool * | pfUsesGlobals | If not NULL, set to TRUE if the 
+//		expression reads a constant global
+//
+// @rdesc Size of the pcode of the expression or zero if the pcode does 
+//		not start with a constant expression.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::EvaluateConstant (unsigned char *pauchData, 
+	size_t nDataSize, ConstantValue *psValue, bool *pfUsesGlobals)
+{
+	ConstantValue asStack [16];
+	int nDepth = 0;
+	bool fUsesGlobals = false;
+	size_t nLength = 0;
+
+	size_t nOffset = 0;
+	while (nOffset < nDataSize && nDepth < 16)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) &pauchData [nOffset];
+		ConstantValue sValue;
+		switch (pHeader ->nOpCode)
+		{
+
+			//
+			// Integer and float literals
+			//
+
+			case NscPCode_Constant:
+				sValue .nType = pHeader ->nType;
+				if (pHeader ->nType == NscType_Integer)
+					sValue .lValue = ((NscPCodeConstantInteger *) pHeader) ->lValue;
+				else if (pHeader ->nType == NscType_Float)
+					sValue .fValue = ((NscPCodeConstantFloat *) pHeader) ->fValue;
+				else
+					return nLength;
+				asStack [nDepth++] = sValue;
+				break;
+
+			//
+			// Globals treated as constants have the value of their 
+			// initializer
+			//
+
+			case NscPCode_Variable:
+				{
+					NscPCodeVariable *pVar = (NscPCodeVariable *) pHeader;
+					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pVar ->nSymbol);
+					if ((pVar ->ulFlags & NscSymFlag_Global) == 0 ||
+						(pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) == 0 ||
+						pVar ->nElement != -1)
+						return nLength;
+					unsigned char *pauchInit = m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+					NscSymbolVariableExtra *pExtra = (NscSymbolVariableExtra *) pauchInit;
+					pauchInit += sizeof (NscSymbolVariableExtra);
+					if (pExtra ->nInitSize == 0 || EvaluateConstant (pauchInit,
+						pExtra ->nInitSize, &sValue, NULL) != pExtra ->nInitSize ||
+						sValue .nType != pVar ->nType)
+						return nLength;
+					asStack [nDepth++] = sValue;
+					fUsesGlobals = true;
+				}
+				break;
+
+			//
+			// Logical operators only need the right hand side if the
+			// left hand side does not decide the result
+			//
+
+			case NscPCode_LogicalAND:
+			case NscPCode_LogicalOR:
+				{
+					NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
+					bool fLhsGlobals, fRhsGlobals = false;
+					if (EvaluateConstant (&pauchData [nOffset + pLogOp ->nLhsOffset],
+						pLogOp ->nLhsSize, &sValue, &fLhsGlobals) != pLogOp ->nLhsSize ||
+						sValue .nType != NscType_Integer)
+						return nLength;
+					bool fLhs = sValue .lValue != 0;
+					if (fLhs == (pHeader ->nOpCode == NscPCode_LogicalAND))
+					{
+						if (EvaluateConstant (&pauchData [nOffset + pLogOp ->nRhsOffset],
+							pLogOp ->nRhsSize, &sValue, &fRhsGlobals) != pLogOp ->nRhsSize ||
+							sValue .nType != NscType_Integer)
+							return nLength;
+						sValue .lValue = sValue .lValue != 0;
+					}
+					else
+						sValue .lValue = fLhs;
+					asStack [nDepth++] = sValue;
+					fUsesGlobals |= fLhsGlobals || fRhsGlobals;
+				}
+				break;
+
+			//
+			// Unary operators
+			//
+
+			case NscPCode_Negate:
+			case NscPCode_BitwiseNot:
+			case NscPCode_LogicalNot:
+				{
+					if (nDepth < 1)
+						return nLength;
+					ConstantValue &sTop = asStack [nDepth - 1];
+					if (sTop .nType == NscType_Float)
+					{
+						if (pHeader ->nOpCode != NscPCode_Negate)
+							return nLength;
+						sTop .fValue = - sTop .fValue;
+					}
+					else if (pHeader ->nOpCode == NscPCode_Negate)
+						sTop .lValue = (INT32) (0 - (UINT32) sTop .lValue);
+					else if (pHeader ->nOpCode == NscPCode_BitwiseNot)
+						sTop .lValue = ~ sTop .lValue;
+					else
+						sTop .lValue = ! sTop .lValue;
+				}
+				break;
+
+			//
+			// Binary operators
+			//
+
+			case NscPCode_Multiply:
+			case NscPCode_Divide:
+			case NscPCode_Modulus:
+			case NscPCode_Add:
+			case NscPCode_Subtract:
+			case NscPCode_ShiftLeft:
+			case NscPCode_ShiftRight:
+			case NscPCode_UnsignedShiftRight:
+			case NscPCode_LessThan:
+			case NscPCode_GreaterThan:
+			case NscPCode_LessThanEq:
+			case NscPCode_GreaterThanEq:
+			case NscPCode_Equal:
+			case NscPCode_NotEqual:
+			case NscPCode_BitwiseAND:
+			case NscPCode_BitwiseXOR:
+			case NscPCode_BitwiseOR:
+				if (nDepth < 2 || !EvaluateBinaryOp (pHeader ->nOpCode,
+					asStack [nDepth - 2], asStack [nDepth - 1], &sValue))
+					return nLength;
+				asStack [--nDepth - 1] = sValue;
+				break;
+
+			default:
+				return nLength;
+		}
+
+		//
+		// If a single value is left, this is the longest constant
+		// expression so far
+		//
+
+		nOffset += pHeader ->nOpSize;
+		if (nDepth == 1)
+		{
+			nLength = nOffset;
+			*psValue = asStack [0];
+			if (pfUsesGlobals)
+				*pfUsesGlobals = fUsesGlobals;
+		}
+	}
+	return nLength;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Evaluate a binary operator on two constants
+//
+// @parm NscPCode | nOpCode | Operator
+//
+// @parm const ConstantValue & | sLhs | Left hand side
+//
+// @parm const ConstantValue & | sRhs | Right hand side
+//
+// @parm ConstantValue * | psValue | Receives the value
+//
+// @rdesc TRUE if the operator could be evaluated.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::EvaluateBinaryOp (NscPCode nOpCode, 
+	const ConstantValue &sLhs, const ConstantValue &sRhs, 
+	ConstantValue *psValue)
+{
+
+	//
+	// Integer operators
+	//
+
+	if (sLhs .nType == NscType_Integer && sRhs .nType == NscType_Integer)
+	{
+		INT32 l = sLhs .lValue;
+		INT32 r = sRhs .lValue;
+		psValue ->nType = NscType_Integer;
+		switch (nOpCode)
+		{
+			case NscPCode_Multiply:
+				psValue ->lValue = (INT32) ((UINT32) l * (UINT32) r);
+				return true;
+			case NscPCode_Divide:
+			case NscPCode_Modulus:
+				if (r == 0 || (r == -1 && l == (INT32) 0x80000000))
+					return false;
+				psValue ->lValue = nOpCode == NscPCode_Divide ? l / r : l % r;
+				return true;
+			case NscPCode_Add:
+				psValue ->lValue = (INT32) ((UINT32) l + (UINT32) r);
+				return true;
+			case NscPCode_Subtract:
+				psValue ->lValue = (INT32) ((UINT32) l - (UINT32) r);
+				return true;
+			case NscPCode_ShiftLeft:
+			case NscPCode_ShiftRight:
+			case NscPCode_UnsignedShiftRight:
+				if (r < 0 || r > 31)
+					return false;
+				if (nOpCode == NscPCode_ShiftLeft)
+					psValue ->lValue = (INT32) ((UINT32) l << r);
+				else if (nOpCode == NscPCode_ShiftRight)
+					psValue ->lValue = l >> r;
+				else
+					psValue ->lValue = (INT32) ((UINT32) l >> r);
+				return true;
+			case NscPCode_LessThan:
+				psValue ->lValue = l < r;
+				return true;
+			case NscPCode_GreaterThan:
+				psValue ->lValue = l > r;
+				return true;
+			case NscPCode_LessThanEq:
+				psValue ->lValue = l <= r;
+				return true;
+			case NscPCode_GreaterThanEq:
+				psValue ->lValue = l >= r;
+				return true;
+			case NscPCode_Equal:
+				psValue ->lValue = l == r;
+				return true;
+			case NscPCode_NotEqual:
+				psValue ->lValue = l != r;
+				return true;
+			case NscPCode_BitwiseAND:
+				psValue ->lValue = l & r;
+				return true;
+			case NscPCode_BitwiseXOR:
+				psValue ->lValue = l ^ r;
+				return true;
+			case NscPCode_BitwiseOR:
+				psValue ->lValue = l | r;
+				return true;
+			default:
+				return false;
+		}
+	}
+
+	//
+	// Float comparisons
+	//
+
+	if (sLhs .nType == NscType_Float && sRhs .nType == NscType_Float)
+	{
+		float l = sLhs .fValue;
+		float r = sRhs .fValue;
+		psValue ->nType = NscType_Integer;
+		switch (nOpCode)
+		{
+			case NscPCode_LessThan:
+				psValue ->lValue = l < r;
+				return true;
+			case NscPCode_GreaterThan:
+				psValue ->lValue = l > r;
+				return true;
+			case NscPCode_LessThanEq:
+				psValue ->lValue = l <= r;
+				return true;
+			case NscPCode_GreaterThanEq:
+				psValue ->lValue = l >= r;
+				return true;
+			case NscPCode_Equal:
+				psValue ->lValue = l == r;
+				return true;
+			case NscPCode_NotEqual:
+				psValue ->lValue = l != r;
+				return true;
+			default:
+				break;
+		}
+	}
+
+	//
+	// Float arithmetic, with integers promoted
+	//
+
+	if ((sLhs .nType != NscType_Integer && sLhs .nType != NscType_Float) ||
+		(sRhs .nType != NscType_Integer && sRhs .nType != NscType_Float))
+		return false;
+	float l = sLhs .nType == NscType_Float ? sLhs .fValue : (float) sLhs .lValue;
+	float r = sRhs .nType == NscType_Float ? sRhs .fValue : (float) sRhs .lValue;
+	psValue ->nType = NscType_Float;
+	switch (nOpCode)
+	{
+		case NscPCode_Multiply:
+			psValue ->fValue = l * r;
+			return true;
+		case NscPCode_Divide:
+			if (r == 0.0f)
+				return false;
+			psValue ->fValue = l / r;
+			return true;
+		case NscPCode_Add:
+			psValue ->fValue = l + r;
+			return true;
+		case NscPCode_Subtract:
+			psValue ->fValue = l - r;
+			return true;
+		default:
+			return false;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code a constant expression that uses constant globals.  Without
+//		this, only the globals themselves are replaced by their 
+//		initializers and the operators on them are still run.
+//
+// @parm unsigned char * | pauchData | Pointer to the pcode
+//
+// @parm unsigned char * | pauchEnd | End of the pcode
+//
+// @parm size_t * | pnOpSize | Receives the size of the pcode coded
+//
+// @rdesc TRUE if a constant was coded.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::CodeFoldedConstant (unsigned char *pauchData, 
+	unsigned char *pauchEnd, size_t *pnOpSize)
+{
+	ConstantValue sValue;
+	bool fUsesGlobals;
+	size_t nLength = EvaluateConstant (pauchData, pauchEnd - pauchData,
+		&sValue, &fUsesGlobals);
+	if (nLength == 0 || !fUsesGlobals)
+		return false;
+	if (sValue .nType == NscType_Integer)
+		CodeCONST (NscType_Integer, &sValue .lValue);
+	else
+		CodeCONST (NscType_Float, &sValue .fValue);
+	*pnOpSize = nLength;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the value of a constant condition
+//
+// @parm unsigned char * | pauchData | Pointer to the condition pcode
+//
+// @parm size_t | nDataSize | Size of the pcode
+//
+// @rdesc 1 if the condition is always true, 0 if it is always false or 
+//		-1 if it isn't constant.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::GetConstantCondition (unsigned char *pauchData, 
+	size_t nDataSize)
+{
+	if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
+		pauchData, nDataSize))
+	{
+		NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *) pauchData;
+		return pCI ->lValue != 0;
+	}
+	ConstantValue sValue;
+	if (m_fOptConstants && nDataSize != 0 && 
+		EvaluateConstant (pauchData, nDataSize, &sValue, NULL) == nDataSize &&
+		sValue .nType == NscType_Integer)
+		return sValue .lValue != 0;
+	return -1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Test if a return value can be coded as a tail call.
+//
+//		When the value is just a call to a script routine returning the 
+//		same type, the arguments of the call can be moved down over the
+//		frame and the routine entered with a JMP.  Its RETN then returns 
+//		straight to our caller, which saves reserving a second return 
+//		value, copying it down and going through our own epilogue.  This 
+//		requires that the arguments fit in the frame being removed and
+//		that we are not in an inlined call, where a return does not 
+//		leave the routine.
+//
+// @parm unsigned char * | pauchData | Pointer to the return value pcode
+//
+// @parm size_t | nDataSize | Size of the pcode
+//
+// @rdesc TRUE if the call can be coded as a tail call.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::IsTailCall (unsigned char *pauchData, size_t nDataSize)
+{
+	if (!m_fOptTailReturn || m_fInlinedFrame || m_fGlobalScope ||
+		m_nExpDepth != 0)
+		return false;
+
+	//
+	// The value must be a single call
+	//
+
+	NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+	if (pHeader ->nOpCode != NscPCode_Call || pHeader ->nOpSize != nDataSize)
+		return false;
+	NscPCodeCall *pCall = (NscPCodeCall *) pHeader;
+	NscSymbol *pSymbol = m_pCtx ->GetSymbol (pCall ->nFnSymbol);
+	NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+		m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+
+	//
+	// The call must be coded as a JSR
+	//
+
+	if ((pSymbol ->ulFlags & (NscSymFlag_EngineFunc | 
+		NscSymFlag_Intrinsic)) != 0)
+		return false;
+	if (std::binary_search (m_anInlineFunctions .begin (), 
+		m_anInlineFunctions .end (), pCall ->nFnSymbol))
+		return false;
+	if (!m_asPureValues .empty () && FindPureValue (pCall) != NULL)
+		return false;
+
+	//
+	// Our return value must be the return value of the call and the 
+	// arguments must fit in our frame
+	//
+
+	if (m_pCtx ->GetTypeSize (pCall ->nType) != m_nReturnSize)
+		return false;
+	return pExtra ->nArgSize <= m_nSPDepth;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code executable data
+//
+// @parm unsigned char * | pauchData | Pointer to code
+//
+// @parm size_t | nDataSize | Size of code
+//
+// @rdesc TRUE if output was generated.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscCodeGenerator::CodeData (unsigned char *pauchData, size_t nDataSize)
+{
+
+	//
+	// Loop through the data
+	//
+
+	unsigned char *pauchEnd = &pauchData [nDataSize];
+	bool fBlockList = pauchData == m_pauchBlockList;
+	m_pauchBlockList = NULL;
+	while (pauchData < pauchEnd)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+		size_t nOpSize = pHeader ->nOpSize;
+		if (m_pauchOut >= m_pauchCodeEnd)
+			ExpandOutputBuffer ();
+
+		//
+		// Labels need the stack depth of the code that jumps to them, so
+		// the free slots must be gone first
+		//
+
+		if (!m_anFreeSlots .empty () && (pHeader ->nOpCode == NscPCode_Case ||
+			pHeader ->nOpCode == NscPCode_Default || 
+			(pHeader ->nOpCode >= NscPCode__First_5Block &&
+			pHeader ->nOpCode <= NscPCode__Last_5Block &&
+			pHeader ->nOpCode != NscPCode_Conditional)))
+			FlushFreeSlots ();
+
+		//
+		// Compute the pure values planned for this statement
+		//
+
+		for (size_t i = 0; i < m_asPureValues .size (); i++)
+		{
+			if (m_asPureValues [i] .pauchFirst == pauchData &&
+				m_asPureValues [i] .nDepth == -1)
+				ComputePureValue (i);
+		}
+
+		//
+		// Switch based on the opcode
+		//
+
+		NscCode nOp;
+		switch (pHeader ->nOpCode)
+		{
+
+			//
+			// If this is a variable
+			//
+
+			case NscPCode_Variable:
+				{
+					if (m_fOptConstants && CodeFoldedConstant (pauchData, 
+						pauchEnd, &nOpSize))
+						break;
+					NscPCodeVariable *pVar = (NscPCodeVariable *) pHeader;
+					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pVar ->nSymbol);
+					if ((pVar ->ulFlags & NscSymFlag_Global) != 0 &&
+						(pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) != 0)
+					{
+						unsigned char *pauchInit = m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+						NscSymbolVariableExtra *pExtra = (NscSymbolVariableExtra *) pauchInit;
+						pauchInit += sizeof (NscSymbolVariableExtra);
+						CodeData (pauchInit, pExtra ->nInitSize);
+					}
+					else
+					{
+						CodeCP (true, pSymbol, pVar ->nType, pVar ->nSourceType,
+							pVar ->ulFlags, pVar ->nElement, pVar ->nStackOffset);
+					}
+				}
+				break;
+
+			//
+			// If this is a declaration
+			// 
+
+			case NscPCode_Declaration:
+				{
+					NscPCodeDeclaration *pDecl = (NscPCodeDeclaration *) pHeader;
+					size_t nOffset;
+
+					//
+					// If the free slot of a finished block has the right
+					// type and the local is assigned before it is read,
+					// reuse it.  Otherwise the local goes on top of the
+					// stack where the parser expects it.
+					//
+
+					if (!m_anFreeSlots .empty ())
+					{
+						int nFreeDepth = m_nSPDepth - GetFreeSlotSize ();
+						if (m_anFreeSlots [0] == pDecl ->nType && 
+							pDecl ->nDataSize == 0 && IsAssignedBeforeUse (
+							&pauchData [pDecl ->nOpSize], pauchEnd, 
+							nFreeDepth - GetPureValueSize ()))
+						{
+							m_anFreeSlots .erase (m_anFreeSlots .begin ());
+							if (m_fMakeDebugFile)
+							{
+								NscSymbol *pSymbol = AddLocalVariable (
+									pDecl ->szString, pDecl ->nType);
+								pSymbol ->nCompiledStart = m_pauchOut - m_pauchCode;
+								pSymbol ->nStackOffset = m_nFrameBase + 
+									nFreeDepth + m_nReturnSize;
+								m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
+							}
+							break;
+						}
+						FlushFreeSlots ();
+					}
+					int nDepth = m_nFrameBase + m_nSPDepth + m_nReturnSize;
+					CodeDeclaration (pDecl ->nType, &m_nSPDepth,
+						&pauchData [pDecl ->nDataOffset],
+						pDecl ->nDataSize, &nOffset, pDecl ->ulSymFlags);
+					if (m_fMakeDebugFile)
+					{
+						NscSymbol *pSymbol = AddLocalVariable (
+							pDecl ->szString, pDecl ->nType);
+						pSymbol ->nCompiledStart = nOffset;
+						pSymbol ->nStackOffset = nDepth;
+						m_anVariables .push_back (m_pCtx ->GetSymbolOffset (pSymbol));
+					}
+				}
+				break;
+
+			//
+			// If this is an argument
+			//
+
+			case NscPCode_Argument:
+				{
+					NscPCodeArgument *pArg = (NscPCodeArgument *) pHeader;
+					CodeData (&pauchData [pArg ->nDataOffset],
+						pArg ->nDataSize);
+				}
+				break;
+
+			//
+			// If this is a statement
+			//
+
+			case NscPCode_Statement:
+				{
+					assert (m_nExpDepth == 0);
+					NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
+					size_t nPureValues = 0;
+					if (m_fOptPure && !m_fGlobalScope)
+					{
+						nPureValues = PlanPureValues (&pauchData [pCode ->nDataOffset],
+							pCode ->nDataSize);
+					}
+					if (m_fOptSlots && !m_fGlobalScope)
+						m_pauchBlockList = &pauchData [pCode ->nDataOffset];
+					CodeData (&pauchData [pCode ->nDataOffset],
+						pCode ->nDataSize);
+					int nPureSize = ReleasePureValues (nPureValues);
+					int nLocals = pCode ->nLocals + nPureSize;
+
+					//
+					// A block nested directly in another leaves its locals
+					// on the stack as free slots.  They are either reused
+					// by the next locals of the enclosing block or removed 
+					// together with its own.
+					//
+
+					std::vector <NscType> anTypes;
+					bool fFree = fBlockList && nPureSize == 0 && 
+						m_fOptSlots && !m_fGlobalScope;
+					if (fFree)
+					{
+						unsigned char *pauchList = &pauchData [pCode ->nDataOffset];
+						unsigned char *pauchListEnd = &pauchList [pCode ->nDataSize];
+						int nSize = 0;
+						while (pauchList < pauchListEnd)
+						{
+							NscPCodeHeader *p = (NscPCodeHeader *) pauchList;
+							if (p ->nOpCode == NscPCode_Declaration)
+							{
+								anTypes .push_back (p ->nType);
+								nSize += m_pCtx ->GetTypeSize (p ->nType);
+							}
+							pauchList += p ->nOpSize;
+						}
+						fFree = nSize == pCode ->nLocals;
+					}
+					if (fFree)
+					{
+						if (m_fMakeDebugFile)
+						{
+							PurgeVariables (m_nFrameBase + m_nReturnSize + 
+								m_nSPDepth - GetFreeSlotSize () - nLocals);
+						}
+						m_anFreeSlots .insert (m_anFreeSlots .begin (), 
+							anTypes .begin (), anTypes .end ());
+						assert (m_nExpDepth == 0);
+						break;
+					}
+					nLocals += GetFreeSlotSize ();
+					m_anFreeSlots .clear ();
+					if (nLocals != 0)
+					{
+						if (m_fMakeDebugFile)
+						{
+							PurgeVariables (m_nFrameBase + m_nReturnSize + 
+								m_nSPDepth - nLocals);
+						}
+						CodeMOVSP (nLocals, &m_nSPDepth);
+						m_pauchLineStart = m_pauchOut;
+					}
+					assert (m_nExpDepth == 0);
+				}
+				break;
+
+			//
+			// If this is an call
+			//
+
+			case NscPCode_Call:
+				{
+
+					//
+					// Get information about the call
+					//
+
+					NscPCodeCall *pCall = (NscPCodeCall *) pHeader;
+					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pCall ->nFnSymbol);
+					NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
 						m_pCtx ->GetSymbolData (pSymbol ->nExtra);
+					bool fTailCall = m_fTailCall;
+					m_fTailCall = false;
+
+					//
+					// If the value of this pure call is already on the 
+					// stack, just copy it
+					//
+
+					if (!m_asPureValues .empty ())
+					{
+						PureValue *pValue = FindPureValue (pCall);
+						if (pValue != NULL)
+						{
+							CodeCP (NscCode_CPTOPSP, m_nSPDepth + m_nExpDepth - 
+								pValue ->nSlot, pValue ->nSize);
+							break;
+						}
+					}
+
+					//
+					// If this isn't a global and there is a return,
+					// then allocate stack space.  A tail call uses our
+					// return value.
+					//
+
+					if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) == 0 &&
+						!fTailCall)
+					{
+						if (pCall ->nType != NscType_Void)
+							CodeDeclaration (pCall ->nType, &m_nExpDepth, NULL, 0, NULL, 0);
+					}
+
+					//
+					// Gather argument information
+					//
+
+					int nArgCount = pExtra ->nArgCount;
+					int nArgSize = pExtra ->nArgSize;
+					unsigned char *pauchFnData = &((unsigned char *) 
+						pExtra) [sizeof (NscSymbolFunctionExtra)];
+					unsigned char *pauchCallData = &pauchData [pCall ->nDataOffset];
+					size_t nCallDataSize = pCall ->nDataSize;
+					unsigned char *pauchCallDataEnd = &pauchCallData [nCallDataSize];
+
+					//
+					// Collect a list of arguments
+					//
+
+					NscPCodeHeader **papArgs = (NscPCodeHeader **)
+						alloca (nArgCount * sizeof (NscPCodeHeader *));
+					for (int i = 0; i < nArgCount; i++)
+					{
+						NscPCodeHeader *p1 = (NscPCodeHeader *) pauchCallData;
+						NscPCodeHeader *p2 = (NscPCodeHeader *) pauchFnData;
+						if (pauchCallData < pauchCallDataEnd)
+						{
+							papArgs [i] = p1;
+							pauchCallData += p1 ->nOpSize;
+						}
+						else
+							papArgs [i] = p2;
+						pauchFnData += p2 ->nOpSize;
+					}
+
+					//
+					// Add the arguments in reverse order
+					//
+
+					for (int i = nArgCount; i-- > 0;)
+					{
+
+						//
+						// Get the data for the argument
+						//
+						// NOTE: We will get a declaration on default 
+						// arguments.
+						//
+
+						NscPCodeHeader *p = papArgs [i];
+						unsigned char *pauchArgData;
+						size_t nArgDataSize;
+						if (p ->nOpCode == NscPCode_Declaration)
+						{
+							NscPCodeDeclaration *pd = 
+								(NscPCodeDeclaration *) p;
+							pauchArgData = ((unsigned char *) p) + 
+								pd ->nDataOffset,
+							nArgDataSize = pd ->nDataSize;
+						}
+						else if (p ->nOpCode == NscPCode_Argument)
+						{
+							NscPCodeArgument *pArg = (NscPCodeArgument *) p;
+							pauchArgData = ((unsigned char *) p) + 
+								pArg ->nDataOffset,
+							nArgDataSize = pArg ->nDataSize;
+						}
+						else
+						{
+							pauchArgData = NULL;
+							nArgDataSize = 0;
+							assert (false);
+						}
+
+						//
+						// Code the data
+						//
+
+						if (p ->nType == NscType_Action)
+						{
+							int nEnd;
+							nEnd = ForwardLabel ();
+							int nExpDepthSave = m_nExpDepth;
+							m_nSPDepth += nExpDepthSave;
+							m_nExpDepth = 0;
+							CodeSTORE_STATE ();
+							CodeJMP (nEnd);
+							CodeData (pauchArgData, nArgDataSize);
+							CodeUnaryOp (NscCode_RETN, NscType_Void);
+							ForwardResolve (nEnd);
+							m_nSPDepth -= nExpDepthSave;
+							m_nExpDepth += nExpDepthSave;
+						}
+						else
+						{
+							CodeData (pauchArgData, nArgDataSize);
+						}
+					}
+
+					//
+					// Generate the call, action, or intrinsic
+					//
+
+					if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) != 0)
+					{
+						CodeACTION (pCall ->nType, pExtra ->nAction,
+							nArgCount, nArgSize);
+					}
+					else if ((pSymbol ->ulFlags & NscSymFlag_Intrinsic) != 0)
+					{
+						CodeInvokeIntrinsic (pExtra ->nIntrinsic, nArgCount,
+							nArgSize);
+					}
+					else if (!m_fGlobalScope && std::binary_search (
+						m_anInlineFunctions .begin (), m_anInlineFunctions .end (),
+						pCall ->nFnSymbol))
+					{
+						CodeInline (pSymbol, pCall ->nType);
+					}
+					else if (fTailCall)
+					{
+
+						//
+						// Move the arguments down over the frame and
+						// enter the routine in its place
+						//
+
+						if (nArgSize != 0)
+						{
+							CodeCP (NscCode_CPDOWNSP, m_nSPDepth + 
+								m_nExpDepth, nArgSize);
+						}
+						CodeMOVSP (m_nSPDepth + m_nExpDepth - nArgSize, NULL);
+						CodeJMP (pSymbol ->szString);
+						m_nExpDepth -= nArgSize;
+					}
+					else
+					{
+						if ((pExtra ->ulFunctionFlags & NscFuncFlag_UsesGlobalVars) != 0 &&
+							(m_fGlobalScope))
+						{
+							m_pCtx ->GenerateMessage (
+								NscMessage_WarningBPFuncCalledBeforeBPSet,
+								pSymbol ->szString);
+						}
+
+						CodeJSR (pSymbol ->szString, nArgCount, nArgSize);
+					}
+				}
+				break;
+
+			//
+			// Element access
+			//
+
+			case NscPCode_Element:
+				{
+					NscPCodeElement *pElement = (NscPCodeElement *) pHeader;
+					CodeData (&pauchData [pElement ->nDataOffset],
+						pElement ->nDataSize);
+					int nTotalSize = m_pCtx ->GetTypeSize (pElement ->nLhsType);
+					int nTypeSize = m_pCtx ->GetTypeSize (pElement ->nType);
+					CodeDESTRUCT (nTotalSize, pElement ->nElement, nTypeSize);
+				}
+				break;
+
+			//
+			// If this is a break
+			//
+
+			case NscPCode_Break:
+				if (m_fNoBugBreakContinue)
+				{
+					if (m_nBreakBlockDepth < m_nSPDepth)
+						CodeMOVSP (m_nSPDepth - m_nBreakBlockDepth, NULL);
+				}
+				CodeJMP (m_nBreakLabel);
+				break;
+
+			//
+			// If this is a continue
+			//
+
+			case NscPCode_Continue:
+				if (m_fNoBugBreakContinue)
+				{
+					if (m_nContinueBlockDepth < m_nSPDepth)
+						CodeMOVSP (m_nSPDepth - m_nContinueBlockDepth, NULL);
+				}
+				CodeJMP (m_nContinueLabel);
+				break;
+
+			//
+			// If this is a return
+			//
+
+			case NscPCode_Return:
+				{
+					NscPCodeReturn *pReturn = (NscPCodeReturn *) pHeader;
+					unsigned char *pauchReturn = &((unsigned char *) 
+						pReturn) [pReturn ->nDataOffset];
+					if (pReturn ->nDataSize != 0 && 
+						IsTailCall (pauchReturn, pReturn ->nDataSize))
+					{
+						m_fTailCall = true;
+						CodeData (pauchReturn, pReturn ->nDataSize);
+						assert (m_nExpDepth == 0);
+						break;
+					}
+					if (pReturn ->nDataSize != 0)
+					{
+						CodeData (pauchReturn, pReturn ->nDataSize);
+						CodeCP (NscCode_CPDOWNSP, m_nReturnSize + 
+							m_nSPDepth + m_nExpDepth, m_nReturnSize);
+					}
+					CodeMOVSP (m_nSPDepth + m_nExpDepth - m_nArgumentSize, NULL);
+					if (m_fOptReturn)
+						m_nExpDepth -= m_nReturnSize;
+					CodeJMP (m_nReturnLabel);
+				}
+				break;
+
+			//
+			// If this is a case or default
+			//
+
+			case NscPCode_Case:
+			case NscPCode_Default:
+				{
+					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+					m_pauchLineStart = m_pauchOut;
+					AddLine (pCase ->nFile, pCase ->nLine);
+					if (pCase ->nLabel != -1)
+						ForwardResolve (pCase ->nLabel);
+				}
+				break;
+
+			//
+			// If this is a switch
+			//
+
+			case NscPCode_Switch:
+				{
 
 					//
-					// If this isn't a global and there is a return,
-					// then allocate stack space 
+					// Get the pcode data
+					//
+
+					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+
+					//
+					// Generate the labels
+					//
+
+					int nEnd;
+					nEnd = ForwardLabel ();
+
+					//
+					// Initialize our labels
+					//
+
+					int nBreakLabelSave = m_nBreakLabel;
+					int nBreakBlockDepthSave = m_nBreakBlockDepth;
+					m_nBreakLabel = nEnd;
+					m_nBreakBlockDepth = m_nSPDepth + 1; // +1 to account for switch expression
+					m_nDefaultLabel = -1;
+					m_pauchLineStart = m_pauchOut;
+
+					//
+					// Generate the conditional code
+					//
+					
+					CodeData (&((unsigned char *) pBlock) 
+						[pBlock ->anOffset [1]], pBlock ->anSize [1]);
+
+					//
+					// Scan for cases and generate the selection
 					//
 
-					if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) == 0)
+					if (m_fOptSwitch)
 					{
-						if (pCall ->nType != NscType_Void)
-							CodeDeclaration (pCall ->nType, &m_nExpDepth, NULL, 0, NULL, 0);
+						CodeSwitchSelect (&((unsigned char *) pBlock) 
+							[pBlock ->anOffset [3]], pBlock ->anSize [3], nEnd);
+					}
+					else
+					{
+						CodeScanCase (&((unsigned char *) pBlock) 
+							[pBlock ->anOffset [3]], pBlock ->anSize [3]);
+
+						//
+						// Generate the end of the switch selection
+						//
+
+						CodeJMP (m_nDefaultLabel != -1 ? m_nDefaultLabel : nEnd);
 					}
 
 					//
-					// Gather argument information
+					// Add the line
 					//
 
-					int nArgCount = pExtra ->nArgCount;
-					int nArgSize = pExtra ->nArgSize;
-					unsigned char *pauchFnData = &((unsigned char *) 
-						pExtra) [sizeof (NscSymbolFunctionExtra)];
-					unsigned char *pauchCallData = &pauchData [pCall ->nDataOffset];
-					size_t nCallDataSize = pCall ->nDataSize;
-					unsigned char *pauchCallDataEnd = &pauchCallData [nCallDataSize];
+					AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+					m_pauchLineStart = m_pauchOut;
 
 					//
-					// Collect a list of arguments
+					// Adjust the stack to keep later asserts happy.
+					// This code treats the conditional as just another normal
+					// stack variable.
 					//
 
-					NscPCodeHeader **papArgs = (NscPCodeHeader **)
-						alloca (nArgCount * sizeof (NscPCodeHeader *));
-					for (int i = 0; i < nArgCount; i++)
+					m_nSPDepth++;
+					m_nExpDepth--;
+
+					//
+					// Generate the actual code
+					//
+
+					CodeData (&((unsigned char *) pBlock) 
+						[pBlock ->anOffset [3]], pBlock ->anSize [3]);
+
+					//
+					// Finish
+					//
+
+					ForwardResolve (nEnd);
+					CodeMOVSP (1, &m_nSPDepth);
+
+					//
+					// Restore labels
+					//
+
+					m_nBreakLabel = nBreakLabelSave;
+					m_nBreakBlockDepth = nBreakBlockDepthSave;
+					m_pauchLineStart = m_pauchOut;
+				}
+				break;
+
+			//
+			// If this is a if
+			//
+
+			case NscPCode_If:
+				{
+					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+
+					//
+					// If the conditional can be optimized, then only 
+					// code the conditional that is valid
+					//
+
+					int nCondValue = GetConstantCondition (
+						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+					if (nCondValue != -1)
 					{
-						NscPCodeHeader *p1 = (NscPCodeHeader *) pauchCallData;
-						NscPCodeHeader *p2 = (NscPCodeHeader *) pauchFnData;
-						if (pauchCallData < pauchCallDataEnd)
+						if (nCondValue != 0)
 						{
-							papArgs [i] = p1;
-							pauchCallData += p1 ->nOpSize;
+							CodeData (&pauchData [pBlock ->anOffset [3]], 
+								pBlock ->anSize [3]);
 						}
 						else
-							papArgs [i] = p2;
-						pauchFnData += p2 ->nOpSize;
+						{
+							CodeData (&pauchData [pBlock ->anOffset [4]], 
+								pBlock ->anSize [4]);
+						}
 					}
 
 					//
-					// Add the arguments in reverse order
+					// If we don't have an else block
 					//
 
-					for (int i = nArgCount; i-- > 0;)
+					else if (pBlock ->anSize [4] == 0 && m_fOptIf)
 					{
+						int nEnd;
+						nEnd = ForwardLabel ();
+						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+						AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+						CodeJZ (nEnd);
+						m_pauchLineStart = m_pauchOut;
+						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
+						ForwardResolve (nEnd);
+					}
 
-						//
-						// Get the data for the argument
-						//
-						// NOTE: We will get a declaration on default 
-						// arguments.
-						//
+					//
+					// Otherwise, code everything
+					//
 
-						NscPCodeHeader *p = papArgs [i];
-						unsigned char *pauchArgData;
-						size_t nArgDataSize;
-						if (p ->nOpCode == NscPCode_Declaration)
-						{
-							NscPCodeDeclaration *pd = 
-								(NscPCodeDeclaration *) p;
-							pauchArgData = ((unsigned char *) p) + 
-								pd ->nDataOffset,
-							nArgDataSize = pd ->nDataSize;
-						}
-						else if (p ->nOpCode == NscPCode_Argument)
-						{
-							NscPCodeArgument *pArg = (NscPCodeArgument *) p;
-							pauchArgData = ((unsigned char *) p) + 
-								pArg ->nDataOffset,
-							nArgDataSize = pArg ->nDataSize;
-						}
-						else
+					else
+					{
+						int nEnd;
+						nEnd = ForwardLabel ();
+						int nElse;
+						nElse = ForwardLabel ();
+						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+						AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+						CodeJZ (nElse);
+						m_pauchLineStart = m_pauchOut;
+						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
+						CodeJMP (nEnd);
+						m_pauchLineStart = m_pauchOut;
+						ForwardResolve (nElse);
+						if (m_nVersion >= 130)
 						{
-							pauchArgData = NULL;
-							nArgDataSize = 0;
-							assert (false);
+							if (pBlock ->anSize [4] != 0 || pBlock ->anFile [4] >= 0)
+							{
+								m_pauchLineStart = m_pauchOut;
+								CodeNOP ();
+								AddLine (pBlock ->anFile [3], pBlock ->anLine [3]);
+								m_pauchLineStart = m_pauchOut;
+							}
 						}
+						CodeData (&pauchData [pBlock ->anOffset [4]], pBlock ->anSize [4]);
+						ForwardResolve (nEnd);
+					}
+				}
+				break;
+
+			//
+			// If this is a do
+			//
+
+			case NscPCode_Do:
+				{
+
+					//
+					// Get the pcode data
+					//
+
+					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+
+					//
+					// Create our labels
+					//
+
+					int nStart;
+					nStart = ForwardLabel ();
+					int nEnd;
+					nEnd = ForwardLabel ();
+					int nTest;
+					nTest = ForwardLabel ();
+
+					//
+					// Initialize our labels
+					//
 
-						//
-						// Code the data
-						//
+					int nBreakLabelSave = m_nBreakLabel;
+					int nContinueLabelSave = m_nContinueLabel;
+					int nBreakBlockDepthSave = m_nBreakBlockDepth;
+					int nContinueBlockDepthSave = m_nContinueBlockDepth;
+					m_nBreakLabel = nEnd;
+					m_nContinueLabel = nTest;
+					m_nBreakBlockDepth = m_nSPDepth;
+					m_nContinueBlockDepth = m_nSPDepth;
 
-						if (p ->nType == NscType_Action)
-						{
-							char szEnd [NscMaxLabelSize];
-							ForwardLabel (szEnd);
-							int nExpDepthSave = m_nExpDepth;
-							m_nSPDepth += nExpDepthSave;
-							m_nExpDepth = 0;
-							CodeSTORE_STATE ();
-							CodeJMP (szEnd);
-							CodeData (pauchArgData, nArgDataSize);
-							CodeUnaryOp (NscCode_RETN, NscType_Void);
-							ForwardResolve (szEnd);
-							m_nSPDepth -= nExpDepthSave;
-							m_nExpDepth += nExpDepthSave;
-						}
-						else
-						{
-							CodeData (pauchArgData, nArgDataSize);
-						}
-					}
+					//
+					// Code the body
+					//
+
+					ForwardResolve (nStart);
+					CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
 
 					//
-					// Generate the call, action, or intrinsic
+					// Code the test
 					//
 
-					if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) != 0)
-					{
-						CodeACTION (pCall ->nType, pExtra ->nAction,
-							nArgCount, nArgSize);
-					}
-					else if ((pSymbol ->ulFlags & NscSymFlag_Intrinsic) != 0)
+					m_pauchLineStart = m_pauchOut;
+					int nCondValue = GetConstantCondition (
+						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+					if (nCondValue != -1)
 					{
-						CodeInvokeIntrinsic (pExtra ->nIntrinsic, nArgCount,
-							nArgSize);
+						m_pauchLineStart = m_pauchOut;
+						ForwardResolve (nTest);
+						if (nCondValue != 0)
+							CodeJMP (nStart);
 					}
 					else
 					{
-						if ((pExtra ->ulFunctionFlags & NscFuncFlag_UsesGlobalVars) != 0 &&
-							(m_fGlobalScope))
+						ForwardResolve (nTest);
+						CodeData (&pauchData [pBlock ->anOffset [1]], 
+							pBlock ->anSize [1]);
+						if (m_fOptDo)
 						{
-							m_pCtx ->GenerateMessage (
-								NscMessage_WarningBPFuncCalledBeforeBPSet,
-								pSymbol ->szString);
+							CodeJNZ (nStart);
+						}
+						else
+						{
+							CodeJZ (nEnd);
+							CodeJMP (nStart);
 						}
-
-						CodeJSR (pSymbol ->szString, nArgCount, nArgSize);
 					}
-				}
-				break;
+					AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+					ForwardResolve (nEnd);
 
-			//
-			// Element access
-			//
+					//
+					// Restore labels
+					//
 
-			case NscPCode_Element:
-				{
-					NscPCodeElement *pElement = (NscPCodeElement *) pHeader;
-					CodeData (&pauchData [pElement ->nDataOffset],
-						pElement ->nDataSize);
-					int nTotalSize = m_pCtx ->GetTypeSize (pElement ->nLhsType);
-					int nTypeSize = m_pCtx ->GetTypeSize (pElement ->nType);
-					CodeDESTRUCT (nTotalSize, pElement ->nElement, nTypeSize);
+					m_nBreakLabel = nBreakLabelSave;
+					m_nContinueLabel = nContinueLabelSave;
+					m_nBreakBlockDepth = nBreakBlockDepthSave;
+					m_nContinueBlockDepth = nContinueBlockDepthSave;
 				}
 				break;
 
 			//
-			// If this is a break
+			// If this is a while
 			//
 
-			case NscPCode_Break:
-				if (m_fNoBugBreakContinue)
+			case NscPCode_While:
 				{
-					if (m_nBreakBlockDepth < m_nSPDepth)
-						CodeMOVSP (m_nSPDepth - m_nBreakBlockDepth, NULL);
-				}
-				CodeJMP (m_pszBreakLabel);
-				break;
 
-			//
-			// If this is a continue
-			//
+					//
+					// Get the pcode data
+					//
 
-			case NscPCode_Continue:
-				if (m_fNoBugBreakContinue)
-				{
-					if (m_nContinueBlockDepth < m_nSPDepth)
-						CodeMOVSP (m_nSPDepth - m_nContinueBlockDepth, NULL);
-				}
-				CodeJMP (m_pszContinueLabel);
-				break;
+					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
 
-			//
-			// If this is a return
-			//
+					//
+					// See if we have a constant conditional
+					//
 
-			case NscPCode_Return:
-				{
-					NscPCodeReturn *pReturn = (NscPCodeReturn *) pHeader;
-					if (pReturn ->nDataSize != 0)
+					int nCondValue = GetConstantCondition (
+						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+
+					//
+					// If we should include the code
+					//
+
+					if (nCondValue != 0)
 					{
-						CodeData (&((unsigned char *) pReturn) 
-							[pReturn ->nDataOffset], pReturn ->nDataSize);
-						CodeCP (NscCode_CPDOWNSP, m_nReturnSize + 
-							m_nSPDepth + m_nExpDepth, m_nReturnSize);
-					}
-					CodeMOVSP (m_nSPDepth + m_nExpDepth - m_nArgumentSize, NULL);
-					if (m_fOptReturn)
-						m_nExpDepth -= m_nReturnSize;
-					CodeJMP (m_pszReturnLabel);
-				}
-				break;
 
-			//
-			// If this is a case or default
-			//
+						//
+						// Create our labels
+						//
 
-			case NscPCode_Case:
-			case NscPCode_Default:
-				{
-					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
-					m_pauchLineStart = m_pauchOut;
-					AddLine (pCase ->nFile, pCase ->nLine);
-					if (pCase ->szLabel [0])
-						ForwardResolve (pCase ->szLabel);
+						int nTest;
+						nTest = ForwardLabel ();
+						int nEnd;
+						nEnd = ForwardLabel ();
+						int nContinue;
+						nContinue = ForwardLabel ();
+
+						//
+						// Plan the loop invariant pure calls.  These are 
+						// computed once a first test has passed, which then
+						// enters the body directly.
+						//
+
+						size_t nPureValues = 0;
+						if (m_fOptPure && !m_fGlobalScope && nCondValue == -1)
+							nPureValues = HoistPureCalls (pauchData, pBlock);
+						int nBody = 0;
+						int nExit = 0;
+						if (nPureValues != 0)
+						{
+							nBody = ForwardLabel ();
+							nExit = ForwardLabel ();
+							m_pauchLineStart = m_pauchOut;
+							CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+							CodeJZ (nExit);
+							AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+							for (size_t i = m_asPureValues .size () - nPureValues; 
+								i < m_asPureValues .size (); i++)
+								ComputePureValue (i);
+							CodeJMP (nBody);
+						}
+
+						//
+						// Initialize our labels
+						//
+
+						int nBreakLabelSave = m_nBreakLabel;
+						int nContinueLabelSave = m_nContinueLabel;
+						int nBreakBlockDepthSave = m_nBreakBlockDepth;
+						int nContinueBlockDepthSave = m_nContinueBlockDepth;
+						m_nBreakLabel = nEnd;
+						m_nContinueLabel = nContinue;
+						m_nBreakBlockDepth = m_nSPDepth;
+						m_nContinueBlockDepth = m_nSPDepth;
+
+						//
+						// Generate the code
+						//
+
+						ForwardResolve (nTest);
+						if (m_fOptWhile)
+							ForwardResolve (nContinue);
+						if (nCondValue == -1)
+						{
+							m_pauchLineStart = m_pauchOut;
+							CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+							CodeJZ (nEnd);
+							AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
+						}
+						if (nPureValues != 0)
+							ForwardResolve (nBody);
+						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
+						if (!m_fOptWhile)
+							ForwardResolve (nContinue);
+						CodeJMP (nTest);
+						ForwardResolve (nEnd);
+						if (nPureValues != 0)
+						{
+							CodeMOVSP (ReleasePureValues (nPureValues), &m_nSPDepth);
+							ForwardResolve (nExit);
+						}
+						m_pauchLineStart = m_pauchOut;
+
+						//
+						// Restore labels
+						//
+
+						m_nBreakLabel = nBreakLabelSave;
+						m_nContinueLabel = nContinueLabelSave;
+						m_nBreakBlockDepth = nBreakBlockDepthSave;
+						m_nContinueBlockDepth = nContinueBlockDepthSave;
+					}
 				}
 				break;
 
 			//
-			// If this is a switch
+			// If this is a for
 			//
 
-			case NscPCode_Switch:
+			case NscPCode_For:
 				{
 
 					//
@@ -3133,993 +5383,1587 @@ bool CNscCodeGenerator::CodeData (unsigned char *pauchData, size_t nDataSize)
 					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
 
 					//
-					// Generate the labels
+					// See if we have a constant conditional
 					//
 
-					char szEnd [NscMaxLabelSize];
-					ForwardLabel (szEnd);
+					int nCondValue = GetConstantCondition (
+						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
 
 					//
-					// Initialize our labels
+					// Create our labels
 					//
 
-					char *pszBreakLabelSave = m_pszBreakLabel;
-					int nBreakBlockDepthSave = m_nBreakBlockDepth;
-					m_pszBreakLabel = szEnd;
-					m_nBreakBlockDepth = m_nSPDepth + 1; // +1 to account for switch expression
-					m_pszDefaultLabel = NULL;
-					m_pauchLineStart = m_pauchOut;
+					int nTest;
+					nTest = ForwardLabel ();
+					int nEnd;
+					nEnd = ForwardLabel ();
+					int nIncrement;
+					nIncrement = ForwardLabel ();
 
 					//
-					// Generate the conditional code
+					// Initialize our labels
 					//
-					
-					CodeData (&((unsigned char *) pBlock) 
-						[pBlock ->anOffset [1]], pBlock ->anSize [1]);
+
+					int nBreakLabelSave = m_nBreakLabel;
+					int nContinueLabelSave = m_nContinueLabel;
+					int nBreakBlockDepthSave = m_nBreakBlockDepth;
+					int nContinueBlockDepthSave = m_nContinueBlockDepth;
+					m_nBreakLabel = nEnd;
+					m_nContinueLabel = nIncrement;
+					m_nBreakBlockDepth = m_nSPDepth;
+					m_nContinueBlockDepth = m_nSPDepth;
 
 					//
-					// Scan for cases
+					// Code the initializer (always exists)
 					//
 
-					CodeScanCase (&((unsigned char *) pBlock) 
-						[pBlock ->anOffset [3]], pBlock ->anSize [3]);
+					assert (m_nExpDepth == 0);
+					m_pauchLineStart = m_pauchOut;
+					CodeData (&pauchData [pBlock ->anOffset [0]], pBlock ->anSize [0]);
+					if (m_nExpDepth != 0)
+						CodeMOVSP (m_nExpDepth, &m_nExpDepth);
+					AddLine (pBlock ->anFile [0], pBlock ->anLine [0]);
 
 					//
-					// Generate the end of the switch selection
+					// Plan the loop invariant pure calls.  These are computed
+					// once a first test has passed, which then enters the 
+					// body directly.
 					//
 
-					CodeJMP (m_pszDefaultLabel ? m_pszDefaultLabel : szEnd);
+					size_t nPureValues = 0;
+					if (m_fOptPure && !m_fGlobalScope && nCondValue == -1)
+						nPureValues = HoistPureCalls (pauchData, pBlock);
+					int nBody = 0;
+					int nExit = 0;
+					if (nPureValues != 0)
+					{
+						nBody = ForwardLabel ();
+						nExit = ForwardLabel ();
+						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+						CodeJZ (nExit);
+						for (size_t i = m_asPureValues .size () - nPureValues; 
+							i < m_asPureValues .size (); i++)
+							ComputePureValue (i);
+						CodeJMP (nBody);
+						m_nBreakBlockDepth = m_nSPDepth;
+						m_nContinueBlockDepth = m_nSPDepth;
+					}
 
 					//
-					// Add the line
+					// Code the conditional only if it wasn't constant
 					//
 
-					AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
-					m_pauchLineStart = m_pauchOut;
+					ForwardResolve (nTest);
+					if (nCondValue == -1)
+					{
+						if (pBlock ->anSize [1] == 0)
+						{
+							if (!m_fOptFor)
+							{
+								INT32 l = 1;
+								CodeCONST (NscType_Integer, &l);
+								CodeJZ (nEnd);
+							}
+						}
+						else
+						{
+							CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+							CodeJZ (nEnd);
+						}
+					}
 
 					//
-					// Adjust the stack to keep later asserts happy.
-					// This code treats the conditional as just another normal
-					// stack variable.
+					// Code the body unless conditional was 0
 					//
 
-					m_nSPDepth++;
-					m_nExpDepth--;
+					if (nCondValue != 0)
+					{
+						if (nPureValues != 0)
+							ForwardResolve (nBody);
+						m_pauchLineStart = m_pauchOut;
+						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
+					}
 
 					//
-					// Generate the actual code
+					// Code the increment unless conditional was 0
 					//
 
-					CodeData (&((unsigned char *) pBlock) 
-						[pBlock ->anOffset [3]], pBlock ->anSize [3]);
+					ForwardResolve (nIncrement);
+					if (nCondValue != 0)
+					{
+						assert (m_nExpDepth == 0);
+						m_pauchLineStart = m_pauchOut;
+						CodeData (&pauchData [pBlock ->anOffset [2]], pBlock ->anSize [2]);
+						if (m_nExpDepth != 0)
+							CodeMOVSP (m_nExpDepth, &m_nExpDepth);
+						AddLine (pBlock ->anFile [0], pBlock ->anLine [0]);
+						CodeJMP (nTest);
+					}
 
 					//
-					// Finish
+					// Mark the end
 					//
 
-					ForwardResolve (szEnd);
-					CodeMOVSP (1, &m_nSPDepth);
+					ForwardResolve (nEnd);
+					if (nPureValues != 0)
+					{
+						CodeMOVSP (ReleasePureValues (nPureValues), &m_nSPDepth);
+						ForwardResolve (nExit);
+					}
 
 					//
 					// Restore labels
 					//
 
-					m_pszBreakLabel = pszBreakLabelSave;
-					m_nBreakBlockDepth = nBreakBlockDepthSave;
 					m_pauchLineStart = m_pauchOut;
+					m_nBreakLabel = nBreakLabelSave;
+					m_nContinueLabel = nContinueLabelSave;
+					m_nBreakBlockDepth = nBreakBlockDepthSave;
+					m_nContinueBlockDepth = nContinueBlockDepthSave;
 				}
 				break;
 
 			//
-			// If this is a if
+			// If this is a conditional
 			//
 
-			case NscPCode_If:
+			case NscPCode_Conditional:
 				{
+
+					//
+					// Get the pcode data
+					//
+
 					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
 
 					//
-					// If the conditional can be optimized, then only 
-					// code the conditional that is valid
+					// See if we have a constant conditional
 					//
 
-					if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
-						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]))
+					int nCondValue = GetConstantCondition (
+						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
+					if (nCondValue != -1)
 					{
-						NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
-							&pauchData [pBlock ->anOffset [1]];
-						if (pCI ->lValue != 0)
+						if (nCondValue != 0)
 						{
-							CodeData (&pauchData [pBlock ->anOffset [3]], 
-								pBlock ->anSize [3]);
+							CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
 						}
 						else
 						{
-							CodeData (&pauchData [pBlock ->anOffset [4]], 
-								pBlock ->anSize [4]);
+							CodeData (&pauchData [pBlock ->anOffset [4]], pBlock ->anSize [4]);
 						}
 					}
 
 					//
-					// If we don't have an else block
+					// Otherwise, treat as normal
 					//
 
-					else if (pBlock ->anSize [4] == 0 && m_fOptIf)
+					else
 					{
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
-						AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
-						CodeJZ (szEnd);
-						m_pauchLineStart = m_pauchOut;
-						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-						ForwardResolve (szEnd);
-					}
 
-					//
-					// Otherwise, code everything
-					//
+						//
+						// Create our labels
+						//
+
+						int nEnd;
+						nEnd = ForwardLabel ();
+						int nElse;
+						nElse = ForwardLabel ();
+
+						//
+						// Generate the code
+						//
 
-					else
-					{
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						char szElse [NscMaxLabelSize];
-						ForwardLabel (szElse);
 						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
-						AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
-						CodeJZ (szElse);
-						m_pauchLineStart = m_pauchOut;
+						CodeJZ (nElse);
 						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-						CodeJMP (szEnd);
-						m_pauchLineStart = m_pauchOut;
-						ForwardResolve (szElse);
-						if (m_nVersion >= 130)
-						{
-							if (pBlock ->anSize [4] != 0 || pBlock ->anFile [4] >= 0)
-							{
-								m_pauchLineStart = m_pauchOut;
-								CodeNOP ();
-								AddLine (pBlock ->anFile [3], pBlock ->anLine [3]);
-								m_pauchLineStart = m_pauchOut;
-							}
-						}
+						m_nExpDepth -= m_pCtx ->GetTypeSize (pBlock ->nType);
+						CodeJMP (nEnd);
+						ForwardResolve (nElse);
 						CodeData (&pauchData [pBlock ->anOffset [4]], pBlock ->anSize [4]);
-						ForwardResolve (szEnd);
+						ForwardResolve (nEnd);
 					}
 				}
 				break;
 
-			//
-			// If this is a do
+			// 
+			// Assignment operators
 			//
 
-			case NscPCode_Do:
-				{
+			case NscPCode_AsnMultiply:
+				nOp = NscCode_MUL;
+				goto do_assignment;
+			case NscPCode_AsnDivide:
+				nOp = NscCode_DIV;
+				goto do_assignment;
+			case NscPCode_AsnModulus:
+				nOp = NscCode_MOD;
+				goto do_assignment;
+			case NscPCode_AsnAdd:
+				nOp = NscCode_ADD;
+				goto do_assignment;
+			case NscPCode_AsnSubtract:
+				nOp = NscCode_SUB;
+				goto do_assignment;
+			case NscPCode_AsnShiftLeft:
+				nOp = NscCode_SHLEFT;
+				goto do_assignment;
+			case NscPCode_AsnShiftRight:
+				nOp = NscCode_SHRIGHT;
+				goto do_assignment;
+			case NscPCode_AsnUnsignedShiftRight:
+				nOp = NscCode_USHRIGHT;
+				goto do_assignment;
+			case NscPCode_AsnBitwiseAND:
+				nOp = NscCode_BOOLAND;
+				goto do_assignment;
+			case NscPCode_AsnBitwiseXOR:
+				nOp = NscCode_EXCOR;
+				goto do_assignment;
+			case NscPCode_AsnBitwiseOR:
+				nOp = NscCode_INCOR;
+				goto do_assignment;
+			case NscPCode_Assignment:
+				nOp = (NscCode) 0;
+do_assignment:;
+			    {
+					NscPCodeAssignment *pAsn = (NscPCodeAssignment *) pHeader;
+					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pAsn ->nSymbol);
+					if (nOp != 0)
+					{
+						CodeCP (true, pSymbol, pAsn ->nType, pAsn ->nSourceType,
+							pAsn ->ulFlags, pAsn ->nElement, pAsn ->nStackOffset);
+						CodeData (&pauchData [pAsn ->nDataOffset],
+							pAsn ->nDataSize);
+						CodeBinaryOp (nOp, false, pAsn ->nType, pAsn ->nType, pAsn ->nRhsType);
+					}
+					else
+					{
+						CodeData (&pauchData [pAsn ->nDataOffset],
+							pAsn ->nDataSize);
+					}
+					CodeCP (false, pSymbol, pAsn ->nType, pAsn ->nType, 
+						pAsn ->ulFlags, pAsn ->nElement, pAsn ->nStackOffset);
+					//CodeMOVSP (1, &m_nExpDepth);
+			    }
+				break;
 
-					//
-					// Get the pcode data
-					//
+			case NscPCode_Negate:
+				CodeUnaryOp (NscCode_NEG, pHeader ->nType);
+				break;
 
-					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+			case NscPCode_BitwiseNot:
+				CodeUnaryOp (NscCode_COMP, pHeader ->nType);
+				break;
 
-					//
-					// Create our labels
-					//
+			case NscPCode_LogicalNot:
+				CodeUnaryOp (NscCode_NOT, pHeader ->nType);
+				break;
 
-					char szStart [NscMaxLabelSize];
-					ForwardLabel (szStart);
-					char szEnd [NscMaxLabelSize];
-					ForwardLabel (szEnd);
-					char szTest [NscMaxLabelSize];
-					ForwardLabel (szTest);
+			case NscPCode_Multiply:
+				nOp = NscCode_MUL;
+				goto do_binaryop;
 
-					//
-					// Initialize our labels
-					//
+			case NscPCode_Divide:
+				nOp = NscCode_DIV;
+				goto do_binaryop;
 
-					char *pszBreakLabelSave = m_pszBreakLabel;
-					char *pszContinueLabelSave = m_pszContinueLabel;
-					int nBreakBlockDepthSave = m_nBreakBlockDepth;
-					int nContinueBlockDepthSave = m_nContinueBlockDepth;
-					m_pszBreakLabel = szEnd;
-					m_pszContinueLabel = szTest;
-					m_nBreakBlockDepth = m_nSPDepth;
-					m_nContinueBlockDepth = m_nSPDepth;
+			case NscPCode_Modulus:
+				nOp = NscCode_MOD;
+				goto do_binaryop;
 
-					//
-					// Code the body
-					//
+			case NscPCode_Add:
+				nOp = NscCode_ADD;
+				goto do_binaryop;
 
-					ForwardResolve (szStart);
-					CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
+			case NscPCode_Subtract:
+				nOp = NscCode_SUB;
+				goto do_binaryop;
 
-					//
-					// Code the test
-					//
+			case NscPCode_ShiftLeft:
+				nOp = NscCode_SHLEFT;
+				goto do_binaryop;
 
-					m_pauchLineStart = m_pauchOut;
-					if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
-						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]))
+			case NscPCode_ShiftRight:
+				nOp = NscCode_SHRIGHT;
+				goto do_binaryop;
+
+			case NscPCode_UnsignedShiftRight:
+				nOp = NscCode_USHRIGHT;
+				goto do_binaryop;
+
+			case NscPCode_LessThan:
+				nOp = NscCode_LT;
+				goto do_binaryop;
+
+			case NscPCode_GreaterThan:
+				nOp = NscCode_GT;
+				goto do_binaryop;
+
+			case NscPCode_LessThanEq:
+				nOp = NscCode_LEQ;
+				goto do_binaryop;
+
+			case NscPCode_GreaterThanEq:
+				nOp = NscCode_GEQ;
+				goto do_binaryop;
+
+			case NscPCode_Equal:
+				{
+					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
+					CodeBinaryOp (NscCode_EQUAL, true, pBinOp ->nType, 
+						pBinOp ->nLhsType, pBinOp ->nRhsType);
+				}
+				break;
+
+			case NscPCode_NotEqual:
+				{
+					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
+					CodeBinaryOp (NscCode_NEQUAL, true, pBinOp ->nType, 
+						pBinOp ->nLhsType, pBinOp ->nRhsType);
+				}
+				break;
+
+			case NscPCode_BitwiseAND:
+				nOp = NscCode_BOOLAND;
+				goto do_binaryop;
+
+			case NscPCode_BitwiseXOR:
+				nOp = NscCode_EXCOR;
+				goto do_binaryop;
+
+			case NscPCode_BitwiseOR:
+				nOp = NscCode_INCOR;
+do_binaryop:;
+				{
+					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
+					CodeBinaryOp (nOp, false, pBinOp ->nType, 
+						pBinOp ->nLhsType, pBinOp ->nRhsType);
+				}
+				break;
+
+			case NscPCode_LogicalAND:
+				{
+					NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
+					int nEnd;
+					nEnd = ForwardLabel ();
+					CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
+					CodeCP (NscCode_CPTOPSP, 1, 1);
+					CodeJZ (nEnd);
+					CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
+					CodeBinaryOp (NscCode_LOGAND, false, NscType_Integer,
+						NscType_Integer, NscType_Integer);
+					ForwardResolve (nEnd);
+				}
+				break;
+
+			case NscPCode_LogicalOR:
+				{
+					NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
+					if (m_fNoBugLogicalOR)
 					{
-						m_pauchLineStart = m_pauchOut;
-						NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
-							&pauchData [pBlock ->anOffset [1]];
-						if (pCI ->lValue != 0)
-							CodeJMP (szStart);
+						int nEnd;
+						nEnd = ForwardLabel ();
+						CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
+						CodeCP (NscCode_CPTOPSP, 1, 1);
+						CodeJNZ (nEnd);
+						CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
+						CodeBinaryOp (NscCode_LOGOR, false, NscType_Integer,
+							NscType_Integer, NscType_Integer);
+						ForwardResolve (nEnd);
 					}
 					else
 					{
-						ForwardResolve (szTest);
-						CodeData (&pauchData [pBlock ->anOffset [1]], 
-							pBlock ->anSize [1]);
-						if (m_fOptDo)
+						int nEnd;
+						nEnd = ForwardLabel ();
+						int nRhs;
+						nRhs = ForwardLabel ();
+						CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
+						CodeCP (NscCode_CPTOPSP, 1, 1);
+						CodeJZ (nRhs);
+						CodeCP (NscCode_CPTOPSP, 1, 1);
+						if (m_nVersion >= 130)
 						{
-							CodeJNZ (szStart);
+							CodeJMP (nEnd);
+							m_nExpDepth -= 1; // adjustment required
 						}
 						else
 						{
-							CodeJZ (szEnd);
-							CodeJMP (szStart);
+							CodeJZ (nEnd);//BIOWARE BUG!!! BEEN REPORTED (Been corrected with 1.30)
 						}
+						ForwardResolve (nRhs);
+						CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
+						ForwardResolve (nEnd);
+						CodeBinaryOp (NscCode_LOGOR, false, NscType_Integer,
+							NscType_Integer, NscType_Integer);
 					}
-					AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
-					ForwardResolve (szEnd);
+				}
+				break;
 
-					//
-					// Restore labels
-					//
+			case NscPCode_Constant:
+				if (m_fOptConstants && CodeFoldedConstant (pauchData, 
+					pauchEnd, &nOpSize))
+					break;
+				switch (pHeader ->nType)
+				{
+					case NscType_Integer:
+						{
+							NscPCodeConstantInteger *p = (NscPCodeConstantInteger *) pHeader;
+							CodeCONST (p ->nType, &p ->lValue);
+						}
+						break;
+					case NscType_Float:
+						{
+							NscPCodeConstantFloat *p = (NscPCodeConstantFloat *) pHeader;
+							CodeCONST (p ->nType, &p ->fValue);
+						}
+						break;
+					case NscType_String:
+						{
+							NscPCodeConstantString *p = (NscPCodeConstantString *) pHeader;
+							CodeCONST (p ->nType, &p ->nLength, p ->szString);
+						}
+						break;
+					case NscType_Object:
+						{
+							NscPCodeConstantObject *p = (NscPCodeConstantObject *) pHeader;
+							CodeCONST (p ->nType, &p ->ulid);
+						}
+						break;
+					case NscType_Vector:
+						{
+							NscPCodeConstantVector *p = (NscPCodeConstantVector *) pHeader;
+							CodeCONST (NscType_Float, &p ->v [0]);
+							CodeCONST (NscType_Float, &p ->v [1]);
+							CodeCONST (NscType_Float, &p ->v [2]);
+						}
+						break;
+					case NscType_Engine_2:
+						{
+							NscPCodeConstantLocation *p = (NscPCodeConstantLocation *) pHeader;
+							CodeCONST (p ->nType, &p ->lValue);
+						}
+						break;
+					case NscType_Engine_7:
+						{
+							NscPCodeConstantJson *p = (NscPCodeConstantJson *) pHeader;
+							CodeCONST (p ->nType, &p ->nLength, p ->szString);
+						}
+						break;
+					default:
+						{
+							NscPCodeConstantStructure *p = (NscPCodeConstantStructure *) pHeader;
 
-					m_pszBreakLabel = pszBreakLabelSave;
-					m_pszContinueLabel = pszContinueLabelSave;
-					m_nBreakBlockDepth = nBreakBlockDepthSave;
-					m_nContinueBlockDepth = nContinueBlockDepthSave;
+							assert (m_pCtx ->IsStructure (p ->nType));
+							CodeCONST (p ->nType, NULL);
+						}
 				}
 				break;
 
 			//
-			// If this is a while
+			// If this is an expression end
 			//
 
-			case NscPCode_While:
+			case NscPCode_ExpressionEnd:
 				{
-
-					//
-					// Get the pcode data
-					//
-
-					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
-
-					//
-					// See if we have a constant conditional
-					//
-
-					int nCondValue = -1;
-					if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
-						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]))
-					{
-						NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
-							&pauchData [pBlock ->anOffset [1]];
-						nCondValue = pCI ->lValue != 0;
-					}
-
-					//
-					// If we should include the code
-					//
-
-					if (nCondValue != 0)
+					if (pHeader ->nType != NscType_Unknown)
 					{
-
-						//
-						// Create our labels
-						//
-
-						char szTest [NscMaxLabelSize];
-						ForwardLabel (szTest);
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						char szContinue [NscMaxLabelSize];
-						ForwardLabel (szContinue);
-
-						//
-						// Initialize our labels
-						//
-
-						char *pszBreakLabelSave = m_pszBreakLabel;
-						char *pszContinueLabelSave = m_pszContinueLabel;
-						int nBreakBlockDepthSave = m_nBreakBlockDepth;
-						int nContinueBlockDepthSave = m_nContinueBlockDepth;
-						m_pszBreakLabel = szEnd;
-						m_pszContinueLabel = szContinue;
-						m_nBreakBlockDepth = m_nSPDepth;
-						m_nContinueBlockDepth = m_nSPDepth;
-
-						//
-						// Generate the code
-						//
-
-						ForwardResolve (szTest);
-						if (m_fOptWhile)
-							ForwardResolve (szContinue);
-						if (nCondValue == -1)
-						{
-							m_pauchLineStart = m_pauchOut;
-							CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
-							CodeJZ (szEnd);
-							AddLine (pBlock ->anFile [1], pBlock ->anLine [1]);
-						}
-						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-						if (!m_fOptWhile)
-							ForwardResolve (szContinue);
-						CodeJMP (szTest);
-						ForwardResolve (szEnd);
-						m_pauchLineStart = m_pauchOut;
-
-						//
-						// Restore labels
-						//
-
-						m_pszBreakLabel = pszBreakLabelSave;
-						m_pszContinueLabel = pszContinueLabelSave;
-						m_nBreakBlockDepth = nBreakBlockDepthSave;
-						m_nContinueBlockDepth = nContinueBlockDepthSave;
+						int nSize = m_pCtx ->GetTypeSize (pHeader ->nType);
+						CodeMOVSP (nSize, &m_nExpDepth);
 					}
+					assert (m_nExpDepth == 0);
 				}
 				break;
 
 			//
-			// If this is a for
+			// If this is a line
 			//
 
-			case NscPCode_For:
+			case NscPCode_Line:
 				{
+					NscPCodeLine *p = (NscPCodeLine *) pHeader;
+					AddLine (p ->nFile, p ->nLine);
+				}
+				break;
 
-					//
-					// Get the pcode data
-					//
-
-					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
-
-					//
-					// See if we have a constant conditional
-					//
-
-					int nCondValue = -1;
-					if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
-						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]))
-					{
-						NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
-							&pauchData [pBlock ->anOffset [1]];
-						nCondValue = pCI ->lValue != 0;
-					}
+			//
+			// Default
+			//
 
-					//
-					// Create our labels
-					//
+			default:
+				assert (false);
+				break;
+		}
 
-					char szTest [NscMaxLabelSize];
-					ForwardLabel (szTest);
-					char szEnd [NscMaxLabelSize];
-					ForwardLabel (szEnd);
-					char szIncrement [NscMaxLabelSize];
-					ForwardLabel (szIncrement);
+		//
+		// Pure values can't be used past their last statement
+		//
 
-					//
-					// Initialize our labels
-					//
+		for (size_t i = 0; i < m_asPureValues .size (); i++)
+		{
+			if (m_asPureValues [i] .pauchLast == pauchData)
+				m_asPureValues [i] .fActive = false;
+		}
 
-					char *pszBreakLabelSave = m_pszBreakLabel;
-					char *pszContinueLabelSave = m_pszContinueLabel;
-					int nBreakBlockDepthSave = m_nBreakBlockDepth;
-					int nContinueBlockDepthSave = m_nContinueBlockDepth;
-					m_pszBreakLabel = szEnd;
-					m_pszContinueLabel = szIncrement;
-					m_nBreakBlockDepth = m_nSPDepth;
-					m_nContinueBlockDepth = m_nSPDepth;
+		//
+		// Move onto the next operator
+		//
 
-					//
-					// Code the initializer (always exists)
-					//
+		pauchData += nOpSize;
+	}
+	return true;
+}
 
-					assert (m_nExpDepth == 0);
-					m_pauchLineStart = m_pauchOut;
-					CodeData (&pauchData [pBlock ->anOffset [0]], pBlock ->anSize [0]);
-					if (m_nExpDepth != 0)
-						CodeMOVSP (m_nExpDepth, &m_nExpDepth);
-					AddLine (pBlock ->anFile [0], pBlock ->anLine [0]);
+//-----------------------------------------------------------------------------
+//
+// @mfunc Scan for case and default labels
+//
+// @parm unsigned char * | pauchData | Pointer to code
+//
+// @parm size_t | nDataSize | Size of code
+//
+// @rdesc TRUE if output was generated.
+//
+//-----------------------------------------------------------------------------
 
-					//
-					// Code the conditional only if it wasn't constant
-					//
+bool CNscCodeGenerator::CodeScanCase (unsigned char *pauchData, size_t nDataSize)
+{
 
-					ForwardResolve (szTest);
-					if (nCondValue == -1)
-					{
-						if (pBlock ->anSize [1] == 0)
-						{
-							if (!m_fOptFor)
-							{
-								INT32 l = 1;
-								CodeCONST (NscType_Integer, &l);
-								CodeJZ (szEnd);
-							}
-						}
-						else
-						{
-							CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
-							CodeJZ (szEnd);
-						}
-					}
+	//
+	// Loop through the data
+	//
 
-					//
-					// Code the body unless conditional was 0
-					//
+	unsigned char *pauchEnd = &pauchData [nDataSize];
+	while (pauchData < pauchEnd)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
+		if (m_pauchOut >= m_pauchCodeEnd)
+			ExpandOutputBuffer ();
 
-					if (nCondValue != 0)
-					{
-						m_pauchLineStart = m_pauchOut;
-						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-					}
+		//
+		// Labels need the stack depth of the code that jumps to them, so
+		// the free slots must be gone first
+		//
 
-					//
-					// Code the increment unless conditional was 0
-					//
+		if (!m_anFreeSlots .empty () && (pHeader ->nOpCode == NscPCode_Case ||
+			pHeader ->nOpCode == NscPCode_Default || 
+			(pHeader ->nOpCode >= NscPCode__First_5Block &&
+			pHeader ->nOpCode <= NscPCode__Last_5Block &&
+			pHeader ->nOpCode != NscPCode_Conditional)))
+			FlushFreeSlots ();
 
-					ForwardResolve (szIncrement);
-					if (nCondValue != 0)
-					{
-						assert (m_nExpDepth == 0);
-						m_pauchLineStart = m_pauchOut;
-						CodeData (&pauchData [pBlock ->anOffset [2]], pBlock ->anSize [2]);
-						if (m_nExpDepth != 0)
-							CodeMOVSP (m_nExpDepth, &m_nExpDepth);
-						AddLine (pBlock ->anFile [0], pBlock ->anLine [0]);
-						CodeJMP (szTest);
-					}
+		//
+		// Switch based on the opcode
+		//
 
-					//
-					// Mark the end
-					//
+		switch (pHeader ->nOpCode)
+		{
 
-					ForwardResolve (szEnd);
+			//
+			// If this is a statement
+			//
 
-					//
-					// Restore labels
-					//
+			case NscPCode_Statement:
+				{
+					NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
+					CodeScanCase (&pauchData [pCode ->nDataOffset],
+						pCode ->nDataSize);
+				}
+				break;
 
-					m_pauchLineStart = m_pauchOut;
-					m_pszBreakLabel = pszBreakLabelSave;
-					m_pszContinueLabel = pszContinueLabelSave;
-					m_nBreakBlockDepth = nBreakBlockDepthSave;
-					m_nContinueBlockDepth = nContinueBlockDepthSave;
+			//
+			// If this is a case
+			//
+
+			case NscPCode_Case:
+				{
+					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+					pCase ->nLabel = ForwardLabel ();
+					CodeCP (NscCode_CPTOPSP, 1, 1);
+					CodeData (&pauchData [pCase ->nCaseOffset], pCase ->nCaseSize);
+					CodeBinaryOp (NscCode_EQUAL, false, NscType_Integer, 
+						NscType_Integer, NscType_Integer);
+					CodeJNZ (pCase ->nLabel);
 				}
 				break;
 
 			//
-			// If this is a conditional
+			// If this is a default
 			//
 
-			case NscPCode_Conditional:
+			case NscPCode_Default:
 				{
+					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+					pCase ->nLabel = ForwardLabel ();
+					m_nDefaultLabel = pCase ->nLabel;
+				}
+				break;
+		}
 
-					//
-					// Get the pcode data
-					//
+		//
+		// Move onto the next operator
+		//
 
-					NscPCode5Block *pBlock = (NscPCode5Block *) pHeader;
+		pauchData += pHeader ->nOpSize;
+	}
+	return true;
+}
 
-					//
-					// See if we have a constant conditional
-					//
+//-----------------------------------------------------------------------------
+//
+// @mfunc Collect the case and default labels of a switch.  Labels are
+//		generated as in CodeScanCase, except that a case that immediately
+//		follows another case shares its label (its own label is cleared so
+//		that it is not resolved a second time).
+//
+// @parm unsigned char * | pauchData | Pointer to code
+//
+// @parm size_t | nDataSize | Size of code
+//
+// @parm std::vector <SwitchCase> & | asCases | Receives the cases
+//
+// @rdesc TRUE if output was generated.
+//
+//-----------------------------------------------------------------------------
 
-					if (m_fOptConditional && CNscPStackEntry::IsSimpleConstant (
-						&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]))
-					{
-						NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
-							&pauchData [pBlock ->anOffset [1]];
-						if (pCI ->lValue != 0)
-						{
-							CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-						}
-						else
-						{
-							CodeData (&pauchData [pBlock ->anOffset [4]], pBlock ->anSize [4]);
-						}
-					}
+bool CNscCodeGenerator::CodeCollectCases (unsigned char *pauchData, 
+	size_t nDataSize, std::vector <SwitchCase> &asCases)
+{
 
-					//
-					// Otherwise, treat as normal
-					//
+	//
+	// Loop through the data
+	//
 
-					else
-					{
+	int nPrevLabel = -1;
+	unsigned char *pauchEnd = &pauchData [nDataSize];
+	while (pauchData < pauchEnd)
+	{
+		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
 
-						//
-						// Create our labels
-						//
+		//
+		// Switch based on the opcode
+		//
 
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						char szElse [NscMaxLabelSize];
-						ForwardLabel (szElse);
+		switch (pHeader ->nOpCode)
+		{
 
-						//
-						// Generate the code
-						//
+			//
+			// If this is a statement
+			//
 
-						CodeData (&pauchData [pBlock ->anOffset [1]], pBlock ->anSize [1]);
-						CodeJZ (szElse);
-						CodeData (&pauchData [pBlock ->anOffset [3]], pBlock ->anSize [3]);
-						m_nExpDepth -= m_pCtx ->GetTypeSize (pBlock ->nType);
-						CodeJMP (szEnd);
-						ForwardResolve (szElse);
-						CodeData (&pauchData [pBlock ->anOffset [4]], pBlock ->anSize [4]);
-						ForwardResolve (szEnd);
-					}
+			case NscPCode_Statement:
+				{
+					NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
+					CodeCollectCases (&pauchData [pCode ->nDataOffset],
+						pCode ->nDataSize, asCases);
+					nPrevLabel = -1;
 				}
 				break;
 
-			// 
-			// Assignment operators
+			//
+			// If this is a case
 			//
 
-			case NscPCode_AsnMultiply:
-				nOp = NscCode_MUL;
-				goto do_assignment;
-			case NscPCode_AsnDivide:
-				nOp = NscCode_DIV;
-				goto do_assignment;
-			case NscPCode_AsnModulus:
-				nOp = NscCode_MOD;
-				goto do_assignment;
-			case NscPCode_AsnAdd:
-				nOp = NscCode_ADD;
-				goto do_assignment;
-			case NscPCode_AsnSubtract:
-				nOp = NscCode_SUB;
-				goto do_assignment;
-			case NscPCode_AsnShiftLeft:
-				nOp = NscCode_SHLEFT;
-				goto do_assignment;
-			case NscPCode_AsnShiftRight:
-				nOp = NscCode_SHRIGHT;
-				goto do_assignment;
-			case NscPCode_AsnUnsignedShiftRight:
-				nOp = NscCode_USHRIGHT;
-				goto do_assignment;
-			case NscPCode_AsnBitwiseAND:
-				nOp = NscCode_BOOLAND;
-				goto do_assignment;
-			case NscPCode_AsnBitwiseXOR:
-				nOp = NscCode_EXCOR;
-				goto do_assignment;
-			case NscPCode_AsnBitwiseOR:
-				nOp = NscCode_INCOR;
-				goto do_assignment;
-			case NscPCode_Assignment:
-				nOp = (NscCode) 0;
-do_assignment:;
-			    {
-					NscPCodeAssignment *pAsn = (NscPCodeAssignment *) pHeader;
-					NscSymbol *pSymbol = m_pCtx ->GetSymbol (pAsn ->nSymbol);
-					if (nOp != 0)
+			case NscPCode_Case:
+				{
+					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+					NscPCodeConstantInteger *pCI = (NscPCodeConstantInteger *)
+						&pauchData [pCase ->nCaseOffset];
+					assert (CNscPStackEntry::IsSimpleConstant (
+						&pauchData [pCase ->nCaseOffset], pCase ->nCaseSize));
+					assert (pCI ->nType == NscType_Integer);
+
+					SwitchCase sCase;
+					sCase .lLow = pCI ->lValue;
+					sCase .lHigh = pCI ->lValue;
+					if (nPrevLabel != -1)
 					{
-						CodeCP (true, pSymbol, pAsn ->nType, pAsn ->nSourceType,
-							pAsn ->ulFlags, pAsn ->nElement, pAsn ->nStackOffset);
-						CodeData (&pauchData [pAsn ->nDataOffset],
-							pAsn ->nDataSize);
-						CodeBinaryOp (nOp, false, pAsn ->nType, pAsn ->nType, pAsn ->nRhsType);
+						sCase .nLabel = nPrevLabel;
+						pCase ->nLabel = -1;
 					}
 					else
 					{
-						CodeData (&pauchData [pAsn ->nDataOffset],
-							pAsn ->nDataSize);
+						pCase ->nLabel = ForwardLabel ();
+						sCase .nLabel = pCase ->nLabel;
 					}
-					CodeCP (false, pSymbol, pAsn ->nType, pAsn ->nType, 
-						pAsn ->ulFlags, pAsn ->nElement, pAsn ->nStackOffset);
-					//CodeMOVSP (1, &m_nExpDepth);
-			    }
+					asCases .push_back (sCase);
+					nPrevLabel = sCase .nLabel;
+				}
 				break;
 
-			case NscPCode_Negate:
-				CodeUnaryOp (NscCode_NEG, pHeader ->nType);
-				break;
+			//
+			// If this is a default
+			//
 
-			case NscPCode_BitwiseNot:
-				CodeUnaryOp (NscCode_COMP, pHeader ->nType);
+			case NscPCode_Default:
+				{
+					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
+					pCase ->nLabel = ForwardLabel ();
+					m_nDefaultLabel = pCase ->nLabel;
+					nPrevLabel = -1;
+				}
 				break;
 
-			case NscPCode_LogicalNot:
-				CodeUnaryOp (NscCode_NOT, pHeader ->nType);
+			//
+			// Anything else separates the cases
+			//
+
+			default:
+				nPrevLabel = -1;
 				break;
+		}
 
-			case NscPCode_Multiply:
-				nOp = NscCode_MUL;
-				goto do_binaryop;
+		//
+		// Move onto the next operator
+		//
+
+		pauchData += pHeader ->nOpSize;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code the case selection of a switch as a balanced comparison tree.
+//		The cases are sorted and runs of consecutive values that share a
+//		label are merged into ranges, so a switch with N distinct targets
+//		needs about log2 (N) comparisons instead of up to N.
+//
+//		The switch value is on the top of the stack, as for CodeScanCase.
+//
+// @parm unsigned char * | pauchData | Pointer to the switch body
+//
+// @parm size_t | nDataSize | Size of the switch body
+//
+// @parm int | nEnd | Label of the end of the switch
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::CodeSwitchSelect (unsigned char *pauchData, 
+	size_t nDataSize, int nEnd)
+{
+
+	//
+	// Collect and sort the cases
+	//
+
+	std::vector <SwitchCase> asCases;
+	CodeCollectCases (pauchData, nDataSize, asCases);
+	std::sort (asCases .begin (), asCases .end ());
+
+	//
+	// Merge consecutive values with the same label into ranges
+	//
+
+	size_t nRanges = 0;
+	for (size_t i = 0; i < asCases .size (); i++)
+	{
+		if (nRanges > 0 &&
+			asCases [nRanges - 1] .nLabel == asCases [i] .nLabel &&
+			asCases [nRanges - 1] .lHigh != INT_MAX &&
+			asCases [nRanges - 1] .lHigh + 1 == asCases [i] .lLow)
+		{
+			asCases [nRanges - 1] .lHigh = asCases [i] .lHigh;
+		}
+		else
+			asCases [nRanges++] = asCases [i];
+	}
+
+	//
+	// Generate the tree
+	//
+
+	CodeSwitchTree (nRanges ? &asCases [0] : NULL, nRanges, INT_MIN, 
+		INT_MAX, m_nDefaultLabel != -1 ? m_nDefaultLabel : nEnd);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code a node of a switch comparison tree.  Every path through the
+//		generated code ends in a jump, either to a case label or to the
+//		default label.
+//
+// @parm const SwitchCase * | pasCases | Sorted, disjoint case ranges
+//
+// @parm size_t | nCount | Number of case ranges
+//
+// @parm INT32 | lMin | Lowest value the switch value can have here
+//
+// @parm INT32 | lMax | Highest value the switch value can have here
+//
+// @parm int | nDefault | Label to jump to if no case matches
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::CodeSwitchTree (const SwitchCase *pasCases, 
+	size_t nCount, INT32 lMin, INT32 lMax, int nDefault)
+{
+
+	//
+	// Small nodes are tested in order.  Since the ranges are sorted, a value
+	// below the current range can't match any later range either.
+	//
+
+	if (nCount <= 3)
+	{
+		for (size_t i = 0; i < nCount; i++)
+		{
+			const SwitchCase &sCase = pasCases [i];
+			if (sCase .lLow <= lMin && sCase .lHigh >= lMax)
+			{
+				CodeJMP (sCase .nLabel);
+				return;
+			}
+			if (sCase .lLow == sCase .lHigh)
+			{
+				CodeSwitchTest (NscCode_EQUAL, sCase .lLow, sCase .nLabel);
+				if (sCase .lLow == lMin)
+					lMin++;
+			}
+			else
+			{
+				if (sCase .lLow > lMin)
+					CodeSwitchTest (NscCode_LT, sCase .lLow, nDefault);
+				if (sCase .lHigh >= lMax)
+				{
+					CodeJMP (sCase .nLabel);
+					return;
+				}
+				CodeSwitchTest (NscCode_LEQ, sCase .lHigh, sCase .nLabel);
+				lMin = sCase .lHigh + 1;
+			}
+		}
+		CodeJMP (nDefault);
+		return;
+	}
 
-			case NscPCode_Divide:
-				nOp = NscCode_DIV;
-				goto do_binaryop;
+	//
+	// Otherwise, split on the middle range: lower values are handled by the
+	// code at nLower, the rest fall through to the upper half
+	//
 
-			case NscPCode_Modulus:
-				nOp = NscCode_MOD;
-				goto do_binaryop;
+	size_t nMid = nCount / 2;
+	INT32 lSplit = pasCases [nMid] .lLow;
+	int nLower;
+	nLower = ForwardLabel ();
+	CodeSwitchTest (NscCode_LT, lSplit, nLower);
+	CodeSwitchTree (&pasCases [nMid], nCount - nMid, lSplit, lMax, nDefault);
+	ForwardResolve (nLower);
+	CodeSwitchTree (pasCases, nMid, lMin, lSplit - 1, nDefault);
+}
 
-			case NscPCode_Add:
-				nOp = NscCode_ADD;
-				goto do_binaryop;
+//-----------------------------------------------------------------------------
+//
+// @mfunc Code a comparison of the switch value on the top of the stack
+//		against a constant, jumping if the comparison is true.  The stack
+//		is left as it was.
+//
+// @parm NscCode | nCode | Comparison opcode (switch value on the left)
+//
+// @parm INT32 | lValue | Constant to compare against
+//
+// @parm int | nLabel | Label to jump to
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
 
-			case NscPCode_Subtract:
-				nOp = NscCode_SUB;
-				goto do_binaryop;
+void CNscCodeGenerator::CodeSwitchTest (NscCode nCode, INT32 lValue, 
+	int nLabel)
+{
+	CodeCP (NscCode_CPTOPSP, 1, 1);
+	CodeCONST (NscType_Integer, &lValue);
+	CodeBinaryOp (nCode, false, NscType_Integer, 
+		NscType_Integer, NscType_Integer);
+	CodeJNZ (nLabel);
+}
 
-			case NscPCode_ShiftLeft:
-				nOp = NscCode_SHLEFT;
-				goto do_binaryop;
+//-----------------------------------------------------------------------------
+//
+// @mfunc Run the peephole optimizer over the generated code.
+//
+//		The code is decoded into an instruction list and the following
+//		patterns are rewritten until none remain:
+//
+//		JMP to the next instruction is removed.
+//		JMP, JZ and JNZ to a JMP are sent to the final destination.
+//		MOVSP followed by MOVSP is merged into one MOVSP.
+//		CPTOPSP followed by a MOVSP that pops the copy is removed.
+//		RSADD, a one cell push, CPDOWNSP into the reserved cell and MOVSP
+//			are reduced to the push.
+//
+//		Instructions are only ever removed or patched in place, so every
+//		old instruction boundary maps onto a new one (see RemapOffset).
+//		The line table, function, inlined call and variable ranges are 
+//		remapped here,
+//		the caller must remap any offsets of its own.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
 
-			case NscPCode_ShiftRight:
-				nOp = NscCode_SHRIGHT;
-				goto do_binaryop;
+void CNscCodeGenerator::OptimizeCode ()
+{
 
-			case NscPCode_UnsignedShiftRight:
-				nOp = NscCode_USHRIGHT;
-				goto do_binaryop;
+	//
+	// Decode the instructions.  If anything can not be decoded, leave the
+	// code alone.
+	//
 
-			case NscPCode_LessThan:
-				nOp = NscCode_LT;
-				goto do_binaryop;
+	m_asInstructions .clear ();
+	size_t nSize = m_pauchOut - m_pauchCode;
+	size_t nOffset = 8 + 5;
+	while (nOffset <= nSize)
+	{
+		Instruction sInstruction;
+		sInstruction .nOffset = nOffset;
+		sInstruction .nNewOffset = nOffset;
+		sInstruction .nTarget = (size_t) -1;
+		sInstruction .nRefs = 0;
+		sInstruction .fDeleted = false;
 
-			case NscPCode_GreaterThan:
-				nOp = NscCode_GT;
-				goto do_binaryop;
+		//
+		// The end of the code is kept as a final empty instruction so
+		// that branches and ranges ending there have something to refer to
+		//
 
-			case NscPCode_LessThanEq:
-				nOp = NscCode_LEQ;
-				goto do_binaryop;
+		if (nOffset == nSize)
+			sInstruction .nLength = 0;
+		else
+		{
+			sInstruction .nLength = GetInstructionLength (
+				&m_pauchCode [nOffset], nSize - nOffset);
+			if (sInstruction .nLength == 0)
+			{
+				m_asInstructions .clear ();
+				return;
+			}
+		}
+		m_asInstructions .push_back (sInstruction);
+		if (sInstruction .nLength == 0)
+			break;
+		nOffset += sInstruction .nLength;
+	}
+	size_t nCount = m_asInstructions .size () - 1;
 
-			case NscPCode_GreaterThanEq:
-				nOp = NscCode_GEQ;
-				goto do_binaryop;
+	//
+	// Resolve the branch targets.  The loader entry point and the resume
+	// point of a STORE_STATE are entered without a branch, so give them an
+	// extra reference to keep them from being merged into their neighbors.
+	//
 
-			case NscPCode_Equal:
-				{
-					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
-					CodeBinaryOp (NscCode_EQUAL, true, pBinOp ->nType, 
-						pBinOp ->nLhsType, pBinOp ->nRhsType);
-				}
+	m_asInstructions [0] .nRefs++;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		unsigned char *pauchData = &m_pauchCode [m_asInstructions [i] .nOffset];
+		size_t nTargetOffset;
+		switch (pauchData [0])
+		{
+			case NscCode_JMP:
+			case NscCode_JSR:
+			case NscCode_JZ:
+			case NscCode_JNZ:
+				nTargetOffset = m_asInstructions [i] .nOffset + 
+					CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
 				break;
 
-			case NscPCode_NotEqual:
-				{
-					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
-					CodeBinaryOp (NscCode_NEQUAL, true, pBinOp ->nType, 
-						pBinOp ->nLhsType, pBinOp ->nRhsType);
-				}
+			case NscCode_STORE_STATE:
+				nTargetOffset = m_asInstructions [i] .nOffset + pauchData [1];
 				break;
 
-			case NscPCode_BitwiseAND:
-				nOp = NscCode_BOOLAND;
-				goto do_binaryop;
+			default:
+				continue;
+		}
+		size_t nTarget = FindInstruction (nTargetOffset);
+		if (nTarget == (size_t) -1)
+		{
+			m_asInstructions .clear ();
+			return;
+		}
+		if (pauchData [0] != NscCode_STORE_STATE)
+			m_asInstructions [i] .nTarget = nTarget;
+		m_asInstructions [nTarget] .nRefs++;
+	}
 
-			case NscPCode_BitwiseXOR:
-				nOp = NscCode_EXCOR;
-				goto do_binaryop;
+	//
+	// Apply the patterns until nothing changes
+	//
 
-			case NscPCode_BitwiseOR:
-				nOp = NscCode_INCOR;
-do_binaryop:;
-				{
-					NscPCodeBinaryOp *pBinOp = (NscPCodeBinaryOp *) pHeader;
-					CodeBinaryOp (nOp, false, pBinOp ->nType, 
-						pBinOp ->nLhsType, pBinOp ->nRhsType);
-				}
-				break;
+	bool fChanged = true;
+	while (fChanged)
+	{
+		fChanged = false;
+		for (size_t i = 0; i < nCount; i++)
+		{
+			if (m_asInstructions [i] .fDeleted)
+				continue;
+			unsigned char *pauchData = &m_pauchCode [m_asInstructions [i] .nOffset];
+			size_t nNext = GetNextInstruction (i);
+			unsigned char *pauchNext = &m_pauchCode [m_asInstructions [nNext] .nOffset];
+			bool fNextIsCode = nNext < nCount && m_asInstructions [nNext] .nRefs == 0;
 
-			case NscPCode_LogicalAND:
-				{
-					NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
-					char szEnd [NscMaxLabelSize];
-					ForwardLabel (szEnd);
-					CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
-					CodeCP (NscCode_CPTOPSP, 1, 1);
-					CodeJZ (szEnd);
-					CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
-					CodeBinaryOp (NscCode_LOGAND, false, NscType_Integer,
-						NscType_Integer, NscType_Integer);
-					ForwardResolve (szEnd);
-				}
-				break;
+			switch (pauchData [0])
+			{
 
-			case NscPCode_LogicalOR:
-				{
-					NscPCodeLogicalOp *pLogOp = (NscPCodeLogicalOp *) pHeader;
-					if (m_fNoBugLogicalOR)
-					{
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
-						CodeCP (NscCode_CPTOPSP, 1, 1);
-						CodeJNZ (szEnd);
-						CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
-						CodeBinaryOp (NscCode_LOGOR, false, NscType_Integer,
-							NscType_Integer, NscType_Integer);
-						ForwardResolve (szEnd);
-					}
-					else
-					{
-						char szEnd [NscMaxLabelSize];
-						ForwardLabel (szEnd);
-						char szRhs [NscMaxLabelSize];
-						ForwardLabel (szRhs);
-						CodeData (&pauchData [pLogOp ->nLhsOffset], pLogOp ->nLhsSize);
-						CodeCP (NscCode_CPTOPSP, 1, 1);
-						CodeJZ (szRhs);
-						CodeCP (NscCode_CPTOPSP, 1, 1);
-						if (m_nVersion >= 130)
-						{
-							CodeJMP (szEnd);
-							m_nExpDepth -= 1; // adjustment required
-						}
-						else
-						{
-							CodeJZ (szEnd);//BIOWARE BUG!!! BEEN REPORTED (Been corrected with 1.30)
-						}
-						ForwardResolve (szRhs);
-						CodeData (&pauchData [pLogOp ->nRhsOffset], pLogOp ->nRhsSize);
-						ForwardResolve (szEnd);
-						CodeBinaryOp (NscCode_LOGOR, false, NscType_Integer,
-							NscType_Integer, NscType_Integer);
-					}
-				}
-				break;
+				//
+				// Branches
+				//
 
-			case NscPCode_Constant:
-				switch (pHeader ->nType)
-				{
-					case NscType_Integer:
-						{
-							NscPCodeConstantInteger *p = (NscPCodeConstantInteger *) pHeader;
-							CodeCONST (p ->nType, &p ->lValue);
-						}
-						break;
-					case NscType_Float:
-						{
-							NscPCodeConstantFloat *p = (NscPCodeConstantFloat *) pHeader;
-							CodeCONST (p ->nType, &p ->fValue);
-						}
-						break;
-					case NscType_String:
-						{
-							NscPCodeConstantString *p = (NscPCodeConstantString *) pHeader;
-							CodeCONST (p ->nType, &p ->nLength, p ->szString);
-						}
-						break;
-					case NscType_Object:
+				case NscCode_JMP:
+				case NscCode_JZ:
+				case NscCode_JNZ:
+					{
+						size_t nTarget = GetBranchTarget (i);
+						if (pauchData [0] == NscCode_JMP && nTarget == nNext)
 						{
-							NscPCodeConstantObject *p = (NscPCodeConstantObject *) pHeader;
-							CodeCONST (p ->nType, &p ->ulid);
+							DeleteInstruction (i);
+							fChanged = true;
 						}
-						break;
-					case NscType_Vector:
+						else if (nTarget != i && nTarget < nCount && 
+							m_pauchCode [m_asInstructions [nTarget] .nOffset] == NscCode_JMP)
 						{
-							NscPCodeConstantVector *p = (NscPCodeConstantVector *) pHeader;
-							CodeCONST (NscType_Float, &p ->v [0]);
-							CodeCONST (NscType_Float, &p ->v [1]);
-							CodeCONST (NscType_Float, &p ->v [2]);
+							size_t nFinal = GetBranchTarget (nTarget);
+							if (nFinal != nTarget)
+							{
+								m_asInstructions [nTarget] .nRefs--;
+								m_asInstructions [nFinal] .nRefs++;
+								m_asInstructions [i] .nTarget = nFinal;
+								fChanged = true;
+							}
 						}
-						break;
-					case NscType_Engine_2:
+						else if (m_fOptTailReturn && pauchData [0] == NscCode_JMP &&
+							nTarget < nCount &&
+							m_pauchCode [m_asInstructions [nTarget] .nOffset] == NscCode_RETN)
 						{
-							NscPCodeConstantLocation *p = (NscPCodeConstantLocation *) pHeader;
-							CodeCONST (p ->nType, &p ->lValue);
+							ReplaceWithRETN (i);
+							fChanged = true;
 						}
-						break;
-					case NscType_Engine_7:
+						else if (m_fOptTailReturn && pauchData [0] == NscCode_JMP &&
+							fNextIsCode)
 						{
-							NscPCodeConstantJson *p = (NscPCodeConstantJson *) pHeader;
-							CodeCONST (p ->nType, &p ->nLength, p ->szString);
+							DeleteInstruction (nNext);
+							fChanged = true;
 						}
-						break;
-					default:
-						{
-							NscPCodeConstantStructure *p = (NscPCodeConstantStructure *) pHeader;
+					}
+					break;
 
-							assert (m_pCtx ->IsStructure (p ->nType));
-							CodeCONST (p ->nType, NULL);
-						}
-				}
-				break;
+				//
+				// RETN, unreachable code
+				//
 
-			//
-			// If this is an expression end
-			//
+				case NscCode_RETN:
+					if (m_fOptTailReturn && fNextIsCode)
+					{
+						DeleteInstruction (nNext);
+						fChanged = true;
+					}
+					break;
 
-			case NscPCode_ExpressionEnd:
-				{
-					if (pHeader ->nType != NscType_Unknown)
+				//
+				// MOVSP, MOVSP
+				//
+
+				case NscCode_MOVSP:
+					if (fNextIsCode && pauchNext [0] == NscCode_MOVSP)
 					{
-						int nSize = m_pCtx ->GetTypeSize (pHeader ->nType);
-						CodeMOVSP (nSize, &m_nExpDepth);
+						INT32 l1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+						INT32 l2 = CNwnByteOrder<INT32>::BigEndian (&pauchNext [2]);
+						WriteINT32 (&pauchData [2], l1 + l2);
+						DeleteInstruction (nNext);
+						fChanged = true;
 					}
-					assert (m_nExpDepth == 0);
-				}
-				break;
 
-			//
-			// If this is a line
-			//
+					//
+					// MOVSP, JMP to MOVSP, RETN.  The epilogue is coded in
+					// place of the JMP with the two MOVSPs merged.
+					//
+
+					else if (m_fOptTailReturn && fNextIsCode && 
+						pauchNext [0] == NscCode_JMP)
+					{
+						size_t nTarget = GetBranchTarget (nNext);
+						if (nTarget >= nCount)
+							break;
+						size_t nReturn = GetNextInstruction (nTarget);
+						unsigned char *pauchTarget = &m_pauchCode [m_asInstructions [nTarget] .nOffset];
+						if (pauchTarget [0] != NscCode_MOVSP || nReturn >= nCount ||
+							m_asInstructions [nReturn] .nRefs != 0 ||
+							m_pauchCode [m_asInstructions [nReturn] .nOffset] != NscCode_RETN)
+							break;
+						INT32 l1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+						INT32 l2 = CNwnByteOrder<INT32>::BigEndian (&pauchTarget [2]);
+						WriteINT32 (&pauchData [2], l1 + l2);
+						ReplaceWithRETN (nNext);
+						fChanged = true;
+					}
+					break;
+
+				//
+				// CPTOPSP, MOVSP
+				//
+
+				case NscCode_CPTOPSP:
+					if (fNextIsCode && pauchNext [0] == NscCode_MOVSP &&
+						CNwnByteOrder<INT32>::BigEndian (&pauchNext [2]) ==
+						-CNwnByteOrder<INT16>::BigEndian (&pauchData [6]))
+					{
+						DeleteInstruction (nNext);
+						DeleteInstruction (i);
+						fChanged = true;
+					}
+					break;
+
+				//
+				// RSADD, push, CPDOWNSP, MOVSP
+				//
+
+				case NscCode_RSADD:
+					{
+						if (!fNextIsCode)
+							break;
+						size_t nCopy = GetNextInstruction (nNext);
+						size_t nPop = GetNextInstruction (nCopy);
+						if (nPop >= nCount || 
+							m_asInstructions [nCopy] .nRefs != 0 ||
+							m_asInstructions [nPop] .nRefs != 0)
+							break;
+						unsigned char *pauchCopy = &m_pauchCode [m_asInstructions [nCopy] .nOffset];
+						unsigned char *pauchPop = &m_pauchCode [m_asInstructions [nPop] .nOffset];
+						if (pauchCopy [0] != NscCode_CPDOWNSP ||
+							CNwnByteOrder<INT32>::BigEndian (&pauchCopy [2]) != -8 ||
+							CNwnByteOrder<INT16>::BigEndian (&pauchCopy [6]) != 4 ||
+							pauchPop [0] != NscCode_MOVSP ||
+							CNwnByteOrder<INT32>::BigEndian (&pauchPop [2]) != -4)
+							break;
+
+						//
+						// The push must leave exactly one cell.  A CPTOPSP
+						// must not read the reserved cell and is moved
+						// up by one since that cell goes away.
+						//
+
+						if (pauchNext [0] == NscCode_CPTOPSP)
+						{
+							INT32 lOffset = CNwnByteOrder<INT32>::BigEndian (&pauchNext [2]);
+							if (CNwnByteOrder<INT16>::BigEndian (&pauchNext [6]) != 4 ||
+								lOffset > -8)
+								break;
+							WriteINT32 (&pauchNext [2], lOffset + 4);
+						}
+						else if (pauchNext [0] == NscCode_CPTOPBP)
+						{
+							if (CNwnByteOrder<INT16>::BigEndian (&pauchNext [6]) != 4)
+								break;
+						}
+						else if (pauchNext [0] != NscCode_CONST)
+							break;
+						DeleteInstruction (nPop);
+						DeleteInstruction (nCopy);
+						DeleteInstruction (i);
+						fChanged = true;
+					}
+					break;
+			}
+		}
+	}
+
+	//
+	// Compute the new offsets
+	//
 
-			case NscPCode_Line:
-				{
-					NscPCodeLine *p = (NscPCodeLine *) pHeader;
-					AddLine (p ->nFile, p ->nLine);
-				}
-				break;
+	nOffset = 8 + 5;
+	for (size_t i = 0; i <= nCount; i++)
+	{
+		m_asInstructions [i] .nNewOffset = nOffset;
+		if (!m_asInstructions [i] .fDeleted)
+			nOffset += m_asInstructions [i] .nLength;
+	}
 
-			//
-			// Default
-			//
+	//
+	// Move the instructions down and patch the branches
+	//
 
-			default:
-				assert (false);
-				break;
+	for (size_t i = 0; i < nCount; i++)
+	{
+		Instruction &sInstruction = m_asInstructions [i];
+		if (sInstruction .fDeleted)
+			continue;
+		unsigned char *pauchData = &m_pauchCode [sInstruction .nNewOffset];
+		memmove (pauchData, &m_pauchCode [sInstruction .nOffset], 
+			sInstruction .nLength);
+		if (sInstruction .nTarget != (size_t) -1)
+		{
+			size_t nTarget = GetBranchTarget (i);
+			WriteINT32 (&pauchData [2], (INT32) 
+				(m_asInstructions [nTarget] .nNewOffset - sInstruction .nNewOffset));
 		}
+	}
+	m_pauchOut = &m_pauchCode [nOffset];
+	m_pauchLineStart = m_pauchOut;
 
-		//
-		// Move onto the next operator
-		//
+	//
+	// Move the line table, function and variable ranges
+	//
 
-		pauchData += pHeader ->nOpSize;
+	for (size_t i = 0; i < m_asLines .size (); i++)
+	{
+		m_asLines [i] .nCompiledStart = RemapOffset (m_asLines [i] .nCompiledStart);
+		m_asLines [i] .nCompiledEnd = RemapOffset (m_asLines [i] .nCompiledEnd);
+	}
+	for (size_t i = 0; i < m_anFunctions .size (); i++)
+	{
+		NscSymbol *pSymbol = m_pCtx ->GetSymbol (m_anFunctions [i]);
+		pSymbol ->nCompiledStart = RemapOffset (pSymbol ->nCompiledStart);
+		pSymbol ->nCompiledEnd = RemapOffset (pSymbol ->nCompiledEnd);
+	}
+	for (size_t i = 0; i < m_pCtx ->GetGlobalVariableCount (); i++)
+	{
+		NscSymbol *pSymbol = m_pCtx ->GetGlobalVariable (i);
+		if ((pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) == 0)
+		{
+			pSymbol ->nCompiledStart = RemapOffset (pSymbol ->nCompiledStart);
+			pSymbol ->nCompiledEnd = RemapOffset (pSymbol ->nCompiledEnd);
+		}
+	}
+	for (size_t i = 0; i < m_anLocalVars .size (); i++)
+	{
+		NscSymbol *pSymbol = m_sLocalSymbols .GetSymbol (m_anLocalVars [i]);
+		pSymbol ->nCompiledStart = RemapOffset (pSymbol ->nCompiledStart);
+		pSymbol ->nCompiledEnd = RemapOffset (pSymbol ->nCompiledEnd);
+	}
+	for (size_t i = 0; i < m_asInlinedFrames .size (); i++)
+	{
+		InlinedFrame &sFrame = m_asInlinedFrames [i];
+		sFrame .nCompiledStart = RemapOffset (sFrame .nCompiledStart);
+		sFrame .nCompiledEnd = RemapOffset (sFrame .nCompiledEnd);
 	}
-	return true;
 }
 
 //-----------------------------------------------------------------------------
 //
-// @mfunc Scan for case and default labels
+// @mfunc Get the length of an instruction
 //
-// @parm unsigned char * | pauchData | Pointer to code
+// @parm const unsigned char * | pauchData | Start of the instruction
 //
-// @parm size_t | nDataSize | Size of code
+// @parm size_t | nSize | Number of bytes available
 //
-// @rdesc TRUE if output was generated.
+// @rdesc Length of the instruction or zero if it can't be decoded.
 //
 //-----------------------------------------------------------------------------
 
-bool CNscCodeGenerator::CodeScanCase (unsigned char *pauchData, size_t nDataSize)
+size_t CNscCodeGenerator::GetInstructionLength (const unsigned char *pauchData, 
+	size_t nSize)
 {
+	size_t nLength;
 
-	//
-	// Loop through the data
-	//
-
-	unsigned char *pauchEnd = &pauchData [nDataSize];
-	while (pauchData < pauchEnd)
+	if (nSize < 2)
+		return 0;
+	switch (pauchData [0])
 	{
-		NscPCodeHeader *pHeader = (NscPCodeHeader *) pauchData;
-		if (m_pauchOut >= m_pauchCodeEnd)
-			ExpandOutputBuffer ();
+		case NscCode_RSADD:
+		case NscCode_NEG:
+		case NscCode_COMP:
+		case NscCode_RETN:
+		case NscCode_NOT:
+		case NscCode_SAVEBP:
+		case NscCode_RESTOREBP:
+		case NscCode_NOP:
+			nLength = 2;
+			break;
 
-		//
-		// Switch based on the opcode
-		//
+		case NscCode_LOGAND:
+		case NscCode_LOGOR:
+		case NscCode_INCOR:
+		case NscCode_EXCOR:
+		case NscCode_BOOLAND:
+		case NscCode_EQUAL:
+		case NscCode_NEQUAL:
+		case NscCode_GEQ:
+		case NscCode_GT:
+		case NscCode_LT:
+		case NscCode_LEQ:
+		case NscCode_SHLEFT:
+		case NscCode_SHRIGHT:
+		case NscCode_USHRIGHT:
+		case NscCode_ADD:
+		case NscCode_SUB:
+		case NscCode_MUL:
+		case NscCode_DIV:
+		case NscCode_MOD:
+			nLength = pauchData [1] == 0x24 ? 4 : 2;
+			break;
 
-		switch (pHeader ->nOpCode)
-		{
+		case NscCode_ACTION:
+			nLength = 5;
+			break;
 
-			//
-			// If this is a statement
-			//
+		case NscCode_CONST:
+			if (pauchData [1] == 5 || pauchData [1] == 0x17)
+			{
+				if (nSize < 4)
+					return 0;
+				nLength = 4 + CNwnByteOrder<UINT16>::BigEndian (&pauchData [2]);
+			}
+			else
+				nLength = 6;
+			break;
 
-			case NscPCode_Statement:
-				{
-					NscPCodeStatement *pCode = (NscPCodeStatement *) pHeader;
-					CodeScanCase (&pauchData [pCode ->nDataOffset],
-						pCode ->nDataSize);
-				}
-				break;
+		case NscCode_MOVSP:
+		case NscCode_JMP:
+		case NscCode_JSR:
+		case NscCode_JZ:
+		case NscCode_JNZ:
+		case NscCode_DECISP:
+		case NscCode_INCISP:
+		case NscCode_DECIBP:
+		case NscCode_INCIBP:
+			nLength = 6;
+			break;
 
-			//
-			// If this is a case
-			//
+		case NscCode_CPDOWNSP:
+		case NscCode_CPTOPSP:
+		case NscCode_CPDOWNBP:
+		case NscCode_CPTOPBP:
+		case NscCode_DESTRUCT:
+			nLength = 8;
+			break;
 
-			case NscPCode_Case:
-				{
-					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
-					ForwardLabel (pCase ->szLabel);
-					CodeCP (NscCode_CPTOPSP, 1, 1);
-					CodeData (&pauchData [pCase ->nCaseOffset], pCase ->nCaseSize);
-					CodeBinaryOp (NscCode_EQUAL, false, NscType_Integer, 
-						NscType_Integer, NscType_Integer);
-					CodeJNZ (pCase ->szLabel);
-				}
-				break;
+		case NscCode_STORE_STATE:
+			nLength = 10;
+			break;
 
-			//
-			// If this is a default
-			//
+		default:
+			return 0;
+	}
+	return nLength <= nSize ? nLength : 0;
+}
 
-			case NscPCode_Default:
-				{
-					NscPCodeCase *pCase = (NscPCodeCase *) pHeader;
-					ForwardLabel (pCase ->szLabel);
-					m_pszDefaultLabel = pCase ->szLabel;
-				}
-				break;
-		}
+//-----------------------------------------------------------------------------
+//
+// @mfunc Find the instruction at a code offset
+//
+// @parm size_t | nOffset | Offset of the instruction before the peephole
+//		pass
+//
+// @rdesc Index of the instruction or -1 if no instruction starts there.
+//
+//-----------------------------------------------------------------------------
 
-		//
-		// Move onto the next operator
-		//
+size_t CNscCodeGenerator::FindInstruction (size_t nOffset) const
+{
+	size_t nLow = 0;
+	size_t nHigh = m_asInstructions .size ();
+	while (nLow < nHigh)
+	{
+		size_t nMid = (nLow + nHigh) / 2;
+		if (m_asInstructions [nMid] .nOffset < nOffset)
+			nLow = nMid + 1;
+		else
+			nHigh = nMid;
+	}
+	if (nLow < m_asInstructions .size () && 
+		m_asInstructions [nLow] .nOffset == nOffset)
+		return nLow;
+	return (size_t) -1;
+}
 
-		pauchData += pHeader ->nOpSize;
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the next instruction that has not been deleted
+//
+// @parm size_t | nInstruction | Current instruction
+//
+// @rdesc Index of the next instruction.  The end of the code is never 
+//		deleted.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::GetNextInstruction (size_t nInstruction) const
+{
+	do
+	{
+		nInstruction++;
+	} while (m_asInstructions [nInstruction] .fDeleted);
+	return nInstruction;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the instruction a branch currently lands on.  A branch to a
+//		deleted instruction lands on the next one that remains.
+//
+// @parm size_t | nInstruction | Branch instruction
+//
+// @rdesc Index of the target instruction.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::GetBranchTarget (size_t nInstruction)
+{
+	size_t nTarget = m_asInstructions [nInstruction] .nTarget;
+	if (m_asInstructions [nTarget] .fDeleted)
+	{
+		nTarget = GetNextInstruction (nTarget);
+		m_asInstructions [nInstruction] .nTarget = nTarget;
 	}
-	return true;
+	return nTarget;
 }
 
 //-----------------------------------------------------------------------------
 //
-// @mfunc Define a new label for conditionals
+// @mfunc Delete an instruction.  Branches to the instruction will land on
+//		the next remaining instruction, so the caller must make sure that
+//		this does not change what they execute.
 //
-// @parm char * | pszRoutine | Populated with the name of the label.
-//		should be 16 + bytes in length
+// @parm size_t | nInstruction | Instruction to delete
 //
 // @rdesc None.
 //
 //-----------------------------------------------------------------------------
 
-void CNscCodeGenerator::ForwardLabel (char *pszRoutine)
+void CNscCodeGenerator::DeleteInstruction (size_t nInstruction)
 {
+	Instruction &sInstruction = m_asInstructions [nInstruction];
 
-	//
-	// Generate the name
-	//
+	if (sInstruction .nTarget != (size_t) -1)
+		m_asInstructions [GetBranchTarget (nInstruction)] .nRefs--;
+	sInstruction .fDeleted = true;
+	if (sInstruction .nRefs != 0)
+	{
+		m_asInstructions [GetNextInstruction (nInstruction)] .nRefs += 
+			sInstruction .nRefs;
+		sInstruction .nRefs = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Replace a branch with a RETN.  The RETN is shorter, so it is
+//		written in place and the rest of the branch dropped.
+//
+// @parm size_t | nInstruction | Branch instruction
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::ReplaceWithRETN (size_t nInstruction)
+{
+	Instruction &sInstruction = m_asInstructions [nInstruction];
+
+	m_asInstructions [GetBranchTarget (nInstruction)] .nRefs--;
+	sInstruction .nTarget = (size_t) -1;
+	sInstruction .nLength = 2;
+	unsigned char *pauchData = &m_pauchCode [sInstruction .nOffset];
+	pauchData [0] = NscCode_RETN;
+	pauchData [1] = 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Translate a code offset from before the peephole pass
+//
+// @parm size_t | nOffset | Offset before the pass
+//
+// @rdesc Offset after the pass.  Offsets that are not on an instruction
+//		boundary (such as 0xffffffff placeholders) are returned as is.
+//
+//-----------------------------------------------------------------------------
+
+size_t CNscCodeGenerator::RemapOffset (size_t nOffset) const
+{
+	size_t nInstruction = FindInstruction (nOffset);
+	if (nInstruction == (size_t) -1)
+		return nOffset;
+	return m_asInstructions [nInstruction] .nNewOffset;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Define a forward label
+//
+// @rdesc Index of the new label.
+//
+//-----------------------------------------------------------------------------
+
+int CNscCodeGenerator::ForwardLabel ()
+{
+	Label sLabel;
+	sLabel .nOffset = (size_t) -1;
+	sLabel .nFirstLink = -1;
+	m_asLabels .push_back (sLabel);
+	return (int) m_asLabels .size () - 1;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Resolve a forward label
+//
+// @parm int | nLabel | Index of the label
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
 
-	sprintf (pszRoutine, "off_%08X", m_nNextLabel++);
+void CNscCodeGenerator::ForwardResolve (int nLabel)
+{
 
 	//
-	// Add the label
+	// Set the offset and resolve the back links
 	//
 
-	NscSymbol *pSymbol = m_sLinker .Add (pszRoutine, NscSymType_Linker);
-	pSymbol ->nOffset = 0;
-	pSymbol ->nFirstBackLink = 0;
+	Label &sLabel = m_asLabels [nLabel];
+	assert (sLabel .nOffset == (size_t) -1);
+	sLabel .nOffset = m_pauchOut - m_pauchCode;
+	for (int nLink = sLabel .nFirstLink; nLink != -1; 
+		nLink = m_asLabelLinks [nLink] .nNext)
+	{
+		size_t nOffset = m_asLabelLinks [nLink] .nOffset;
+		WriteINT32 (&m_pauchCode [nOffset + 2], (INT32) 
+			(sLabel .nOffset - nOffset));
+	}
 }
 
 //-----------------------------------------------------------------------------
 //
-// @mfunc Resolve a forward label
+// @mfunc Reference a forward label
 //
-// @parm const char * | pszRoutine | Name of the routine
+// @parm int | nLabel | Index of the label
 //
 // @rdesc None.
 //
 //-----------------------------------------------------------------------------
 
-void CNscCodeGenerator::ForwardResolve (const char *pszRoutine)
+void CNscCodeGenerator::ReferenceLabel (int nLabel)
 {
 
 	//
-	// Search the symbol table for a match
+	// If the label has been resolved, then do a simple patch now
 	//
 
-	NscSymbol *pSymbol = m_sLinker .Find (pszRoutine);
-	assert (pSymbol != NULL);
+	Label &sLabel = m_asLabels [nLabel];
+	size_t nCurPos = m_pauchOut - m_pauchCode;
+	if (sLabel .nOffset != (size_t) -1)
+	{
+		WriteINT32 (&m_pauchOut [2], (INT32) 
+			(sLabel .nOffset - nCurPos));
+	}
 
 	//
-	// Set the offset and resolve the back links
+	// Otherwise, add a new link
 	//
 
-	assert (pSymbol ->nOffset == 0);
-	pSymbol ->nOffset = m_pauchOut - m_pauchCode;
-	size_t nLink = pSymbol ->nFirstBackLink;
-	while (nLink != 0)
+	else
 	{
-		BackLink *pLink = (BackLink *) m_sLinker .GetData (nLink);
-		unsigned char *pauchData = &m_pauchCode [pLink ->nOffset];
-		WriteINT32 (&pauchData [2], (INT32) 
-			(pSymbol ->nOffset - pLink ->nOffset));
-		nLink = pLink ->nNext;
+		LabelLink sLink;
+		sLink .nOffset = nCurPos;
+		sLink .nNext = sLabel .nFirstLink;
+		sLabel .nFirstLink = (int) m_asLabelLinks .size ();
+		m_asLabelLinks .push_back (sLink);
 	}
 }
 
@@ -4290,6 +7134,113 @@ void CNscCodeGenerator::GetDebugTypeText (NscType nType, char *pszText)
 	}
 }
 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Write a function record to the debug file
+//
+// @parm CNscDebugTextWriter & | sText | Debug file text
+//
+// @parm size_t | nCompiledStart | Offset of the start of the code
+//
+// @parm size_t | nCompiledEnd | Offset of the end of the code
+//
+// @parm int | nArgCount | Number of arguments
+//
+// @parm NscType | nType | Return type
+//
+// @parm const char * | pszName | Name of the function
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::WriteDebugFunction (CNscDebugTextWriter &sText, 
+	size_t nCompiledStart, size_t nCompiledEnd, int nArgCount, 
+	NscType nType, const char *pszName)
+{
+	char szType [32];
+	GetDebugTypeText (nType, szType);
+	sText .String ("f ");
+	sText .Hex ((UINT32) nCompiledStart);
+	sText .Char (' ');
+	sText .Hex ((UINT32) nCompiledEnd);
+	sText .Char (' ');
+	sText .Decimal (nArgCount, 3);
+	sText .Char (' ');
+	sText .String (szType);
+	sText .Char (' ');
+	sText .String (pszName);
+	sText .EndLine ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Write the argument records of a function to the debug file
+//
+// @parm CNscDebugTextWriter & | sText | Debug file text
+//
+// @parm unsigned char * | pauchArgData | Argument declarations
+//
+// @parm int | nArgCount | Number of arguments
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::WriteDebugArguments (CNscDebugTextWriter &sText, 
+	unsigned char *pauchArgData, int nArgCount)
+{
+	char szType [32];
+	for (int nArg = 0; nArg < nArgCount; nArg++)
+	{
+		NscPCodeHeader *pArg = (NscPCodeHeader *) pauchArgData;
+		GetDebugTypeText (pArg ->nType, szType);
+		sText .String ("fp ");
+		sText .String (szType);
+		sText .EndLine ();
+		pauchArgData += pArg ->nOpSize;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Write a variable record to the debug file
+//
+// @parm CNscDebugTextWriter & | sText | Debug file text
+//
+// @parm size_t | nCompiledStart | Offset where the variable comes into scope
+//
+// @parm size_t | nCompiledEnd | Offset where the variable goes out of scope
+//
+// @parm int | nStackOffset | Stack offset of the variable in bytes
+//
+// @parm NscType | nType | Type of the variable
+//
+// @parm const char * | pszName | Name of the variable
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscCodeGenerator::WriteDebugVariable (CNscDebugTextWriter &sText, 
+	size_t nCompiledStart, size_t nCompiledEnd, int nStackOffset, 
+	NscType nType, const char *pszName)
+{
+	char szType [32];
+	GetDebugTypeText (nType, szType);
+	sText .String ("v ");
+	sText .Hex ((UINT32) nCompiledStart);
+	sText .Char (' ');
+	sText .Hex ((UINT32) nCompiledEnd);
+	sText .Char (' ');
+	sText .Hex ((UINT32) nStackOffset);
+	sText .Char (' ');
+	sText .String (szType);
+	sText .Char (' ');
+	sText .String (pszName);
+	sText .EndLine ();
+}
+
 //-----------------------------------------------------------------------------
 //
 // @mfunc Purge variables to the given depth
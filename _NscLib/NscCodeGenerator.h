@@ -58,6 +58,8 @@
 //
 //-----------------------------------------------------------------------------
 
+class CNscDebugTextWriter;
+
 //-----------------------------------------------------------------------------
 //
 // Class definition
@@ -73,21 +75,77 @@ class CNscCodeGenerator
 		size_t	nOffset;
 	};
 
-	struct Line 
+	struct Label
+	{
+		size_t	nOffset;
+		int		nFirstLink;
+	};
+
+	struct LabelLink
+	{
+		size_t	nOffset;
+		int		nNext;
+	};
+
+	struct SwitchCase
+	{
+		INT32		lLow;
+		INT32		lHigh;
+		int			nLabel;
+
+		bool operator < (const SwitchCase &other) const
+		{
+			return lLow < other .lLow;
+		}
+	};
+
+	struct Instruction
+	{
+		size_t	nOffset;
+		size_t	nNewOffset;
+		size_t	nLength;
+		size_t	nTarget;
+		int		nRefs;
+		bool	fDeleted;
+	};
+
+	struct PureValue
 	{
-		int		nFile;
-		int		nLine;
+		NscPCodeCall	*pCall;
+		unsigned char	*pauchFirst;
+		unsigned char	*pauchLast;
+		int		nDepth;
+		int		nSlot;
+		int		nSize;
+		bool	fActive;
+	};
+
+	struct ConstantValue
+	{
+		NscType	nType;
+		union
+		{
+			INT32	lValue;
+			float	fValue;
+		};
+	};
+
+	struct InlinedFrame
+	{
+		size_t	nFnSymbol;
 		size_t	nCompiledStart;
 		size_t	nCompiledEnd;
 	};
 
+	typedef NscCompileWorkspace::Line Line;
+
 // @access Constructors and destructors
 public:
 
 	// @cmember General constructor
 
 	CNscCodeGenerator (CNscContext *pCtx, int nVersion, 
-		bool fEnableOptimizations);
+		int nOptimizationLevel);
 
 	// @cmember Delete the streams
 	
@@ -103,6 +161,13 @@ public:
 // @access Public inline methods
 public:
 
+	// @cmember Get the time spent writing the debug file
+
+	UINT64 GetSymbolsTime () const
+	{
+		return m_ulSymbolsTime;
+	}
+
 // @access Protected methods
 protected:
 
@@ -131,15 +196,19 @@ protected:
 
 	// @cmember Code a JMP statement
 
+	bool CodeJMP (int nLabel);
+
+	// @cmember Code a JMP to a routine
+
 	bool CodeJMP (const char *pszRoutine);
 
 	// @cmember Code a JZ statement
 
-	bool CodeJZ (const char *pszRoutine);
+	bool CodeJZ (int nLabel);
 
 	// @cmember Code a JNZ statement
 
-	bool CodeJNZ (const char *pszRoutine);
+	bool CodeJNZ (int nLabel);
 
 	// @cmember Code a CONST
 
@@ -152,6 +221,94 @@ protected:
 		unsigned char *pauchArgData, size_t nArgCount, int nFile, int nLine,
 		UINT32 ulFunctionFlags);
 
+	// @cmember Add the return value and arguments of a routine to the 
+	//		debug variables
+
+	NscSymbol *AddFrameVariables (NscType nRetType, 
+		unsigned char *pauchArgData, size_t nArgCount);
+
+	// @cmember Code a call by expanding the routine body in place
+
+	bool CodeInline (NscSymbol *pSymbol, NscType nRetType);
+
+	// @cmember Select the functions to be inlined
+
+	void SelectInlineFunctions (NscSymbol *pEntrySymbol);
+
+	// @cmember Gather the inlining cost and the calls of a block of data
+
+	bool GatherInlineInfo (unsigned char *pauchData, size_t nDataSize,
+		int *pnCost, std::vector <size_t> &anCalls);
+
+	// @cmember Plan the loop invariant pure calls of a loop
+
+	size_t HoistPureCalls (unsigned char *pauchData, NscPCode5Block *pBlock);
+
+	// @cmember Plan the pure calls to compute once in a block
+
+	size_t PlanPureValues (unsigned char *pauchData, size_t nDataSize);
+
+	// @cmember Compute a pure value into its stack slot
+
+	void ComputePureValue (size_t nIndex);
+
+	// @cmember Find the active pure value of a call
+
+	PureValue *FindPureValue (NscPCodeCall *pCall);
+
+	// @cmember Release the last pure values
+
+	int ReleasePureValues (size_t nCount);
+
+	// @cmember Get the size of the computed pure values
+
+	int GetPureValueSize () const;
+
+	// @cmember Get the stack adjustment of a local for the pure values
+
+	int GetPureValueShift (int nStackOffset) const;
+
+	// @cmember Test two expressions for equality
+
+	bool IsSameExpression (const unsigned char *pauchData1, size_t nDataSize1,
+		const unsigned char *pauchData2, size_t nDataSize2);
+
+	// @cmember Get the size of the free local slots
+
+	int GetFreeSlotSize () const;
+
+	// @cmember Remove the free local slots from the stack
+
+	void FlushFreeSlots ();
+
+	// @cmember Test if a new local is assigned before it is read
+
+	bool IsAssignedBeforeUse (unsigned char *pauchData, 
+		unsigned char *pauchEnd, int nStackOffset);
+
+	// @cmember Evaluate the constant expression at the start of pcode
+
+	size_t EvaluateConstant (unsigned char *pauchData, size_t nDataSize,
+		ConstantValue *psValue, bool *pfUsesGlobals);
+
+	// @cmember Evaluate a binary operator on two constants
+
+	static bool EvaluateBinaryOp (NscPCode nOpCode, const ConstantValue &sLhs,
+		const ConstantValue &sRhs, ConstantValue *psValue);
+
+	// @cmember Code a constant expression that uses constant globals
+
+	bool CodeFoldedConstant (unsigned char *pauchData, 
+		unsigned char *pauchEnd, size_t *pnOpSize);
+
+	// @cmember Get the value of a constant condition
+
+	int GetConstantCondition (unsigned char *pauchData, size_t nDataSize);
+
+	// @cmember Test if a return value can be coded as a tail call
+
+	bool IsTailCall (unsigned char *pauchData, size_t nDataSize);
+
 	// @cmember Code a block of data
 
 	bool CodeData (unsigned char *pauchData, size_t nDataSize);
@@ -160,6 +317,58 @@ protected:
 
 	bool CodeScanCase (unsigned char *pauchData, size_t nDataSize);
 
+	// @cmember Collect the case and default labels of a switch
+
+	bool CodeCollectCases (unsigned char *pauchData, size_t nDataSize,
+		std::vector <SwitchCase> &asCases);
+
+	// @cmember Code the case selection of a switch as a comparison tree
+
+	void CodeSwitchSelect (unsigned char *pauchData, size_t nDataSize,
+		int nEnd);
+
+	// @cmember Code a node of a switch comparison tree
+
+	void CodeSwitchTree (const SwitchCase *pasCases, size_t nCount,
+		INT32 lMin, INT32 lMax, int nDefault);
+
+	// @cmember Code a comparison of the switch value against a constant
+
+	void CodeSwitchTest (NscCode nCode, INT32 lValue, int nLabel);
+
+	// @cmember Run the peephole optimizer over the generated code
+
+	void OptimizeCode ();
+
+	// @cmember Get the length of an instruction
+
+	static size_t GetInstructionLength (const unsigned char *pauchData, 
+		size_t nSize);
+
+	// @cmember Find the instruction at a code offset
+
+	size_t FindInstruction (size_t nOffset) const;
+
+	// @cmember Get the next instruction that has not been deleted
+
+	size_t GetNextInstruction (size_t nInstruction) const;
+
+	// @cmember Get the instruction a branch currently lands on
+
+	size_t GetBranchTarget (size_t nInstruction);
+
+	// @cmember Delete an instruction
+
+	void DeleteInstruction (size_t nInstruction);
+
+	// @cmember Replace a branch with a RETN
+
+	void ReplaceWithRETN (size_t nInstruction);
+
+	// @cmember Translate a code offset from before the peephole pass
+
+	size_t RemapOffset (size_t nOffset) const;
+
 	// @cmember Code a copy
 
 	bool CodeCP (NscCode nCode, int nStackSize, int nCount);
@@ -238,11 +447,15 @@ protected:
 
 	// @cmember Define a forward label for conditionals
 
-	void ForwardLabel (char *pszRoutine);
+	int ForwardLabel ();
 
 	// @cmember Resolve a forward label
 
-	void ForwardResolve (const char *pszRoutine);
+	void ForwardResolve (int nLabel);
+
+	// @cmember Reference a forward label
+
+	void ReferenceLabel (int nLabel);
 
 	// @cmember Define a linker label
 
@@ -256,6 +469,23 @@ protected:
 
 	static void GetDebugTypeText (NscType nType, char *pszText);
 
+	// @cmember Write a function record to the debug file
+
+	static void WriteDebugFunction (CNscDebugTextWriter &sText, 
+		size_t nCompiledStart, size_t nCompiledEnd, int nArgCount, 
+		NscType nType, const char *pszName);
+
+	// @cmember Write the argument records of a function to the debug file
+
+	static void WriteDebugArguments (CNscDebugTextWriter &sText, 
+		unsigned char *pauchArgData, int nArgCount);
+
+	// @cmember Write a variable record to the debug file
+
+	static void WriteDebugVariable (CNscDebugTextWriter &sText, 
+		size_t nCompiledStart, size_t nCompiledEnd, int nStackOffset, 
+		NscType nType, const char *pszName);
+
 	// @cmember Purge local variables to the given depth
 
 	void PurgeVariables (int nDepth);
@@ -386,6 +616,14 @@ protected:
 
 	bool					m_fGlobalScope;
 
+	// @cmember If true, we are inside an inlined call
+
+	bool					m_fInlinedFrame;
+
+	// @cmember If true, the next call is coded as a tail call
+
+	bool					m_fTailCall;
+
 	// @cmember If true, we are producing an NDB file
 
 	bool					m_fMakeDebugFile;
@@ -410,9 +648,13 @@ protected:
 
 	int						m_nContinueBlockDepth;
 
-	// @cmember Current label index
+	// @cmember Forward labels
 
-	int						m_nNextLabel;
+	std::vector <Label>		m_asLabels;
+
+	// @cmember Unresolved references of the forward labels
+
+	std::vector <LabelLink>	m_asLabelLinks;
 
 	// @cmember Size of the return value
 
@@ -422,25 +664,30 @@ protected:
 
 	int						m_nArgumentSize;
 
+	// @cmember Stack depth of the current frame within the routine 
+	//		(non-zero inside an inlined call)
+
+	int						m_nFrameBase;
+
 	// @cmember Linker symbol table
 
 	CNscSymbolTable			m_sLinker;
 
 	// @cmember Pointer to the current return label
 
-	char					*m_pszReturnLabel;
+	int						m_nReturnLabel;
 
 	// @cmember Break label
 
-	char					*m_pszBreakLabel;
+	int						m_nBreakLabel;
 
 	// @cmember Continue label
 
-	char					*m_pszContinueLabel;
+	int						m_nContinueLabel;
 
 	// @cmember Located default label
 
-	char					*m_pszDefaultLabel;
+	int						m_nDefaultLabel;
 
 	// @cmember Current position in the code
 
@@ -450,6 +697,11 @@ protected:
 
 	unsigned char			*m_pauchCode;
 
+	// @cmember Workspace the code buffer, linker, local symbols and line 
+	//		table were taken from (or NULL)
+
+	NscCompileWorkspace		*m_pWorkspace;
+
 	// @cmember Pointer to the end
 
 	unsigned char			*m_pauchCodeEnd;
@@ -484,6 +736,34 @@ protected:
 
 	std::vector <Line>		m_asLines;
 
+	// @cmember Text of the debug file
+
+	std::vector <char>		m_achDebugText;
+
+	// @cmember Sorted list of the functions to be inlined
+
+	std::vector <size_t>	m_anInlineFunctions;
+
+	// @cmember List of the inlined calls
+
+	std::vector <InlinedFrame> m_asInlinedFrames;
+
+	// @cmember List of the pure values computed into the stack
+
+	std::vector <PureValue>	m_asPureValues;
+
+	// @cmember Types of the locals of finished blocks still on the stack
+
+	std::vector <NscType>	m_anFreeSlots;
+
+	// @cmember Statement list about to be coded by a block
+
+	unsigned char			*m_pauchBlockList;
+
+	// @cmember Instructions decoded by the peephole pass
+
+	std::vector <Instruction> m_asInstructions;
+
 	// @cmember Stack of entered into function symbols for GatherUsed.
 
 	CSymbolStack			m_sFunctionsEntered;
@@ -492,6 +772,10 @@ protected:
 
 	int						m_nVersion;
 
+	// @cmember Time spent writing the debug file, in nanoseconds
+
+	UINT64					m_ulSymbolsTime;
+
 	//
 	// OPTIMIZATION FLAGS
 	//
@@ -539,6 +823,34 @@ protected:
 	// @cmember If true, optimize conditionals
 
 	bool					m_fOptConditional;
+
+	// @cmember If true, select switch cases with a comparison tree
+
+	bool					m_fOptSwitch;
+
+	// @cmember If true, inline small functions
+
+	bool					m_fOptInline;
+
+	// @cmember If true, reuse the results of pure calls
+
+	bool					m_fOptPure;
+
+	// @cmember If true, reuse the stack slots of finished blocks
+
+	bool					m_fOptSlots;
+
+	// @cmember If true, run the peephole pass over the generated code
+
+	bool					m_fOptPeephole;
+
+	// @cmember If true, fold the values of constant globals into expressions
+
+	bool					m_fOptConstants;
+
+	// @cmember If true, code tail calls and inline return epilogues
+
+	bool					m_fOptTailReturn;
 };
 
 #endif // ETS_NSCCODEGENERATOR_H
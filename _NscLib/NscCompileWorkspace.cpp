@@ -0,0 +1,365 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscCompileWorkspace.cpp - Reusable compile buffers |
+//
+// This module contains the compile workspace.  Each buffer is handed to
+// the compilation at its start and taken back at its end.  On the way back
+// the workspace records the buffer's high-water mark and, once per shrink
+// interval, frees a buffer that has grown far beyond what recent
+// compilations needed, so that one large script does not pin its memory
+// for the rest of a batch.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "Nsc.h"
+#include "NscPStackEntry.h"
+#include "NscCompileWorkspace.h"
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscCompileWorkspace> constructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscCompileWorkspace::NscCompileWorkspace ()
+{
+	m_pauchCode = NULL;
+	m_nCodeSize = NscInitialScript;
+	m_pauchCodeTaken = NULL;
+	memset (&m_sCodeUsage, 0, sizeof (m_sCodeUsage));
+	memset (m_anTableAllocated, 0, sizeof (m_anTableAllocated));
+	memset (m_asTableUsage, 0, sizeof (m_asTableUsage));
+	m_nEntries = 0;
+	memset (&m_sEntryUsage, 0, sizeof (m_sEntryUsage));
+	m_nLinesCapacity = 0;
+	memset (&m_sLineUsage, 0, sizeof (m_sLineUsage));
+	m_nDebugTextCapacity = 0;
+	memset (&m_sDebugTextUsage, 0, sizeof (m_sDebugTextUsage));
+	memset (&m_sStatistics, 0, sizeof (m_sStatistics));
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscCompileWorkspace> destructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscCompileWorkspace::~NscCompileWorkspace ()
+{
+	if (m_pauchCode)
+		delete [] m_pauchCode;
+	while (m_listEntryFree .GetNext () != &m_listEntryFree)
+	{
+		CNwnDoubleLinkList *pNext = m_listEntryFree .GetNext ();
+		CNscPStackEntry *pEntry = (CNscPStackEntry *) pNext;
+		delete pEntry;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Record a use of a buffer and test if it should be shrunk
+//
+// @parm Usage & | sUsage | Usage of the buffer
+//
+// @parm size_t | nUsed | Amount of the buffer used by the compilation
+//
+// @parm size_t | nAllocated | Allocated size of the buffer
+//
+// @parm size_t | nMinimum | Size below which the buffer is never shrunk
+//
+// @parm size_t * | pnShrinkTo | Receives the size to shrink to
+//
+// @rdesc TRUE if the buffer should be shrunk.
+//
+//-----------------------------------------------------------------------------
+
+bool NscCompileWorkspace::TestShrink (Usage &sUsage, size_t nUsed,
+	size_t nAllocated, size_t nMinimum, size_t *pnShrinkTo)
+{
+	if (nUsed > sUsage .nPeak)
+		sUsage .nPeak = nUsed;
+	if (++sUsage .nUses < ShrinkInterval)
+		return false;
+
+	//
+	// End of the interval, test the high-water mark and start over
+	//
+
+	size_t nPeak = sUsage .nPeak;
+	sUsage .nPeak = 0;
+	sUsage .nUses = 0;
+	if (nPeak < nMinimum)
+		nPeak = nMinimum;
+	if (nAllocated <= nPeak * ShrinkFactor)
+		return false;
+	*pnShrinkTo = nPeak;
+	m_sStatistics .Shrinks++;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Take the code buffer
+//
+// @parm size_t * | pnSize | Receives the size of the buffer
+//
+// @rdesc Pointer to the buffer.  The caller owns the buffer (and may
+//		replace it with a larger one allocated by new []) until it is
+//		handed back by ReleaseCode.
+//
+//-----------------------------------------------------------------------------
+
+unsigned char *NscCompileWorkspace::AcquireCode (size_t *pnSize)
+{
+	if (m_pauchCode == NULL)
+	{
+		m_pauchCode = new unsigned char [m_nCodeSize];
+		m_sStatistics .CodeAllocations++;
+	}
+	m_pauchCodeTaken = m_pauchCode;
+	m_pauchCode = NULL;
+	*pnSize = m_nCodeSize;
+	return m_pauchCodeTaken;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Return the code buffer
+//
+// @parm unsigned char * | pauchCode | Buffer being returned
+//
+// @parm size_t | nSize | Size of the buffer
+//
+// @parm size_t | nUsed | Number of bytes of code generated
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::ReleaseCode (unsigned char *pauchCode,
+	size_t nSize, size_t nUsed)
+{
+	assert (m_pauchCode == NULL);
+	if (pauchCode != m_pauchCodeTaken)
+		m_sStatistics .CodeAllocations++;
+	m_pauchCodeTaken = NULL;
+
+	//
+	// Keep the buffer unless it is much larger than recently needed
+	//
+
+	size_t nShrinkTo;
+	if (TestShrink (m_sCodeUsage, nUsed, nSize, NscInitialScript, &nShrinkTo))
+	{
+		delete [] pauchCode;
+		m_nCodeSize = nShrinkTo;
+		return;
+	}
+	m_pauchCode = pauchCode;
+	m_nCodeSize = nSize;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap a kept symbol table into the given (empty) table
+//
+// @parm Table | nTable | Symbol table to take
+//
+// @parm CNscSymbolTable & | sTable | Table receiving the kept one
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::AcquireTable (Table nTable, CNscSymbolTable &sTable)
+{
+	CNscSymbolTable &sKept = m_asTables [nTable];
+	sKept .Reset ();
+	sTable .Swap (sKept);
+	m_anTableAllocated [nTable] = sTable .GetAllocated ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap a symbol table back into the workspace
+//
+// @parm Table | nTable | Symbol table to return
+//
+// @parm CNscSymbolTable & | sTable | Table holding the kept one
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::ReleaseTable (Table nTable, CNscSymbolTable &sTable)
+{
+	CNscSymbolTable &sKept = m_asTables [nTable];
+	if (sTable .GetAllocated () != m_anTableAllocated [nTable])
+		m_sStatistics .SymbolTableAllocations++;
+	sTable .Swap (sKept);
+	size_t nShrinkTo;
+	if (TestShrink (m_asTableUsage [nTable], sKept .GetSize (),
+		sKept .GetAllocated (), sKept .GetGrowSize (), &nShrinkTo))
+		sKept .Release ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Move the kept parser stack entries onto a free list
+//
+// @parm CNwnDoubleLinkList * | pList | Free list of the context
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::AcquireEntries (CNwnDoubleLinkList *pList)
+{
+	while (m_listEntryFree .GetNext () != &m_listEntryFree)
+	{
+		CNwnDoubleLinkList *pNext = m_listEntryFree .GetNext ();
+		CNscPStackEntry *pEntry = (CNscPStackEntry *) pNext;
+		pEntry ->m_link .InsertHead (pList);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Take back the parser stack entries of a free list
+//
+// @parm CNwnDoubleLinkList * | pList | Free list of the context.  All
+//		entries must have been freed.
+//
+// @parm size_t | nAllocated | Number of entries the context allocated
+//
+// @parm size_t | nPeak | Largest number of entries in use at once
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::ReleaseEntries (CNwnDoubleLinkList *pList,
+	size_t nAllocated, size_t nPeak)
+{
+	m_nEntries += nAllocated;
+	m_sStatistics .PStackEntryAllocations += nAllocated;
+
+	//
+	// Delete the entries beyond the high-water mark if the list is too long
+	//
+
+	size_t nKeep = m_nEntries;
+	TestShrink (m_sEntryUsage, nPeak, m_nEntries, 64, &nKeep);
+	while (pList ->GetNext () != pList)
+	{
+		CNwnDoubleLinkList *pNext = pList ->GetNext ();
+		CNscPStackEntry *pEntry = (CNscPStackEntry *) pNext;
+		if (m_nEntries > nKeep)
+		{
+			delete pEntry;
+			m_nEntries--;
+		}
+		else
+			pEntry ->m_link .InsertHead (&m_listEntryFree);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap the kept line table into the given (empty) table
+//
+// @parm std::vector <Line> & | asLines | Table receiving the kept one
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::AcquireLines (std::vector <Line> &asLines)
+{
+	m_asLines .clear ();
+	asLines .swap (m_asLines);
+	m_nLinesCapacity = asLines .capacity ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap a line table back into the workspace
+//
+// @parm std::vector <Line> & | asLines | Table holding the kept one
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::ReleaseLines (std::vector <Line> &asLines)
+{
+	if (asLines .capacity () != m_nLinesCapacity)
+		m_sStatistics .LineTableAllocations++;
+	asLines .swap (m_asLines);
+	size_t nShrinkTo;
+	if (TestShrink (m_sLineUsage, m_asLines .size (),
+		m_asLines .capacity (), 256, &nShrinkTo))
+	{
+		std::vector <Line> asShrunk;
+		asShrunk .reserve (nShrinkTo);
+		m_asLines .swap (asShrunk);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap the kept debug text buffer into the given (empty) one
+//
+// @parm std::vector <char> & | achText | Buffer receiving the kept one
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::AcquireDebugText (std::vector <char> &achText)
+{
+	achText .swap (m_achDebugText);
+	m_nDebugTextCapacity = achText .capacity ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Swap a debug text buffer back into the workspace
+//
+// @parm std::vector <char> & | achText | Buffer holding the kept one.  The
+//		size of the buffer is the amount of text written.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCompileWorkspace::ReleaseDebugText (std::vector <char> &achText)
+{
+	if (achText .capacity () != m_nDebugTextCapacity)
+		m_sStatistics .DebugTextAllocations++;
+	achText .swap (m_achDebugText);
+	size_t nShrinkTo;
+	if (TestShrink (m_sDebugTextUsage, m_achDebugText .size (), 
+		m_achDebugText .capacity (), 0x10000, &nShrinkTo))
+	{
+		std::vector <char> achShrunk;
+		achShrunk .reserve (nShrinkTo);
+		m_achDebugText .swap (achShrunk);
+	}
+}
@@ -0,0 +1,258 @@
+#ifndef ETS_NSCCOMPILEWORKSPACE_H
+#define ETS_NSCCOMPILEWORKSPACE_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscCompileWorkspace.h - Reusable compile buffers |
+//
+// This module contains the definition of the compile workspace.  The
+// workspace keeps the large buffers of a compilation (code buffer, symbol
+// tables, parser stack entries, line table and debug file text) between
+// compilations so
+// that a batch of scripts does not allocate and free them for each script.
+// A workspace is owned by a single compiler instance and must only be used
+// by one compilation at a time.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include "Nsc.h"
+#include "NwnDoubleLinkList.h"
+#include "NscSymbolTable.h"
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscCompileWorkspace
+{
+// @access Public types
+public:
+
+	//
+	// Symbol tables kept by the workspace.
+	//
+
+	enum Table
+	{
+		Table_Symbols,
+		Table_Linker,
+		Table_LocalSymbols,
+
+		Table_Count
+	};
+
+	//
+	// Debug line table entry of the code generator.
+	//
+
+	struct Line
+	{
+		int                 nFile;
+		int                 nLine;
+		size_t              nCompiledStart;
+		size_t              nCompiledEnd;
+	};
+
+	//
+	// Usage counters.  The allocation counters include a kept buffer that
+	// had to grow during a compilation.
+	//
+
+	struct Statistics
+	{
+		UINT64              Compiles;
+		UINT64              CodeAllocations;
+		UINT64              SymbolTableAllocations;
+		UINT64              PStackEntryAllocations;
+		UINT64              LineTableAllocations;
+		UINT64              DebugTextAllocations;
+		UINT64              Shrinks;
+	};
+
+	//
+	// A buffer is shrunk back to its high-water mark when, over the last
+	// ShrinkInterval uses, it was never more than 1/ShrinkFactor full.
+	//
+
+	enum
+	{
+		ShrinkInterval      = 32,
+		ShrinkFactor        = 4,
+	};
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscCompileWorkspace ();
+
+	// @cmember Destructor
+
+	~NscCompileWorkspace ();
+
+// @access Public methods
+public:
+
+	// @cmember Note the start of a compilation
+
+	void BeginCompile ()
+	{
+		m_sStatistics .Compiles++;
+	}
+
+	// @cmember Take the code buffer
+
+	unsigned char *AcquireCode (size_t *pnSize);
+
+	// @cmember Return the code buffer
+
+	void ReleaseCode (unsigned char *pauchCode, size_t nSize, size_t nUsed);
+
+	// @cmember Swap a kept symbol table into the given (empty) table
+
+	void AcquireTable (Table nTable, CNscSymbolTable &sTable);
+
+	// @cmember Swap a symbol table back into the workspace
+
+	void ReleaseTable (Table nTable, CNscSymbolTable &sTable);
+
+	// @cmember Move the kept parser stack entries onto a free list
+
+	void AcquireEntries (CNwnDoubleLinkList *pList);
+
+	// @cmember Take back the parser stack entries of a free list
+
+	void ReleaseEntries (CNwnDoubleLinkList *pList, size_t nAllocated,
+		size_t nPeak);
+
+	// @cmember Swap the kept line table into the given (empty) table
+
+	void AcquireLines (std::vector <Line> &asLines);
+
+	// @cmember Swap a line table back into the workspace
+
+	void ReleaseLines (std::vector <Line> &asLines);
+
+	// @cmember Swap the kept debug text buffer into the given (empty) one
+
+	void AcquireDebugText (std::vector <char> &achText);
+
+	// @cmember Swap a debug text buffer back into the workspace
+
+	void ReleaseDebugText (std::vector <char> &achText);
+
+	// @cmember Get the usage counters
+
+	void GetStatistics (Statistics &sStatistics) const
+	{
+		sStatistics = m_sStatistics;
+	}
+
+// @access Protected types
+protected:
+
+	//
+	// High-water mark of a buffer over the current shrink interval.
+	//
+
+	struct Usage
+	{
+		size_t              nPeak;
+		int                 nUses;
+	};
+
+// @access Protected methods
+protected:
+
+	// @cmember Record a use of a buffer and test if it should be shrunk
+
+	bool TestShrink (Usage &sUsage, size_t nUsed, size_t nAllocated,
+		size_t nMinimum, size_t *pnShrinkTo);
+
+// @access Protected members
+protected:
+
+	// @cmember Kept code buffer (NULL while taken or after a shrink)
+
+	unsigned char               *m_pauchCode;
+
+	// @cmember Size of the kept code buffer (or of the next one)
+
+	size_t                      m_nCodeSize;
+
+	// @cmember Code buffer handed out
+
+	unsigned char               *m_pauchCodeTaken;
+
+	// @cmember Code buffer usage
+
+	Usage                       m_sCodeUsage;
+
+	// @cmember Kept symbol tables
+
+	CNscSymbolTable             m_asTables [Table_Count];
+
+	// @cmember Allocated size of the symbol tables when handed out
+
+	size_t                      m_anTableAllocated [Table_Count];
+
+	// @cmember Symbol table usage
+
+	Usage                       m_asTableUsage [Table_Count];
+
+	// @cmember Kept parser stack entries
+
+	CNwnDoubleLinkList          m_listEntryFree;
+
+	// @cmember Number of kept parser stack entries
+
+	size_t                      m_nEntries;
+
+	// @cmember Parser stack entry usage
+
+	Usage                       m_sEntryUsage;
+
+	// @cmember Kept line table
+
+	std::vector <Line>          m_asLines;
+
+	// @cmember Capacity of the line table when handed out
+
+	size_t                      m_nLinesCapacity;
+
+	// @cmember Line table usage
+
+	Usage                       m_sLineUsage;
+
+	// @cmember Kept debug text buffer
+
+	std::vector <char>          m_achDebugText;
+
+	// @cmember Capacity of the debug text buffer when handed out
+
+	size_t                      m_nDebugTextCapacity;
+
+	// @cmember Debug text buffer usage
+
+	Usage                       m_sDebugTextUsage;
+
+	// @cmember Usage counters
+
+	Statistics                  m_sStatistics;
+};
+
+#endif // ETS_NSCCOMPILEWORKSPACE_H
@@ -39,10 +39,12 @@
 //-----------------------------------------------------------------------------
 
 #include <vector>
+#include <chrono>
 #include "Precomp.h"
 #include "Nsc.h"
 #include "NscContext.h"
 #include "NscCodeGenerator.h"
+#include "NscTrace.h"
 #include "NscIntrinsicDefs.h"
 #include "../_NwnUtilLib/easylogging++.h"
 
@@ -101,6 +103,8 @@ bool NscCompilerInitialize (CNwnLoader *pLoader, int nVersion,
 {
 	fEnableExtensions; //4100
 
+	NscTraceScope sTrace ("nwscript.nss initialization", "parse");
+
 	//
 	// Reset 
 	//
@@ -303,7 +307,11 @@ NscResult NscCompileScript (CNwnLoader *pLoader, const char *pszName,
 	// Initialize context
 	//
 
+	NscCompileWorkspace *pWorkspace = 
+		&pCompiler ->NscGetCompilerState () ->m_sWorkspace;
+	pWorkspace ->BeginCompile ();
 	CNscContext sCtx (pCompiler);
+	sCtx .SetWorkspace (pWorkspace);
 	sCtx .SetLoader (pLoader);
 	sCtx .LoadSymbolTable (&pCompiler ->NscGetCompilerState () ->m_sNscNWScript);
     sCtx.SetDisableNwnEeEscape(false);
@@ -374,10 +382,18 @@ NscResult NscCompileScript (CNwnLoader *pLoader, const char *pszName,
 		return NscResult_Failure;
 	}
 
-	sCtx .AddStream (pStream);
+	NscCompileTimings *pTimings = 
+		&pCompiler ->NscGetCompilerState () ->m_sTimings;
+	UINT64 ulStart = NscGetTimestamp ();
+
+	{
+		NscTraceScope sTrace ("Phase 1 parse", "parse", pszFullName);
+		sCtx .AddStream (pStream);
         //sCtx.yydebug = 1;
-	sCtx .SetupPreprocessor ();
-	sCtx .parse ();
+		sCtx .SetupPreprocessor ();
+		sCtx .parse ();
+	}
+	pTimings ->Phase1Time = NscGetTimestamp () - ulStart;
 	if (sCtx .GetErrors () > 0)
 	{
 		if (fAllocated)
@@ -400,13 +416,18 @@ NscResult NscCompileScript (CNwnLoader *pLoader, const char *pszName,
 	// PHASE 2
 	//
 
-	pStream = new CNwnMemoryStream 
-		(pszFullName, pauchData, ulSize, fAllocated);
-	sCtx .ClearFiles ();
-	sCtx .AddStream (pStream);
-	sCtx .SetPhase2 (true);
-	sCtx .SetupPreprocessor ();
-	sCtx .parse ();
+	ulStart = NscGetTimestamp ();
+	{
+		NscTraceScope sTrace ("Phase 2 parse", "parse", pszFullName);
+		pStream = new CNwnMemoryStream 
+			(pszFullName, pauchData, ulSize, fAllocated);
+		sCtx .ClearFiles ();
+		sCtx .AddStream (pStream);
+		sCtx .SetPhase2 (true);
+		sCtx .SetupPreprocessor ();
+		sCtx .parse ();
+	}
+	pTimings ->Phase2Time = NscGetTimestamp () - ulStart;
 	if (sCtx .GetErrors () > 0) {
             return NscResult_Failure;
         }
@@ -415,11 +436,28 @@ NscResult NscCompileScript (CNwnLoader *pLoader, const char *pszName,
 	// Generate the output
 	//
 
-	CNscCodeGenerator sGen (&sCtx, nVersion, fEnableOptimizations);
+	int nOptimizationLevel = 0;
+	if (fEnableOptimizations)
+	{
+		nOptimizationLevel = (ulCompilerFlags & 
+			NscCompilerFlag_OptimizeLevel2) != 0 ? 2 : 1;
+	}
+	CNscCodeGenerator sGen (&sCtx, nVersion, nOptimizationLevel);
 
 	try
 	{
-		if (sGen .GenerateOutput (pCodeOutput, pDebugOutput, fIgnoreIncludes))
+		ulStart = NscGetTimestamp ();
+		bool fGenerated;
+		{
+			NscTraceScope sTrace ("Code generation", "codegen", pszFullName);
+			fGenerated = sGen .GenerateOutput (pCodeOutput, 
+				pDebugOutput, fIgnoreIncludes);
+		}
+		pTimings ->SymbolsTime = sGen .GetSymbolsTime ();
+		pTimings ->CodeGenerationTime = NscGetTimestamp () - ulStart - 
+			pTimings ->SymbolsTime;
+
+		if (fGenerated)
 		{
 			//
 			// If using the -c flag, prevent creating a compiled file.
@@ -546,6 +584,20 @@ const char *NscGetActionName (int nAction, NscCompiler *pCompiler)
 	}
 }
 
+//-----------------------------------------------------------------------------
+//
+// @func Return a timestamp for measuring the time of a stage
+//
+// @rdesc Nanoseconds from an arbitrary but fixed point in time.
+//
+//-----------------------------------------------------------------------------
+
+UINT64 NscGetTimestamp ()
+{
+	return (UINT64) std::chrono::duration_cast <std::chrono::nanoseconds> (
+		std::chrono::steady_clock::now () .time_since_epoch ()) .count ();
+}
+
 //----------------------------------------------------------------------------
 //
 // Functions to hand off parser callbacks to the context class
@@ -616,6 +668,7 @@ NscCompiler::NscCompiler (
   m_ResLoadFile (NULL),
   m_ResUnloadFile (NULL),
   m_CacheResources (true),
+  m_ResourceCache (new NscResourceCache ()),
   m_ErrorOutput (NULL)
 {
 	m_CompilerState ->m_fSaveSymbolTable = SaveSymbolTable;
@@ -632,7 +685,7 @@ NscCompiler::NscCompiler (
 NscCompiler::~NscCompiler ()
 {
 	delete m_CompilerState;
-	NscFlushResourceCache ();
+	NscReleasePinnedResources ();
 }
 
 //-----------------------------------------------------------------------------
@@ -841,16 +894,114 @@ NscCompiler::NscCompileScript (
 {
 	Code.clear ();
 	DebugSymbols.clear ();
+
+	CNwnVectorStream CodeStream (Code);
+	CNwnVectorStream SymbolsStream (DebugSymbols);
+	NscResult        Result;
+
+	Result = NscCompileScript (ScriptName,
+		ScriptText,
+		ScriptTextLength,
+		CompilerVersion,
+		Optimize,
+		IgnoreIncludes,
+		ErrorOutput,
+		CompilerFlags,
+		&CodeStream,
+		&SymbolsStream,
+		Dependencies);
+
+	//
+	// Only NscResult_Success actually returns output that is meaningful, so
+	// throw away anything that may have been partially written otherwise.
+	//
+
+	if (Result != NscResult_Success)
+	{
+		Code.clear ();
+		DebugSymbols.clear ();
+	}
+
+	return Result;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Compile a script (from memory) to caller supplied output streams.
+//		The code and the debug symbols are written straight to the streams;
+//		no debug symbols are generated if no symbols stream is given.  The
+//		streams may have received partial output if the compilation fails.
+//
+// @parm const NWN::ResRef32 | ScriptName | Supplies the script resource name.
+//
+// @parm const void * | ScriptText | Supplies the script source text to
+//                                   compile.
+//
+// @parm size_t | ScriptTextLength | Supplies the length, in bytes, of the
+//                                   script source text.
+//
+// @parm int | CompilerVersion | Supplies the Bioware-compatible compiler
+//                               version.
+//
+// @parm bool | Optimize | Supplies true if optimizations are enabled.
+//
+// @parm bool | IgnoreIncludes | Supplies true if include scripts are not
+//                               compiled.
+//
+// @parm IDebugTextOut * | ErrorOutput | Receives any error text from the
+//                                       compilation attempt.
+//
+// @parm UINT32 | CompilerFlags | Supplies compiler control flags.
+//
+// @parm CNwnStream * | CodeOutput | Receives the compiled instructions.
+//
+// @parm CNwnStream * | SymbolsOutput | Receives the symbolic debugging
+//                                      information.  (Can be NULL)
+//
+// @parm std::set<std::string> | Dependencies | Receives the resources loaded
+//                                                  while compiling
+// @rdesc Result of the compilation.
+//
+//-----------------------------------------------------------------------------
+
+NscResult
+NscCompiler::NscCompileScript (
+	 const NWN::ResRef32 & ScriptName,
+	 const void * ScriptText,
+	 size_t ScriptTextLength,
+	 int CompilerVersion,
+	 bool Optimize,
+	 bool IgnoreIncludes,
+	 IDebugTextOut * ErrorOutput,
+	 UINT32 CompilerFlags,
+	 CNwnStream * CodeOutput,
+	 CNwnStream * SymbolsOutput,
+	 std::set<std::string> & Dependencies
+	)
+{
 	Dependencies.clear ();
 	g_Resources.clear ();
 
 	//
-	// If we haven't yet initialized the compiler, do so now.
+	// If we haven't yet initialized the compiler, do so now.  The loads of
+	// nwscript.nss are not counted as include loads of the script.
 	//
 
-	if (!NscCompilerInitialize (CompilerVersion,
+	NscCompileTimings & Timings = m_CompilerState ->m_sTimings;
+	bool                WasInitialized = m_Initialized;
+	UINT64              InitStart = NscGetTimestamp ();
+	bool                Initialized;
+
+	Initialized = NscCompilerInitialize (CompilerVersion,
 		m_EnableExtensions,
-		ErrorOutput))
+		ErrorOutput);
+
+	memset (&Timings, 0, sizeof (Timings));
+
+	if (!WasInitialized)
+		Timings .NWScriptInitTime = NscGetTimestamp () - InitStart;
+
+	if (!Initialized)
 	{
 		if (ErrorOutput != NULL)
 		{
@@ -864,8 +1015,6 @@ NscCompiler::NscCompileScript (
 	try
 	{
 		std::string      ScriptNameStr;
-		CNwnMemoryStream CodeStream;
-		CNwnMemoryStream SymbolsStream;
 		NscResult        Result;
 
 		ScriptNameStr  = m_ResourceManager .StrFromResRef (ScriptName);
@@ -892,12 +1041,14 @@ NscCompiler::NscCompileScript (
 			CompilerVersion,
 			Optimize,
 			IgnoreIncludes,
-			&CodeStream,
-			&SymbolsStream,
+			CodeOutput,
+			SymbolsOutput,
 			ErrorOutput,
 			this,
 			CompilerFlags);
 
+		NscReleasePinnedResources ();
+
 		m_ErrorOutput = NULL;
 		m_ShowIncludes = false;
 		m_GenerateMakeDeps = false;
@@ -905,36 +1056,12 @@ NscCompiler::NscCompileScript (
         m_StrictModeEnabled = false;
         m_SuppressWarnings = false;
 
-		//
-		// Only NscResult_Success actually returns output that is meaningful, so
-		// throw away anything that may have been partially written otherwise.
-		//
-
 		if (Result != NscResult_Success)
 			return Result;
 
-		//
-		// Now convert the result to the standard output format and call it done.
-		//
-
-		CodeStream .Flush ();
-		SymbolsStream .Flush ();
-
-		if (CodeStream .GetLength () != 0)
-		{
-			Code.resize (CodeStream .GetLength ());
-
-			memcpy (&Code [0], CodeStream .GetData (), Code .size ());
-		}
-
-		if (SymbolsStream .GetLength () != 0)
-		{
-			DebugSymbols.resize (SymbolsStream .GetLength ());
-
-			memcpy (&DebugSymbols [0],
-				SymbolsStream .GetData (),
-				DebugSymbols .size ());
-		}
+		CodeOutput ->Flush ();
+		if (SymbolsOutput != NULL)
+			SymbolsOutput ->Flush ();
 
 		if (NscGetCompilerState () ->m_fSaveSymbolTable)
 			m_SymbolTableReady = true;
@@ -945,6 +1072,8 @@ NscCompiler::NscCompileScript (
 	}
 	catch (std::exception &e)
 	{
+		NscReleasePinnedResources ();
+
 		if (ErrorOutput != NULL)
 		{
 			ErrorOutput ->WriteText ("Exception compiling '%s.ncs': '%s'\n",
@@ -977,14 +1106,75 @@ NscCompiler::NscDisassembleScript (
 	 std::string & Disassembly
 	)
 {
-	CNwnMemoryStream MemStream;
-
 	Disassembly .clear ();
 
 	//
-	// Initialize but ensure we'll do a real initialize later, if we have not
-	// already.  We do not have all of the state necessary here to support a
-	// full initialize (yet).
+	// The disassembly only needs the names of the actions, so scan the
+	// prototypes of nwscript.nss instead of parsing it
+	//
+
+	NscActionTable &sActions = m_CompilerState ->m_sActionTable;
+	if (!sActions .IsLoaded ())
+	{
+		bool fAllocated;
+		UINT32 ulSize;
+		unsigned char *pauchData = LoadResource ("nwscript",
+			NwnResType_NSS, &ulSize, &fAllocated);
+		if (pauchData == NULL)
+		{
+			Disassembly = "DISASSEMBLY ERROR:  UNABLE TO LOCATE NWSCRIPT.NSS";
+			return;
+		}
+		sActions .Scan (pauchData, ulSize);
+		if (fAllocated)
+			free (pauchData);
+	}
+
+	//
+	// A line is about a dozen times the size of its instruction
+	//
+
+	Disassembly .reserve (CodeLength * 12);
+	::NscScriptDecompile (Disassembly,
+		(const unsigned char *) Code,
+		CodeLength,
+		sActions);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Verify a compiled script.
+//
+// @parm const char * | ScriptName | Supplies the name of the script, for
+//		the error messages
+//
+// @parm const void * | Code | Supplies the compiled script
+//
+// @parm size_t | CodeLength | Supplies the length of the compiled script
+//
+// @parm const void * | Symbols | Supplies the debug symbols, if any
+//
+// @parm size_t | SymbolsLength | Supplies the length of the debug symbols
+//
+// @parm IDebugTextOut * | TextOut | Receives the errors
+//
+// @rdesc Returns true if the script verified.
+//
+//-----------------------------------------------------------------------------
+
+bool
+NscCompiler::NscVerifyScript (
+	 const char * ScriptName,
+	 const void * Code,
+	 size_t CodeLength,
+	 const void * Symbols,
+	 size_t SymbolsLength,
+	 IDebugTextOut * TextOut
+	)
+{
+
+	//
+	// The stack use of the actions comes from nwscript.nss
 	//
 
 	if (!m_NWScriptParsed)
@@ -995,25 +1185,92 @@ NscCompiler::NscDisassembleScript (
 			NULL,
 			this))
 		{
-			Disassembly = "DISASSEMBLY ERROR:  COMPILER INITIALIZATION FAILED";
-			return;
+			TextOut ->WriteText ("%s.ncs: Error: Verification failed: "
+				"compiler initialization failed\n", ScriptName);
+			return false;
 		}
 
 		m_NWScriptParsed = true;
 	}
 
-	::NscScriptDecompile (MemStream,
-		(unsigned char *) Code,
-		(unsigned long) CodeLength,
-		this);
+	return m_CompilerState ->m_sVerifier .Verify (this,
+		ScriptName,
+		(const unsigned char *) Code,
+		CodeLength,
+		(const unsigned char *) Symbols,
+		SymbolsLength,
+		TextOut);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Analyze the static cost of a compiled script.
+//
+// @parm const char * | ScriptName | Supplies the name of the script
+//
+// @parm const void * | Code | Supplies the compiled script
+//
+// @parm size_t | CodeLength | Supplies the length of the compiled script
+//
+// @parm const void * | Symbols | Supplies the debug symbols, if any
+//
+// @parm size_t | SymbolsLength | Supplies the length of the debug symbols
+//
+// @parm NscScriptCost & | Cost | Receives the costs
+//
+// @rdesc Returns true if the script was analyzed.
+//
+//-----------------------------------------------------------------------------
+
+bool
+NscCompiler::NscAnalyzeScriptCost (
+	 const char * ScriptName,
+	 const void * Code,
+	 size_t CodeLength,
+	 const void * Symbols,
+	 size_t SymbolsLength,
+	 NscScriptCost & Cost
+	)
+{
+
+	//
+	// The action names come from nwscript.nss
+	//
+
+	if (!m_NWScriptParsed)
+	{
+		if (!::NscCompilerInitialize (this,
+			0,
+			m_EnableExtensions,
+			NULL,
+			this))
+			return false;
 
-	MemStream .Flush ();
+		m_NWScriptParsed = true;
+	}
 
-	if (MemStream .GetLength () == 0)
-		return;
+	//
+	// The stack depths come from a silent verification.  If the script does
+	// not verify, they are reported as unknown.
+	//
 
-	Disassembly .assign ((char *) MemStream .GetData (),
-		MemStream .GetLength ());
+	NscVerifier &sVerifier = m_CompilerState ->m_sVerifier;
+	bool fVerified = sVerifier .Verify (this,
+		ScriptName,
+		(const unsigned char *) Code,
+		CodeLength,
+		(const unsigned char *) Symbols,
+		SymbolsLength,
+		NULL);
+
+	return m_CompilerState ->m_sCostAnalyzer .Analyze (this,
+		fVerified ? &sVerifier : NULL,
+		ScriptName,
+		(const unsigned char *) Code,
+		CodeLength,
+		(const unsigned char *) Symbols,
+		SymbolsLength,
+		Cost);
 }
 
 //-----------------------------------------------------------------------------
@@ -1037,6 +1294,32 @@ NscCompiler::NscGetActionName (
 	return ::NscGetActionName (Action, this);
 }
 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Parse nwscript.nss, if not yet done.
+//
+// @parm int | CompilerVersion | Bioware-compatible compiler version
+//
+// @parm IDebugTextout * | TextOut | Error text sink for nwscript.nss compile
+//
+// @rdesc Returns true on success, else false on failure.
+//
+//-----------------------------------------------------------------------------
+
+bool
+NscCompiler::NscParseNWScript (
+	 int CompilerVersion,
+	 IDebugTextOut * TextOut
+	)
+{
+	if (m_NWScriptParsed)
+		return true;
+
+	return NscCompilerInitialize (CompilerVersion,
+		m_EnableExtensions,
+		TextOut);
+}
+
 //-----------------------------------------------------------------------------
 //
 // @mfunc Return the prototype of an action service handler.
@@ -1227,6 +1510,55 @@ NscCompiler::NscSetResourceCacheEnabled (
 		NscFlushResourceCache ();
 }
 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Share a resource cache with other compiler instances.
+//
+// @parm const std::shared_ptr< NscResourceCache > & | Cache | Supplies the
+//                                                     cache to use.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void
+NscCompiler::NscSetResourceCache (
+	 const std::shared_ptr< NscResourceCache > & Cache
+	)
+{
+	m_ResourceCache = Cache;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Return the compile workspace of the compiler.
+//
+// @rdesc Reference to the workspace.
+//
+//-----------------------------------------------------------------------------
+
+const NscCompileWorkspace &
+NscCompiler::NscGetCompileWorkspace (
+	) const
+{
+	return m_CompilerState ->m_sWorkspace;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Return the stage timings of the last compilation.
+//
+// @rdesc Reference to the timings.
+//
+//-----------------------------------------------------------------------------
+
+const NscCompileTimings &
+NscCompiler::NscGetCompileTimings (
+	) const
+{
+	return m_CompilerState ->m_sTimings;
+}
+
 
 //-----------------------------------------------------------------------------
 //
@@ -1253,6 +1585,7 @@ NscCompiler::LoadResource (
 	 bool * pfAllocated
 	)
 {
+	NscTraceScope                 Trace ("LoadResource", "include", pszName);
 	unsigned char               * FileContents;
 	ResourceManager::FileHandle   Handle;
 	size_t                        FileSize;
@@ -1276,21 +1609,59 @@ NscCompiler::LoadResource (
 	// If caching is enabled, query the existing cache first.
 	//
 
-	if (m_CacheResources)
+	//
+	// The returned contents are pinned until the compilation completes so
+	// that an eviction on behalf of another compiler sharing the cache does
+	// not free them while they are still being parsed.
+	//
+
+	if (m_CacheResources && m_ResourceCache)
 	{
-        ResourceCacheKey CacheKey;
+		NscResourceCache::Entry CacheEntry;
 
-		CacheKey .ResRef  = ResRef;
-		CacheKey .ResType = (NWN::ResType) nResType;
+		if (m_ResourceCache ->Lookup (ResRef,
+			(NWN::ResType) nResType,
+			CacheEntry))
+		{
+			bool AlreadyPinned = std::find (m_PinnedResources .begin (),
+				m_PinnedResources .end (),
+				CacheEntry .Contents) != m_PinnedResources .end ();
 
-		ResourceCache::const_iterator it = m_ResourceCache .find (CacheKey);
+			//
+			// The entry may have been loaded by another compilation or by a
+			// prefetcher, so report it as if it had been loaded now (once per
+			// compilation).
+			//
 
-		if (it != m_ResourceCache .end ())
-		{
-			*pulSize     = it ->second .Size;
+			if (!AlreadyPinned)
+			{
+				m_PinnedResources .push_back (CacheEntry .Contents);
+
+				if ((m_ShowIncludes) && (m_ErrorOutput != NULL) &&
+					!CacheEntry .Location .empty ())
+				{
+					m_ErrorOutput->WriteText ("ShowIncludes: Handled resource %s\n",
+						CacheEntry .Location .c_str ());
+				}
+			}
+
+			if (m_GenerateMakeDeps)
+			{
+				std::string::size_type Sep = CacheEntry .Location .find_last_of ('/');
+
+				// ignore .bif files when adding dependencies
+				if (Sep != std::string::npos &&
+					OsCompat::dirExists (CacheEntry .Location .substr (0, Sep) .c_str ()))
+				{
+					g_Resources.insert(CacheEntry .Location);
+				}
+			}
+
+			m_CompilerState ->m_sTimings .IncludeCacheHits++;
+
+			*pulSize     = CacheEntry .Size;
 			*pfAllocated = false;
-			//g_Resources.insert(it->second.Location);
-			return it ->second .Contents;
+			return CacheEntry .Contents .get ();
 		}
 	}
 
@@ -1766,38 +2137,46 @@ NscCompiler::NscCacheResource (
 	 const std::string & sLocation
 	)
 {
-	if (!m_CacheResources)
+	NscResourceCache::Entry Entry;
+
+	if (!m_CacheResources || !m_ResourceCache)
 		return false;
 
+	//
+	// Make room for the pin up front so that pinning cannot fail once the
+	// cache has taken ownership of the contents.
+	//
+
 	try
 	{
-		ResourceCacheKey   Key;
-		ResourceCacheEntry Entry;
-		bool               Inserted;
-
-		Key .ResRef  = ResRef;
-		Key .ResType = ResType;
-
-		Entry .Allocated = Allocated;
-		Entry .Contents  = ResFileContents;
-		Entry .Size      = ResFileLength;
-		Entry .Location  = sLocation;
-
-		Inserted = m_ResourceCache .insert (ResourceCache::value_type (Key, Entry)) .second;
-
-		assert (Inserted == true);
+		m_PinnedResources .reserve (m_PinnedResources .size () + 1);
 	}
 	catch (std::exception)
 	{
 		return false;
 	}
 
+	if (!m_ResourceCache ->Insert (ResRef,
+		ResType,
+		ResFileContents,
+		ResFileLength,
+		Allocated,
+		sLocation,
+		Entry))
+	{
+		return false;
+	}
+
+	m_PinnedResources .push_back (Entry .Contents);
+
 	return true;
 }
 
 //-----------------------------------------------------------------------------
 //
-// @mfunc Flush the resource cache.
+// @mfunc Flush the resource cache.  The resources pinned by this compiler
+//		are released; the cache itself is only emptied if no other compiler
+//		shares it.
 //
 // @rdesc None.
 //
@@ -1807,14 +2186,13 @@ void
 NscCompiler::NscFlushResourceCache (
 	)
 {
-	for (ResourceCache::iterator it = m_ResourceCache .begin ();
-		    it != m_ResourceCache .end ();
-		    ++it)
-	{
-		if (it ->second .Allocated)
-			free (it ->second .Contents);
-	}
-}
-
+	NscReleasePinnedResources ();
 
+	//
+	// A cache shared through NscSetResourceCache still serves the other
+	// compilers, so leave its entries to them.
+	//
 
+	if (m_ResourceCache && m_ResourceCache .use_count () == 1)
+		m_ResourceCache ->Flush ();
+}
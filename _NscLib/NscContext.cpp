@@ -121,6 +121,7 @@ CNscContext::CNscContext (NscCompiler *pCompiler)
 	m_fOptReturn = false;
 	m_fIncludeTerminatesComment = false;
 	m_fOptExpression = false;
+	m_fNoOptDeclarations = false;
 	m_nUsedFiles = 0;
 	m_pErrorStream = NULL;
 	m_fWarnAllowDefaultInitializedConstants = false;
@@ -133,6 +134,10 @@ CNscContext::CNscContext (NscCompiler *pCompiler)
 	m_nMaxFunctionParameterCount = INT_MAX;
 	m_nMaxIdentifierCount = INT_MAX;
 	m_DisableNwnEeEscape = false;
+	m_nEntriesAllocated = 0;
+	m_nEntriesInUse = 0;
+	m_nEntriesPeak = 0;
+	m_pWorkspace = NULL;
 }
 
 //-----------------------------------------------------------------------------
@@ -158,7 +163,22 @@ CNscContext::~CNscContext ()
 			pEntry ->m_pszFile, pEntry ->m_nLine);
 #endif
 		pEntry ->Free ();
-		delete pEntry;
+		if (m_pWorkspace)
+			pEntry ->m_link .InsertHead (&m_listEntryFree);
+		else
+			delete pEntry;
+	}
+
+	//
+	// Hand the entries and the symbol table back to the workspace
+	//
+
+	if (m_pWorkspace)
+	{
+		m_pWorkspace ->ReleaseEntries (&m_listEntryFree, 
+			m_nEntriesAllocated, m_nEntriesPeak);
+		m_pWorkspace ->ReleaseTable (NscCompileWorkspace::Table_Symbols,
+			m_sSymbols);
 	}
 
 	//
@@ -186,6 +206,26 @@ CNscContext::~CNscContext ()
 	ClearDefines ();
 }
 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Use the buffers of a compile workspace.  This must be done before
+//		anything is added to the context.
+//
+// @parm NscCompileWorkspace * | pWorkspace | Workspace to use
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void CNscContext::SetWorkspace (NscCompileWorkspace *pWorkspace)
+{
+	assert (m_pWorkspace == NULL);
+	m_pWorkspace = pWorkspace;
+	m_pWorkspace ->AcquireTable (NscCompileWorkspace::Table_Symbols, 
+		m_sSymbols);
+	m_pWorkspace ->AcquireEntries (&m_listEntryFree);
+}
+
 //----------------------------------------------------------------------------
 //
 // Construct the parser and call it
@@ -1889,9 +1929,16 @@ try_again:;
 
 					if (m_pLoader)
 					{
+						NscCompileTimings *pTimings = 
+							&GetCompilerState () ->m_sTimings;
+						UINT64 ulStart = NscGetTimestamp ();
+
 						pauchData = m_pLoader ->LoadResource (
 							pszTemp, NwnResType_NSS, &ulSize, 
 							&fAllocated);
+
+						pTimings ->IncludeTime += NscGetTimestamp () - ulStart;
+						pTimings ->IncludeLoads++;
 					}
 					if (pauchData == NULL)
 					{
@@ -2224,7 +2271,7 @@ try_again:;
 				memmove (pszTemp, pszSymbol, nCount);
 				pszTemp [nCount] = 0;
 
-				ProcessIfdef (pszSymbol, false);
+				ProcessIfdef (pszTemp, false);
 				goto try_again;
 			}
 			else if (strncmp (p, "#ifndef", 7) == 0 && GetPreprocessorEnabled ())
@@ -2272,7 +2319,7 @@ try_again:;
 				memmove (pszTemp, pszSymbol, nCount);
 				pszTemp [nCount] = 0;
 
-				ProcessIfdef (pszSymbol, true);
+				ProcessIfdef (pszTemp, true);
 				goto try_again;
 			}
 			else if (strncmp (p, "#if", 3) == 0 && GetPreprocessorEnabled ())
@@ -3432,7 +3479,12 @@ CNscPStackEntry *CNscContext::GetPStackEntryInt ()
 		pEntry = (CNscPStackEntry *) pNext;
 	}
 	else
+	{
 		pEntry = new CNscPStackEntry;
+		m_nEntriesAllocated++;
+	}
+	if (++m_nEntriesInUse > m_nEntriesPeak)
+		m_nEntriesPeak = m_nEntriesInUse;
 
 	//
 	// Add to the allocated list
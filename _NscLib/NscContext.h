@@ -52,6 +52,10 @@
 #include "NwnStreams.h"
 #include "NscPStackEntry.h"
 #include "NscSymbolTable.h"
+#include "NscCompileWorkspace.h"
+#include "NscVerifier.h"
+#include "NscCostAnalyzer.h"
+#include "NscActionTable.h"
 #define YYSTYPE CNscPStackEntry *
 #include "NscParser.hpp"
 
@@ -94,6 +98,11 @@ struct NscCompilerState
 	bool                          m_fSaveSymbolTable;
 	bool 						  m_SuppressWarnings;
 	bool						  m_EnableDoubleQuoteEscape;
+	NscCompileWorkspace           m_sWorkspace;
+	NscCompileTimings             m_sTimings;
+	NscVerifier                   m_sVerifier;
+	NscCostAnalyzer               m_sCostAnalyzer;
+	NscActionTable                m_sActionTable;
 
 	inline
 	NscCompilerState(
@@ -321,6 +330,7 @@ public:
 	{
 		pEntry ->Free ();
 		pEntry ->m_link .InsertHead (&m_listEntryFree);
+		m_nEntriesInUse--;
 	}
 
 	// @cmember Add a new prototype to the symbol table
@@ -784,6 +794,17 @@ public:
 		m_pLoader = pLoader;
 	}
 
+	// @cmember Use the buffers of a compile workspace
+
+	void SetWorkspace (NscCompileWorkspace *pWorkspace);
+
+	// @cmember Get the compile workspace (or NULL)
+
+	NscCompileWorkspace *GetWorkspace ()
+	{
+		return m_pWorkspace;
+	}
+
 	// @cmember TRUE if a main was found 
 
 	bool HasMain () const
@@ -1735,6 +1756,22 @@ protected:
 
 	CNwnDoubleLinkList		m_listEntryFree;
 
+	// @cmember Number of entries allocated by this context
+
+	size_t					m_nEntriesAllocated;
+
+	// @cmember Number of entries in use
+
+	size_t					m_nEntriesInUse;
+
+	// @cmember Largest number of entries in use at once
+
+	size_t					m_nEntriesPeak;
+
+	// @cmember Workspace supplying the reusable buffers (or NULL)
+
+	NscCompileWorkspace		*m_pWorkspace;
+
 	// @cmember My symbol table
 
 	CNscSymbolTable			m_sSymbols;
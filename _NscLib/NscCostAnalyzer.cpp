@@ -0,0 +1,513 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscCostAnalyzer.cpp - Static cost analyzer |
+//
+// This module contains the static cost analyzer.  Functions are taken from
+// the routine records of the debug symbols (the records of inlined calls,
+// which lie within another routine, are skipped), or else start at the
+// targets of JSR.  A loop is a backward branch within a function; branches
+// back to the same instruction belong to the same loop.  The stack depths
+// come from the verifier, which must have verified the same script.
+//
+// The cost of a function is the sum of the costs of its instructions, each
+// instruction costing one (an ACTION costing ActionWeight) times LoopWeight
+// for every loop that it is in.  It is only meant to rank functions.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "Nsc.h"
+#include "NscVerifier.h"
+#include "NscCostAnalyzer.h"
+#include "../_NwnDataLib/NWScriptReader.h"
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscCostAnalyzer> constructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscCostAnalyzer::NscCostAnalyzer ()
+{
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscCostAnalyzer> destructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscCostAnalyzer::~NscCostAnalyzer ()
+{
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Analyze a compiled script
+//
+// @parm NscCompiler * | pCompiler | Compiler supplying the action names
+//		(nwscript.nss must have been parsed)
+//
+// @parm const NscVerifier * | pVerifier | Verifier that verified the
+//		script, or NULL if the stack depths are not known
+//
+// @parm const char * | pszName | Name of the script
+//
+// @parm const unsigned char * | pauchCode | Compiled script, including
+//		the header
+//
+// @parm size_t | nCodeSize | Size of the compiled script
+//
+// @parm const unsigned char * | pauchSymbols | Debug symbols of the script
+//
+// @parm size_t | nSymbolsSize | Size of the debug symbols
+//
+// @parm NscScriptCost & | sCost | Receives the costs
+//
+// @rdesc true if the script could be decoded.
+//
+//-----------------------------------------------------------------------------
+
+bool NscCostAnalyzer::Analyze (NscCompiler *pCompiler,
+	const NscVerifier *pVerifier, const char *pszName,
+	const unsigned char *pauchCode, size_t nCodeSize,
+	const unsigned char *pauchSymbols, size_t nSymbolsSize,
+	NscScriptCost &sCost)
+{
+	sCost .strName = pszName;
+	sCost .asFunctions .clear ();
+	if (!Decode (pauchCode, nCodeSize))
+		return false;
+	SplitFunctions (pauchSymbols, nSymbolsSize, nCodeSize);
+
+	//
+	// Walk the functions
+	//
+
+	size_t nFirst = 0;
+	for (size_t nFunction = 0; nFunction < m_asFunctions .size (); nFunction++)
+	{
+		const Function &sFunction = m_asFunctions [nFunction];
+		while (nFirst < m_asInstructions .size () &&
+			m_asInstructions [nFirst] .nOffset < sFunction .nStart)
+			nFirst++;
+		size_t nLast = nFirst;
+		while (nLast < m_asInstructions .size () &&
+			m_asInstructions [nLast] .nOffset < sFunction .nEnd)
+			nLast++;
+		if (nFirst == nLast)
+			continue;
+
+		sCost .asFunctions .resize (sCost .asFunctions .size () + 1);
+		NscFunctionCost &sFunctionCost = sCost .asFunctions .back ();
+		sFunctionCost .strName = sFunction .strName;
+		sFunctionCost .nOffset = sFunction .nStart;
+		sFunctionCost .nSize = m_asInstructions [nLast - 1] .nOffset +
+			m_asInstructions [nLast - 1] .nLength - sFunction .nStart;
+		sFunctionCost .nInstructions = (int) (nLast - nFirst);
+		memset (sFunctionCost .anClassCounts, 0,
+			sizeof (sFunctionCost .anClassCounts));
+		sFunctionCost .nLoopNesting = FindLoops (nFirst, nLast);
+		sFunctionCost .nCost = 0;
+
+		int nMaxDepth = 0;
+		for (size_t i = nFirst; i < nLast; i++)
+		{
+			const Instruction &sInstruction = m_asInstructions [i];
+			NscOpcodeClass nClass = GetOpcodeClass (sInstruction .cOp);
+			sFunctionCost .anClassCounts [nClass]++;
+
+			//
+			// Count the action by name
+			//
+
+			UINT64 nCost = 1;
+			if (nClass == NscOpcodeClass_Action)
+			{
+				const char *pszAction = pCompiler ->NscGetActionName (
+					sInstruction .lOperand);
+				char szAction [32];
+				if (pszAction == NULL || pszAction [0] == 0)
+				{
+					snprintf (szAction, _countof (szAction), "Action%d",
+						(int) sInstruction .lOperand);
+					pszAction = szAction;
+				}
+				sFunctionCost .mapActions [pszAction]++;
+				nCost = ActionWeight;
+			}
+
+			//
+			// Weigh the instruction by its loops
+			//
+
+			int nLoops = std::min (sInstruction .nLoopNesting,
+				(int) MaxLoopWeighting);
+			for (int j = 0; j < nLoops; j++)
+				nCost *= LoopWeight;
+			sFunctionCost .nCost += nCost;
+
+			//
+			// Track the stack depth (unreachable code has none)
+			//
+
+			int nDepth;
+			if (pVerifier != NULL &&
+				pVerifier ->GetDepth (sInstruction .nOffset, nDepth))
+				nMaxDepth = std::max (nMaxDepth, nDepth);
+		}
+		sFunctionCost .nMaxStackDepth = pVerifier != NULL ? nMaxDepth : -1;
+		nFirst = nLast;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Decode the instruction stream
+//
+// @parm const unsigned char * | pauchCode | Compiled script
+//
+// @parm size_t | nCodeSize | Size of the compiled script
+//
+// @rdesc true if the whole stream decoded.
+//
+//-----------------------------------------------------------------------------
+
+bool NscCostAnalyzer::Decode (const unsigned char *pauchCode,
+	size_t nCodeSize)
+{
+	m_asInstructions .clear ();
+	if (nCodeSize < HeaderSize || memcmp (pauchCode, "NCS V1.0", 8) != 0)
+		return false;
+
+	size_t nOffset = HeaderSize;
+	while (nOffset < nCodeSize)
+	{
+		size_t nLength = NWScriptReader::GetInstructionLength (
+			&pauchCode [nOffset], nCodeSize - nOffset);
+		if (nLength == 0)
+			return false;
+
+		Instruction sInstruction;
+		sInstruction .nOffset = (UINT32) nOffset;
+		sInstruction .nLength = (UINT32) nLength;
+		sInstruction .cOp = pauchCode [nOffset];
+		sInstruction .lOperand = 0;
+		sInstruction .nLoopNesting = 0;
+		switch (sInstruction .cOp)
+		{
+			case NscCode_JMP:
+			case NscCode_JSR:
+			case NscCode_JZ:
+			case NscCode_JNZ:
+				sInstruction .lOperand = CNwnByteOrder<INT32>::BigEndian (
+					&pauchCode [nOffset + 2]);
+				break;
+
+			case NscCode_ACTION:
+				sInstruction .lOperand = CNwnByteOrder<UINT16>::BigEndian (
+					&pauchCode [nOffset + 2]);
+				break;
+		}
+		m_asInstructions .push_back (sInstruction);
+		nOffset += nLength;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Split the script into functions
+//
+// @parm const unsigned char * | pauchSymbols | Debug symbols, if any
+//
+// @parm size_t | nSize | Size of the debug symbols
+//
+// @parm size_t | nCodeSize | Size of the compiled script
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscCostAnalyzer::SplitFunctions (const unsigned char *pauchSymbols,
+	size_t nSize, size_t nCodeSize)
+{
+	std::vector <Function> asRoutines;
+
+	//
+	// Collect the routine records, "f start end argc rettype name"
+	//
+
+	const char *pszText = (const char *) pauchSymbols;
+	const char *pszEnd = pszText + nSize;
+	while (pszText < pszEnd)
+	{
+		const char *pszLineEnd = (const char *) memchr (pszText, '\n',
+			pszEnd - pszText);
+		if (pszLineEnd == NULL)
+			pszLineEnd = pszEnd;
+		char szLine [600];
+		size_t nLength = pszLineEnd - pszText;
+		if (nLength >= _countof (szLine))
+			nLength = _countof (szLine) - 1;
+		memcpy (szLine, pszText, nLength);
+		szLine [nLength] = 0;
+		pszText = pszLineEnd + 1;
+
+		char szName [260];
+		unsigned int nStart, nEnd;
+		if (szLine [0] != 'f' || szLine [1] != ' ' ||
+			sscanf (szLine, "f %x %x %*x %*s %259s", &nStart, &nEnd,
+			szName) != 3 || nStart == 0xFFFFFFFF)
+			continue;
+
+		Function sRoutine;
+		sRoutine .strName = szName;
+		sRoutine .nStart = nStart;
+		sRoutine .nEnd = nEnd;
+		asRoutines .push_back (sRoutine);
+	}
+
+	//
+	// Without symbols, every JSR target starts a function
+	//
+
+	if (asRoutines .empty ())
+	{
+		for (size_t i = 0; i < m_asInstructions .size (); i++)
+		{
+			const Instruction &sInstruction = m_asInstructions [i];
+			if (sInstruction .cOp != NscCode_JSR)
+				continue;
+			Function sRoutine;
+			sRoutine .nStart = sInstruction .nOffset + sInstruction .lOperand;
+			sRoutine .nEnd = sRoutine .nStart;
+			asRoutines .push_back (sRoutine);
+		}
+		Function sRoutine;
+		sRoutine .nStart = HeaderSize;
+		sRoutine .nEnd = HeaderSize;
+		asRoutines .push_back (sRoutine);
+	}
+
+	//
+	// Sort the routines, outermost first, and drop the nested ones
+	//
+
+	std::stable_sort (asRoutines .begin (), asRoutines .end (),
+		[] (const Function &sRoutine1, const Function &sRoutine2)
+		{
+			if (sRoutine1 .nStart != sRoutine2 .nStart)
+				return sRoutine1 .nStart < sRoutine2 .nStart;
+			return sRoutine1 .nEnd > sRoutine2 .nEnd;
+		});
+
+	m_asFunctions .clear ();
+	UINT32 nCovered = 0;
+	for (size_t i = 0; i < asRoutines .size (); i++)
+	{
+		const Function &sRoutine = asRoutines [i];
+		if (sRoutine .nStart < HeaderSize || sRoutine .nStart >= nCodeSize)
+			continue;
+		if (!m_asFunctions .empty () &&
+			(sRoutine .nStart < nCovered ||
+			sRoutine .nStart == m_asFunctions .back () .nStart))
+			continue;
+		m_asFunctions .push_back (sRoutine);
+		nCovered = std::max (nCovered, sRoutine .nEnd);
+	}
+
+	//
+	// Each function runs up to the next one
+	//
+
+	for (size_t i = 0; i < m_asFunctions .size (); i++)
+	{
+		Function &sFunction = m_asFunctions [i];
+		sFunction .nEnd = i + 1 < m_asFunctions .size () ?
+			m_asFunctions [i + 1] .nStart : (UINT32) nCodeSize;
+		if (sFunction .strName .empty ())
+		{
+			char szName [32];
+			snprintf (szName, _countof (szName), "fn_%08X",
+				sFunction .nStart);
+			sFunction .strName = szName;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Find the loop nesting of the instructions of a function
+//
+// @parm size_t | nFirst | First instruction of the function
+//
+// @parm size_t | nLast | Instruction following the function
+//
+// @rdesc The deepest loop nesting of the function.
+//
+//-----------------------------------------------------------------------------
+
+int NscCostAnalyzer::FindLoops (size_t nFirst, size_t nLast)
+{
+
+	//
+	// Find the loops, keyed by the instruction branched back to
+	//
+
+	std::map <UINT32, UINT32> mapLoops;
+	UINT32 nStart = m_asInstructions [nFirst] .nOffset;
+	for (size_t i = nFirst; i < nLast; i++)
+	{
+		const Instruction &sInstruction = m_asInstructions [i];
+		if (sInstruction .cOp != NscCode_JMP &&
+			sInstruction .cOp != NscCode_JZ &&
+			sInstruction .cOp != NscCode_JNZ)
+			continue;
+		if (sInstruction .lOperand > 0 ||
+			(INT64) sInstruction .nOffset + sInstruction .lOperand < nStart)
+			continue;
+		UINT32 nHead = sInstruction .nOffset + sInstruction .lOperand;
+		UINT32 &nTail = mapLoops [nHead];
+		nTail = std::max (nTail, sInstruction .nOffset);
+	}
+
+	//
+	// Count the loops around each instruction
+	//
+
+	int nMaxNesting = 0;
+	for (size_t i = nFirst; i < nLast; i++)
+	{
+		Instruction &sInstruction = m_asInstructions [i];
+		int nNesting = 0;
+		for (std::map <UINT32, UINT32>::const_iterator it = mapLoops .begin ();
+			it != mapLoops .end () && it ->first <= sInstruction .nOffset; ++it)
+		{
+			if (sInstruction .nOffset <= it ->second)
+				nNesting++;
+		}
+		sInstruction .nLoopNesting = nNesting;
+		nMaxNesting = std::max (nMaxNesting, nNesting);
+	}
+	return nMaxNesting;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the name of an opcode class
+//
+// @parm int | nClass | Opcode class
+//
+// @rdesc Name of the class.
+//
+//-----------------------------------------------------------------------------
+
+const char *NscCostAnalyzer::GetClassName (int nClass)
+{
+	static const char *apszNames [NscOpcodeClass__NumClasses] =
+	{
+		"stack",
+		"constant",
+		"arithmetic",
+		"logical",
+		"branch",
+		"call",
+		"action",
+		"other",
+	};
+
+	if (nClass < 0 || nClass >= NscOpcodeClass__NumClasses)
+		return "";
+	return apszNames [nClass];
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the class of an opcode
+//
+// @parm unsigned char | cOp | Opcode
+//
+// @rdesc Class of the opcode.
+//
+//-----------------------------------------------------------------------------
+
+NscOpcodeClass NscCostAnalyzer::GetOpcodeClass (unsigned char cOp)
+{
+	switch (cOp)
+	{
+		case NscCode_CPDOWNSP:
+		case NscCode_RSADD:
+		case NscCode_CPTOPSP:
+		case NscCode_MOVSP:
+		case NscCode_CPDOWNBP:
+		case NscCode_CPTOPBP:
+		case NscCode_SAVEBP:
+		case NscCode_RESTOREBP:
+			return NscOpcodeClass_Stack;
+
+		case NscCode_CONST:
+			return NscOpcodeClass_Constant;
+
+		case NscCode_ADD:
+		case NscCode_SUB:
+		case NscCode_MUL:
+		case NscCode_DIV:
+		case NscCode_MOD:
+		case NscCode_NEG:
+		case NscCode_DECISP:
+		case NscCode_INCISP:
+		case NscCode_DECIBP:
+		case NscCode_INCIBP:
+			return NscOpcodeClass_Arithmetic;
+
+		case NscCode_LOGAND:
+		case NscCode_LOGOR:
+		case NscCode_INCOR:
+		case NscCode_EXCOR:
+		case NscCode_BOOLAND:
+		case NscCode_EQUAL:
+		case NscCode_NEQUAL:
+		case NscCode_GEQ:
+		case NscCode_GT:
+		case NscCode_LT:
+		case NscCode_LEQ:
+		case NscCode_SHLEFT:
+		case NscCode_SHRIGHT:
+		case NscCode_USHRIGHT:
+		case NscCode_COMP:
+		case NscCode_NOT:
+			return NscOpcodeClass_Logical;
+
+		case NscCode_JMP:
+		case NscCode_JZ:
+		case NscCode_JNZ:
+			return NscOpcodeClass_Branch;
+
+		case NscCode_JSR:
+		case NscCode_RETN:
+			return NscOpcodeClass_Call;
+
+		case NscCode_ACTION:
+			return NscOpcodeClass_Action;
+
+		default:
+			return NscOpcodeClass_Other;
+	}
+}
@@ -0,0 +1,182 @@
+#ifndef ETS_NSCCOSTANALYZER_H
+#define ETS_NSCCOSTANALYZER_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscCostAnalyzer.h - Static cost analyzer |
+//
+// This module contains the definition of the static cost analyzer.  The
+// analyzer walks the code of a compiled script one function at a time and
+// counts the instructions by opcode class and the ACTION calls by engine
+// function, and finds the deepest stack and the deepest loop nesting of
+// each function.  From these it gives each function a rough static cost,
+// which points at the hot spots of a script without running it.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <string>
+#include <vector>
+#include <map>
+#include "Nsc.h"
+
+class NscVerifier;
+
+//-----------------------------------------------------------------------------
+//
+// Opcode classes
+//
+//-----------------------------------------------------------------------------
+
+enum NscOpcodeClass
+{
+	NscOpcodeClass_Stack		= 0,		// RSADD, CPxxxxSP/BP, MOVSP, ...
+	NscOpcodeClass_Constant		= 1,		// CONST
+	NscOpcodeClass_Arithmetic	= 2,		// ADD, ..., NEG, INCxSP, DECxBP, ...
+	NscOpcodeClass_Logical		= 3,		// Comparisons, bitwise and boolean
+	NscOpcodeClass_Branch		= 4,		// JMP, JZ, JNZ
+	NscOpcodeClass_Call			= 5,		// JSR, RETN
+	NscOpcodeClass_Action		= 6,		// ACTION
+	NscOpcodeClass_Other		= 7,		// DESTRUCT, STORE_STATE, NOP, ...
+
+	NscOpcodeClass__NumClasses
+};
+
+//-----------------------------------------------------------------------------
+//
+// Costs of a function and of a script
+//
+//-----------------------------------------------------------------------------
+
+struct NscFunctionCost
+{
+	std::string					strName;
+	UINT32						nOffset;
+	UINT32						nSize;
+	int							nInstructions;
+	int							anClassCounts [NscOpcodeClass__NumClasses];
+	std::map <std::string, int>	mapActions;
+	int							nMaxStackDepth;		// -1 if not known
+	int							nLoopNesting;
+	UINT64						nCost;
+};
+
+struct NscScriptCost
+{
+	std::string					strName;
+	std::vector <NscFunctionCost> asFunctions;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscCostAnalyzer
+{
+// @access Public types
+public:
+
+	enum Constants
+	{
+		HeaderSize			= 13,		// "NCS V1.0", 'B', file size
+		ActionWeight		= 10,		// cost of an ACTION
+		LoopWeight			= 10,		// cost factor per loop level
+		MaxLoopWeighting	= 6,		// loop levels that add to the cost
+	};
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscCostAnalyzer ();
+
+	// @cmember Destructor
+
+	~NscCostAnalyzer ();
+
+// @access Public methods
+public:
+
+	// @cmember Analyze a compiled script
+
+	bool Analyze (NscCompiler *pCompiler, const NscVerifier *pVerifier,
+		const char *pszName, const unsigned char *pauchCode,
+		size_t nCodeSize, const unsigned char *pauchSymbols,
+		size_t nSymbolsSize, NscScriptCost &sCost);
+
+	// @cmember Get the name of an opcode class
+
+	static const char *GetClassName (int nClass);
+
+	// @cmember Get the class of an opcode
+
+	static NscOpcodeClass GetOpcodeClass (unsigned char cOp);
+
+// @access Protected types
+protected:
+
+	//
+	// A decoded instruction
+	//
+
+	struct Instruction
+	{
+		UINT32				nOffset;
+		UINT32				nLength;
+		unsigned char		cOp;
+		INT32				lOperand;
+		int					nLoopNesting;
+	};
+
+	//
+	// A function of the script
+	//
+
+	struct Function
+	{
+		std::string			strName;
+		UINT32				nStart;
+		UINT32				nEnd;
+	};
+
+// @access Protected methods
+protected:
+
+	// @cmember Decode the instruction stream
+
+	bool Decode (const unsigned char *pauchCode, size_t nCodeSize);
+
+	// @cmember Split the script into functions
+
+	void SplitFunctions (const unsigned char *pauchSymbols, size_t nSize,
+		size_t nCodeSize);
+
+	// @cmember Find the loop nesting of the instructions of a function
+
+	int FindLoops (size_t nFirst, size_t nLast);
+
+// @access Protected members
+protected:
+
+	// @cmember Decoded instructions
+
+	std::vector <Instruction>	m_asInstructions;
+
+	// @cmember Functions in address order
+
+	std::vector <Function>		m_asFunctions;
+};
+
+#endif // ETS_NSCCOSTANALYZER_H
@@ -0,0 +1,163 @@
+#ifndef ETS_NSCDEBUGTEXTWRITER_H
+#define ETS_NSCDEBUGTEXTWRITER_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscDebugTextWriter.h - NDB text formatter |
+//
+// This module contains the formatter used to write the NDB debug symbol
+// file.  The records are fixed formats of zero padded hex and decimal
+// fields, so the writer formats them directly into a reusable buffer
+// instead of going through sprintf for every record.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <cstring>
+#include "NwnDefines.h"
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class CNscDebugTextWriter
+{
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor.  Writing starts at the beginning of
+	//		the buffer, whatever it held before.
+
+	CNscDebugTextWriter (std::vector <char> &achBuffer)
+		: m_achBuffer (achBuffer)
+	{
+		m_achBuffer .resize (m_achBuffer .capacity ());
+		m_nSize = 0;
+	}
+
+// @access Public methods
+public:
+
+	// @cmember Write a character
+
+	void Char (char c)
+	{
+		MakeRoom (1);
+		m_achBuffer [m_nSize++] = c;
+	}
+
+	// @cmember Write a string
+
+	void String (const char *psz)
+	{
+		size_t nLength = strlen (psz);
+		MakeRoom (nLength);
+		memcpy (&m_achBuffer [m_nSize], psz, nLength);
+		m_nSize += nLength;
+	}
+
+	// @cmember Write a value as 8 lower case hex digits ("%08x")
+
+	void Hex (UINT32 ulValue)
+	{
+		MakeRoom (8);
+		char *pch = &m_achBuffer [m_nSize];
+		memcpy (&pch [0], &s_achHexPairs [((ulValue >> 24) & 0xff) * 2], 2);
+		memcpy (&pch [2], &s_achHexPairs [((ulValue >> 16) & 0xff) * 2], 2);
+		memcpy (&pch [4], &s_achHexPairs [((ulValue >> 8) & 0xff) * 2], 2);
+		memcpy (&pch [6], &s_achHexPairs [(ulValue & 0xff) * 2], 2);
+		m_nSize += 8;
+	}
+
+	// @cmember Write a zero padded decimal value ("%0*d")
+
+	void Decimal (int nValue, int nWidth)
+	{
+		char achDigits [16];
+		int nDigits = 0;
+		UINT32 ulValue = nValue < 0 ? 0 - (UINT32) nValue : (UINT32) nValue;
+		do
+		{
+			achDigits [nDigits++] = (char) ('0' + ulValue % 10);
+			ulValue /= 10;
+		} while (ulValue != 0);
+		MakeRoom (nWidth + nDigits + 1);
+		if (nValue < 0)
+		{
+			m_achBuffer [m_nSize++] = '-';
+			nWidth--;
+		}
+		while (nWidth-- > nDigits)
+			m_achBuffer [m_nSize++] = '0';
+		while (nDigits > 0)
+			m_achBuffer [m_nSize++] = achDigits [--nDigits];
+	}
+
+	// @cmember End the current line
+
+	void EndLine ()
+	{
+		MakeRoom (2);
+		m_achBuffer [m_nSize++] = '\r';
+		m_achBuffer [m_nSize++] = '\n';
+	}
+
+	// @cmember Get the text written
+
+	const char *GetData () const
+	{
+		return m_achBuffer .data ();
+	}
+
+	// @cmember Get the number of characters written
+
+	size_t GetSize () const
+	{
+		return m_nSize;
+	}
+
+// @access Protected methods
+protected:
+
+	// @cmember Make sure there is room for more text
+
+	void MakeRoom (size_t nCount)
+	{
+		if (m_nSize + nCount > m_achBuffer .size ())
+		{
+			size_t nNewSize = m_achBuffer .size () * 2 + 0x1000;
+			while (m_nSize + nCount > nNewSize)
+				nNewSize *= 2;
+			m_achBuffer .resize (nNewSize);
+		}
+	}
+
+// @access Protected members
+protected:
+
+	// @cmember Hex digit pairs of all byte values
+
+	static const char	s_achHexPairs [513];
+
+	// @cmember Buffer receiving the text
+
+	std::vector <char>	&m_achBuffer;
+
+	// @cmember Number of characters written
+
+	size_t				m_nSize;
+};
+
+#endif // ETS_NSCDEBUGTEXTWRITER_H
@@ -40,656 +40,406 @@
 
 #include "Precomp.h"
 #include "Nsc.h"
+#include "NscActionTable.h"
+#include "../_NwnDataLib/NWScriptReader.h"
 
 //-----------------------------------------------------------------------------
 //
-// @func Get a 4 byte long from the data
-//
-// @parm unsigned char * | pData | Pointer to the data
-//
-// @parm unsigned long * | pul | Pointer to the destination
-//
-// @rdesc Updated address.
+// Disassembly text writer.  The lines are fixed formats of upper case hex
+// fields, so they are formatted directly into the caller's string instead of
+// going through sprintf for every field.
 //
 //-----------------------------------------------------------------------------
 
-static unsigned char *GetUINT32 (unsigned char *pData, unsigned long *pul)
+class CNscDisassemblyWriter
 {
-	*pul = CNwnByteOrder<UINT32>::BigEndian (pData);
-	return &pData [4];
-}
+public:
 
-//-----------------------------------------------------------------------------
-//
-// @func Get a 2 byte long from the data
-//
-// @parm unsigned char * | pData | Pointer to the data
-//
-// @parm unsigned long * | pul | Pointer to the destination
-//
-// @rdesc Updated address.
-//
-//-----------------------------------------------------------------------------
+	// @cmember General constructor.  Text is appended to the string.
 
-static unsigned char *GetUINT16 (unsigned char *pData, unsigned long *pul)
-{
-	*pul = CNwnByteOrder<UINT16>::BigEndian (pData);
-	return &pData [2];
-}
+	CNscDisassemblyWriter (std::string &strText) : m_strText (strText)
+	{
+		m_nSize = m_strText .size ();
+	}
 
-//-----------------------------------------------------------------------------
-//
-// @func Get a floating point value from the data
-//
-// @parm unsigned char * | pData | Pointer to the data
-//
-// @parm unsigned long * | pul | Pointer to the destination
-//
-// @rdesc Updated address.
-//
-//-----------------------------------------------------------------------------
+	// @cmember Destructor, trims the string to the text written
 
-static unsigned char *GetFLOAT (unsigned char *pData, float *pf)
-{
-	*pf = CNwnByteOrder<float>::BigEndian (pData);
-	return &pData [4];
-}
+	~CNscDisassemblyWriter ()
+	{
+		m_strText .resize (m_nSize);
+	}
 
-//-----------------------------------------------------------------------------
-//
-// @func Get the operator text
-//
-// @parm unsigned char | cOpType | Operator type
-//
-// @parm char * | szOpText | Output
-//
-// @rdesc None.
-//
-//-----------------------------------------------------------------------------
+	// @cmember Make sure there is room for more text
 
-static void GetOpText (unsigned char cOpType, char *szOpText)
-{
-	switch (cOpType)
+	void MakeRoom (size_t nCount)
+	{
+		if (m_nSize + nCount > m_strText .size ())
+		{
+			size_t nNewSize = m_strText .size () * 2 + 0x1000;
+			if (nNewSize < m_strText .capacity ())
+				nNewSize = m_strText .capacity ();
+			while (m_nSize + nCount > nNewSize)
+				nNewSize *= 2;
+			m_strText .resize (nNewSize);
+		}
+	}
+
+	// @cmember Write a character (room must have been made)
+
+	void Char (char c)
 	{
-		case 0x03:
-			strcpy (szOpText, "I");
-			break;
-
-		case 0x04:
-			strcpy (szOpText, "F");
-			break;
-
-		case 0x05:
-			strcpy (szOpText, "S");
-			break;
-
-		case 0x06:
-			strcpy (szOpText, "O");
-			break;
-
-		case 0x10:
-			strcpy (szOpText, "EFF");
-			break;
-
-		case 0x11:
-			strcpy (szOpText, "EVNT");
-			break;
-
-		case 0x12:
-			strcpy (szOpText, "LOC");
-			break;
-
-		case 0x13:
-			strcpy (szOpText, "TAL");
-			break;
-
-		case 0x20:
-			strcpy (szOpText, "II");
-			break;
-
-		case 0x21:
-			strcpy (szOpText, "FF");
-			break;
-
-		case 0x22:
-			strcpy (szOpText, "OO");
-			break;
-
-		case 0x23:
-			strcpy (szOpText, "SS");
-			break;
-
-		case 0x24:
-			strcpy (szOpText, "TT");
-			break;
-
-		case 0x25:
-			strcpy (szOpText, "IF");
-			break;
-
-		case 0x26:
-			strcpy (szOpText, "FI");
-			break;
-
-		case 0x30:
-			strcpy (szOpText, "EFFEFF");
-			break;
-
-		case 0x3A:
-			strcpy (szOpText, "VV");
-			break;
-
-		case 0x3B:
-			strcpy (szOpText, "VF");
-			break;
-
-		case 0x3C:
-			strcpy (szOpText, "FV");
-			break;
-
-		default:
-			sprintf (szOpText, "P%d", cOpType);
-			//if (g_fpDebug)
-			//	fprintf (g_fpDebug, "Unknown optype %02X\r\n", cOpType);
-			break;
+		m_strText [m_nSize++] = c;
 	}
-}
+
+	// @cmember Write characters (room must have been made)
+
+	void Text (const char *pach, size_t nLength)
+	{
+		memcpy (&m_strText [m_nSize], pach, nLength);
+		m_nSize += nLength;
+	}
+
+	// @cmember Write a string (room must have been made)
+
+	void String (const char *psz)
+	{
+		Text (psz, strlen (psz));
+	}
+
+	// @cmember Write a value as upper case hex digits ("%0*X", room must
+	//		have been made)
+
+	void Hex (UINT32 ulValue, int nDigits)
+	{
+		while (nDigits > 0)
+		{
+			nDigits--;
+			m_strText [m_nSize++] = s_achHexDigits [(ulValue >> (nDigits * 4)) & 0xf];
+		}
+	}
+
+	// @cmember Pad with spaces up to a column of the current line
+
+	void PadTo (size_t nLineStart, size_t nColumn)
+	{
+		while (m_nSize - nLineStart < nColumn)
+			m_strText [m_nSize++] = ' ';
+	}
+
+	// @cmember Get the position of the next character
+
+	size_t GetPosition () const
+	{
+		return m_nSize;
+	}
+
+protected:
+
+	static const char	s_achHexDigits [17];
+	std::string			&m_strText;
+	size_t				m_nSize;
+};
+
+const char CNscDisassemblyWriter::s_achHexDigits [17] = "0123456789ABCDEF";
 
 //-----------------------------------------------------------------------------
 //
 // @func Dump a script
 //
-// @parm CNwnStream & | sStream | Destination stream
+// @parm std::string & | strText | Receives the disassembly, which is
+//		appended to the string
 //
-// @parm unsigned char * | pStart | Start of the data
+// @parm const unsigned char * | pauchData | Start of the data
 //
-// @parm unsigned char * | pEnd | End of the data
+// @parm size_t | nSize | Size of the data
 //
-// @param NscCompiler * | pCompiler | Compiler instance
+// @parm const NscActionTable & | sActions | Names of the engine actions
 //
 // @rdesc None.
 //
 //-----------------------------------------------------------------------------
 
-void NscScriptDecompile (CNwnStream &sStream, 
-	unsigned char *pauchData, unsigned long ulSize, NscCompiler *pCompiler)
+void NscScriptDecompile (std::string &strText, 
+	const unsigned char *pauchData, size_t nSize, const NscActionTable &sActions)
 {
+	CNscDisassemblyWriter sText (strText);
 
 	//
-	// Loop through the data
+	// Loop through the instructions, which start with the T of the header
 	//
 
-	unsigned char *pStart = pauchData;
-	unsigned char *pEnd = &pauchData [ulSize];
-	unsigned char *pData = pStart;
-	pData += 8;
-	while (pData < pEnd)
+	size_t nOffset = nSize < 8 ? nSize : 8;
+	while (nOffset < nSize)
 	{
-		char szByteText [128];
-		char szOpText [512];
-		char szOpType [32];
-		char *pszOpRoot;
+		const unsigned char *pOp = &pauchData [nOffset];
+		unsigned char cOp = pOp [0];
+		const NWScriptReader::InstructionDescriptor &sDescriptor =
+			NWScriptReader::GetInstructionDescriptor (cOp);
+		size_t nLength = NWScriptReader::GetInstructionLength (pOp,
+			nSize - nOffset);
 
 		//
-		// Switch based on the next opcode
+		// Make room for the line.  Only string constants and action names
+		// can make it longer than the fixed fields.
 		//
 
-		unsigned char *pOp = pData;
-		unsigned char cOp = *pData++;
-		switch (cOp)
+		const char *pszName = NULL;
+		size_t nExtra = 0;
+		if (nLength != 0 && sDescriptor .Layout == NWScriptReader::InstructionLayout_Action)
 		{
+			pszName = sActions .GetName (CNwnByteOrder<UINT16>::BigEndian (&pOp [2]));
+			nExtra = strlen (pszName);
+		}
+		else if (nLength != 0 && sDescriptor .Layout == NWScriptReader::InstructionLayout_Constant)
+			nExtra = 128;
+		sText .MakeRoom (128 + nExtra);
 
-			case NscCode_CPDOWNSP:
-				{
-					if (&pData [7] > pEnd || pData [0] != 1)
-						goto invalid_op;
-					unsigned long ul1, ul2;
-					pData = GetUINT32 (pData + 1, &ul1);
-					pData = GetUINT16 (pData, &ul2);
-					sprintf (szByteText, "%02X 01 %08X %04X", cOp, ul1, ul2);
-					sprintf (szOpText, "CPDOWNSP %08X, %04X", ul1, ul2);
-				}
-				break;
-
-			case NscCode_RSADD:
-				pszOpRoot = "RSADD";
-do_simple_operator:;
-				{
-					if (&pData [1] > pEnd)
-						goto invalid_op;
-					unsigned char cOpType = *pData++;
-					GetOpText (cOpType, szOpType);
-					sprintf (szByteText, "%02X %02X", cOp, cOpType);
-					sprintf (szOpText, "%s%s", pszOpRoot, szOpType);
-				}
-				break;
-
-			case NscCode_CPTOPSP:
-				{
-					if (&pData [7] > pEnd || pData [0] != 1)
-						goto invalid_op;
-					unsigned long ul1, ul2;
-					pData = GetUINT32 (pData + 1, &ul1);
-					pData = GetUINT16 (pData, &ul2);
-					sprintf (szByteText, "%02X 01 %08X %04X", cOp, ul1, ul2);
-					sprintf (szOpText, "CPTOPSP %08X, %04X", ul1, ul2);
-				}
-				break;
-
-			case NscCode_CONST:
-				{
-					if (&pData [1] > pEnd)
-						goto invalid_op;
-					unsigned char cOpType = *pData;
-					GetOpText (cOpType, szOpType);
-					switch (cOpType)
-					{
-						case 3:
-						case 6:
-							{
-								if (&pData [5] > pEnd)
-									goto invalid_op;
-								unsigned long ul;
-								pData = GetUINT32 (pData + 1, &ul);
-								sprintf (szByteText, "%02X %02X %08X", cOp, cOpType, ul);
-								sprintf (szOpText, "CONST%s %08X", szOpType, ul);
-							}
-							break;
-
-						case 4:
-							{
-								if (&pData [5] > pEnd)
-									goto invalid_op;
-								union
-								{
-									unsigned long ul;
-									float f;
-								} val;
-								pData = GetFLOAT (pData + 1, &val .f);
-								sprintf (szByteText, "%02X %02X %08X", cOp, cOpType, val .ul);
-								sprintf (szOpText, "CONST%s %f", szOpType, val .f);
-							}
-							break;
-
-						case 5:
-							{
-								if (&pData [3] > pEnd)
-									goto invalid_op;
-								unsigned long ul;
-								GetUINT16 (pData + 1, &ul);
-								if (&pData [3 + ul] > pEnd)
-									goto invalid_op;
-								pData += 3;
-								char szValue [129];
-								unsigned long ulCopy = ul > 128 ? 128 : ul;
-								memmove (szValue, pData, ulCopy);
-								szValue [ulCopy] = 0;
-								sprintf (szByteText, "%02X %02X %04X str", cOp, cOpType, ul);
-								snprintf (szOpText, _countof (szOpText), 
-									"CONST%s \"%s\"", szOpType, szValue);
-								pData += ul;
-							}
-							break;
-
-						default:
-							goto invalid_op;
-					}
-				}
-				break;
-
-			case NscCode_ACTION:
-				{
-					if (&pData [4] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1, ul2;
-					pData = GetUINT16 (pData + 1, &ul1);
-					ul2 = *pData++;
-					const char *pszName = NscGetActionName ((int) ul1, pCompiler);
-					sprintf (szByteText, "%02X 00 %04X %02X", cOp, ul1, ul2);
-					sprintf (szOpText, "ACTION %s(%04X), %02X", pszName, ul1, ul2);
-				}
-				break;
-
-			case NscCode_LOGAND:
-				pszOpRoot = "LOGAND";
-do_binary_operator:;
-				{
-					if (&pData [1] > pEnd)
-						goto invalid_op;
-					unsigned char cOpType = *pData++;
-					GetOpText (cOpType, szOpType);
-					if (cOpType == 0x24)
-					{
-						if (&pData [2] > pEnd)
-							goto invalid_op;
-						unsigned long ul1;
-						pData = GetUINT16 (pData, &ul1);
-						sprintf (szByteText, "%02X %02X %04X", cOp, cOpType, ul1);
-						sprintf (szOpText, "%s%s %04X", pszOpRoot, szOpType, ul1);
-					}
-					else
-					{
-						sprintf (szByteText, "%02X %02X", cOp, cOpType);
-						sprintf (szOpText, "%s%s", pszOpRoot, szOpType);
-					}
-				}
-				break;
-
-			case NscCode_LOGOR:
-				pszOpRoot = "LOGOR";
-				goto do_binary_operator;
-
-			case NscCode_INCOR:
-				pszOpRoot = "INCOR";
-				goto do_binary_operator;
-
-			case NscCode_EXCOR:
-				pszOpRoot = "EXCOR";
-				goto do_binary_operator;
-
-			case NscCode_BOOLAND:
-				pszOpRoot = "BOOLAND";
-				goto do_binary_operator;
-
-			case NscCode_EQUAL:
-				pszOpRoot = "EQUAL";
-				goto do_binary_operator;
-
-			case NscCode_NEQUAL:
-				pszOpRoot = "NEQUAL";
-				goto do_binary_operator;
-
-			case NscCode_GEQ:
-				pszOpRoot = "GEQ";
-				goto do_binary_operator;
-
-			case NscCode_GT:
-				pszOpRoot = "GT";
-				goto do_binary_operator;
-
-			case NscCode_LT:
-				pszOpRoot = "LT";
-				goto do_binary_operator;
-
-			case NscCode_LEQ:
-				pszOpRoot = "LEQ";
-				goto do_binary_operator;
-
-			case NscCode_SHLEFT:
-				pszOpRoot = "SHLEFT";
-				goto do_binary_operator;
-
-			case NscCode_SHRIGHT:
-				pszOpRoot = "SHRIGHT";
-				goto do_binary_operator;
-
-			case NscCode_USHRIGHT:
-				pszOpRoot = "USHRIGHT";
-				goto do_binary_operator;
-
-			case NscCode_ADD:
-				pszOpRoot = "ADD";
-				goto do_binary_operator;
+		//
+		// Offset
+		//
 
-			case NscCode_SUB:
-				pszOpRoot = "SUB";
-				goto do_binary_operator;
+		sText .Hex ((UINT32) nOffset, 8);
+		sText .Char (' ');
+		size_t nBytesStart = sText .GetPosition ();
 
-			case NscCode_MUL:
-				pszOpRoot = "MUL";
-				goto do_binary_operator;
+		//
+		// If the instruction is not well-formed, dump the opcode
+		//
 
-			case NscCode_DIV:
-				pszOpRoot = "DIV";
-				goto do_binary_operator;
+		if (nLength == 0)
+		{
+			sText .Hex (cOp, 2);
+			sText .PadTo (nBytesStart, 24);
+			sText .Text (" ??\r\n", 5);
+			nOffset++;
+			continue;
+		}
 
-			case NscCode_MOD:
-				pszOpRoot = "MOD";
-				goto do_binary_operator;
+		//
+		// T is the only instruction without a type opcode
+		//
 
-			case NscCode_NEG:
-				pszOpRoot = "NEG";
-				goto do_simple_operator;
+		if (sDescriptor .Layout == NWScriptReader::InstructionLayout_Header)
+		{
+			UINT32 ulSize = CNwnByteOrder<UINT32>::BigEndian (&pOp [1]);
+			sText .Hex (cOp, 2);
+			sText .Char (' ');
+			sText .Hex (ulSize, 8);
+			sText .PadTo (nBytesStart, 24);
+			sText .Text (" T ", 3);
+			sText .Hex (ulSize, 8);
+			sText .Text ("\r\n", 2);
+			nOffset += nLength;
+			continue;
+		}
 
-			case NscCode_COMP:
-				pszOpRoot = "COMP";
-				goto do_simple_operator;
+		//
+		// Write the instruction bytes
+		//
 
-			case NscCode_MOVSP:
+		unsigned char cOpType = pOp [1];
+		UINT32 ul1 = 0, ul2 = 0, ul3 = 0;
+		sText .Hex (cOp, 2);
+		sText .Char (' ');
+		sText .Hex (cOpType, 2);
+		switch (sDescriptor .Layout)
+		{
+			case NWScriptReader::InstructionLayout_Binary:
+				if (cOpType == 0x24)
 				{
-					if (&pData [5] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 00 %08X", cOp, ul1);
-					sprintf (szOpText, "MOVSP %08X", ul1);
+					ul1 = CNwnByteOrder<UINT16>::BigEndian (&pOp [2]);
+					sText .Char (' ');
+					sText .Hex (ul1, 4);
 				}
 				break;
 
-			case NscCode_STORE_STATEALL:
-				{
-					if (&pData [1] > pEnd)
-						goto invalid_op;
-					unsigned long ul = *pData++;
-					sprintf (szByteText, "%02X %02X", cOp, ul);
-					sprintf (szOpText, "SAVE_STATEALL %02x", ul);
-				}
+			case NWScriptReader::InstructionLayout_StackCopy:
+				ul1 = CNwnByteOrder<UINT32>::BigEndian (&pOp [2]);
+				ul2 = CNwnByteOrder<UINT16>::BigEndian (&pOp [6]);
+				sText .Char (' ');
+				sText .Hex (ul1, 8);
+				sText .Char (' ');
+				sText .Hex (ul2, 4);
 				break;
 
-			case NscCode_JMP:
+			case NWScriptReader::InstructionLayout_Constant:
+				sText .Char (' ');
+				if (cOpType == 5)
 				{
-					if (&pData [5] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 00 %08X", cOp, ul1);
-					sprintf (szOpText, "JMP off_%08X", (pOp - pStart) + ul1);
+					ul1 = CNwnByteOrder<UINT16>::BigEndian (&pOp [2]);
+					sText .Hex (ul1, 4);
+					sText .Text (" str", 4);
 				}
-				break;
-
-			case NscCode_JSR:
+				else
 				{
-					if (&pData [5] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 00 %08X", cOp, ul1);
-					sprintf (szOpText, "JSR fn_%08X", (pOp - pStart) + ul1);
+					ul1 = CNwnByteOrder<UINT32>::BigEndian (&pOp [2]);
+					sText .Hex (ul1, 8);
 				}
 				break;
 
-			case NscCode_JZ:
-				{
-					if (&pData [5] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 00 %08X", cOp, ul1);
-					sprintf (szOpText, "JZ off_%08X", (pOp - pStart) + ul1);
-				}
+			case NWScriptReader::InstructionLayout_Action:
+				ul1 = CNwnByteOrder<UINT16>::BigEndian (&pOp [2]);
+				ul2 = pOp [4];
+				sText .Char (' ');
+				sText .Hex (ul1, 4);
+				sText .Char (' ');
+				sText .Hex (ul2, 2);
 				break;
 
-			case NscCode_RETN:
-				{
-					if (&pData [1] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					pData++;
-					sprintf (szByteText, "%02X 00", cOp);
-					sprintf (szOpText, "RETN");
-				}
+			case NWScriptReader::InstructionLayout_Int32:
+			case NWScriptReader::InstructionLayout_Branch:
+				ul1 = CNwnByteOrder<UINT32>::BigEndian (&pOp [2]);
+				sText .Char (' ');
+				sText .Hex (ul1, 8);
 				break;
 
-			case NscCode_DESTRUCT:
-				{
-					if (&pData [7] > pEnd || pData [0] != 1)
-						goto invalid_op;
-					unsigned long ul1, ul2, ul3;
-					pData = GetUINT16 (pData + 1, &ul1);
-					pData = GetUINT16 (pData, &ul2);
-					pData = GetUINT16 (pData, &ul3);
-					sprintf (szByteText, "%02X 01 %04X %04X %04x", cOp, ul1, ul2, ul3);
-					sprintf (szOpText, "DESTRUCT %04X, %04X, %04X", ul1, ul2, ul3);
-					// First parameter, number of bytes to destroy
-					// Second parameter, offset of element not to destroy
-					// Third parameter, number of bytes no to destroy
-				}
+			case NWScriptReader::InstructionLayout_Destruct:
+				ul1 = CNwnByteOrder<UINT16>::BigEndian (&pOp [2]);
+				ul2 = CNwnByteOrder<UINT16>::BigEndian (&pOp [4]);
+				ul3 = CNwnByteOrder<UINT16>::BigEndian (&pOp [6]);
+				sText .Char (' ');
+				sText .Hex (ul1, 4);
+				sText .Char (' ');
+				sText .Hex (ul2, 4);
+				sText .Char (' ');
+				sText .Hex (ul3, 4);
 				break;
 
-			case NscCode_NOT:
-				pszOpRoot = "NOT";
-				goto do_simple_operator;
-
-			case NscCode_DECISP:
-				{
-					if (&pData [5] > pEnd || pData [0] != 3)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 03 %08X", cOp, ul1);
-					sprintf (szOpText, "DECISP %08X", ul1);
-				}
+			case NWScriptReader::InstructionLayout_StoreState:
+				ul1 = CNwnByteOrder<UINT32>::BigEndian (&pOp [2]);
+				ul2 = CNwnByteOrder<UINT32>::BigEndian (&pOp [6]);
+				sText .Char (' ');
+				sText .Hex (ul1, 8);
+				sText .Char (' ');
+				sText .Hex (ul2, 8);
 				break;
 
-			case NscCode_INCISP:
-				{
-					if (&pData [5] > pEnd || pData [0] != 3)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 03 %08X", cOp, ul1);
-					sprintf (szOpText, "INCISP %08X", ul1);
-				}
+			default:
 				break;
+		}
+		sText .PadTo (nBytesStart, 24);
 
-			case NscCode_JNZ:
+		//
+		// Write the mnemonic, completed by the type suffix if it takes one
+		//
+
+		sText .Char (' ');
+		sText .String (sDescriptor .Mnemonic);
+		if (sDescriptor .TypeSuffix)
+		{
+			const char *pszSuffix = NWScriptReader::GetTypeOpcodeSuffix (cOpType);
+			if (pszSuffix != NULL)
+				sText .String (pszSuffix);
+			else
+			{
+				char szSuffix [8];
+				snprintf (szSuffix, _countof (szSuffix), "P%d", cOpType);
+				sText .String (szSuffix);
+			}
+		}
+
+		//
+		// Write the operands
+		//
+
+		switch (sDescriptor .Layout)
+		{
+			case NWScriptReader::InstructionLayout_None:
+				if (!sDescriptor .TypeSuffix && 
+					sDescriptor .TypeOpcode == NWScriptReader::AnyTypeOpcode)
 				{
-					if (&pData [5] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 00 %08X", cOp, ul1);
-					sprintf (szOpText, "JNZ off_%08X", (pOp - pStart) + ul1);
+					sText .Char (' ');
+					sText .Hex (cOpType, 2);
 				}
 				break;
 
-			case NscCode_CPDOWNBP:
+			case NWScriptReader::InstructionLayout_Binary:
+				if (cOpType == 0x24)
 				{
-					if (&pData [7] > pEnd || pData [0] != 1)
-						goto invalid_op;
-					unsigned long ul1, ul2;
-					pData = GetUINT32 (pData + 1, &ul1);
-					pData = GetUINT16 (pData, &ul2);
-					sprintf (szByteText, "%02X 01 %08X %04X", cOp, ul1, ul2);
-					sprintf (szOpText, "CPDOWNBP %08X, %04X", ul1, ul2);
+					sText .Char (' ');
+					sText .Hex (ul1, 4);
 				}
 				break;
 
-			case NscCode_CPTOPBP:
-				{
-					if (&pData [7] > pEnd || pData [0] != 1)
-						goto invalid_op;
-					unsigned long ul1, ul2;
-					pData = GetUINT32 (pData + 1, &ul1);
-					pData = GetUINT16 (pData, &ul2);
-					sprintf (szByteText, "%02X 01 %08X %04X", cOp, ul1, ul2);
-					sprintf (szOpText, "CPTOPBP %08X, %04X", ul1, ul2);
-				}
+			case NWScriptReader::InstructionLayout_StackCopy:
+				sText .Char (' ');
+				sText .Hex (ul1, 8);
+				sText .Text (", ", 2);
+				sText .Hex (ul2, 4);
 				break;
 
-			case NscCode_DECIBP:
+			case NWScriptReader::InstructionLayout_Constant:
+				sText .Char (' ');
+				if (cOpType == 5)
 				{
-					if (&pData [5] > pEnd || pData [0] != 3)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 03 %08X", cOp, ul1);
-					sprintf (szOpText, "DECIBP %08X", ul1);
+					sText .Char ('"');
+					sText .Text ((const char *) &pOp [4], ul1 > 128 ? 128 : ul1);
+					sText .Char ('"');
 				}
-				break;
-
-			case NscCode_INCIBP:
+				else if (cOpType == 4)
 				{
-					if (&pData [5] > pEnd || pData [0] != 3)
-						goto invalid_op;
-					unsigned long ul1;
-					pData = GetUINT32 (pData + 1, &ul1);
-					sprintf (szByteText, "%02X 03 %08X", cOp, ul1);
-					sprintf (szOpText, "INCIBP %08X", ul1);
+
+					//
+					// Floats are rare enough to leave to the C library
+					//
+
+					char szValue [64];
+					snprintf (szValue, _countof (szValue), "%f",
+						CNwnByteOrder<float>::BigEndian (&pOp [2]));
+					sText .MakeRoom (strlen (szValue));
+					sText .String (szValue);
 				}
+				else
+					sText .Hex (ul1, 8);
 				break;
 
-			case NscCode_SAVEBP:
-				{
-					if (&pData [1] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					pData++;
-					sprintf (szByteText, "%02X 00", cOp);
-					sprintf (szOpText, "SAVEBP");
-				}
+			case NWScriptReader::InstructionLayout_Action:
+				sText .Char (' ');
+				sText .String (pszName);
+				sText .Char ('(');
+				sText .Hex (ul1, 4);
+				sText .Text ("), ", 3);
+				sText .Hex (ul2, 2);
 				break;
 
-			case NscCode_RESTOREBP:
-				{
-					if (&pData [1] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					pData++;
-					sprintf (szByteText, "%02X 00", cOp);
-					sprintf (szOpText, "RESTOREBP");
-				}
+			case NWScriptReader::InstructionLayout_Int32:
+				sText .Char (' ');
+				sText .Hex (ul1, 8);
 				break;
 
-			case NscCode_STORE_STATE:
-				{
-					if (&pData [9] > pEnd)
-						goto invalid_op;
-					unsigned long ul1, ul2, ul3;
-					ul3 = *pData++;
-					pData = GetUINT32 (pData, &ul1);
-					pData = GetUINT32 (pData, &ul2);
-					sprintf (szByteText, "%02X %02X %08X %08X", cOp, ul3, ul1, ul2);
-					sprintf (szOpText, "STORE_STATE %02X, %08X, %08X", ul3, ul1, ul2);
-				    // First value is BP stack size to save
-					// second value is SP stack size to save
-				}
+			case NWScriptReader::InstructionLayout_Branch:
+				sText .Text (cOp == NscCode_JSR ? " fn_" : " off_", cOp == NscCode_JSR ? 4 : 5);
+				sText .Hex ((UINT32) (nOffset + ul1), 8);
 				break;
 
-			case NscCode_NOP:
-				{
-					if (&pData [1] > pEnd || pData [0] != 0)
-						goto invalid_op;
-					pData++;
-					sprintf (szByteText, "%02X 00", cOp);
-					sprintf (szOpText, "NOP");
-				}
+			case NWScriptReader::InstructionLayout_Destruct:
+				// First parameter, number of bytes to destroy
+				// Second parameter, offset of element not to destroy
+				// Third parameter, number of bytes no to destroy
+				sText .Char (' ');
+				sText .Hex (ul1, 4);
+				sText .Text (", ", 2);
+				sText .Hex (ul2, 4);
+				sText .Text (", ", 2);
+				sText .Hex (ul3, 4);
 				break;
 
-			case NscCode_Size:
-				{
-					if (&pData [4] > pEnd)
-						goto invalid_op;
-					unsigned long ul;
-					pData = GetUINT32 (pData, &ul);
-					sprintf (szByteText, "%02X %08X", cOp, ul);
-					sprintf (szOpText, "T %08X", ul);
-				}
+			case NWScriptReader::InstructionLayout_StoreState:
+				// First value is BP stack size to save
+				// second value is SP stack size to save
+				sText .Char (' ');
+				sText .Hex (cOpType, 2);
+				sText .Text (", ", 2);
+				sText .Hex (ul1, 8);
+				sText .Text (", ", 2);
+				sText .Hex (ul2, 8);
 				break;
 
 			default:
-invalid_op:;
-				sprintf (szByteText, "%02X", cOp);
-				sprintf (szOpText, "??");
-				//if (g_fpDebug)
-				//	fprintf (g_fpDebug, "Unknown opcode %02x\r\n", cOp);
 				break;
 		}
-
-		//
-		// Format the final line
-		//
-
-		char szText [1024];
-		sprintf (szText, "%08X %-24s %s", pOp - pStart, szByteText, szOpText);
-		sStream .WriteLine (szText);
+		sText .Text ("\r\n", 2);
+		nOffset += nLength;
 	}
 }
 
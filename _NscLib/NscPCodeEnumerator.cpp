@@ -532,6 +532,252 @@ bool CNscPCodeSideEffectChecker::OnPCodeEntry (PCodeEntryParameters *pEntry)
 
 }
 
+//-----------------------------------------------------------------------------
+//
+// @mfunc Process a PCode block, recording the variables stored to
+//
+// @parm PCodeEntryParameters * | pEntry | PCode entry descriptor
+//
+// @rdesc True to continue the enumeration.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscPCodeStoreCollector::OnPCodeEntry (PCodeEntryParameters *pEntry)
+{
+	NscPCode nOpCode = pEntry ->pHeader ->nOpCode;
+
+	//
+	// Assignments and increments store their symbol
+	//
+
+	bool fStore = false;
+	if (nOpCode >= NscPCode__First_Assignment &&
+	    nOpCode <= NscPCode__Last_Assignment)
+		fStore = true;
+	else if (nOpCode == NscPCode_Variable &&
+	    (pEntry ->ulSymbolFlags [0] & NscSymFlag_Increments) != 0)
+		fStore = true;
+	if (fStore)
+	{
+		if ((pEntry ->ulSymbolFlags [0] & NscSymFlag_Global) != 0)
+			m_anGlobals .push_back (pEntry ->nSymbolImmediates [0]);
+		else
+			m_anLocals .push_back (pEntry ->nStackOffsets [0]);
+	}
+
+	//
+	// A call to anything but a pure function or an engine function
+	// might store globals
+	//
+
+	else if (nOpCode == NscPCode_Call)
+	{
+		CNscContext *pCtx = GetNscContext ();
+		const NscPCodeCall *pCall = (const NscPCodeCall *) pEntry ->pHeader;
+		NscSymbol *pSymbol = pCtx ->GetSymbol (pCall ->nFnSymbol);
+		NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+			pCtx ->GetSymbolData (pSymbol ->nExtra);
+		if ((pSymbol ->ulFlags & NscSymFlag_EngineFunc) == 0 &&
+			(pExtra ->ulFunctionFlags & NscFuncFlag_PureFunction) == 0)
+			m_fCallsImpure = true;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Check whether a call is to a pure function returning a value
+//
+// @parm CNscContext * | pCtx | Context
+//
+// @parm const NscPCodeCall * | pCall | Call
+//
+// @rdesc True if the call is to a pure function.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscPCodePureCallCollector::IsPureCall (CNscContext *pCtx, 
+	const NscPCodeCall *pCall)
+{
+	if (pCall ->nType == NscType_Void)
+		return false;
+	NscSymbol *pSymbol = pCtx ->GetSymbol (pCall ->nFnSymbol);
+	NscSymbolFunctionExtra *pExtra = (NscSymbolFunctionExtra *)
+		pCtx ->GetSymbolData (pSymbol ->nExtra);
+	return (pExtra ->ulFunctionFlags & NscFuncFlag_PureFunction) != 0 &&
+		(pSymbol ->ulFlags & NscSymFlag_Intrinsic) == 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Process a PCode block, recording the pure calls
+//
+//		Calls within action arguments are skipped since that code runs
+//		later.  Calls that are only evaluated on some paths through the 
+//		block (the right side of a logical operator or a branch of a
+//		conditional) are marked as conditional.
+//
+// @parm PCodeEntryParameters * | pEntry | PCode entry descriptor
+//
+// @rdesc True to continue the enumeration.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscPCodePureCallCollector::OnPCodeEntry (PCodeEntryParameters *pEntry)
+{
+	if (pEntry ->pHeader ->nOpCode != NscPCode_Call)
+		return true;
+	const NscPCodeCall *pCall = (const NscPCodeCall *) pEntry ->pHeader;
+	if (!IsPureCall (GetNscContext (), pCall))
+		return true;
+
+	//
+	// Look at the containing entries
+	//
+
+	PureCall sCall;
+	sCall .pCall = pCall;
+	sCall .fConditional = false;
+	const unsigned char *pauchInner = (const unsigned char *) pCall;
+	for (const PCodeEntryParameters *pOuter = pEntry ->pContainingEntry;
+	     pOuter != NULL;
+	     pOuter = pOuter ->pContainingEntry)
+	{
+		const NscPCodeHeader *pHeader = pOuter ->pHeader;
+		const unsigned char *pauchOuter = (const unsigned char *) pHeader;
+		if (pHeader ->nOpCode == NscPCode_Argument &&
+			pHeader ->nType == NscType_Action)
+			return true;
+		else if (pHeader ->nOpCode == NscPCode_LogicalAND ||
+			pHeader ->nOpCode == NscPCode_LogicalOR)
+		{
+			const NscPCodeLogicalOp *pLogOp = (const NscPCodeLogicalOp *) pHeader;
+			if (pauchInner >= &pauchOuter [pLogOp ->nRhsOffset])
+				sCall .fConditional = true;
+		}
+		else if (pHeader ->nOpCode >= NscPCode__First_5Block &&
+			pHeader ->nOpCode <= NscPCode__Last_5Block)
+		{
+			const NscPCode5Block *p5Block = (const NscPCode5Block *) pHeader;
+			if (pauchInner >= &pauchOuter [p5Block ->anOffset [3]])
+				sCall .fConditional = true;
+		}
+		pauchInner = pauchOuter;
+	}
+	m_asCalls .push_back (sCall);
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Process a PCode block, checking that its value can't change
+//		over a region of code
+//
+//		Only constants, variables that exist before the region and are
+//		not stored to within it, and pure calls of such values are 
+//		invariant.
+//
+// @parm PCodeEntryParameters * | pEntry | PCode entry descriptor
+//
+// @rdesc False if the value may change.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscPCodeInvariantChecker::OnPCodeEntry (PCodeEntryParameters *pEntry)
+{
+	CNscContext *pCtx = GetNscContext ();
+	NscPCode nOpCode = pEntry ->pHeader ->nOpCode;
+
+	switch (nOpCode)
+	{
+
+		//
+		// Variables must not change
+		//
+
+		case NscPCode_Variable:
+			{
+				UINT32 ulFlags = pEntry ->ulSymbolFlags [0];
+				if ((ulFlags & NscSymFlag_Increments) != 0)
+					return false;
+				if ((ulFlags & NscSymFlag_Global) != 0)
+				{
+					NscSymbol *pSymbol = pCtx ->GetSymbol (
+						pEntry ->nSymbolImmediates [0]);
+					if ((pSymbol ->ulFlags & NscSymFlag_TreatAsConstant) != 0)
+						return true;
+					return !m_pStores ->GetCallsImpure () &&
+						!m_pStores ->IsGlobalStored (pEntry ->nSymbolImmediates [0]);
+				}
+				return pEntry ->nStackOffsets [0] < m_nDepth &&
+					!m_pStores ->IsLocalStored (pEntry ->nStackOffsets [0]);
+			}
+
+		//
+		// Calls must be pure.  A pure function may still read globals, 
+		// so no global may change either.
+		//
+
+		case NscPCode_Call:
+			return CNscPCodePureCallCollector::IsPureCall (pCtx,
+				(const NscPCodeCall *) pEntry ->pHeader) &&
+				!m_pStores ->GetCallsImpure () && 
+				!m_pStores ->GetStoresGlobals ();
+
+		//
+		// Action arguments are not values
+		//
+
+		case NscPCode_Argument:
+			return pEntry ->pHeader ->nType != NscType_Action;
+
+		//
+		// Plain expressions
+		//
+
+		case NscPCode_Declaration:
+		case NscPCode_Element:
+		case NscPCode_LogicalAND:
+		case NscPCode_LogicalOR:
+		case NscPCode_Conditional:
+			return true;
+
+		//
+		// Anything else
+		//
+
+		default:
+			return nOpCode >= NscPCode__First_Simple && 
+				nOpCode != NscPCode_ExpressionEnd;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Process a PCode block, checking that it doesn't reference the
+//		locals at or above a stack offset
+//
+// @parm PCodeEntryParameters * | pEntry | PCode entry descriptor
+//
+// @rdesc False if one of the locals is referenced.
+//
+//-----------------------------------------------------------------------------
+
+bool CNscPCodeLocalReferenceChecker::OnPCodeEntry (PCodeEntryParameters *pEntry)
+{
+	NscPCode nOpCode = pEntry ->pHeader ->nOpCode;
+
+	if (nOpCode == NscPCode_Variable || 
+		(nOpCode >= NscPCode__First_Assignment && 
+		nOpCode <= NscPCode__Last_Assignment))
+	{
+		if ((pEntry ->ulSymbolFlags [0] & NscSymFlag_Global) == 0 &&
+			pEntry ->nStackOffsets [0] >= m_nStackOffset)
+			return false;
+	}
+	return true;
+}
+
 //-----------------------------------------------------------------------------
 //
 // @mfunc Process a PCode block, printing the PCode to the console
@@ -51,6 +51,8 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <algorithm>
+
 //-----------------------------------------------------------------------------
 //
 // Forward definitions
@@ -260,6 +262,227 @@ private:
 //
 //-----------------------------------------------------------------------------
 
+class CNscPCodeStoreCollector : public CNscPCodeEnumerator
+{
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	CNscPCodeStoreCollector (CNscContext *pCtx)
+	: CNscPCodeEnumerator (pCtx)
+	{
+		m_fCallsImpure = false;
+	}
+
+	// @cmember Delete the object
+	
+	~CNscPCodeStoreCollector ()
+	{
+	}
+
+// @access Public methods
+public:
+
+	// @cmember Check whether a local (by stack offset) is stored to
+
+	bool IsLocalStored (int nStackOffset) const
+	{
+		return std::find (m_anLocals .begin (), m_anLocals .end (),
+			nStackOffset) != m_anLocals .end ();
+	}
+
+	// @cmember Check whether a global (by symbol) is stored to
+
+	bool IsGlobalStored (size_t nSymbol) const
+	{
+		return std::find (m_anGlobals .begin (), m_anGlobals .end (),
+			nSymbol) != m_anGlobals .end ();
+	}
+
+	// @cmember Check whether any global is stored to
+
+	bool GetStoresGlobals () const
+	{
+		return !m_anGlobals .empty ();
+	}
+
+	// @cmember Check whether a function that may store globals is called
+
+	bool GetCallsImpure () const
+	{
+		return m_fCallsImpure;
+	}
+
+// @access Private members
+private:
+
+	// @cmember Records the variables stored to by the entry
+
+	virtual bool OnPCodeEntry (PCodeEntryParameters *pEntry);
+
+	// @cmember Stack offsets of the locals stored to
+
+	std::vector <int>		m_anLocals;
+
+	// @cmember Symbols of the globals stored to
+
+	std::vector <size_t>	m_anGlobals;
+
+	// @cmember If true, a non-pure user function is called
+
+	bool					m_fCallsImpure;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class CNscPCodePureCallCollector : public CNscPCodeEnumerator
+{
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	CNscPCodePureCallCollector (CNscContext *pCtx)
+	: CNscPCodeEnumerator (pCtx)
+	{
+	}
+
+	// @cmember Delete the object
+	
+	~CNscPCodePureCallCollector ()
+	{
+	}
+
+// @access Public types
+public:
+
+	struct PureCall
+	{
+		const NscPCodeCall	*pCall;
+		bool				fConditional;
+	};
+
+// @access Public methods
+public:
+
+	// @cmember Get the calls found, outermost first
+
+	const std::vector <PureCall> &GetCalls () const
+	{
+		return m_asCalls;
+	}
+
+	// @cmember Check whether a call is to a pure function returning a value
+
+	static bool IsPureCall (CNscContext *pCtx, const NscPCodeCall *pCall);
+
+// @access Private members
+private:
+
+	// @cmember Records the pure calls
+
+	virtual bool OnPCodeEntry (PCodeEntryParameters *pEntry);
+
+	// @cmember List of the calls found
+
+	std::vector <PureCall>	m_asCalls;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class CNscPCodeInvariantChecker : public CNscPCodeEnumerator
+{
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	CNscPCodeInvariantChecker (CNscContext *pCtx, 
+		const CNscPCodeStoreCollector *pStores, int nDepth)
+	: CNscPCodeEnumerator (pCtx)
+	{
+		m_pStores = pStores;
+		m_nDepth = nDepth;
+	}
+
+	// @cmember Delete the object
+	
+	~CNscPCodeInvariantChecker ()
+	{
+	}
+
+// @access Private members
+private:
+
+	// @cmember Returns false if the entry's value may change
+
+	virtual bool OnPCodeEntry (PCodeEntryParameters *pEntry);
+
+	// @cmember Stores made in the region the value must not change over
+
+	const CNscPCodeStoreCollector *m_pStores;
+
+	// @cmember Stack depth of the locals that exist before the region
+
+	int						m_nDepth;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class CNscPCodeLocalReferenceChecker : public CNscPCodeEnumerator
+{
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	CNscPCodeLocalReferenceChecker (CNscContext *pCtx, int nStackOffset)
+	: CNscPCodeEnumerator (pCtx)
+	{
+		m_nStackOffset = nStackOffset;
+	}
+
+	// @cmember Delete the object
+	
+	~CNscPCodeLocalReferenceChecker ()
+	{
+	}
+
+// @access Private members
+private:
+
+	// @cmember Returns false if the entry references the locals
+
+	virtual bool OnPCodeEntry (PCodeEntryParameters *pEntry);
+
+	// @cmember Stack offset of the first local that must not be referenced
+
+	int						m_nStackOffset;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
 class CNscPCodePrinter : public CNscPCodeEnumerator
 {
 
@@ -1067,7 +1067,7 @@ void CNscPStackEntry::PushCase (NscPCode nCode,
 	p ->nOpSize = nSize;
 	p ->nOpCode = nCode;
 	p ->nType = NscType_Unknown;
-	p ->szLabel [0] = 0;
+	p ->nLabel = -1;
 	p ->nCaseSize = nCaseSize;
 	p ->nCaseOffset = sizeof (NscPCodeCase);
 	p ->nFile = nFile;
@@ -628,6 +628,7 @@ protected:
 #endif
 
 	friend class CNscContext;
+	friend class NscCompileWorkspace;
 };
 
 #endif // ETS_NSCPSTACKENTRY_H
@@ -0,0 +1,408 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscResourceCache.cpp - Shared resource cache |
+//
+// This module contains the resource cache.  Entries are spread over a fixed
+// number of shards by the hash of their key so that concurrent compilations
+// rarely contend on the same lock.  Each shard keeps its entries in least
+// recently used order and evicts from the tail when the shard's share of the
+// memory budget is exceeded.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "NscResourceCache.h"
+
+//-----------------------------------------------------------------------------
+//
+// Deleter for cached contents.  Ownership is only handed to the deleter once
+// the entry has been fully inserted, so that a failed insert never frees the
+// caller's buffer.
+//
+//-----------------------------------------------------------------------------
+
+struct NscContentsDeleter
+{
+	bool fAllocated;
+
+	void operator () (unsigned char *pauchContents) const
+	{
+		if (fAllocated)
+			free (pauchContents);
+	}
+};
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscResourceCache> constructor.
+//
+// @parm size_t | nMemoryBudget | Maximum number of content bytes retained by
+//                                the cache, or zero for no limit.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscResourceCache::NscResourceCache (size_t nMemoryBudget)
+: m_nMemoryBudget (nMemoryBudget),
+  m_nHits (0),
+  m_nMisses (0),
+  m_nInsertions (0),
+  m_nEvictions (0),
+  m_nBytesServed (0),
+  m_nBytesCached (0),
+  m_nEntriesCached (0)
+{
+	for (int i = 0; i < ShardCount; i++)
+		m_asShards [i] .Bytes = 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscResourceCache> destructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscResourceCache::~NscResourceCache ()
+{
+	Flush ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Compute the hash of a key (FNV-1a over the resref and type)
+//
+// @parm const Key & | sKey | Key to hash
+//
+// @rdesc Hash value.
+//
+//-----------------------------------------------------------------------------
+
+UINT32 NscResourceCache::HashKey (const Key &sKey)
+{
+	const unsigned char *p = (const unsigned char *) &sKey .ResRef;
+	UINT32 ulHash = 2166136261u;
+
+	for (size_t i = 0; i < sizeof (sKey .ResRef); i++)
+	{
+		ulHash ^= p [i];
+		ulHash *= 16777619u;
+	}
+	ulHash ^= (UINT32) sKey .ResType;
+	ulHash *= 16777619u;
+	return ulHash;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Look up a resource in the cache
+//
+// @parm const NWN::ResRef32 & | sResRef | Name of the resource
+//
+// @parm NWN::ResType | nResType | Type of the resource
+//
+// @parm Entry & | sEntry | On success, receives a reference to the cached
+//                          contents.  The contents stay valid for as long as
+//                          the caller holds the reference.
+//
+// @rdesc True if the resource was found.
+//
+//-----------------------------------------------------------------------------
+
+bool NscResourceCache::Lookup (const NWN::ResRef32 &sResRef,
+	NWN::ResType nResType, Entry &sEntry)
+{
+	Key sKey;
+	sKey .ResRef = sResRef;
+	sKey .ResType = nResType;
+
+	Shard &sShard = GetShard (sKey);
+	{
+		std::lock_guard <std::mutex> sLock (sShard .Lock);
+
+		KeyIndex::iterator it = sShard .Index .find (sKey);
+		if (it != sShard .Index .end ())
+		{
+
+			//
+			// Move the entry to the front of the LRU list
+			//
+
+			sShard .Lru .splice (sShard .Lru .begin (), sShard .Lru, it ->second);
+			sEntry = it ->second ->sEntry;
+		}
+		else
+		{
+			m_nMisses++;
+			return false;
+		}
+	}
+
+	m_nHits++;
+	m_nBytesServed += sEntry .Size;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Check for a resource without touching the usage counters or the
+//		LRU order (used by prefetchers to skip already cached resources)
+//
+// @parm const NWN::ResRef32 & | sResRef | Name of the resource
+//
+// @parm NWN::ResType | nResType | Type of the resource
+//
+// @rdesc True if the resource is cached.
+//
+//-----------------------------------------------------------------------------
+
+bool NscResourceCache::Contains (const NWN::ResRef32 &sResRef,
+	NWN::ResType nResType)
+{
+	Key sKey;
+	sKey .ResRef = sResRef;
+	sKey .ResType = nResType;
+
+	Shard &sShard = GetShard (sKey);
+	std::lock_guard <std::mutex> sLock (sShard .Lock);
+
+	return sShard .Index .find (sKey) != sShard .Index .end ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Insert a resource into the cache
+//
+// @parm const NWN::ResRef32 & | sResRef | Name of the resource
+//
+// @parm NWN::ResType | nResType | Type of the resource
+//
+// @parm unsigned char * | pauchContents | Resource contents
+//
+// @parm UINT32 | ulSize | Size of the resource contents
+//
+// @parm bool | fAllocated | True if the contents are to be freed via free
+//
+// @parm const std::string & | strLocation | Where the resource was loaded from
+//
+// @parm Entry & | sEntry | On success, receives a reference to the cached
+//                          contents.
+//
+// @rdesc True if the cache now owns the memory for the resource.  If the
+//        resource is already cached or does not fit the memory budget, the
+//        caller retains ownership.
+//
+//-----------------------------------------------------------------------------
+
+bool NscResourceCache::Insert (const NWN::ResRef32 &sResRef,
+	NWN::ResType nResType, unsigned char *pauchContents, UINT32 ulSize,
+	bool fAllocated, const std::string &strLocation, Entry &sEntry)
+{
+	Key sKey;
+	sKey .ResRef = sResRef;
+	sKey .ResType = nResType;
+
+	Shard &sShard = GetShard (sKey);
+	size_t nBudget = GetShardBudget ();
+
+	//
+	// A resource larger than a whole shard would only flush the shard
+	//
+
+	if (nBudget != 0 && ulSize > nBudget)
+		return false;
+
+	try
+	{
+		std::lock_guard <std::mutex> sLock (sShard .Lock);
+
+		if (sShard .Index .find (sKey) != sShard .Index .end ())
+			return false;
+
+		NscContentsDeleter sDeleter;
+		sDeleter .fAllocated = false;
+
+		Node sNode;
+		sNode .sKey = sKey;
+		sNode .sEntry .Size = ulSize;
+		sNode .sEntry .Location = strLocation;
+		sNode .sEntry .Contents .reset (pauchContents, sDeleter);
+
+		sShard .Lru .push_front (sNode);
+		try
+		{
+			sShard .Index [sKey] = sShard .Lru .begin ();
+		}
+		catch (std::exception)
+		{
+			sShard .Lru .pop_front ();
+			throw;
+		}
+
+		//
+		// The entry is in place, the cache now owns the contents
+		//
+
+		std::get_deleter <NscContentsDeleter> (sShard .Lru .front () .sEntry
+			.Contents) ->fAllocated = fAllocated;
+		sShard .Bytes += ulSize;
+		m_nBytesCached += ulSize;
+		m_nEntriesCached++;
+		m_nInsertions++;
+
+		if (nBudget != 0)
+			Trim (sShard, nBudget);
+
+		sEntry = sShard .Lru .front () .sEntry;
+	}
+	catch (std::exception)
+	{
+		return false;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Evict least recently used entries from a shard.  The shard lock
+//		must be held.  The most recently used entry is never evicted.
+//
+// @parm Shard & | sShard | Shard to trim
+//
+// @parm size_t | nBudget | Byte budget of the shard
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscResourceCache::Trim (Shard &sShard, size_t nBudget)
+{
+	while (sShard .Bytes > nBudget && sShard .Lru .size () > 1)
+	{
+		Node &sNode = sShard .Lru .back ();
+		sShard .Bytes -= sNode .sEntry .Size;
+		m_nBytesCached -= sNode .sEntry .Size;
+		m_nEntriesCached--;
+		m_nEvictions++;
+		sShard .Index .erase (sNode .sKey);
+		sShard .Lru .pop_back ();
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Release all cached resources.  Contents still referenced by a
+//		caller are released when the last reference is dropped.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscResourceCache::Flush ()
+{
+	for (int i = 0; i < ShardCount; i++)
+	{
+		Shard &sShard = m_asShards [i];
+		std::lock_guard <std::mutex> sLock (sShard .Lock);
+
+		m_nBytesCached -= sShard .Bytes;
+		m_nEntriesCached -= sShard .Lru .size ();
+		sShard .Index .clear ();
+		sShard .Lru .clear ();
+		sShard .Bytes = 0;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Set the memory budget, evicting entries that no longer fit
+//
+// @parm size_t | nMemoryBudget | Maximum number of content bytes retained by
+//                                the cache, or zero for no limit.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscResourceCache::SetMemoryBudget (size_t nMemoryBudget)
+{
+	m_nMemoryBudget = nMemoryBudget;
+	if (nMemoryBudget == 0)
+		return;
+
+	size_t nBudget = GetShardBudget ();
+	for (int i = 0; i < ShardCount; i++)
+	{
+		Shard &sShard = m_asShards [i];
+		std::lock_guard <std::mutex> sLock (sShard .Lock);
+
+		Trim (sShard, nBudget);
+
+		//
+		// Trim keeps the most recent entry, drop it as well if it alone
+		// is over budget
+		//
+
+		if (sShard .Bytes > nBudget)
+		{
+			m_nBytesCached -= sShard .Bytes;
+			m_nEntriesCached -= sShard .Lru .size ();
+			m_nEvictions += sShard .Lru .size ();
+			sShard .Index .clear ();
+			sShard .Lru .clear ();
+			sShard .Bytes = 0;
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the usage counters
+//
+// @parm Statistics & | sStatistics | Receives the counters
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscResourceCache::GetStatistics (Statistics &sStatistics)
+{
+	sStatistics .Hits = m_nHits .load ();
+	sStatistics .Misses = m_nMisses .load ();
+	sStatistics .Insertions = m_nInsertions .load ();
+	sStatistics .Evictions = m_nEvictions .load ();
+	sStatistics .BytesServed = m_nBytesServed .load ();
+	sStatistics .BytesCached = m_nBytesCached .load ();
+	sStatistics .EntriesCached = m_nEntriesCached .load ();
+	sStatistics .MemoryBudget = m_nMemoryBudget .load ();
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Reset the usage counters (the cached byte and entry counts are
+//		state, not counters, and are kept)
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscResourceCache::ResetStatistics ()
+{
+	m_nHits = 0;
+	m_nMisses = 0;
+	m_nInsertions = 0;
+	m_nEvictions = 0;
+	m_nBytesServed = 0;
+}
@@ -0,0 +1,217 @@
+#ifndef ETS_NSCRESOURCECACHE_H
+#define ETS_NSCRESOURCECACHE_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscResourceCache.h - Shared resource cache |
+//
+// This module contains the definition of the resource cache that services
+// repeated #include load requests.  A single cache may be shared between
+// several compiler instances (possibly running on different threads).
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <list>
+#include <string>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <unordered_map>
+#include "NwnDefines.h"
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscResourceCache
+{
+// @access Public types
+public:
+
+	//
+	// Cached resource contents.  The contents buffer is reference counted so
+	// that an entry that is evicted (or flushed) while a compilation is still
+	// reading from it remains valid until the last reference is dropped.
+	//
+
+	struct Entry
+	{
+		std::shared_ptr< unsigned char > Contents;
+		UINT32                           Size;
+		std::string                      Location;
+	};
+
+	//
+	// Cache usage counters.
+	//
+
+	struct Statistics
+	{
+		UINT64              Hits;
+		UINT64              Misses;
+		UINT64              Insertions;
+		UINT64              Evictions;
+		UINT64              BytesServed;
+		size_t              BytesCached;
+		size_t              EntriesCached;
+		size_t              MemoryBudget;
+	};
+
+	enum
+	{
+		ShardCount          = 16,
+		DefaultMemoryBudget = 256 * 1024 * 1024,
+	};
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscResourceCache (size_t nMemoryBudget = DefaultMemoryBudget);
+
+	// @cmember Destructor
+
+	~NscResourceCache ();
+
+// @access Public methods
+public:
+
+	// @cmember Look up a resource in the cache
+
+	bool Lookup (const NWN::ResRef32 &sResRef, NWN::ResType nResType,
+		Entry &sEntry);
+
+	// @cmember Check for a resource without touching counters or LRU order
+
+	bool Contains (const NWN::ResRef32 &sResRef, NWN::ResType nResType);
+
+	// @cmember Insert a resource into the cache
+
+	bool Insert (const NWN::ResRef32 &sResRef, NWN::ResType nResType,
+		unsigned char *pauchContents, UINT32 ulSize, bool fAllocated,
+		const std::string &strLocation, Entry &sEntry);
+
+	// @cmember Release all cached resources
+
+	void Flush ();
+
+	// @cmember Set the memory budget (zero for unlimited)
+
+	void SetMemoryBudget (size_t nMemoryBudget);
+
+	// @cmember Get the memory budget
+
+	size_t GetMemoryBudget () const
+	{
+		return m_nMemoryBudget .load ();
+	}
+
+	// @cmember Get the usage counters
+
+	void GetStatistics (Statistics &sStatistics);
+
+	// @cmember Reset the usage counters
+
+	void ResetStatistics ();
+
+// @access Protected types
+protected:
+
+	struct Key
+	{
+		NWN::ResRef32       ResRef;
+		NWN::ResType        ResType;
+
+		bool operator == (const Key &other) const
+		{
+			return ResType == other .ResType &&
+				memcmp (&ResRef, &other .ResRef, sizeof (ResRef)) == 0;
+		}
+	};
+
+	struct KeyHash
+	{
+		size_t operator () (const Key &sKey) const
+		{
+			return (size_t) HashKey (sKey);
+		}
+	};
+
+	struct Node
+	{
+		Key                 sKey;
+		Entry               sEntry;
+	};
+
+	typedef std::list <Node> LruList;
+	typedef std::unordered_map <Key, LruList::iterator, KeyHash> KeyIndex;
+
+	struct Shard
+	{
+		std::mutex          Lock;
+		LruList             Lru;
+		KeyIndex            Index;
+		size_t              Bytes;
+	};
+
+// @access Protected methods
+protected:
+
+	// @cmember Compute the hash of a key
+
+	static UINT32 HashKey (const Key &sKey);
+
+	// @cmember Get the shard that holds a key
+
+	Shard &GetShard (const Key &sKey)
+	{
+		return m_asShards [(HashKey (sKey) >> 16) % ShardCount];
+	}
+
+	// @cmember Get the byte budget for a single shard
+
+	size_t GetShardBudget () const
+	{
+		return m_nMemoryBudget .load () / ShardCount;
+	}
+
+	// @cmember Evict from a shard until it fits the given budget
+
+	void Trim (Shard &sShard, size_t nBudget);
+
+// @access Protected members
+protected:
+
+	// @cmember Cache shards, each with its own lock and LRU order
+
+	Shard                       m_asShards [ShardCount];
+
+	// @cmember Memory budget in bytes (zero for unlimited)
+
+	std::atomic <size_t>        m_nMemoryBudget;
+
+	// @cmember Usage counters
+
+	std::atomic <UINT64>        m_nHits;
+	std::atomic <UINT64>        m_nMisses;
+	std::atomic <UINT64>        m_nInsertions;
+	std::atomic <UINT64>        m_nEvictions;
+	std::atomic <UINT64>        m_nBytesServed;
+	std::atomic <size_t>        m_nBytesCached;
+	std::atomic <size_t>        m_nEntriesCached;
+};
+
+#endif // ETS_NSCRESOURCECACHE_H
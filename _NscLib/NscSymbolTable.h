@@ -59,6 +59,7 @@
 //
 //-----------------------------------------------------------------------------
 
+#include <utility>
 #include "NwnDefines.h"
 
 class CNscSymbolTable
@@ -125,6 +126,52 @@ public:
 		m_nGlobalIdentifierCount = 0;
 	}
 
+	// @cmember Exchange the contents of two symbol tables
+
+	void Swap (CNscSymbolTable &sTable)
+	{
+		std::swap (m_pauchData, sTable .m_pauchData);
+		std::swap (m_nSize, sTable .m_nSize);
+		std::swap (m_nAllocated, sTable .m_nAllocated);
+		std::swap (m_nGrowSize, sTable .m_nGrowSize);
+		std::swap (m_nGlobalIdentifierCount, sTable .m_nGlobalIdentifierCount);
+		std::swap (m_sFence, sTable .m_sFence);
+	}
+
+	// @cmember Free the symbol table data
+
+	void Release ()
+	{
+		if (m_pauchData)
+			delete [] m_pauchData;
+		m_pauchData = NULL;
+		m_nSize = 0;
+		m_nAllocated = 0;
+		memset (&m_sFence, 0, sizeof (m_sFence));
+		m_nGlobalIdentifierCount = 0;
+	}
+
+	// @cmember Get the size of the symbol table data
+
+	size_t GetSize () const
+	{
+		return m_nSize;
+	}
+
+	// @cmember Get the allocated size of the symbol table data
+
+	size_t GetAllocated () const
+	{
+		return m_nAllocated;
+	}
+
+	// @cmember Get the grow amount
+
+	size_t GetGrowSize () const
+	{
+		return m_nGrowSize;
+	}
+
 	// @cmember Get a pointer to symbol table data
 
 	unsigned char *GetData (size_t nOffset = 0)
@@ -328,10 +375,9 @@ protected:
 			if (m_nSize == 0)
 				m_nSize = 1;
 			else
-			{
 				memmove (pauchNew, m_pauchData, m_nSize);
+			if (m_pauchData)
 				delete [] m_pauchData;
-			}
 			m_pauchData = pauchNew;
 		}
 	}
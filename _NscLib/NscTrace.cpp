@@ -0,0 +1,321 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscTrace.cpp - Event tracing |
+//
+// This module contains the event tracer.  A thread gets its ring buffer the
+// first time it records an event; only that registration takes a lock.  The
+// owning thread is the only writer of a buffer and publishes each event by
+// advancing the buffer's count, so a full buffer simply overwrites its
+// oldest events.  The events are formatted once the traced work is done.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include <mutex>
+#include "Precomp.h"
+#include "Nsc.h"
+#include "NscTrace.h"
+
+//-----------------------------------------------------------------------------
+//
+// Ring buffer of the events of a thread
+//
+//-----------------------------------------------------------------------------
+
+struct NscTraceBuffer
+{
+	std::atomic <UINT64>	nCount;
+	int						nThreadId;
+	std::string				strThreadName;
+	NscTrace::Event			asEvents [NscTrace::BufferEvents];
+};
+
+//-----------------------------------------------------------------------------
+//
+// Globals
+//
+//-----------------------------------------------------------------------------
+
+std::atomic <bool> NscTrace::s_fEnabled (false);
+
+static std::mutex g_sTraceLock;
+static std::vector <NscTraceBuffer *> g_apTraceBuffers;
+static UINT64 g_ulTraceStart;
+static thread_local NscTraceBuffer *g_pThreadTraceBuffer;
+
+//-----------------------------------------------------------------------------
+//
+// @func Get the ring buffer of the calling thread
+//
+// @rdesc Pointer to the buffer.
+//
+//-----------------------------------------------------------------------------
+
+static NscTraceBuffer *NscGetThreadTraceBuffer ()
+{
+	if (g_pThreadTraceBuffer == NULL)
+	{
+		NscTraceBuffer *pBuffer = new NscTraceBuffer;
+		pBuffer ->nCount = 0;
+
+		std::lock_guard <std::mutex> sLock (g_sTraceLock);
+
+		pBuffer ->nThreadId = (int) g_apTraceBuffers .size () + 1;
+		g_apTraceBuffers .push_back (pBuffer);
+		g_pThreadTraceBuffer = pBuffer;
+	}
+	return g_pThreadTraceBuffer;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @func Append a string to JSON text as a quoted string
+//
+// @parm std::string & | strText | Text to append to
+//
+// @parm const char * | pszString | String to append
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+static void NscAppendJsonString (std::string &strText, const char *pszString)
+{
+	strText += '"';
+	for (const char *p = pszString; *p; p++)
+	{
+		unsigned char c = (unsigned char) *p;
+		if (c == '"' || c == '\\')
+		{
+			strText += '\\';
+			strText += (char) c;
+		}
+		else if (c < 0x20)
+		{
+			char szEscape [8];
+			snprintf (szEscape, _countof (szEscape), "\\u%04x", c);
+			strText += szEscape;
+		}
+		else
+			strText += (char) c;
+	}
+	strText += '"';
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Start recording events
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::Start ()
+{
+	if (g_ulTraceStart == 0)
+		g_ulTraceStart = NscGetTimestamp ();
+	s_fEnabled .store (true);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Stop recording events.  Scopes that are still open record their
+//		end events.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::Stop ()
+{
+	s_fEnabled .store (false);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Record the start of a scope
+//
+// @parm const char * | pszName | Name of the scope
+//
+// @parm const char * | pszCategory | Category of the scope
+//
+// @parm const char * | pszArg | Argument of the scope (can be NULL)
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::Begin (const char *pszName, const char *pszCategory,
+	const char *pszArg)
+{
+	Record ('B', pszName, pszCategory, pszArg);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Record the end of a scope
+//
+// @parm const char * | pszName | Name of the scope
+//
+// @parm const char * | pszCategory | Category of the scope
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::End (const char *pszName, const char *pszCategory)
+{
+	Record ('E', pszName, pszCategory, NULL);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Name the calling thread in the trace
+//
+// @parm const char * | pszName | Name of the thread
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::SetThreadName (const char *pszName)
+{
+	NscTraceBuffer *pBuffer = NscGetThreadTraceBuffer ();
+
+	std::lock_guard <std::mutex> sLock (g_sTraceLock);
+
+	pBuffer ->strThreadName = pszName;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Record an event
+//
+// @parm char | chPhase | 'B' for the start of a scope, 'E' for its end
+//
+// @parm const char * | pszName | Name of the scope
+//
+// @parm const char * | pszCategory | Category of the scope
+//
+// @parm const char * | pszArg | Argument of the scope (can be NULL)
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::Record (char chPhase, const char *pszName,
+	const char *pszCategory, const char *pszArg)
+{
+	NscTraceBuffer *pBuffer = NscGetThreadTraceBuffer ();
+	UINT64 nCount = pBuffer ->nCount .load (std::memory_order_relaxed);
+
+	Event &sEvent = pBuffer ->asEvents [nCount & (BufferEvents - 1)];
+	sEvent .ulTime = NscGetTimestamp ();
+	sEvent .pszName = pszName;
+	sEvent .pszCategory = pszCategory;
+	sEvent .chPhase = chPhase;
+	if (pszArg != NULL)
+	{
+		strncpy (sEvent .szArg, pszArg, MaxArgLength);
+		sEvent .szArg [MaxArgLength] = 0;
+	}
+	else
+		sEvent .szArg [0] = 0;
+
+	pBuffer ->nCount .store (nCount + 1, std::memory_order_release);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Format the recorded events as a Chrome trace.  The threads that
+//		recorded events should be idle.  Where a buffer wrapped, the end
+//		events of the scopes whose begin events were overwritten are left
+//		out.
+//
+// @parm std::string & | strText | Receives the JSON text of the trace
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscTrace::Format (std::string &strText)
+{
+	char szNumber [128];
+	bool fFirst = true;
+
+	std::lock_guard <std::mutex> sLock (g_sTraceLock);
+
+	strText = "{\"displayTimeUnit\": \"ms\", \"traceEvents\": [";
+
+	for (size_t i = 0; i < g_apTraceBuffers .size (); i++)
+	{
+		NscTraceBuffer *pBuffer = g_apTraceBuffers [i];
+		UINT64 nCount = pBuffer ->nCount .load (std::memory_order_acquire);
+		UINT64 nFirst = nCount > BufferEvents ? nCount - BufferEvents : 0;
+		int nDepth = 0;
+
+		//
+		// Name the thread
+		//
+
+		if (!pBuffer ->strThreadName .empty ())
+		{
+			snprintf (szNumber, _countof (szNumber),
+				"%s\n{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 1, \"tid\": %d, "
+				"\"args\": {\"name\": ", fFirst ? "" : ",", pBuffer ->nThreadId);
+			strText += szNumber;
+			NscAppendJsonString (strText, pBuffer ->strThreadName .c_str ());
+			strText += "}}";
+			fFirst = false;
+		}
+
+		//
+		// Add the events
+		//
+
+		for (UINT64 n = nFirst; n < nCount; n++)
+		{
+			const Event &sEvent = pBuffer ->asEvents [n & (BufferEvents - 1)];
+
+			if (sEvent .chPhase == 'E')
+			{
+				if (nDepth == 0)
+					continue;
+				nDepth--;
+			}
+			else
+				nDepth++;
+
+			strText += fFirst ? "\n{\"name\": " : ",\n{\"name\": ";
+			NscAppendJsonString (strText, sEvent .pszName);
+			strText += ", \"cat\": ";
+			NscAppendJsonString (strText, sEvent .pszCategory);
+			snprintf (szNumber, _countof (szNumber),
+				", \"ph\": \"%c\", \"ts\": %.3f, \"pid\": 1, \"tid\": %d",
+				sEvent .chPhase,
+				(double) (INT64) (sEvent .ulTime - g_ulTraceStart) / 1000.0,
+				pBuffer ->nThreadId);
+			strText += szNumber;
+			if (sEvent .szArg [0] != 0)
+			{
+				strText += ", \"args\": {\"name\": ";
+				NscAppendJsonString (strText, sEvent .szArg);
+				strText += "}";
+			}
+			strText += "}";
+			fFirst = false;
+		}
+	}
+
+	strText += "\n]}\n";
+}
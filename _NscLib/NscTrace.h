@@ -0,0 +1,167 @@
+#ifndef ETS_NSCTRACE_H
+#define ETS_NSCTRACE_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscTrace.h - Event tracing |
+//
+// This module contains the definition of the event tracer.  When tracing is
+// started, scopes of interest (a file compile, an #include load, a parse
+// phase, code generation) record a begin and an end event with a timestamp.
+// Each thread records into its own ring buffer without taking a lock, so
+// tracing costs little more than reading the clock.  The events are
+// formatted in the Chrome trace event format, which chrome://tracing and
+// Perfetto can load.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <string>
+#include <atomic>
+#include "NwnDefines.h"
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscTrace
+{
+// @access Public types
+public:
+
+	enum Constants
+	{
+		BufferEvents		= 0x10000,	// events kept per thread
+		MaxArgLength		= 47,		// characters kept of an argument
+	};
+
+	//
+	// A recorded event.  The name and category must be string literals (or
+	// otherwise stay valid until the trace is formatted); the argument is
+	// copied.
+	//
+
+	struct Event
+	{
+		UINT64				ulTime;
+		const char			*pszName;
+		const char			*pszCategory;
+		char				chPhase;
+		char				szArg [MaxArgLength + 1];
+	};
+
+// @access Public methods
+public:
+
+	// @cmember Start recording events
+
+	static void Start ();
+
+	// @cmember Stop recording events
+
+	static void Stop ();
+
+	// @cmember Test if events are being recorded
+
+	static bool IsEnabled ()
+	{
+		return s_fEnabled .load (std::memory_order_relaxed);
+	}
+
+	// @cmember Record the start of a scope
+
+	static void Begin (const char *pszName, const char *pszCategory,
+		const char *pszArg = NULL);
+
+	// @cmember Record the end of a scope
+
+	static void End (const char *pszName, const char *pszCategory);
+
+	// @cmember Name the calling thread in the trace
+
+	static void SetThreadName (const char *pszName);
+
+	// @cmember Format the recorded events as a Chrome trace
+
+	static void Format (std::string &strText);
+
+// @access Protected methods
+protected:
+
+	// @cmember Record an event
+
+	static void Record (char chPhase, const char *pszName,
+		const char *pszCategory, const char *pszArg);
+
+// @access Protected members
+protected:
+
+	// @cmember If true, events are recorded
+
+	static std::atomic <bool>	s_fEnabled;
+};
+
+//-----------------------------------------------------------------------------
+//
+// Scope of a traced operation.  Records a begin event when constructed and
+// the matching end event when destroyed, if tracing was on when the scope
+// was entered.
+//
+//-----------------------------------------------------------------------------
+
+class NscTraceScope
+{
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscTraceScope (const char *pszName, const char *pszCategory,
+		const char *pszArg = NULL)
+	{
+		m_pszName = NULL;
+		if (NscTrace::IsEnabled ())
+		{
+			m_pszName = pszName;
+			m_pszCategory = pszCategory;
+			NscTrace::Begin (pszName, pszCategory, pszArg);
+		}
+	}
+
+	// @cmember Destructor
+
+	~NscTraceScope ()
+	{
+		if (m_pszName != NULL)
+			NscTrace::End (m_pszName, m_pszCategory);
+	}
+
+// @access Protected members
+protected:
+
+	// @cmember Name of the scope, or NULL if not traced
+
+	const char					*m_pszName;
+
+	// @cmember Category of the scope
+
+	const char					*m_pszCategory;
+
+private:
+
+	NscTraceScope (const NscTraceScope &);
+	NscTraceScope &operator = (const NscTraceScope &);
+};
+
+#endif // ETS_NSCTRACE_H
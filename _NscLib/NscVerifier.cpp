@@ -0,0 +1,1332 @@
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscVerifier.cpp - Compiled script verifier |
+//
+// This module contains the compiled script verifier.  Each instruction is
+// verified once: the first path to reach an instruction records its stack
+// depth and routine, and every later path must agree.  A call continues
+// once the stack effect of its routine is known, either from the prototype
+// in the debug symbols or from the first RETN of the routine that is
+// reached, so the work is linear in the size of the script.
+//
+// Stack depths are in bytes relative to the stack pointer at the entry of
+// the routine.  A JMP to, or a fall through into, the entry of a routine is
+// a tail call; the records of inlined calls in the debug symbols are not
+// routine entries.  A saved situation (STORE_STATE) is verified as a routine
+// of its own, entered with the saved locals on the stack.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include "Precomp.h"
+#include "Nsc.h"
+#include "NscVerifier.h"
+#include <algorithm>
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscVerifier> constructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscVerifier::NscVerifier ()
+{
+	m_pCompiler = NULL;
+	m_pszName = NULL;
+	m_pauchCode = NULL;
+	m_nCodeSize = 0;
+	m_pTextOut = NULL;
+	m_nErrors = 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc <c NscVerifier> destructor.
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+NscVerifier::~NscVerifier ()
+{
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Verify a compiled script
+//
+// @parm NscCompiler * | pCompiler | Compiler supplying the action
+//		prototypes (nwscript.nss must have been parsed)
+//
+// @parm const char * | pszName | Name of the script
+//
+// @parm const unsigned char * | pauchCode | Compiled script, including
+//		the header
+//
+// @parm size_t | nCodeSize | Size of the compiled script
+//
+// @parm const unsigned char * | pauchSymbols | Debug symbols of the script.
+//		Without them, calls are checked against the stack effects seen
+//		at the returns of each routine only.
+//
+// @parm size_t | nSymbolsSize | Size of the debug symbols
+//
+// @parm IDebugTextOut * | pTextOut | Receives the errors, NULL to verify
+//		silently
+//
+// @rdesc true if the script verified.
+//
+//-----------------------------------------------------------------------------
+
+bool NscVerifier::Verify (NscCompiler *pCompiler, const char *pszName,
+	const unsigned char *pauchCode, size_t nCodeSize,
+	const unsigned char *pauchSymbols, size_t nSymbolsSize,
+	IDebugTextOut *pTextOut)
+{
+	m_pCompiler = pCompiler;
+	m_pszName = pszName;
+	m_pauchCode = pauchCode;
+	m_nCodeSize = nCodeSize;
+	m_pTextOut = pTextOut;
+	m_nErrors = 0;
+	m_asInstructions .clear ();
+	m_asRoutines .clear ();
+	m_asPrototypes .clear ();
+	m_anWork .clear ();
+
+	//
+	// Decode the instructions
+	//
+
+	if (!Decode ())
+		return false;
+	if (m_asInstructions .empty ())
+	{
+		Error (HeaderSize, "the script contains no code");
+		return false;
+	}
+
+	//
+	// Mark the routine entries
+	//
+
+	if (pauchSymbols != NULL && nSymbolsSize > 0)
+		LoadPrototypes (pauchSymbols, nSymbolsSize);
+	for (size_t i = 0; i < m_asPrototypes .size (); i++)
+	{
+		UINT32 nOffset = m_asPrototypes [i] .nOffset;
+		if (nOffset < m_nCodeSize && m_anInstructionAt [nOffset] >= 0)
+			m_asInstructions [m_anInstructionAt [nOffset]] .fEntry = true;
+	}
+
+	//
+	// Follow the control flow from the entry point
+	//
+
+	Routine sRoutine;
+	sRoutine .nEntry = 0;
+	sRoutine .fHost = true;
+	sRoutine .fPrototype = false;
+	sRoutine .nArgSize = 0;
+	sRoutine .nReturnSize = 0;
+	sRoutine .nEffect = Unknown;
+	sRoutine .nPopFloor = 0;
+	sRoutine .nAccessFloor = 0;
+	m_asRoutines .push_back (sRoutine);
+	Reach (0, 0, 0, -1);
+
+	while (!m_anWork .empty () && m_nErrors < MaxErrors)
+	{
+		int nInstruction = m_anWork .back ();
+		m_anWork .pop_back ();
+		Step (nInstruction);
+	}
+	return m_nErrors == 0;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Decode the instruction stream
+//
+// @rdesc true if the whole stream decoded.
+//
+//-----------------------------------------------------------------------------
+
+bool NscVerifier::Decode ()
+{
+
+	//
+	// Check the header
+	//
+
+	if (m_nCodeSize < HeaderSize ||
+		memcmp (m_pauchCode, "NCS V1.0", 8) != 0 ||
+		m_pauchCode [8] != NscCode_Size)
+	{
+		Error (0, "bad script header");
+		return false;
+	}
+	if (CNwnByteOrder<UINT32>::BigEndian (&m_pauchCode [9]) != m_nCodeSize)
+	{
+		Error (9, "the header gives a script size of %u bytes, the "
+			"script has %u", CNwnByteOrder<UINT32>::BigEndian (
+			&m_pauchCode [9]), (UINT32) m_nCodeSize);
+		return false;
+	}
+
+	//
+	// Decode the instructions
+	//
+
+	m_anInstructionAt .assign (m_nCodeSize, -1);
+	size_t nOffset = HeaderSize;
+	while (nOffset < m_nCodeSize)
+	{
+		Instruction sInstruction;
+		if (!DecodeInstruction (nOffset, sInstruction))
+		{
+			Error ((UINT32) nOffset, "undecodable instruction %02X %02X",
+				m_pauchCode [nOffset], nOffset + 1 < m_nCodeSize ?
+				m_pauchCode [nOffset + 1] : 0);
+			return false;
+		}
+		m_anInstructionAt [nOffset] = (int) m_asInstructions .size ();
+		m_asInstructions .push_back (sInstruction);
+		nOffset += sInstruction .nLength;
+	}
+
+	//
+	// Mark the targets of JSR as routine entries
+	//
+
+	for (size_t i = 0; i < m_asInstructions .size (); i++)
+	{
+		Instruction &sInstruction = m_asInstructions [i];
+		if (sInstruction .cOp != NscCode_JSR)
+			continue;
+		INT64 nTarget = (INT64) sInstruction .nOffset + sInstruction .lOp1;
+		if (nTarget >= 0 && nTarget < (INT64) m_nCodeSize &&
+			m_anInstructionAt [(size_t) nTarget] >= 0)
+			m_asInstructions [m_anInstructionAt [(size_t) nTarget]] .fEntry = true;
+	}
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Decode one instruction
+//
+// @parm size_t | nOffset | Offset of the instruction
+//
+// @parm Instruction & | sInstruction | Receives the instruction
+//
+// @rdesc true if the instruction is valid.
+//
+//-----------------------------------------------------------------------------
+
+bool NscVerifier::DecodeInstruction (size_t nOffset,
+	Instruction &sInstruction)
+{
+	const unsigned char *pauchData = &m_pauchCode [nOffset];
+	size_t nSize = m_nCodeSize - nOffset;
+
+	if (nSize < 2)
+		return false;
+	sInstruction .nOffset = (UINT32) nOffset;
+	sInstruction .cOp = pauchData [0];
+	sInstruction .cType = pauchData [1];
+	sInstruction .lOp1 = 0;
+	sInstruction .lOp2 = 0;
+	sInstruction .lOp3 = 0;
+	sInstruction .nDepth = Unknown;
+	sInstruction .nRoutine = -1;
+	sInstruction .nEntryRoutine = -1;
+	sInstruction .fEntry = false;
+
+	unsigned char cType = pauchData [1];
+	size_t nLength;
+	switch (pauchData [0])
+	{
+		case NscCode_CPDOWNSP:
+		case NscCode_CPTOPSP:
+		case NscCode_CPDOWNBP:
+		case NscCode_CPTOPBP:
+			if (cType != 1)
+				return false;
+			nLength = 8;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+			sInstruction .lOp2 = CNwnByteOrder<UINT16>::BigEndian (&pauchData [6]);
+			break;
+
+		case NscCode_RSADD:
+			if (cType < 3 || (cType > 6 && cType < 0x10) || cType > 0x19)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_CONST:
+			switch (cType)
+			{
+				case 3:
+				case 4:
+				case 6:
+				case 0x12:
+					nLength = 6;
+					break;
+
+				case 5:
+				case 0x17:
+					if (nSize < 4)
+						return false;
+					nLength = 4 + CNwnByteOrder<UINT16>::BigEndian (&pauchData [2]);
+					break;
+
+				default:
+					return false;
+			}
+			break;
+
+		case NscCode_ACTION:
+			if (cType != 0)
+				return false;
+			nLength = 5;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<UINT16>::BigEndian (&pauchData [2]);
+			sInstruction .lOp2 = pauchData [4];
+			break;
+
+		case NscCode_LOGAND:
+		case NscCode_LOGOR:
+		case NscCode_INCOR:
+		case NscCode_EXCOR:
+		case NscCode_BOOLAND:
+		case NscCode_SHLEFT:
+		case NscCode_SHRIGHT:
+		case NscCode_USHRIGHT:
+		case NscCode_MOD:
+			if (cType != 0x20)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_EQUAL:
+		case NscCode_NEQUAL:
+			if (cType == 0x24)
+			{
+				nLength = 4;
+				if (nSize < nLength)
+					return false;
+				sInstruction .lOp1 = CNwnByteOrder<UINT16>::BigEndian (&pauchData [2]);
+			}
+			else if ((cType >= 0x20 && cType <= 0x23) ||
+				(cType >= 0x30 && cType <= 0x39))
+				nLength = 2;
+			else
+				return false;
+			break;
+
+		case NscCode_GEQ:
+		case NscCode_GT:
+		case NscCode_LT:
+		case NscCode_LEQ:
+			if (cType != 0x20 && cType != 0x21)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_ADD:
+		case NscCode_SUB:
+		case NscCode_MUL:
+		case NscCode_DIV:
+			switch (cType)
+			{
+				case 0x20:
+				case 0x21:
+				case 0x25:
+				case 0x26:
+					break;
+
+				case 0x23:
+					if (pauchData [0] != NscCode_ADD)
+						return false;
+					break;
+
+				case 0x3A:
+					if (pauchData [0] != NscCode_ADD &&
+						pauchData [0] != NscCode_SUB)
+						return false;
+					break;
+
+				case 0x3B:
+				case 0x3C:
+					if (pauchData [0] != NscCode_MUL &&
+						pauchData [0] != NscCode_DIV)
+						return false;
+					break;
+
+				default:
+					return false;
+			}
+			nLength = 2;
+			break;
+
+		case NscCode_NEG:
+			if (cType != 3 && cType != 4)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_COMP:
+		case NscCode_NOT:
+			if (cType != 3)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_MOVSP:
+		case NscCode_JMP:
+		case NscCode_JSR:
+		case NscCode_JZ:
+		case NscCode_JNZ:
+			if (cType != 0)
+				return false;
+			nLength = 6;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+			break;
+
+		case NscCode_DECISP:
+		case NscCode_INCISP:
+		case NscCode_DECIBP:
+		case NscCode_INCIBP:
+			if (cType != 3)
+				return false;
+			nLength = 6;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+			break;
+
+		case NscCode_RETN:
+		case NscCode_SAVEBP:
+		case NscCode_RESTOREBP:
+		case NscCode_NOP:
+			if (cType != 0)
+				return false;
+			nLength = 2;
+			break;
+
+		case NscCode_DESTRUCT:
+			if (cType != 1)
+				return false;
+			nLength = 8;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<INT16>::BigEndian (&pauchData [2]);
+			sInstruction .lOp2 = CNwnByteOrder<INT16>::BigEndian (&pauchData [4]);
+			sInstruction .lOp3 = CNwnByteOrder<INT16>::BigEndian (&pauchData [6]);
+			break;
+
+		case NscCode_STORE_STATE:
+			nLength = 10;
+			if (nSize < nLength)
+				return false;
+			sInstruction .lOp1 = CNwnByteOrder<INT32>::BigEndian (&pauchData [2]);
+			sInstruction .lOp2 = CNwnByteOrder<INT32>::BigEndian (&pauchData [6]);
+			break;
+
+		default:
+			return false;
+	}
+	if (nLength > nSize)
+		return false;
+	sInstruction .nLength = (UINT16) nLength;
+	return true;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Parse the routine prototypes of the debug symbols
+//
+// @parm const unsigned char * | pauchSymbols | Debug symbols
+//
+// @parm size_t | nSize | Size of the debug symbols
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::LoadPrototypes (const unsigned char *pauchSymbols,
+	size_t nSize)
+{
+	std::vector <int> anStructSizes;
+	Prototype *pPrototype = NULL;
+	const char *pszText = (const char *) pauchSymbols;
+	const char *pszEnd = pszText + nSize;
+
+	while (pszText < pszEnd)
+	{
+
+		//
+		// Extract the next line
+		//
+
+		const char *pszLineEnd = (const char *) memchr (pszText, '\n',
+			pszEnd - pszText);
+		if (pszLineEnd == NULL)
+			pszLineEnd = pszEnd;
+		char szLine [600];
+		size_t nLength = pszLineEnd - pszText;
+		if (nLength >= _countof (szLine))
+			nLength = _countof (szLine) - 1;
+		memcpy (szLine, pszText, nLength);
+		szLine [nLength] = 0;
+		pszText = pszLineEnd + 1;
+
+		//
+		// Structures come first, then the routines, each followed by the
+		// types of its fields or arguments
+		//
+
+		char szType [256];
+		char szName [256];
+		unsigned int nStart, nEnd, nCount;
+		if (szLine [0] == 's' && szLine [1] == ' ')
+		{
+			anStructSizes .push_back (0);
+			pPrototype = NULL;
+		}
+		else if (szLine [0] == 's' && szLine [1] == 'f' && szLine [2] == ' ')
+		{
+			if (anStructSizes .empty () ||
+				sscanf (&szLine [3], "%255s", szType) != 1)
+				continue;
+			int nTypeSize = GetSymbolTypeSize (szType, anStructSizes);
+			if (nTypeSize == Unknown || anStructSizes .back () == Unknown)
+				anStructSizes .back () = Unknown;
+			else
+				anStructSizes .back () += nTypeSize;
+		}
+		else if (szLine [0] == 'f' && szLine [1] == ' ')
+		{
+			pPrototype = NULL;
+			if (sscanf (&szLine [2], "%x %x %u %255s %255s", &nStart,
+				&nEnd, &nCount, szType, szName) != 5)
+				continue;
+
+			//
+			// Skip routines that were not compiled (i.e. always inlined or
+			// not called) and the internal routines, whose stack use is not
+			// described by a prototype
+			//
+
+			if (nStart == 0xFFFFFFFF || szName [0] == '#')
+				continue;
+			Prototype sPrototype;
+			sPrototype .nOffset = nStart;
+			sPrototype .nEnd = nEnd;
+			sPrototype .nArgSize = 0;
+			sPrototype .nReturnSize = GetSymbolTypeSize (szType, anStructSizes);
+			if (sPrototype .nReturnSize == Unknown)
+				continue;
+			m_asPrototypes .push_back (sPrototype);
+			pPrototype = &m_asPrototypes .back ();
+		}
+		else if (szLine [0] == 'f' && szLine [1] == 'p' && szLine [2] == ' ')
+		{
+			if (pPrototype == NULL ||
+				sscanf (&szLine [3], "%255s", szType) != 1)
+				continue;
+			int nTypeSize = GetSymbolTypeSize (szType, anStructSizes);
+			if (nTypeSize == Unknown)
+			{
+				m_asPrototypes .pop_back ();
+				pPrototype = NULL;
+				continue;
+			}
+			pPrototype ->nArgSize += nTypeSize;
+		}
+		else
+			pPrototype = NULL;
+	}
+
+	//
+	// Sort by offset for lookup, then drop the records of inlined calls,
+	// which lie within the code of the routine they were inlined into
+	//
+
+	std::sort (m_asPrototypes .begin (), m_asPrototypes .end (),
+		[] (const Prototype &s1, const Prototype &s2)
+		{
+			if (s1 .nOffset != s2 .nOffset)
+				return s1 .nOffset < s2 .nOffset;
+			return s1 .nEnd > s2 .nEnd;
+		});
+	size_t nKept = 0;
+	UINT32 nEnd = 0;
+	for (size_t i = 0; i < m_asPrototypes .size (); i++)
+	{
+		if (nKept > 0 && m_asPrototypes [i] .nOffset < nEnd)
+			continue;
+		nEnd = m_asPrototypes [i] .nEnd;
+		m_asPrototypes [nKept++] = m_asPrototypes [i];
+	}
+	m_asPrototypes .resize (nKept);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the stack size of a debug symbol type
+//
+// @parm const char * | pszType | Type text
+//
+// @parm const std::vector <int> & | anStructSizes | Sizes of the
+//		structures defined so far
+//
+// @rdesc Size in bytes or Unknown.
+//
+//-----------------------------------------------------------------------------
+
+int NscVerifier::GetSymbolTypeSize (const char *pszType,
+	const std::vector <int> &anStructSizes)
+{
+	switch (pszType [0])
+	{
+		case 'v':
+			return pszType [1] == 0 ? 0 : Unknown;
+
+		case 'i':
+		case 'f':
+		case 's':
+		case 'o':
+			return pszType [1] == 0 ? 4 : Unknown;
+
+		case 'e':
+			return 4;
+
+		case 't':
+			{
+				size_t nStruct = (size_t) atoi (&pszType [1]);
+				if (nStruct >= anStructSizes .size ())
+					return Unknown;
+				return anStructSizes [nStruct];
+			}
+
+		default:
+			return Unknown;
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the stack sizes of an action
+//
+// @parm int | nAction | Action index
+//
+// @rdesc Pointer to the sizes or NULL if the action is unknown.
+//
+//-----------------------------------------------------------------------------
+
+const NscVerifier::Action *NscVerifier::GetAction (int nAction)
+{
+	if (nAction < 0)
+		return NULL;
+	if ((size_t) nAction >= m_asActions .size ())
+	{
+		Action sAction;
+		sAction .fLoaded = false;
+		m_asActions .resize (nAction + 1, sAction);
+	}
+
+	//
+	// Get the prototype the first time the action is seen
+	//
+
+	Action &sAction = m_asActions [nAction];
+	if (!sAction .fLoaded)
+	{
+		NscPrototypeDefinition sPrototype;
+		sAction .fLoaded = true;
+		sAction .fValid = m_pCompiler ->NscGetActionPrototype (
+			nAction, sPrototype);
+		sAction .anArgSizes .clear ();
+		if (sAction .fValid)
+		{
+			NscType nType = sPrototype .ReturnType;
+			for (size_t i = 0; i <= sPrototype .ParameterTypes .size (); i++)
+			{
+				int nSize;
+				if (i > 0)
+					nType = sPrototype .ParameterTypes [i - 1];
+				if (nType == NscType_Void || nType == NscType_Action)
+					nSize = 0;
+				else if (nType == NscType_Vector)
+					nSize = 12;
+				else if (nType == NscType_Integer ||
+					nType == NscType_Float ||
+					nType == NscType_String ||
+					nType == NscType_Object ||
+					(nType >= NscType_Engine_0 && nType < NscType_Struct_0))
+					nSize = 4;
+				else
+				{
+					sAction .fValid = false;
+					break;
+				}
+				if (i == 0)
+					sAction .nReturnSize = nSize;
+				else
+					sAction .anArgSizes .push_back (nSize);
+			}
+			sAction .nMinArgs = (int) sPrototype .MinParameters;
+		}
+	}
+	return sAction .fValid ? &sAction : NULL;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the routine entered at an instruction
+//
+// @parm int | nInstruction | Entry instruction
+//
+// @rdesc Index of the routine.
+//
+//-----------------------------------------------------------------------------
+
+int NscVerifier::GetRoutine (int nInstruction)
+{
+	Instruction &sInstruction = m_asInstructions [nInstruction];
+	if (sInstruction .nEntryRoutine >= 0)
+		return sInstruction .nEntryRoutine;
+
+	//
+	// Create the routine, using the prototype if there is one
+	//
+
+	Routine sRoutine;
+	sRoutine .nEntry = nInstruction;
+	sRoutine .fHost = false;
+	sRoutine .fPrototype = false;
+	sRoutine .nArgSize = Unknown;
+	sRoutine .nReturnSize = Unknown;
+	sRoutine .nEffect = Unknown;
+	sRoutine .nPopFloor = Unknown;
+	sRoutine .nAccessFloor = Unknown;
+
+	Prototype sKey;
+	sKey .nOffset = sInstruction .nOffset;
+	std::vector <Prototype>::const_iterator it = std::lower_bound (
+		m_asPrototypes .begin (), m_asPrototypes .end (), sKey,
+		[] (const Prototype &s1, const Prototype &s2)
+		{
+			return s1 .nOffset < s2 .nOffset;
+		});
+	if (it != m_asPrototypes .end () && it ->nOffset == sKey .nOffset)
+	{
+		sRoutine .fPrototype = true;
+		sRoutine .nArgSize = it ->nArgSize;
+		sRoutine .nReturnSize = it ->nReturnSize;
+		sRoutine .nEffect = -it ->nArgSize;
+		sRoutine .nPopFloor = -it ->nArgSize;
+		sRoutine .nAccessFloor = -(it ->nArgSize + it ->nReturnSize);
+	}
+
+	int nRoutine = (int) m_asRoutines .size ();
+	m_asRoutines .push_back (sRoutine);
+	sInstruction .nEntryRoutine = nRoutine;
+	Reach (nInstruction, 0, nRoutine, -1);
+	return nRoutine;
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Note that control reaches an instruction
+//
+// @parm int | nInstruction | Instruction reached
+//
+// @parm int | nDepth | Stack depth
+//
+// @parm int | nRoutine | Routine
+//
+// @parm int | nFrom | Instruction transferring control or -1
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::Reach (int nInstruction, int nDepth, int nRoutine,
+	int nFrom)
+{
+	Instruction &sInstruction = m_asInstructions [nInstruction];
+	UINT32 nFromOffset = nFrom >= 0 ?
+		m_asInstructions [nFrom] .nOffset : sInstruction .nOffset;
+
+	if (sInstruction .nDepth == Unknown)
+	{
+		sInstruction .nDepth = nDepth;
+		sInstruction .nRoutine = nRoutine;
+		m_anWork .push_back (nInstruction);
+	}
+	else if (sInstruction .nRoutine != nRoutine)
+	{
+		Error (nFromOffset, "control enters the routine at %08X other "
+			"than through its entry", sInstruction .nOffset);
+	}
+	else if (sInstruction .nDepth != nDepth)
+	{
+		Error (nFromOffset, "stack depth %d at %08X, %d on another path",
+			nDepth, sInstruction .nOffset, sInstruction .nDepth);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Note that a routine returns
+//
+// @parm int | nRoutine | Routine
+//
+// @parm int | nDepth | Stack depth at the return
+//
+// @parm int | nFrom | Instruction returning (RETN or tail call JMP)
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::Return (int nRoutine, int nDepth, int nFrom)
+{
+	Routine &sRoutine = m_asRoutines [nRoutine];
+	UINT32 nOffset = m_asInstructions [nFrom] .nOffset;
+
+	if (sRoutine .fPrototype)
+	{
+		if (nDepth != sRoutine .nEffect)
+		{
+			Error (nOffset, "return with stack depth %d, the prototype "
+				"has %d bytes of arguments", nDepth, sRoutine .nArgSize);
+		}
+		return;
+	}
+	if (sRoutine .nEffect != Unknown)
+	{
+		if (nDepth != sRoutine .nEffect)
+		{
+			Error (nOffset, "return with stack depth %d, %d on another "
+				"path", nDepth, sRoutine .nEffect);
+		}
+		return;
+	}
+
+	//
+	// The stack effect of the routine is now known, so the calls waiting
+	// for it can continue
+	//
+
+	sRoutine .nEffect = nDepth;
+	if (sRoutine .fHost)
+		return;
+	std::vector <Pending> asPending;
+	asPending .swap (sRoutine .asPending);
+	for (size_t i = 0; i < asPending .size (); i++)
+	{
+		const Pending &sPending = asPending [i];
+		if (sPending .fTailCall)
+		{
+			Return (sPending .nRoutine, sPending .nDepth + nDepth,
+				sPending .nInstruction);
+		}
+		else
+		{
+			Reach (sPending .nInstruction + 1, sPending .nDepth + nDepth,
+				sPending .nRoutine, sPending .nInstruction);
+		}
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Verify one instruction
+//
+// @parm int | nInstruction | Instruction
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::Step (int nInstruction)
+{
+	const Instruction &sInstruction = m_asInstructions [nInstruction];
+	int nDepth = sInstruction .nDepth;
+	int nRoutine = sInstruction .nRoutine;
+	int nNext = nInstruction + 1;
+	bool fFallThrough = true;
+	int nIn = 0;
+	int nOut = 0;
+
+	switch (sInstruction .cOp)
+	{
+		case NscCode_CPDOWNSP:
+			CheckAccess (nInstruction, sInstruction .lOp1, sInstruction .lOp2);
+			CheckAccess (nInstruction, -sInstruction .lOp2, sInstruction .lOp2);
+			break;
+
+		case NscCode_CPTOPSP:
+			CheckAccess (nInstruction, sInstruction .lOp1, sInstruction .lOp2);
+			nOut = sInstruction .lOp2;
+			break;
+
+		case NscCode_RSADD:
+		case NscCode_CONST:
+		case NscCode_SAVEBP:
+			nOut = 4;
+			break;
+
+		case NscCode_RESTOREBP:
+			nIn = 4;
+			break;
+
+		case NscCode_ACTION:
+			{
+				const Action *pAction = GetAction (sInstruction .lOp1);
+				if (pAction == NULL)
+				{
+					Error (sInstruction .nOffset, "unknown action %d",
+						sInstruction .lOp1);
+					return;
+				}
+				if (sInstruction .lOp2 > (INT32) pAction ->anArgSizes .size () ||
+					sInstruction .lOp2 < pAction ->nMinArgs)
+				{
+					Error (sInstruction .nOffset, "%d arguments for action "
+						"%d, which takes %d to %d", sInstruction .lOp2,
+						sInstruction .lOp1, pAction ->nMinArgs,
+						(int) pAction ->anArgSizes .size ());
+					return;
+				}
+				for (INT32 i = 0; i < sInstruction .lOp2; i++)
+					nIn += pAction ->anArgSizes [i];
+				nOut = pAction ->nReturnSize;
+			}
+			break;
+
+		case NscCode_LOGAND:
+		case NscCode_LOGOR:
+		case NscCode_INCOR:
+		case NscCode_EXCOR:
+		case NscCode_BOOLAND:
+		case NscCode_EQUAL:
+		case NscCode_NEQUAL:
+		case NscCode_GEQ:
+		case NscCode_GT:
+		case NscCode_LT:
+		case NscCode_LEQ:
+		case NscCode_SHLEFT:
+		case NscCode_SHRIGHT:
+		case NscCode_USHRIGHT:
+		case NscCode_ADD:
+		case NscCode_SUB:
+		case NscCode_MUL:
+		case NscCode_DIV:
+		case NscCode_MOD:
+			switch (sInstruction .cType)
+			{
+				case 0x24:
+					if (sInstruction .lOp1 <= 0 || (sInstruction .lOp1 & 3) != 0)
+					{
+						Error (sInstruction .nOffset, "bad structure size "
+							"%d", sInstruction .lOp1);
+						return;
+					}
+					nIn = sInstruction .lOp1 * 2;
+					nOut = 4;
+					break;
+
+				case 0x3A:
+					nIn = 24;
+					nOut = 12;
+					break;
+
+				case 0x3B:
+				case 0x3C:
+					nIn = 16;
+					nOut = 12;
+					break;
+
+				default:
+					nIn = 8;
+					nOut = 4;
+					break;
+			}
+			break;
+
+		case NscCode_NEG:
+		case NscCode_COMP:
+		case NscCode_NOT:
+			nIn = 4;
+			nOut = 4;
+			break;
+
+		case NscCode_MOVSP:
+			if (sInstruction .lOp1 > 0 || (sInstruction .lOp1 & 3) != 0)
+			{
+				Error (sInstruction .nOffset, "bad stack adjustment %d",
+					sInstruction .lOp1);
+				return;
+			}
+			nIn = -sInstruction .lOp1;
+			break;
+
+		case NscCode_JMP:
+			{
+				int nTarget = GetTarget (nInstruction, sInstruction .lOp1);
+				if (nTarget < 0)
+					return;
+
+				//
+				// A JMP to the entry of a routine is a tail call: the
+				// routine returns to our caller
+				//
+
+				if (m_asInstructions [nTarget] .fEntry)
+					TailCall (nInstruction, nTarget);
+				else
+					Reach (nTarget, nDepth, nRoutine, nInstruction);
+				fFallThrough = false;
+			}
+			break;
+
+		case NscCode_JSR:
+			{
+				int nTarget = GetTarget (nInstruction, sInstruction .lOp1);
+				if (nTarget < 0)
+					return;
+				int nCallee = GetRoutine (nTarget);
+				const Routine &sCallee = m_asRoutines [nCallee];
+				fFallThrough = false;
+				if (nNext >= (int) m_asInstructions .size ())
+				{
+					Error (sInstruction .nOffset, "the call returns past "
+						"the end of the script");
+					return;
+				}
+
+				//
+				// The caller must have pushed the arguments and reserved
+				// the return value
+				//
+
+				if (sCallee .fPrototype &&
+					sCallee .nArgSize + sCallee .nReturnSize > 0)
+				{
+					CheckAccess (nInstruction, -(sCallee .nArgSize +
+						sCallee .nReturnSize), sCallee .nArgSize +
+						sCallee .nReturnSize);
+				}
+				if (sCallee .nEffect != Unknown)
+				{
+					CheckDepth (nInstruction, nDepth + sCallee .nEffect);
+					Reach (nNext, nDepth + sCallee .nEffect, nRoutine,
+						nInstruction);
+				}
+				else
+				{
+					Pending sPending;
+					sPending .nInstruction = nInstruction;
+					sPending .nDepth = nDepth;
+					sPending .nRoutine = nRoutine;
+					sPending .fTailCall = false;
+					m_asRoutines [nCallee] .asPending .push_back (sPending);
+				}
+			}
+			break;
+
+		case NscCode_JZ:
+		case NscCode_JNZ:
+			{
+				int nTarget = GetTarget (nInstruction, sInstruction .lOp1);
+				if (nTarget < 0)
+					return;
+				Reach (nTarget, nDepth - 4, nRoutine, nInstruction);
+				nIn = 4;
+			}
+			break;
+
+		case NscCode_RETN:
+			Return (nRoutine, nDepth, nInstruction);
+			fFallThrough = false;
+			break;
+
+		case NscCode_DESTRUCT:
+			if (sInstruction .lOp1 <= 0 || (sInstruction .lOp1 & 3) != 0 ||
+				sInstruction .lOp2 < 0 || (sInstruction .lOp2 & 3) != 0 ||
+				sInstruction .lOp3 < 0 || (sInstruction .lOp3 & 3) != 0 ||
+				sInstruction .lOp2 + sInstruction .lOp3 > sInstruction .lOp1)
+			{
+				Error (sInstruction .nOffset, "bad DESTRUCT operands");
+				return;
+			}
+			nIn = sInstruction .lOp1;
+			nOut = sInstruction .lOp3;
+			break;
+
+		case NscCode_DECISP:
+		case NscCode_INCISP:
+			CheckAccess (nInstruction, sInstruction .lOp1, 4);
+			break;
+
+		case NscCode_CPDOWNBP:
+		case NscCode_CPTOPBP:
+		case NscCode_DECIBP:
+		case NscCode_INCIBP:
+			{
+				INT32 lSize = sInstruction .cOp == NscCode_DECIBP ||
+					sInstruction .cOp == NscCode_INCIBP ? 4 : sInstruction .lOp2;
+				if (sInstruction .lOp1 >= 0 || (sInstruction .lOp1 & 3) != 0 ||
+					lSize <= 0 || (lSize & 3) != 0 ||
+					sInstruction .lOp1 + lSize > 0)
+				{
+					Error (sInstruction .nOffset, "bad global variable "
+						"operands %d, %d", sInstruction .lOp1, lSize);
+					return;
+				}
+				if (sInstruction .cOp == NscCode_CPDOWNBP)
+					CheckAccess (nInstruction, -lSize, lSize);
+				else if (sInstruction .cOp == NscCode_CPTOPBP)
+					nOut = lSize;
+			}
+			break;
+
+		case NscCode_STORE_STATE:
+			{
+				if (sInstruction .lOp1 < 0 || (sInstruction .lOp1 & 3) != 0 ||
+					sInstruction .lOp2 < 0 || (sInstruction .lOp2 & 3) != 0)
+				{
+					Error (sInstruction .nOffset, "bad STORE_STATE operands");
+					return;
+				}
+				if (sInstruction .lOp2 > 0)
+					CheckAccess (nInstruction, -sInstruction .lOp2, sInstruction .lOp2);
+				int nTarget = GetTarget (nInstruction, sInstruction .cType);
+				if (nTarget < 0)
+					return;
+
+				//
+				// The saved situation runs later as a routine of its own,
+				// with the saved locals on the stack
+				//
+
+				Routine sRoutine;
+				sRoutine .nEntry = nTarget;
+				sRoutine .fHost = true;
+				sRoutine .fPrototype = false;
+				sRoutine .nArgSize = 0;
+				sRoutine .nReturnSize = 0;
+				sRoutine .nEffect = Unknown;
+				sRoutine .nPopFloor = 0;
+				sRoutine .nAccessFloor = 0;
+				m_asRoutines .push_back (sRoutine);
+				Reach (nTarget, sInstruction .lOp2,
+					(int) m_asRoutines .size () - 1, nInstruction);
+			}
+			break;
+
+		case NscCode_NOP:
+			break;
+	}
+
+	if (!fFallThrough)
+		return;
+	if (nIn > 0)
+		CheckDepth (nInstruction, nDepth - nIn);
+	if (nNext >= (int) m_asInstructions .size ())
+	{
+		Error (sInstruction .nOffset, "control runs past the end of the "
+			"script");
+		return;
+	}
+
+	//
+	// Falling through into the entry of a routine is a tail call whose JMP
+	// was optimized away
+	//
+
+	if (m_asInstructions [nNext] .fEntry)
+	{
+		m_asInstructions [nInstruction] .nDepth = nDepth - nIn + nOut;
+		TailCall (nInstruction, nNext);
+		m_asInstructions [nInstruction] .nDepth = nDepth;
+	}
+	else
+		Reach (nNext, nDepth - nIn + nOut, nRoutine, nInstruction);
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Verify a tail call
+//
+// @parm int | nInstruction | Instruction transferring control
+//
+// @parm int | nTarget | Entry of the routine called
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::TailCall (int nInstruction, int nTarget)
+{
+	int nDepth = m_asInstructions [nInstruction] .nDepth;
+	int nRoutine = m_asInstructions [nInstruction] .nRoutine;
+	int nCallee = GetRoutine (nTarget);
+
+	if (m_asRoutines [nCallee] .nEffect != Unknown)
+	{
+		Return (nRoutine, nDepth + m_asRoutines [nCallee] .nEffect,
+			nInstruction);
+	}
+	else
+	{
+		Pending sPending;
+		sPending .nInstruction = nInstruction;
+		sPending .nDepth = nDepth;
+		sPending .nRoutine = nRoutine;
+		sPending .fTailCall = true;
+		m_asRoutines [nCallee] .asPending .push_back (sPending);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Check a stack pointer relative access
+//
+// @parm int | nInstruction | Instruction
+//
+// @parm int | nOffset | Offset from the top of the stack
+//
+// @parm int | nSize | Size of the access
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::CheckAccess (int nInstruction, int nOffset, int nSize)
+{
+	const Instruction &sInstruction = m_asInstructions [nInstruction];
+	const Routine &sRoutine = m_asRoutines [sInstruction .nRoutine];
+
+	if (nOffset >= 0 || (nOffset & 3) != 0 || nSize <= 0 ||
+		(nSize & 3) != 0 || nOffset + nSize > 0)
+	{
+		Error (sInstruction .nOffset, "bad stack operands %d, %d",
+			nOffset, nSize);
+	}
+	else if (sRoutine .nAccessFloor != Unknown &&
+		sInstruction .nDepth + nOffset < sRoutine .nAccessFloor)
+	{
+		Error (sInstruction .nOffset, "stack access %d bytes below the "
+			"frame of the routine", sRoutine .nAccessFloor -
+			(sInstruction .nDepth + nOffset));
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Check a new stack depth
+//
+// @parm int | nInstruction | Instruction
+//
+// @parm int | nDepth | Stack depth after (or during) the instruction
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::CheckDepth (int nInstruction, int nDepth)
+{
+	const Instruction &sInstruction = m_asInstructions [nInstruction];
+	const Routine &sRoutine = m_asRoutines [sInstruction .nRoutine];
+
+	if (sRoutine .nPopFloor != Unknown && nDepth < sRoutine .nPopFloor)
+	{
+		Error (sInstruction .nOffset, "stack underflow, %d bytes popped "
+			"beyond the frame of the routine", sRoutine .nPopFloor - nDepth);
+	}
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Get the index of the instruction at a branch target
+//
+// @parm int | nInstruction | Branch instruction
+//
+// @parm INT32 | lDistance | Distance to the target
+//
+// @rdesc Index of the target instruction or -1 if invalid.
+//
+//-----------------------------------------------------------------------------
+
+int NscVerifier::GetTarget (int nInstruction, INT32 lDistance)
+{
+	const Instruction &sInstruction = m_asInstructions [nInstruction];
+	INT64 nTarget = (INT64) sInstruction .nOffset + lDistance;
+
+	if (nTarget < HeaderSize || nTarget >= (INT64) m_nCodeSize ||
+		m_anInstructionAt [(size_t) nTarget] < 0)
+	{
+		Error (sInstruction .nOffset, "branch target %08X is not an "
+			"instruction", (UINT32) nTarget);
+		return -1;
+	}
+	return m_anInstructionAt [(size_t) nTarget];
+}
+
+//-----------------------------------------------------------------------------
+//
+// @mfunc Report an error
+//
+// @parm UINT32 | nOffset | Offset of the instruction in the script
+//
+// @parm const char * | pszFormat | Format of the message
+//
+// @rdesc None.
+//
+//-----------------------------------------------------------------------------
+
+void NscVerifier::Error (UINT32 nOffset, const char *pszFormat, ...)
+{
+	char szMessage [512];
+	va_list marker;
+
+	if (m_nErrors >= MaxErrors)
+		return;
+	if (m_pTextOut == NULL)
+	{
+		m_nErrors++;
+		return;
+	}
+	va_start (marker, pszFormat);
+	vsnprintf (szMessage, _countof (szMessage), pszFormat, marker);
+	va_end (marker);
+	m_pTextOut ->WriteText ("%s.ncs(%08X): Error: Verification failed: %s\n",
+		m_pszName, nOffset, szMessage);
+	if (++m_nErrors == MaxErrors)
+	{
+		m_pTextOut ->WriteText ("%s.ncs: Error: Too many verification "
+			"errors, stopping.\n", m_pszName);
+	}
+}
@@ -0,0 +1,257 @@
+#ifndef ETS_NSCVERIFIER_H
+#define ETS_NSCVERIFIER_H
+
+//-----------------------------------------------------------------------------
+//
+// @doc
+//
+// @module	NscVerifier.h - Compiled script verifier |
+//
+// This module contains the definition of the compiled script verifier.  The
+// verifier decodes the instruction stream of a compiled script once, then
+// follows its control flow one instruction at a time, recording the stack
+// depth at each instruction relative to the entry of the routine that
+// contains it.  It reports undecodable instructions, branches that do not
+// land on an instruction, code that runs off the end of the script, stack
+// depths that disagree where control flow merges, stack accesses outside of
+// the routine's frame, and calls and returns that do not agree with the
+// routine prototypes recorded in the debug symbols.
+//
+// A verifier is owned by a single compiler instance; it keeps its buffers
+// and the stack sizes of the engine actions between scripts.
+//
+// @end
+//
+//-----------------------------------------------------------------------------
+
+//-----------------------------------------------------------------------------
+//
+// Required include files
+//
+//-----------------------------------------------------------------------------
+
+#include <vector>
+#include "Nsc.h"
+
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+//-----------------------------------------------------------------------------
+
+class NscVerifier
+{
+// @access Public types
+public:
+
+	enum Constants
+	{
+		MaxErrors			= 16,		// errors reported per script
+		HeaderSize			= 13,		// "NCS V1.0", 'B', file size
+		Unknown				= -0x7FFFFFFF - 1,
+	};
+
+// @access Constructors and destructors
+public:
+
+	// @cmember General constructor
+
+	NscVerifier ();
+
+	// @cmember Destructor
+
+	~NscVerifier ();
+
+// @access Public methods
+public:
+
+	// @cmember Verify a compiled script
+
+	bool Verify (NscCompiler *pCompiler, const char *pszName,
+		const unsigned char *pauchCode, size_t nCodeSize,
+		const unsigned char *pauchSymbols, size_t nSymbolsSize,
+		IDebugTextOut *pTextOut);
+
+	// @cmember Get the stack depth before an instruction of the last script
+	//		verified, relative to the entry of its routine
+
+	bool GetDepth (UINT32 nOffset, int &nDepth) const
+	{
+		if (nOffset >= m_anInstructionAt .size () ||
+			m_anInstructionAt [nOffset] < 0)
+			return false;
+		nDepth = m_asInstructions [m_anInstructionAt [nOffset]] .nDepth;
+		return nDepth != Unknown;
+	}
+
+// @access Protected types
+protected:
+
+	//
+	// A decoded instruction and the analysis state of it
+	//
+
+	struct Instruction
+	{
+		UINT32				nOffset;
+		unsigned char		cOp;
+		unsigned char		cType;
+		UINT16				nLength;
+		INT32				lOp1;
+		INT32				lOp2;
+		INT32				lOp3;
+		int					nDepth;
+		int					nRoutine;
+		int					nEntryRoutine;
+		bool				fEntry;
+	};
+
+	//
+	// A call or tail call waiting for the stack effect of its routine
+	//
+
+	struct Pending
+	{
+		int					nInstruction;
+		int					nDepth;
+		int					nRoutine;
+		bool				fTailCall;
+	};
+
+	//
+	// A routine (a call target, the script entry or a saved situation)
+	//
+
+	struct Routine
+	{
+		int					nEntry;
+		bool				fHost;
+		bool				fPrototype;
+		int					nArgSize;
+		int					nReturnSize;
+		int					nEffect;
+		int					nPopFloor;
+		int					nAccessFloor;
+		std::vector <Pending> asPending;
+	};
+
+	//
+	// A routine prototype from the debug symbols
+	//
+
+	struct Prototype
+	{
+		UINT32				nOffset;
+		UINT32				nEnd;
+		int					nArgSize;
+		int					nReturnSize;
+	};
+
+	//
+	// The stack sizes of an engine action
+	//
+
+	struct Action
+	{
+		bool				fLoaded;
+		bool				fValid;
+		int					nMinArgs;
+		int					nReturnSize;
+		std::vector <int>	anArgSizes;
+	};
+
+// @access Protected methods
+protected:
+
+	// @cmember Decode the instruction stream
+
+	bool Decode ();
+
+	// @cmember Decode one instruction
+
+	bool DecodeInstruction (size_t nOffset, Instruction &sInstruction);
+
+	// @cmember Parse the routine prototypes of the debug symbols
+
+	void LoadPrototypes (const unsigned char *pauchSymbols, size_t nSize);
+
+	// @cmember Get the stack size of a debug symbol type
+
+	int GetSymbolTypeSize (const char *pszType,
+		const std::vector <int> &anStructSizes);
+
+	// @cmember Get the stack sizes of an action
+
+	const Action *GetAction (int nAction);
+
+	// @cmember Get the routine entered at an instruction
+
+	int GetRoutine (int nInstruction);
+
+	// @cmember Note that control reaches an instruction
+
+	void Reach (int nInstruction, int nDepth, int nRoutine, int nFrom);
+
+	// @cmember Note that a routine returns
+
+	void Return (int nRoutine, int nDepth, int nFrom);
+
+	// @cmember Verify a tail call
+
+	void TailCall (int nInstruction, int nTarget);
+
+	// @cmember Verify one instruction
+
+	void Step (int nInstruction);
+
+	// @cmember Check a stack pointer relative access
+
+	void CheckAccess (int nInstruction, int nOffset, int nSize);
+
+	// @cmember Check a new stack depth
+
+	void CheckDepth (int nInstruction, int nDepth);
+
+	// @cmember Get the index of the instruction at a branch target
+
+	int GetTarget (int nInstruction, INT32 lDistance);
+
+	// @cmember Report an error
+
+	void Error (UINT32 nOffset, const char *pszFormat, ...);
+
+// @access Protected members
+protected:
+
+	// @cmember Compiler supplying the action prototypes
+
+	NscCompiler					*m_pCompiler;
+
+	// @cmember Script being verified
+
+	const char					*m_pszName;
+	const unsigned char			*m_pauchCode;
+	size_t						m_nCodeSize;
+	IDebugTextOut				*m_pTextOut;
+	int							m_nErrors;
+
+	// @cmember Decoded instructions and the instruction at each offset
+
+	std::vector <Instruction>	m_asInstructions;
+	std::vector <int>			m_anInstructionAt;
+
+	// @cmember Routines and prototypes
+
+	std::vector <Routine>		m_asRoutines;
+	std::vector <Prototype>		m_asPrototypes;
+
+	// @cmember Instructions left to verify
+
+	std::vector <int>			m_anWork;
+
+	// @cmember Stack sizes of the engine actions, kept between scripts
+
+	std::vector <Action>		m_asActions;
+};
+
+#endif // ETS_NSCVERIFIER_H
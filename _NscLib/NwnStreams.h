@@ -52,6 +52,8 @@
 #pragma warning(disable:4296) // C4296: '<': expression is always false
 #endif
 
+#include <vector>
+
 //-----------------------------------------------------------------------------
 //
 // Forward definitions
@@ -411,6 +413,172 @@ protected:
 	bool				m_fManaged;
 };
 
+//-----------------------------------------------------------------------------
+//
+// Class definition
+//
+// Output stream that writes straight into a vector owned by the caller.
+//
+//-----------------------------------------------------------------------------
+
+class CNwnVectorStream : public CNwnStream
+{
+// @access Constructors and destructors
+public:
+
+	// @cmember Constructor
+
+	CNwnVectorStream (std::vector <unsigned char> &vecData, 
+		const char *pszFileName = "")
+	{
+		m_strFileName = pszFileName;
+		m_pvecData = &vecData;
+		m_nPos = vecData .size ();
+	}
+
+	// @cmember Destructor
+
+	virtual ~CNwnVectorStream ()
+	{
+	}
+
+// @access Public input routines
+public:
+
+	// @cmember Read data from the input
+
+	virtual size_t Read (void *pBuffer, size_t nCount)
+	{
+		size_t nRemaining = m_pvecData ->size () - m_nPos;
+		if (nRemaining < nCount)
+			nCount = nRemaining;
+		if (nCount != 0)
+			memcpy (pBuffer, &(*m_pvecData) [m_nPos], nCount);
+		m_nPos += nCount;
+		return nCount;
+	}
+
+	// @cmember Read a line from the input
+
+	virtual char *ReadLine (char *pachBuffer, size_t nCount) 
+	{
+		char *pachOut = pachBuffer;
+		while (--nCount > 0 && m_nPos < m_pvecData ->size ())
+		{
+			unsigned char c = (*m_pvecData) [m_nPos++];
+			*pachOut++ = (char) c;
+			if (c == '\n')
+				break;
+		}
+		*pachOut = 0;
+		return pachOut == pachBuffer ? NULL : pachBuffer; 
+	}
+
+// @access Public output routines
+public:
+
+	// @cmember Flush any data to the output
+
+	virtual bool Flush ()
+	{
+		return true;
+	}
+
+	// @cmember Write data to the output
+
+	virtual size_t Write (void *pBuffer, size_t nCount)
+	{
+		const unsigned char *pauchData = (const unsigned char *) pBuffer;
+
+		//
+		// Overwrite what lies past the position, then append the rest
+		//
+
+		size_t nOverlap = m_pvecData ->size () - m_nPos;
+		if (nOverlap > nCount)
+			nOverlap = nCount;
+		if (nOverlap != 0)
+			memcpy (&(*m_pvecData) [m_nPos], pauchData, nOverlap);
+		m_pvecData ->insert (m_pvecData ->end (), 
+			pauchData + nOverlap, pauchData + nCount);
+		m_nPos += nCount;
+		return nCount;
+	}
+
+	// @cmember Write a line to the output
+
+	virtual size_t WriteLine (const char *pszBuffer, bool fAppendCRLF = true)
+	{
+		if (pszBuffer == NULL)
+			pszBuffer = "";
+		size_t nCount = Write ((void *) pszBuffer, strlen (pszBuffer));
+		if (fAppendCRLF)
+			nCount += Write ((void *) "\r\n", 2);
+		return nCount;
+	}
+
+// @access Public general routines
+public:
+
+	// @cmember Get the length of the file
+
+	virtual size_t GetLength ()
+	{
+		return m_pvecData ->size ();
+	}
+
+	// @cmember Seek file position
+
+	virtual size_t Seek (size_t nPosition, SeekPosition nStart)
+	{
+		if (nStart == current)
+			nPosition += GetPosition ();
+		else if (nStart == end)
+			nPosition = GetLength () - nPosition;
+
+		if (nPosition > GetLength ())
+			nPosition = GetLength ();
+		m_nPos = nPosition;
+		return GetPosition ();
+	}
+
+	// @cmember Get current position
+
+	virtual size_t GetPosition ()
+	{
+		return m_nPos;
+	}
+
+	// @cmember Get the file name
+
+	virtual const char *GetFileName ()
+	{
+		return m_strFileName .c_str ();
+	}
+
+	// @cmember Test for end of file
+
+	virtual bool IsEndOfFile () const
+	{
+		return m_nPos >= m_pvecData ->size ();
+	}
+
+// @access Protected variables
+protected:
+
+	// @cmember File name
+
+	std::string					m_strFileName;
+
+	// @cmember Vector that receives the data
+
+	std::vector <unsigned char>	*m_pvecData;
+
+	// @cmember Current position
+
+	size_t						m_nPos;
+};
+
 #ifdef _MSC_VER
 #pragma warning(pop)
 #endif
@@ -0,0 +1,1366 @@
+/*++
+
+Module Name:
+
+	BatchFileIo.cpp
+
+Abstract:
+
+	This module houses the batch file I/O backends.  See BatchFileIo.h for an
+	overview.
+
+--*/
+
+#include "Precomp.h"
+#include "BatchFileIo.h"
+
+#include <cerrno>
+#include <cstring>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+
+#if !defined(_WINDOWS)
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+#endif
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>)
+#define NWN_HAVE_IO_URING 1
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/uio.h>
+#include <linux/io_uring.h>
+#endif
+#endif
+
+namespace
+{
+
+class SyncFileIo : public BatchFileIo
+{
+
+public:
+
+	virtual
+	void
+	ReadFiles(
+		ReadRequest * Requests,
+		size_t Count
+		)
+	{
+		for (size_t i = 0; i < Count; i += 1)
+			ReadFileSync( Requests[ i ] );
+	}
+
+	virtual
+	void
+	WriteFiles(
+		WriteRequest * Requests,
+		size_t Count
+		)
+	{
+		for (size_t i = 0; i < Count; i += 1)
+			WriteFileSync( Requests[ i ] );
+	}
+
+	virtual
+	BACKEND
+	GetBackend(
+		) const
+	{
+		return BackendSync;
+	}
+
+};
+
+class ThreadPoolFileIo : public BatchFileIo
+{
+
+public:
+
+	ThreadPoolFileIo(
+		size_t ThreadCount
+		);
+
+	virtual
+	~ThreadPoolFileIo(
+		);
+
+	virtual
+	void
+	ReadFiles(
+		ReadRequest * Requests,
+		size_t Count
+		)
+	{
+		RunBatch(
+			Count,
+			[Requests]( size_t i ) { ReadFileSync( Requests[ i ] ); });
+	}
+
+	virtual
+	void
+	WriteFiles(
+		WriteRequest * Requests,
+		size_t Count
+		)
+	{
+		RunBatch(
+			Count,
+			[Requests]( size_t i ) { WriteFileSync( Requests[ i ] ); });
+	}
+
+	virtual
+	BACKEND
+	GetBackend(
+		) const
+	{
+		return BackendThreadPool;
+	}
+
+private:
+
+	typedef std::function< void ( size_t ) > WorkRoutine;
+
+	void
+	RunBatch(
+		size_t Count,
+		const WorkRoutine & Work
+		);
+
+	void
+	WorkerThread(
+		);
+
+	void
+	DrainBatch(
+		const WorkRoutine & Work,
+		size_t Count
+		);
+
+	std::vector< std::thread > m_Workers;
+
+	//
+	// The batch currently being worked on.  Everything but m_Next and
+	// m_Completed is protected by m_Lock.  Workers that join a batch bump
+	// m_Busy, and RunBatch does not return until they have all left it.
+	//
+
+	std::mutex                 m_Lock;
+	std::mutex                 m_BatchLock;
+	std::condition_variable    m_Wakeup;
+	std::condition_variable    m_Done;
+	const WorkRoutine        * m_Work;
+	size_t                     m_Count;
+	std::atomic< size_t >      m_Next;
+	std::atomic< size_t >      m_Completed;
+	size_t                     m_Busy;
+	unsigned long              m_Generation;
+	bool                       m_Stopping;
+
+};
+
+ThreadPoolFileIo::ThreadPoolFileIo(
+	size_t ThreadCount
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new ThreadPoolFileIo and starts its workers.
+	The calling thread also takes part in each batch, so ThreadCount - 1
+	worker threads are started.
+
+Arguments:
+
+	ThreadCount - Supplies the number of threads that service a batch.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Work( nullptr ),
+  m_Count( 0 ),
+  m_Next( 0 ),
+  m_Completed( 0 ),
+  m_Busy( 0 ),
+  m_Generation( 0 ),
+  m_Stopping( false )
+{
+	try
+	{
+		for (size_t i = 1; i < ThreadCount; i += 1)
+			m_Workers.push_back( std::thread( &ThreadPoolFileIo::WorkerThread, this ) );
+	}
+	catch (std::exception)
+	{
+		{
+			std::lock_guard< std::mutex > Lock( m_Lock );
+
+			m_Stopping = true;
+		}
+
+		m_Wakeup.notify_all( );
+
+		for (std::vector< std::thread >::iterator it = m_Workers.begin( );
+		     it != m_Workers.end( );
+		     ++it)
+		{
+			it->join( );
+		}
+
+		throw;
+	}
+}
+
+ThreadPoolFileIo::~ThreadPoolFileIo(
+	)
+/*++
+
+Routine Description:
+
+	This routine stops the worker threads and waits for them to exit.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	{
+		std::lock_guard< std::mutex > Lock( m_Lock );
+
+		m_Stopping = true;
+	}
+
+	m_Wakeup.notify_all( );
+
+	for (std::vector< std::thread >::iterator it = m_Workers.begin( );
+	     it != m_Workers.end( );
+	     ++it)
+	{
+		it->join( );
+	}
+}
+
+void
+ThreadPoolFileIo::RunBatch(
+	size_t Count,
+	const WorkRoutine & Work
+	)
+/*++
+
+Routine Description:
+
+	This routine runs a work routine once for each index of a batch, spread
+	over the worker threads and the calling thread, and waits for the whole
+	batch to finish.
+
+Arguments:
+
+	Count - Supplies the number of items in the batch.
+
+	Work - Supplies the routine to invoke for each item index.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if ((Count <= 1) || (m_Workers.empty( )))
+	{
+		for (size_t i = 0; i < Count; i += 1)
+			Work( i );
+
+		return;
+	}
+
+	//
+	// Only one batch may be outstanding at a time.
+	//
+
+	std::lock_guard< std::mutex > BatchLock( m_BatchLock );
+
+	{
+		std::lock_guard< std::mutex > Lock( m_Lock );
+
+		m_Work       = &Work;
+		m_Count      = Count;
+		m_Next       = 0;
+		m_Completed  = 0;
+		m_Generation += 1;
+	}
+
+	m_Wakeup.notify_all( );
+
+	DrainBatch( Work, Count );
+
+	std::unique_lock< std::mutex > Lock( m_Lock );
+
+	while ((m_Completed < Count) || (m_Busy != 0))
+		m_Done.wait( Lock );
+
+	m_Work  = nullptr;
+	m_Count = 0;
+}
+
+void
+ThreadPoolFileIo::DrainBatch(
+	const WorkRoutine & Work,
+	size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine claims and runs batch items until none remain.
+
+Arguments:
+
+	Work - Supplies the routine to invoke for each item index.
+
+	Count - Supplies the number of items in the batch.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (;;)
+	{
+		size_t Index = m_Next++;
+
+		if (Index >= Count)
+			break;
+
+		Work( Index );
+
+		if (++m_Completed == Count)
+		{
+			std::lock_guard< std::mutex > Lock( m_Lock );
+
+			m_Done.notify_all( );
+		}
+	}
+}
+
+void
+ThreadPoolFileIo::WorkerThread(
+	)
+/*++
+
+Routine Description:
+
+	This routine is the body of a worker thread.  It waits for a new batch,
+	helps drain it, and repeats until the pool is stopped.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode, worker thread.
+
+--*/
+{
+	unsigned long Generation = 0;
+
+	for (;;)
+	{
+		const WorkRoutine * Work;
+		size_t              Count;
+
+		{
+			std::unique_lock< std::mutex > Lock( m_Lock );
+
+			while ((!m_Stopping) &&
+			       ((Generation == m_Generation) || (m_Work == nullptr)))
+			{
+				m_Wakeup.wait( Lock );
+			}
+
+			if (m_Stopping)
+				break;
+
+			Generation  = m_Generation;
+			Work        = m_Work;
+			Count       = m_Count;
+			m_Busy     += 1;
+		}
+
+		DrainBatch( *Work, Count );
+
+		{
+			std::lock_guard< std::mutex > Lock( m_Lock );
+
+			m_Busy -= 1;
+			m_Done.notify_all( );
+		}
+	}
+}
+
+#if NWN_HAVE_IO_URING
+
+class IoUringFileIo : public BatchFileIo
+{
+
+public:
+
+	IoUringFileIo(
+		);
+
+	virtual
+	~IoUringFileIo(
+		);
+
+	//
+	// Set up the submission and completion rings.  Returns false if the
+	// kernel does not support io_uring (or it is disabled).
+	//
+
+	bool
+	Initialize(
+		);
+
+	virtual
+	void
+	ReadFiles(
+		ReadRequest * Requests,
+		size_t Count
+		);
+
+	virtual
+	void
+	WriteFiles(
+		WriteRequest * Requests,
+		size_t Count
+		);
+
+	virtual
+	BACKEND
+	GetBackend(
+		) const
+	{
+		return BackendIoUring;
+	}
+
+private:
+
+	enum
+	{
+		RingEntries = 128
+	};
+
+	//
+	// Tracks one whole file transfer through the ring.
+	//
+
+	struct Transfer
+	{
+		int              Fd;
+		unsigned char  * Buffer;
+		size_t           Length;
+		size_t           Done;
+		struct iovec     Vec;
+		REQUEST_STATUS * Status;
+	};
+
+	void
+	RunTransfers(
+		Transfer * Transfers,
+		size_t Count,
+		unsigned char Opcode
+		);
+
+	//
+	// There is a single ring, so batches from different threads take turns.
+	//
+
+	std::mutex       m_RingLock;
+	int              m_RingFd;
+	void           * m_SqRing;
+	size_t           m_SqRingSize;
+	void           * m_CqRing;
+	size_t           m_CqRingSize;
+	io_uring_sqe   * m_Sqes;
+	size_t           m_SqesSize;
+	unsigned       * m_SqHead;
+	unsigned       * m_SqTail;
+	unsigned       * m_SqMask;
+	unsigned       * m_SqArray;
+	unsigned       * m_CqHead;
+	unsigned       * m_CqTail;
+	unsigned       * m_CqMask;
+	io_uring_cqe   * m_Cqes;
+	unsigned         m_SqEntries;
+
+};
+
+IoUringFileIo::IoUringFileIo(
+	)
+: m_RingFd( -1 ),
+  m_SqRing( MAP_FAILED ),
+  m_SqRingSize( 0 ),
+  m_CqRing( MAP_FAILED ),
+  m_CqRingSize( 0 ),
+  m_Sqes( (io_uring_sqe *) MAP_FAILED ),
+  m_SqesSize( 0 ),
+  m_SqEntries( 0 )
+{
+}
+
+IoUringFileIo::~IoUringFileIo(
+	)
+{
+	if (m_Sqes != MAP_FAILED)
+		munmap( m_Sqes, m_SqesSize );
+
+	if ((m_CqRing != MAP_FAILED) && (m_CqRing != m_SqRing))
+		munmap( m_CqRing, m_CqRingSize );
+
+	if (m_SqRing != MAP_FAILED)
+		munmap( m_SqRing, m_SqRingSize );
+
+	if (m_RingFd != -1)
+		close( m_RingFd );
+}
+
+bool
+IoUringFileIo::Initialize(
+	)
+/*++
+
+Routine Description:
+
+	This routine creates the io_uring instance and maps its rings.  The raw
+	system call interface is used so that no user mode io_uring library is
+	required at build time.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if the ring is ready
+	for use, else false if io_uring is not available.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	io_uring_params Params;
+
+	memset( &Params, 0, sizeof( Params ) );
+
+	m_RingFd = (int) syscall( __NR_io_uring_setup, (unsigned) RingEntries, &Params );
+
+	if (m_RingFd < 0)
+	{
+		m_RingFd = -1;
+		return false;
+	}
+
+	m_SqRingSize = Params.sq_off.array + Params.sq_entries * sizeof( unsigned );
+	m_CqRingSize = Params.cq_off.cqes + Params.cq_entries * sizeof( io_uring_cqe );
+
+	if (Params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		if (m_CqRingSize > m_SqRingSize)
+			m_SqRingSize = m_CqRingSize;
+
+		m_CqRingSize = m_SqRingSize;
+	}
+
+	m_SqRing = mmap(
+		nullptr,
+		m_SqRingSize,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		m_RingFd,
+		IORING_OFF_SQ_RING);
+
+	if (m_SqRing == MAP_FAILED)
+		return false;
+
+	if (Params.features & IORING_FEAT_SINGLE_MMAP)
+	{
+		m_CqRing = m_SqRing;
+	}
+	else
+	{
+		m_CqRing = mmap(
+			nullptr,
+			m_CqRingSize,
+			PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE,
+			m_RingFd,
+			IORING_OFF_CQ_RING);
+
+		if (m_CqRing == MAP_FAILED)
+			return false;
+	}
+
+	m_SqesSize = Params.sq_entries * sizeof( io_uring_sqe );
+	m_Sqes     = (io_uring_sqe *) mmap(
+		nullptr,
+		m_SqesSize,
+		PROT_READ | PROT_WRITE,
+		MAP_SHARED | MAP_POPULATE,
+		m_RingFd,
+		IORING_OFF_SQES);
+
+	if (m_Sqes == MAP_FAILED)
+		return false;
+
+	m_SqHead    = (unsigned *) ((unsigned char *) m_SqRing + Params.sq_off.head);
+	m_SqTail    = (unsigned *) ((unsigned char *) m_SqRing + Params.sq_off.tail);
+	m_SqMask    = (unsigned *) ((unsigned char *) m_SqRing + Params.sq_off.ring_mask);
+	m_SqArray   = (unsigned *) ((unsigned char *) m_SqRing + Params.sq_off.array);
+	m_CqHead    = (unsigned *) ((unsigned char *) m_CqRing + Params.cq_off.head);
+	m_CqTail    = (unsigned *) ((unsigned char *) m_CqRing + Params.cq_off.tail);
+	m_CqMask    = (unsigned *) ((unsigned char *) m_CqRing + Params.cq_off.ring_mask);
+	m_Cqes      = (io_uring_cqe *) ((unsigned char *) m_CqRing + Params.cq_off.cqes);
+	m_SqEntries = Params.sq_entries;
+
+	return true;
+}
+
+void
+IoUringFileIo::RunTransfers(
+	Transfer * Transfers,
+	size_t Count,
+	unsigned char Opcode
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes a set of whole file transfers through the ring.  All
+	transfers that fit are submitted with a single io_uring_enter call, and
+	short transfers are resubmitted for their remainder.
+
+	Transfers that complete are marked StatusSuccess; transfers that fail are
+	marked StatusTransferFailed.  File descriptors are not closed here.
+
+Arguments:
+
+	Transfers - Supplies the transfers to run.
+
+	Count - Supplies the number of transfers.
+
+	Opcode - Supplies IORING_OP_READV or IORING_OP_WRITEV.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::vector< size_t > Queue;
+	unsigned              Queued;
+	size_t                InFlight;
+
+	Queue.reserve( Count );
+
+	for (size_t i = Count; i != 0; i -= 1)
+		Queue.push_back( i - 1 );
+
+	Queued   = 0;
+	InFlight = 0;
+
+	while ((!Queue.empty( )) || (Queued != 0) || (InFlight != 0))
+	{
+		unsigned Tail = *m_SqTail;
+		long     Consumed;
+
+		//
+		// Fill the submission ring.  Queued counts entries already placed
+		// in the ring that the kernel has not yet consumed.
+		//
+
+		while ((!Queue.empty( )) && (InFlight + Queued < m_SqEntries))
+		{
+			size_t         Index = Queue.back( );
+			Transfer     & Xfer  = Transfers[ Index ];
+			unsigned       Slot  = Tail & *m_SqMask;
+			io_uring_sqe * Sqe   = &m_Sqes[ Slot ];
+
+			Queue.pop_back( );
+
+			Xfer.Vec.iov_base = Xfer.Buffer + Xfer.Done;
+			Xfer.Vec.iov_len  = Xfer.Length - Xfer.Done;
+
+			memset( Sqe, 0, sizeof( *Sqe ) );
+			Sqe->opcode    = Opcode;
+			Sqe->fd        = Xfer.Fd;
+			Sqe->off       = Xfer.Done;
+			Sqe->addr      = (unsigned long) &Xfer.Vec;
+			Sqe->len       = 1;
+			Sqe->user_data = Index;
+
+			m_SqArray[ Slot ] = Slot;
+			Tail   += 1;
+			Queued += 1;
+		}
+
+		__atomic_store_n( m_SqTail, Tail, __ATOMIC_RELEASE );
+
+		Consumed = syscall(
+			__NR_io_uring_enter,
+			m_RingFd,
+			Queued,
+			1,
+			IORING_ENTER_GETEVENTS,
+			nullptr,
+			0);
+
+		if (Consumed < 0)
+		{
+			if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY))
+			{
+				//
+				// The ring is unusable.  Anything not yet completed is
+				// reported as failed.
+				//
+
+				for (size_t i = 0; i < Count; i += 1)
+				{
+					if (*Transfers[ i ].Status == StatusPending)
+						*Transfers[ i ].Status = StatusTransferFailed;
+				}
+
+				return;
+			}
+
+			Consumed = 0;
+		}
+
+		Queued   -= (unsigned) Consumed;
+		InFlight += (size_t) Consumed;
+
+		unsigned Head = *m_CqHead;
+
+		while (Head != __atomic_load_n( m_CqTail, __ATOMIC_ACQUIRE ))
+		{
+			io_uring_cqe * Cqe   = &m_Cqes[ Head & *m_CqMask ];
+			size_t         Index = (size_t) Cqe->user_data;
+			Transfer     & Xfer  = Transfers[ Index ];
+
+			if ((Cqe->res == -EINTR) || (Cqe->res == -EAGAIN))
+			{
+				Queue.push_back( Index );
+			}
+			else if (Cqe->res <= 0)
+			{
+				*Xfer.Status = StatusTransferFailed;
+			}
+			else
+			{
+				Xfer.Done += (size_t) Cqe->res;
+
+				if (Xfer.Done < Xfer.Length)
+					Queue.push_back( Index );
+				else
+					*Xfer.Status = StatusSuccess;
+			}
+
+			InFlight -= 1;
+			Head     += 1;
+		}
+
+		__atomic_store_n( m_CqHead, Head, __ATOMIC_RELEASE );
+	}
+}
+
+void
+IoUringFileIo::ReadFiles(
+	ReadRequest * Requests,
+	size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine reads a batch of whole files.  The files are opened and
+	sized synchronously, then all of the reads of a ring's worth of files are
+	issued together.
+
+Arguments:
+
+	Requests - Supplies the read requests.
+
+	Count - Supplies the number of requests.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::lock_guard< std::mutex > Lock( m_RingLock );
+	std::vector< Transfer >       Transfers;
+
+	Transfers.reserve( RingEntries );
+
+	for (size_t First = 0; First < Count; First += RingEntries)
+	{
+		size_t Last = First + RingEntries;
+
+		if (Last > Count)
+			Last = Count;
+
+		Transfers.clear( );
+
+		for (size_t i = First; i < Last; i += 1)
+		{
+			ReadRequest & Request = Requests[ i ];
+			struct stat   StatBuf;
+			Transfer      Xfer;
+			int           Fd;
+
+			Request.Contents.clear( );
+			Request.Status = StatusPending;
+
+			Fd = open( Request.FileName.c_str( ), O_RDONLY | O_CLOEXEC );
+
+			if (Fd < 0)
+			{
+				Request.Status = StatusOpenFailed;
+				continue;
+			}
+
+			if (fstat( Fd, &StatBuf ) != 0)
+			{
+				close( Fd );
+				Request.Status = StatusOpenFailed;
+				continue;
+			}
+
+			if (StatBuf.st_size == 0)
+			{
+				close( Fd );
+				Request.Status = StatusSuccess;
+				continue;
+			}
+
+			try
+			{
+				Request.Contents.resize( (size_t) StatBuf.st_size );
+			}
+			catch (std::exception)
+			{
+				close( Fd );
+				Request.Status = StatusTransferFailed;
+				continue;
+			}
+
+			Xfer.Fd     = Fd;
+			Xfer.Buffer = &Request.Contents[ 0 ];
+			Xfer.Length = Request.Contents.size( );
+			Xfer.Done   = 0;
+			Xfer.Status = &Request.Status;
+
+			Transfers.push_back( Xfer );
+		}
+
+		if (!Transfers.empty( ))
+			RunTransfers( &Transfers[ 0 ], Transfers.size( ), IORING_OP_READV );
+
+		for (std::vector< Transfer >::iterator it = Transfers.begin( );
+		     it != Transfers.end( );
+		     ++it)
+		{
+			close( it->Fd );
+		}
+	}
+}
+
+void
+IoUringFileIo::WriteFiles(
+	WriteRequest * Requests,
+	size_t Count
+	)
+/*++
+
+Routine Description:
+
+	This routine writes a batch of whole files.  The files are created
+	synchronously, then all of the writes of a ring's worth of files are
+	issued together.
+
+Arguments:
+
+	Requests - Supplies the write requests.
+
+	Count - Supplies the number of requests.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::lock_guard< std::mutex > Lock( m_RingLock );
+	std::vector< Transfer >       Transfers;
+
+	Transfers.reserve( RingEntries );
+
+	for (size_t First = 0; First < Count; First += RingEntries)
+	{
+		size_t Last = First + RingEntries;
+
+		if (Last > Count)
+			Last = Count;
+
+		Transfers.clear( );
+
+		for (size_t i = First; i < Last; i += 1)
+		{
+			WriteRequest & Request = Requests[ i ];
+			Transfer       Xfer;
+			int            Fd;
+
+			Request.Status = StatusPending;
+
+			Fd = open(
+				Request.FileName.c_str( ),
+				O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+				0666);
+
+			if (Fd < 0)
+			{
+				Request.Status = StatusOpenFailed;
+				continue;
+			}
+
+			if (Request.Length == 0)
+			{
+				close( Fd );
+				Request.Status = StatusSuccess;
+				continue;
+			}
+
+			Xfer.Fd     = Fd;
+			Xfer.Buffer = (unsigned char *) Request.Data;
+			Xfer.Length = Request.Length;
+			Xfer.Done   = 0;
+			Xfer.Status = &Request.Status;
+
+			Transfers.push_back( Xfer );
+		}
+
+		if (!Transfers.empty( ))
+			RunTransfers( &Transfers[ 0 ], Transfers.size( ), IORING_OP_WRITEV );
+
+		for (std::vector< Transfer >::iterator it = Transfers.begin( );
+		     it != Transfers.end( );
+		     ++it)
+		{
+			if (close( it->Fd ) != 0)
+				*it->Status = StatusTransferFailed;
+		}
+	}
+}
+
+#endif // NWN_HAVE_IO_URING
+
+}
+
+std::unique_ptr< BatchFileIo >
+BatchFileIo::Create(
+	BACKEND Backend,
+	size_t ThreadCount
+	)
+/*++
+
+Routine Description:
+
+	This routine creates a batch I/O object for the requested backend.  If
+	io_uring is requested (or selected automatically) but is not available,
+	the thread pool backend is returned instead.
+
+Arguments:
+
+	Backend - Supplies the requested backend.
+
+	ThreadCount - Supplies the number of threads for the thread pool backend,
+	              or zero to use one per processor.
+
+Return Value:
+
+	The routine returns the new batch I/O object.  On failure, an
+	std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Backend == BackendSync)
+		return std::unique_ptr< BatchFileIo >( new SyncFileIo( ) );
+
+#if NWN_HAVE_IO_URING
+	if ((Backend == BackendIoUring) || (Backend == BackendAuto))
+	{
+		std::unique_ptr< IoUringFileIo > Ring( new IoUringFileIo( ) );
+
+		if (Ring->Initialize( ))
+			return std::unique_ptr< BatchFileIo >( Ring.release( ) );
+	}
+#endif
+
+	if (ThreadCount == 0)
+	{
+		ThreadCount = std::thread::hardware_concurrency( );
+
+		if (ThreadCount < 2)
+			ThreadCount = 2;
+	}
+
+	return std::unique_ptr< BatchFileIo >( new ThreadPoolFileIo( ThreadCount ) );
+}
+
+bool
+BatchFileIo::ParseBackendName(
+	const char * Name,
+	BACKEND & Backend
+	)
+/*++
+
+Routine Description:
+
+	This routine converts a backend name to a backend value.
+
+Arguments:
+
+	Name - Supplies the backend name.
+
+	Backend - Receives the backend value.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if the name was
+	recognized.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	for (int i = 0; i < LastBackend; i += 1)
+	{
+		if (!strcmp( Name, GetBackendName( (BACKEND) i ) ))
+		{
+			Backend = (BACKEND) i;
+			return true;
+		}
+	}
+
+	return false;
+}
+
+const char *
+BatchFileIo::GetBackendName(
+	BACKEND Backend
+	)
+{
+	switch (Backend)
+	{
+
+	case BackendSync:
+		return "sync";
+
+	case BackendThreadPool:
+		return "threads";
+
+	case BackendIoUring:
+		return "uring";
+
+	case BackendAuto:
+		return "auto";
+
+	default:
+		return "unknown";
+
+	}
+}
+
+void
+BatchFileIo::ReadFileSync(
+	ReadRequest & Request
+	)
+/*++
+
+Routine Description:
+
+	This routine reads a single whole file on the calling thread.
+
+Arguments:
+
+	Request - Supplies the read request, which receives the file contents and
+	          the request status.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Request.Contents.clear( );
+	Request.Status = StatusPending;
+
+	try
+	{
+#if defined(_WINDOWS)
+		FILE * f;
+		long   Size;
+
+		f = fopen( Request.FileName.c_str( ), "rb" );
+
+		if (f == nullptr)
+		{
+			Request.Status = StatusOpenFailed;
+			return;
+		}
+
+		if ((fseek( f, 0, SEEK_END ) != 0) ||
+		    ((Size = ftell( f )) < 0) ||
+		    (fseek( f, 0, SEEK_SET ) != 0))
+		{
+			fclose( f );
+			Request.Status = StatusTransferFailed;
+			return;
+		}
+
+		Request.Contents.resize( (size_t) Size );
+
+		if ((Size != 0) &&
+		    (fread( &Request.Contents[ 0 ], (size_t) Size, 1, f ) != 1))
+		{
+			fclose( f );
+			Request.Contents.clear( );
+			Request.Status = StatusTransferFailed;
+			return;
+		}
+
+		fclose( f );
+#else
+		struct stat StatBuf;
+		size_t      Done;
+		int         Fd;
+
+		Fd = open( Request.FileName.c_str( ), O_RDONLY | O_CLOEXEC );
+
+		if (Fd < 0)
+		{
+			Request.Status = StatusOpenFailed;
+			return;
+		}
+
+		if (fstat( Fd, &StatBuf ) != 0)
+		{
+			close( Fd );
+			Request.Status = StatusOpenFailed;
+			return;
+		}
+
+		try
+		{
+			Request.Contents.resize( (size_t) StatBuf.st_size );
+		}
+		catch (std::exception)
+		{
+			close( Fd );
+			throw;
+		}
+
+		Done = 0;
+
+		while (Done < Request.Contents.size( ))
+		{
+			ssize_t Transferred;
+
+			Transferred = pread(
+				Fd,
+				&Request.Contents[ Done ],
+				Request.Contents.size( ) - Done,
+				(off_t) Done);
+
+			if ((Transferred < 0) && (errno == EINTR))
+				continue;
+
+			if (Transferred <= 0)
+			{
+				close( Fd );
+				Request.Contents.clear( );
+				Request.Status = StatusTransferFailed;
+				return;
+			}
+
+			Done += (size_t) Transferred;
+		}
+
+		close( Fd );
+#endif
+
+		Request.Status = StatusSuccess;
+	}
+	catch (std::exception)
+	{
+		Request.Contents.clear( );
+		Request.Status = StatusTransferFailed;
+	}
+}
+
+void
+BatchFileIo::WriteFileSync(
+	WriteRequest & Request
+	)
+/*++
+
+Routine Description:
+
+	This routine writes a single whole file on the calling thread.
+
+Arguments:
+
+	Request - Supplies the write request, which receives the request status.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+#if defined(_WINDOWS)
+	FILE * f;
+
+	f = fopen( Request.FileName.c_str( ), "wb" );
+
+	if (f == nullptr)
+	{
+		Request.Status = StatusOpenFailed;
+		return;
+	}
+
+	if ((Request.Length != 0) &&
+	    (fwrite( Request.Data, Request.Length, 1, f ) != 1))
+	{
+		fclose( f );
+		Request.Status = StatusTransferFailed;
+		return;
+	}
+
+	if (fclose( f ) != 0)
+	{
+		Request.Status = StatusTransferFailed;
+		return;
+	}
+#else
+	size_t Done;
+	int    Fd;
+
+	Fd = open(
+		Request.FileName.c_str( ),
+		O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC,
+		0666);
+
+	if (Fd < 0)
+	{
+		Request.Status = StatusOpenFailed;
+		return;
+	}
+
+	Done = 0;
+
+	while (Done < Request.Length)
+	{
+		ssize_t Transferred;
+
+		Transferred = pwrite(
+			Fd,
+			Request.Data + Done,
+			Request.Length - Done,
+			(off_t) Done);
+
+		if ((Transferred < 0) && (errno == EINTR))
+			continue;
+
+		if (Transferred <= 0)
+		{
+			close( Fd );
+			Request.Status = StatusTransferFailed;
+			return;
+		}
+
+		Done += (size_t) Transferred;
+	}
+
+	if (close( Fd ) != 0)
+	{
+		Request.Status = StatusTransferFailed;
+		return;
+	}
+#endif
+
+	Request.Status = StatusSuccess;
+}
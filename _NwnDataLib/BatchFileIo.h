@@ -0,0 +1,189 @@
+/*++
+
+Module Name:
+
+	BatchFileIo.h
+
+Abstract:
+
+	This module defines the batch file I/O interface, which reads or writes a
+	set of whole files in one operation.  Touching tens of thousands of small
+	script files one fopen/mmap/fclose at a time is dominated by syscall and
+	page fault overhead; the batch interface lets a backend keep many of the
+	transfers in flight at once.
+
+	Three backends are provided:
+
+	- Synchronous, which transfers one file after another on the calling
+	  thread (the historical behavior).
+
+	- Thread pool, which spreads the open/pread/close sequences over a set of
+	  persistent worker threads.
+
+	- io_uring (Linux only), which opens the files synchronously and then
+	  submits all of the data transfers for a batch with a single system call.
+	  If the running kernel does not support io_uring, the thread pool backend
+	  is used instead.
+
+	A batch I/O object may be shared between threads.
+
+--*/
+
+#ifndef _PROGRAMS_NWN2DATALIB_BATCHFILEIO_H
+#define _PROGRAMS_NWN2DATALIB_BATCHFILEIO_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <memory>
+
+class BatchFileIo
+{
+
+public:
+
+	typedef enum _BACKEND
+	{
+		BackendSync,
+		BackendThreadPool,
+		BackendIoUring,
+
+		//
+		// Pick the fastest backend supported by the system.
+		//
+
+		BackendAuto,
+
+		LastBackend
+	} BACKEND, * PBACKEND;
+
+	typedef enum _REQUEST_STATUS
+	{
+		StatusPending,
+		StatusSuccess,
+		StatusOpenFailed,
+		StatusTransferFailed,
+
+		LastStatus
+	} REQUEST_STATUS, * PREQUEST_STATUS;
+
+	//
+	// Describes a whole file read.  The caller supplies the file name; the
+	// backend fills in the contents and the status.
+	//
+
+	struct ReadRequest
+	{
+		std::string                  FileName;
+		std::vector< unsigned char > Contents;
+		REQUEST_STATUS               Status;
+	};
+
+	//
+	// Describes a whole file write.  The file is created (or truncated) and
+	// replaced with the supplied data, which must remain valid until the
+	// WriteFiles call returns.
+	//
+
+	struct WriteRequest
+	{
+		std::string                  FileName;
+		const unsigned char        * Data;
+		size_t                       Length;
+		REQUEST_STATUS               Status;
+	};
+
+	virtual
+	~BatchFileIo(
+		)
+	{
+	}
+
+	//
+	// Read a batch of files.  Each request's status is set on return; the
+	// call itself does not fail.
+	//
+
+	virtual
+	void
+	ReadFiles(
+		ReadRequest * Requests,
+		size_t Count
+		) = 0;
+
+	//
+	// Write a batch of files.  Each request's status is set on return; the
+	// call itself does not fail.
+	//
+
+	virtual
+	void
+	WriteFiles(
+		WriteRequest * Requests,
+		size_t Count
+		) = 0;
+
+	//
+	// Return the backend that actually services requests (BackendAuto and
+	// unsupported backends are resolved at creation time).
+	//
+
+	virtual
+	BACKEND
+	GetBackend(
+		) const = 0;
+
+	//
+	// Create a batch I/O object.  ThreadCount applies to the thread pool
+	// backend (and to the thread pool used as an io_uring fallback); zero
+	// selects a default based on the number of processors.
+	//
+
+	static
+	std::unique_ptr< BatchFileIo >
+	Create(
+		BACKEND Backend,
+		size_t ThreadCount = 0
+		);
+
+	//
+	// Convert between backend names ("sync", "threads", "uring", "auto") and
+	// backend values.
+	//
+
+	static
+	bool
+	ParseBackendName(
+		const char * Name,
+		BACKEND & Backend
+		);
+
+	static
+	const char *
+	GetBackendName(
+		BACKEND Backend
+		);
+
+	//
+	// Single file helpers used by all backends for whatever is not
+	// transferred in bulk.
+	//
+
+	static
+	void
+	ReadFileSync(
+		ReadRequest & Request
+		);
+
+	static
+	void
+	WriteFileSync(
+		WriteRequest & Request
+		);
+
+};
+
+#endif
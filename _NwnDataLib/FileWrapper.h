@@ -129,7 +129,21 @@ public:
 			m_Size = ftell(m_File);
 			fseek(m_File, 0 , SEEK_SET);// needed for next read from beginning of file
 
-			View = static_cast<unsigned char *>(mmap(0, m_Size, PROT_READ, MAP_SHARED, fileno(File), 0));
+			//
+			// mmap reports failure with MAP_FAILED rather than nullptr, and
+			// cannot map an empty file at all; both cases fall back to
+			// buffered reads.
+			//
+
+			View = nullptr;
+
+			if (m_Size != 0)
+			{
+				View = static_cast<unsigned char *>(mmap(0, m_Size, PROT_READ, MAP_SHARED, fileno(File), 0));
+
+				if (View == MAP_FAILED)
+					View = nullptr;
+			}
 
 			if (View != nullptr)
 			{
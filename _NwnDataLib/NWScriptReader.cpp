@@ -810,78 +810,394 @@ Environment:
 
 --*/
 {
-	FILE * f;
+	FILE                       * f;
+	std::vector< unsigned char > NDBData;
+	unsigned char                Buffer[ 4096 ];
+	size_t                       Read;
 
-	f = NULL;
+	f = fopen( NDBFileName.c_str( ), "rb" );
 
-	try
+	if (f == NULL)
+		return false;
+
+	while ((Read = fread( Buffer, 1, sizeof( Buffer ), f )) != 0)
+		NDBData.insert( NDBData.end( ), Buffer, Buffer + Read );
+
+	fclose( f );
+
+	return LoadSymbols(
+		NDBData.empty( ) ? NULL : &NDBData[ 0 ],
+		NDBData.size( ) );
+}
+
+bool
+NWScriptReader::LoadSymbols(
+	 const unsigned char * NDBData,
+	 size_t NDBLength
+	)
+/*++
+
+Routine Description:
+
+	This routine loads a standard NDB symbol table from memory.
+
+Arguments:
+
+	NDBData - Supplies the contents of the NDB file.
+
+	NDBLength - Supplies the length, in bytes, of the NDB file.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if the symbol table was
+	successfully loaded, else false if the load failed.  Failures to load the
+	symbol table are not fatal with respect to script execution.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	const char * Text;
+	const char * TextEnd;
+	bool         FirstLine;
+
+	Text      = (const char *) NDBData;
+	TextEnd   = Text + NDBLength;
+	FirstLine = true;
+
+	while (Text < TextEnd)
 	{
-		char Line[ 1025 ];
+		char         Line[ 1025 ];
+		const char * LineEnd;
+		size_t       Length;
+
+		LineEnd = (const char *) memchr( Text, '\n', TextEnd - Text );
+
+		if (LineEnd == NULL)
+			LineEnd = TextEnd;
 
-		f = fopen( NDBFileName.c_str( ), "rt" );
+		Length = LineEnd - Text;
 
-		if (f == NULL)
-			throw std::runtime_error( "Failed to load NDB file." );
+		if (Length >= sizeof( Line ))
+			Length = sizeof( Line ) - 1;
 
-		fgets( Line, 1024, f );
+		memcpy( Line, Text, Length );
+		Line[ Length ] = '\0';
 		strtok( Line, "\r\n" );
 
-		if (strcmp( Line, "NDB V1.0" ))
-			throw std::runtime_error( "Bad symbol file format." );
+		Text = LineEnd + 1;
+
+		if (FirstLine)
+		{
+			if (strcmp( Line, "NDB V1.0" ))
+				return false;
+
+			FirstLine = false;
+			continue;
+		}
 
 		//
-		// Now scan the debug symbols file for subroutine names, cataloging
-		// these.
+		// Scan the debug symbols for subroutine names, cataloging these.
 		//
 
-		while (fgets( Line, 1024, f ))
+		if (!strncmp( Line, "f ", 2 ))
 		{
-			strtok( Line, "\r\n" );
-
-			if (!strncmp( Line, "f ", 2 ))
+			char  SymbolName[ 256 ];
+			ULONG StartPC;
+			ULONG EndPC;
+			ULONG NumParams;
+			char  ReturnType[ 256 ];
+
+			if (sscanf(
+				Line,
+				"f %08x %08x %03u %255s %255s",
+				&StartPC,
+				&EndPC,
+				&NumParams,
+				ReturnType,
+				SymbolName) != 5)
 			{
-				char  SymbolName[ 256 ];
-				ULONG StartPC;
-				ULONG EndPC;
-				ULONG NumParams;
-				char  ReturnType[ 256 ];
-
-				if (sscanf(
-					Line,
-					"f %08x %08x %03d %s %s",
-					&StartPC,
-					&EndPC,
-					&NumParams,
-					ReturnType,
-					sizeof( ReturnType ),
-					SymbolName,
-					sizeof( SymbolName )) != 5)
-				{
-					continue;
-				}
-
-				if (StartPC == 0xFFFFFFFF)
-					continue;
-
-				m_SymbolTable.insert(
-					SymbolNameMap::value_type(
-						(ULONG) (StartPC - sizeof( NCS_HEADER )),
-						SymbolName
-						)
-					);
+				continue;
 			}
+
+			if ((StartPC == 0xFFFFFFFF) || (StartPC < NCSHeaderSize))
+				continue;
+
+			m_SymbolTable.insert(
+				SymbolNameMap::value_type(
+					(ULONG) (StartPC - NCSHeaderSize),
+					SymbolName
+					)
+				);
 		}
 	}
-	catch (std::exception)
-	{
-		if (f != NULL)
-			fclose( f );
 
-		return false;
+	return !FirstLine;
+}
+
+//
+// Define the instruction descriptors, indexed by opcode.
+//
+
+static const NWScriptReader::InstructionDescriptor InstructionDescriptors[ 0x100 ] =
+{
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x00
+	{ "CPDOWNSP",      NWScriptReader::InstructionLayout_StackCopy,  1,                             false }, // 0x01
+	{ "RSADD",         NWScriptReader::InstructionLayout_None,       NWScriptReader::AnyTypeOpcode, true  }, // 0x02
+	{ "CPTOPSP",       NWScriptReader::InstructionLayout_StackCopy,  1,                             false }, // 0x03
+	{ "CONST",         NWScriptReader::InstructionLayout_Constant,   NWScriptReader::AnyTypeOpcode, true  }, // 0x04
+	{ "ACTION",        NWScriptReader::InstructionLayout_Action,     0,                             false }, // 0x05
+	{ "LOGAND",        NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x06
+	{ "LOGOR",         NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x07
+	{ "INCOR",         NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x08
+	{ "EXCOR",         NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x09
+	{ "BOOLAND",       NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0A
+	{ "EQUAL",         NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0B
+	{ "NEQUAL",        NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0C
+	{ "GEQ",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0D
+	{ "GT",            NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0E
+	{ "LT",            NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x0F
+	{ "LEQ",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x10
+	{ "SHLEFT",        NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x11
+	{ "SHRIGHT",       NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x12
+	{ "USHRIGHT",      NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x13
+	{ "ADD",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x14
+	{ "SUB",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x15
+	{ "MUL",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x16
+	{ "DIV",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x17
+	{ "MOD",           NWScriptReader::InstructionLayout_Binary,     NWScriptReader::AnyTypeOpcode, true  }, // 0x18
+	{ "NEG",           NWScriptReader::InstructionLayout_None,       NWScriptReader::AnyTypeOpcode, true  }, // 0x19
+	{ "COMP",          NWScriptReader::InstructionLayout_None,       NWScriptReader::AnyTypeOpcode, true  }, // 0x1A
+	{ "MOVSP",         NWScriptReader::InstructionLayout_Int32,      0,                             false }, // 0x1B
+	{ "SAVE_STATEALL", NWScriptReader::InstructionLayout_None,       NWScriptReader::AnyTypeOpcode, false }, // 0x1C
+	{ "JMP",           NWScriptReader::InstructionLayout_Branch,     0,                             false }, // 0x1D
+	{ "JSR",           NWScriptReader::InstructionLayout_Branch,     0,                             false }, // 0x1E
+	{ "JZ",            NWScriptReader::InstructionLayout_Branch,     0,                             false }, // 0x1F
+	{ "RETN",          NWScriptReader::InstructionLayout_None,       0,                             false }, // 0x20
+	{ "DESTRUCT",      NWScriptReader::InstructionLayout_Destruct,   1,                             false }, // 0x21
+	{ "NOT",           NWScriptReader::InstructionLayout_None,       NWScriptReader::AnyTypeOpcode, true  }, // 0x22
+	{ "DECISP",        NWScriptReader::InstructionLayout_Int32,      3,                             false }, // 0x23
+	{ "INCISP",        NWScriptReader::InstructionLayout_Int32,      3,                             false }, // 0x24
+	{ "JNZ",           NWScriptReader::InstructionLayout_Branch,     0,                             false }, // 0x25
+	{ "CPDOWNBP",      NWScriptReader::InstructionLayout_StackCopy,  1,                             false }, // 0x26
+	{ "CPTOPBP",       NWScriptReader::InstructionLayout_StackCopy,  1,                             false }, // 0x27
+	{ "DECIBP",        NWScriptReader::InstructionLayout_Int32,      3,                             false }, // 0x28
+	{ "INCIBP",        NWScriptReader::InstructionLayout_Int32,      3,                             false }, // 0x29
+	{ "SAVEBP",        NWScriptReader::InstructionLayout_None,       0,                             false }, // 0x2A
+	{ "RESTOREBP",     NWScriptReader::InstructionLayout_None,       0,                             false }, // 0x2B
+	{ "STORE_STATE",   NWScriptReader::InstructionLayout_StoreState, NWScriptReader::AnyTypeOpcode, false }, // 0x2C
+	{ "NOP",           NWScriptReader::InstructionLayout_None,       0,                             false }, // 0x2D
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x2E
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x2F
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x30
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x31
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x32
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x33
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x34
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x35
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x36
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x37
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x38
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x39
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3A
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3B
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3C
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3D
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3E
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x3F
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x40
+	{ NULL,            NWScriptReader::InstructionLayout_Invalid,    0,                             false }, // 0x41
+	{ "T",             NWScriptReader::InstructionLayout_Header,     NWScriptReader::AnyTypeOpcode, false }, // 0x42
+
+	//
+	// The remaining opcodes are not instructions.
+	//
+};
+
+//
+// Define the mnemonic suffixes of the type opcodes, indexed by type opcode.
+//
+
+static const char * const TypeOpcodeSuffixes[ 0x40 ] =
+{
+	NULL,  NULL,   NULL,  "I",   "F",   "S",    "O",  NULL,  // 0x00
+	NULL,  NULL,   NULL,  NULL,  NULL,  NULL,   NULL, NULL,  // 0x08
+	"EFF", "EVNT", "LOC", "TAL", NULL,  NULL,   NULL, NULL,  // 0x10
+	NULL,  NULL,   NULL,  NULL,  NULL,  NULL,   NULL, NULL,  // 0x18
+	"II",  "FF",   "OO",  "SS",  "TT",  "IF",   "FI", NULL,  // 0x20
+	NULL,  NULL,   NULL,  NULL,  NULL,  NULL,   NULL, NULL,  // 0x28
+	"EFFEFF", NULL, NULL, NULL,  NULL,  NULL,   NULL, NULL,  // 0x30
+	NULL,  NULL,   "VV",  "VF",  "FV",  NULL,   NULL, NULL   // 0x38
+};
+
+const NWScriptReader::InstructionDescriptor &
+NWScriptReader::GetInstructionDescriptor(
+	 UCHAR Opcode
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the descriptor of an opcode, which gives the mnemonic
+	and the operand layout of the instruction.
+
+Arguments:
+
+	Opcode - Supplies the opcode to look up.
+
+Return Value:
+
+	The routine returns the descriptor of the opcode.  Unknown opcodes have the
+	InstructionLayout_Invalid layout and no mnemonic.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return InstructionDescriptors[ Opcode ];
+}
+
+const char *
+NWScriptReader::GetTypeOpcodeSuffix(
+	 UCHAR TypeOpcode
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the mnemonic suffix of a type opcode.
+
+Arguments:
+
+	TypeOpcode - Supplies the type opcode to look up.
+
+Return Value:
+
+	The routine returns the suffix (i.e. "I" or "FF"), else NULL if the type
+	opcode is not known.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (TypeOpcode >= sizeof( TypeOpcodeSuffixes ) / sizeof( TypeOpcodeSuffixes[ 0 ] ))
+		return NULL;
+
+	return TypeOpcodeSuffixes[ TypeOpcode ];
+}
+
+size_t
+NWScriptReader::GetInstructionLength(
+	 const unsigned char * Instruction,
+	 size_t Length
+	)
+/*++
+
+Routine Description:
+
+	This routine determines the length of the instruction at the start of a
+	buffer from the operand layout of its opcode.  Only the encoding is
+	checked: the opcode must be known, the type opcode must be the one that the
+	opcode requires and the operands must fit in the buffer.
+
+Arguments:
+
+	Instruction - Supplies the instruction bytes.
+
+	Length - Supplies the count of bytes available at Instruction.
+
+Return Value:
+
+	The routine returns the length, in bytes, of the instruction, else zero if
+	the buffer does not start with a well-formed instruction.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Needed;
+
+	if (Length < 1)
+		return 0;
+
+	const InstructionDescriptor & Descriptor = InstructionDescriptors[ Instruction[ 0 ] ];
+
+	if (Descriptor.Layout == InstructionLayout_Header)
+		return (Length >= 5) ? 5 : 0;
+
+	if (Length < 2)
+		return 0;
+
+	if ((Descriptor.TypeOpcode != AnyTypeOpcode) &&
+	    (Descriptor.TypeOpcode != Instruction[ 1 ]))
+	{
+		return 0;
 	}
 
-	if (f != NULL)
-		fclose( f );
+	switch (Descriptor.Layout)
+	{
 
-	return true;
+	case InstructionLayout_None:
+		Needed = 2;
+		break;
+
+	case InstructionLayout_Binary:
+		Needed = (Instruction[ 1 ] == 0x24) ? 4 : 2;
+		break;
+
+	case InstructionLayout_StackCopy:
+	case InstructionLayout_Destruct:
+		Needed = 8;
+		break;
+
+	case InstructionLayout_Constant:
+		switch (Instruction[ 1 ])
+		{
+
+		case 0x03: // int
+		case 0x04: // float
+		case 0x06: // object
+			Needed = 6;
+			break;
+
+		case 0x05: // string
+			if (Length < 4)
+				return 0;
+
+			Needed = 4 + (((size_t) Instruction[ 2 ] << 8) | Instruction[ 3 ]);
+			break;
+
+		default:
+			return 0;
+
+		}
+		break;
+
+	case InstructionLayout_Action:
+		Needed = 5;
+		break;
+
+	case InstructionLayout_Int32:
+	case InstructionLayout_Branch:
+		Needed = 6;
+		break;
+
+	case InstructionLayout_StoreState:
+		Needed = 10;
+		break;
+
+	default:
+		return 0;
+
+	}
+
+	return (Length >= Needed) ? Needed : 0;
 }
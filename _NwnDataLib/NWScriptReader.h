@@ -36,6 +36,94 @@ public:
 
 	typedef std::vector< SymbolTableRawEntry > SymbolTableRawEntryVec;
 
+	//
+	// Define the size of the NCS file header that precedes the instruction
+	// stream.  PCs are relative to the end of the header, whereas NDB files
+	// give file offsets.
+	//
+
+	enum
+	{
+		NCSHeaderSize = 13
+	};
+
+	//
+	// Define the operand layouts of the instruction set.  Every instruction
+	// but T (which only appears in the file header) is an opcode byte and a
+	// type opcode byte followed by the operands of its layout.
+	//
+
+	typedef enum _INSTRUCTION_LAYOUT
+	{
+		InstructionLayout_Invalid,     // Not an instruction
+		InstructionLayout_None,        // No operands
+		InstructionLayout_Binary,      // INT16 size for the TT type only
+		InstructionLayout_StackCopy,   // INT32 offset, INT16 size
+		InstructionLayout_Constant,    // Value of the type opcode's type
+		InstructionLayout_Action,      // INT16 action, INT8 argument count
+		InstructionLayout_Int32,       // INT32 value
+		InstructionLayout_Branch,      // INT32 displacement from the opcode
+		InstructionLayout_Destruct,    // INT16 size, INT16 offset, INT16 size
+		InstructionLayout_StoreState,  // INT32 BP size, INT32 SP size
+		InstructionLayout_Header,      // INT32 file size, no type opcode
+
+		LastInstructionLayout
+	} INSTRUCTION_LAYOUT, * PINSTRUCTION_LAYOUT;
+
+	//
+	// Describe an opcode.  The type opcode must match TypeOpcode unless that
+	// is AnyTypeOpcode.  If TypeSuffix is set, the mnemonic is completed by
+	// the suffix of the type opcode (i.e. ADD + II).
+	//
+
+	enum
+	{
+		AnyTypeOpcode = 0x100
+	};
+
+	struct InstructionDescriptor
+	{
+		const char         * Mnemonic;
+		INSTRUCTION_LAYOUT   Layout;
+		USHORT               TypeOpcode;
+		bool                 TypeSuffix;
+	};
+
+	//
+	// Return the descriptor of an opcode.  Unknown opcodes have the invalid
+	// layout.
+	//
+
+	static
+	const InstructionDescriptor &
+	GetInstructionDescriptor(
+		 UCHAR Opcode
+		);
+
+	//
+	// Return the mnemonic suffix of a type opcode (i.e. "I" or "FF"), else
+	// NULL if the type opcode is not known.
+	//
+
+	static
+	const char *
+	GetTypeOpcodeSuffix(
+		 UCHAR TypeOpcode
+		);
+
+	//
+	// Return the length, in bytes, of the instruction at the start of a
+	// buffer, else zero if the buffer does not start with a well-formed
+	// instruction.
+	//
+
+	static
+	size_t
+	GetInstructionLength(
+		 const unsigned char * Instruction,
+		 size_t Length
+		);
+
 	//
 	// Keep state for the return value hack and what we have done with it in
 	// the shareable reader object.  It is up to the script VM to use (and set)
@@ -346,6 +434,16 @@ public:
 		 const std::string & NDBFileName
 		);
 
+	//
+	// Load the symbol table (optional) from an in-memory NDB file.
+	//
+
+	bool
+	LoadSymbols(
+		 const unsigned char * NDBData,
+		 size_t NDBLength
+		);
+
 private:
 
 //#include <pshpack1.h>
@@ -0,0 +1,2015 @@
+/*++
+
+Module Name:
+
+	NWScriptVM.cpp
+
+Abstract:
+
+	This module houses the offline NWScript virtual machine.  See NWScriptVM.h
+	for an overview.
+
+	The VM decodes each instruction through the NWScriptReader as it executes
+	it.  Stack offsets in the instruction set are in bytes (four per cell) and
+	relative to the top of stack (SP) or to the base pointer saved by SAVEBP
+	(BP); the VM stack holds one typed cell per four bytes.
+
+--*/
+
+#include "Precomp.h"
+#include "NWScriptVM.h"
+
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <chrono>
+
+
+//
+// Define the most saved situations that one Execute call may run, so that a
+// script which keeps rescheduling itself (i.e. a DelayCommand heartbeat)
+// terminates.
+//
+
+#define NWSCRIPTVM_MAX_QUEUED_STATES 4096
+
+
+static
+NWScriptVM::VM_TYPE
+GetCellType(
+	 UCHAR TypeOpcode
+	)
+/*++
+
+Routine Description:
+
+	This routine converts an instruction type operand for a single cell to the
+	type of the cell.
+
+Arguments:
+
+	TypeOpcode - Supplies the type operand of the instruction.
+
+Return Value:
+
+	The routine returns the cell type, else LastVMType if the type operand
+	does not describe a single cell.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (TypeOpcode)
+	{
+
+	case 0x03:
+		return NWScriptVM::VMType_Int;
+
+	case 0x04:
+		return NWScriptVM::VMType_Float;
+
+	case 0x05:
+		return NWScriptVM::VMType_String;
+
+	case 0x06:
+		return NWScriptVM::VMType_Object;
+
+	default:
+		if ((TypeOpcode >= NWScriptVM::VMType_EngineStructure0) &&
+		    (TypeOpcode <= NWScriptVM::VMType_EngineStructureLast))
+		{
+			return (NWScriptVM::VM_TYPE) TypeOpcode;
+		}
+
+		return NWScriptVM::LastVMType;
+
+	}
+}
+
+static
+bool
+CellsEqual(
+	 const NWScriptVM::StackCell & Cell1,
+	 const NWScriptVM::StackCell & Cell2
+	)
+/*++
+
+Routine Description:
+
+	This routine compares two stack cells for EQUAL and NEQUAL.
+
+Arguments:
+
+	Cell1 - Supplies the first cell.
+
+	Cell2 - Supplies the second cell.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if the cells hold the
+	same value.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (Cell1.Type != Cell2.Type)
+		return false;
+
+	switch (Cell1.Type)
+	{
+
+	case NWScriptVM::VMType_Float:
+		return (Cell1.Float == Cell2.Float);
+
+	case NWScriptVM::VMType_String:
+		return (Cell1.String == Cell2.String);
+
+	case NWScriptVM::VMType_Int:
+	case NWScriptVM::VMType_Object:
+		return (Cell1.Int == Cell2.Int);
+
+	default:
+		return ((Cell1.Int == Cell2.Int) && (Cell1.String == Cell2.String));
+
+	}
+}
+
+NWScriptVM::NWScriptVM(
+	 NWScriptReader & Script,
+	 const ActionDefinitionVec & Actions
+	)
+/*++
+
+Routine Description:
+
+	This routine constructs a new NWScriptVM over a script.  The script is not
+	validated until it is executed.
+
+Arguments:
+
+	Script - Supplies the reader of the script to execute.
+
+	Actions - Supplies the action table, indexed by action ordinal.
+
+Return Value:
+
+	None.  Raises an std::exception on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+: m_Script( Script ),
+  m_Actions( Actions ),
+  m_BP( 0 ),
+  m_ObjectSelf( ObjectInvalid ),
+  m_CurrentPC( 0 ),
+  m_InstructionLimit( 0 ),
+  m_InstructionBase( 0 ),
+  m_SegmentStart( 0 )
+{
+	ResetStatistics( );
+}
+
+NWScriptVM::~NWScriptVM(
+	)
+/*++
+
+Routine Description:
+
+	This routine deletes the current NWScriptVM object and its associated
+	members.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+}
+
+LONG
+NWScriptVM::Execute(
+	 ULONG ObjectSelf
+	)
+/*++
+
+Routine Description:
+
+	This routine executes the script from its entry point, followed by any
+	saved situations queued while it ran.
+
+Arguments:
+
+	ObjectSelf - Supplies the object that the script runs on (OBJECT_SELF).
+
+Return Value:
+
+	The routine returns the value of a StartingConditional script, else zero.
+
+	On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONGLONG StartTime;
+	LONG      Result;
+	size_t    Queued;
+
+	m_Stack.clear( );
+	m_CallStack.clear( );
+	m_SavedStates.clear( );
+	m_QueuedStates.clear( );
+	m_FunctionDepth.assign( m_Statistics.Functions.size( ), 0 );
+
+	m_BP              = 0;
+	m_ObjectSelf      = ObjectSelf;
+	m_CurrentPC       = 0;
+	m_InstructionBase = m_Statistics.Instructions;
+	m_SegmentStart    = m_Statistics.Instructions;
+
+	StartTime = GetTime( );
+
+	//
+	// Run the loader code at PC zero.  It returns to the host once the entry
+	// point has returned, leaving the return value (if any) on the stack.
+	//
+
+	EnterFunction( 0, ReturnToHost );
+	Run( 0 );
+
+	Result = 0;
+
+	if ((!m_Stack.empty( )) && (m_Stack[ 0 ].Type == VMType_Int))
+		Result = m_Stack[ 0 ].Int;
+
+	//
+	// Now run the deferred work that the script scheduled.
+	//
+
+	for (Queued = 0; !m_QueuedStates.empty( ); Queued += 1)
+	{
+		SavedState State;
+
+		if (Queued == NWSCRIPTVM_MAX_QUEUED_STATES)
+			Fault( "Too many deferred script situations." );
+
+		State.ResumePC   = m_QueuedStates.front( ).ResumePC;
+		State.ObjectSelf = m_QueuedStates.front( ).ObjectSelf;
+		State.Globals.swap( m_QueuedStates.front( ).Globals );
+		State.Locals.swap( m_QueuedStates.front( ).Locals );
+
+		m_QueuedStates.pop_front( );
+
+		ExecuteSavedState( State );
+	}
+
+	m_Statistics.Executions  += 1;
+	m_Statistics.ElapsedTime += GetTime( ) - StartTime;
+
+	return Result;
+}
+
+void
+NWScriptVM::GetStatistics(
+	 Statistics & VMStatistics
+	) const
+/*++
+
+Routine Description:
+
+	This routine returns the statistics accumulated since the last reset.
+
+Arguments:
+
+	VMStatistics - Receives the statistics.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	VMStatistics = m_Statistics;
+}
+
+void
+NWScriptVM::ResetStatistics(
+	)
+/*++
+
+Routine Description:
+
+	This routine resets the statistics.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Statistics.Executions     = 0;
+	m_Statistics.Instructions   = 0;
+	m_Statistics.ActionCalls    = 0;
+	m_Statistics.StackHighWater = 0;
+	m_Statistics.ElapsedTime    = 0;
+	m_Statistics.Functions.clear( );
+
+	m_FunctionIndex.clear( );
+	m_FunctionDepth.clear( );
+	m_InstructionBase = 0;
+	m_SegmentStart    = 0;
+}
+
+LONG
+NWScriptVM::StackPopInt(
+	)
+/*++
+
+Routine Description:
+
+	This routine pops an integer off of the stack.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the value popped.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	LONG Value = StackTop( VMType_Int ).Int;
+
+	m_Stack.pop_back( );
+
+	return Value;
+}
+
+float
+NWScriptVM::StackPopFloat(
+	)
+/*++
+
+Routine Description:
+
+	This routine pops a float off of the stack.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the value popped.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	float Value = StackTop( VMType_Float ).Float;
+
+	m_Stack.pop_back( );
+
+	return Value;
+}
+
+std::string
+NWScriptVM::StackPopString(
+	)
+/*++
+
+Routine Description:
+
+	This routine pops a string off of the stack.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the value popped.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	std::string Value;
+
+	Value.swap( StackTop( VMType_String ).String );
+
+	m_Stack.pop_back( );
+
+	return Value;
+}
+
+ULONG
+NWScriptVM::StackPopObject(
+	)
+/*++
+
+Routine Description:
+
+	This routine pops an object id off of the stack.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the value popped.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONG Value = StackTop( VMType_Object ).Object;
+
+	m_Stack.pop_back( );
+
+	return Value;
+}
+
+void
+NWScriptVM::StackPopVector(
+	 float Vector[ 3 ]
+	)
+/*++
+
+Routine Description:
+
+	This routine pops a vector (three floats, x on the bottom) off of the
+	stack.
+
+Arguments:
+
+	Vector - Receives the vector popped.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	Vector[ 2 ] = StackPopFloat( );
+	Vector[ 1 ] = StackPopFloat( );
+	Vector[ 0 ] = StackPopFloat( );
+}
+
+NWScriptVM::StackCell
+NWScriptVM::StackPopEngineStructure(
+	 VM_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine pops an engine structure off of the stack.
+
+Arguments:
+
+	Type - Supplies the engine structure type expected.
+
+Return Value:
+
+	The routine returns the cell popped.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	StackCell Value;
+
+	StackCell & Top = StackTop( Type );
+
+	Value.Type = Top.Type;
+	Value.Int  = Top.Int;
+	Value.String.swap( Top.String );
+
+	m_Stack.pop_back( );
+
+	return Value;
+}
+
+void
+NWScriptVM::StackPushInt(
+	 LONG Value
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes an integer onto the stack.
+
+Arguments:
+
+	Value - Supplies the value to push.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PushCell( VMType_Int ).Int = Value;
+}
+
+void
+NWScriptVM::StackPushFloat(
+	 float Value
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes a float onto the stack.
+
+Arguments:
+
+	Value - Supplies the value to push.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PushCell( VMType_Float ).Float = Value;
+}
+
+void
+NWScriptVM::StackPushString(
+	 const std::string & Value
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes a string onto the stack.
+
+Arguments:
+
+	Value - Supplies the value to push.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PushCell( VMType_String ).String = Value;
+}
+
+void
+NWScriptVM::StackPushObject(
+	 ULONG Value
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes an object id onto the stack.
+
+Arguments:
+
+	Value - Supplies the value to push.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	PushCell( VMType_Object ).Object = Value;
+}
+
+void
+NWScriptVM::StackPushVector(
+	 const float Vector[ 3 ]
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes a vector (three floats, x on the bottom) onto the
+	stack.
+
+Arguments:
+
+	Vector - Supplies the value to push.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	StackPushFloat( Vector[ 0 ] );
+	StackPushFloat( Vector[ 1 ] );
+	StackPushFloat( Vector[ 2 ] );
+}
+
+void
+NWScriptVM::StackPushEngineStructure(
+	 const StackCell & Value
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes an engine structure onto the stack.
+
+Arguments:
+
+	Value - Supplies the value to push.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if ((Value.Type < VMType_EngineStructure0) ||
+	    (Value.Type > VMType_EngineStructureLast))
+	{
+		Fault( "Pushed a value that is not an engine structure." );
+	}
+
+	StackCell & Cell = PushCell( Value.Type );
+
+	Cell.Int    = Value.Int;
+	Cell.String = Value.String;
+}
+
+void
+NWScriptVM::StackPopArgument(
+	 VM_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine pops an action argument of a given type and discards it.
+
+Arguments:
+
+	Type - Supplies the type of the argument.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Type)
+	{
+
+	case VMType_Void:
+		break;
+
+	case VMType_Vector:
+		{
+			float Vector[ 3 ];
+
+			StackPopVector( Vector );
+		}
+		break;
+
+	case VMType_Action:
+		{
+			SavedState State;
+
+			TakeSavedState( State );
+		}
+		break;
+
+	default:
+		StackTop( Type );
+		m_Stack.pop_back( );
+		break;
+
+	}
+}
+
+void
+NWScriptVM::StackPushDefault(
+	 VM_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes the default (empty) value of a type.
+
+Arguments:
+
+	Type - Supplies the type of the value.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (Type)
+	{
+
+	case VMType_Void:
+		break;
+
+	case VMType_Int:
+	case VMType_String:
+		PushCell( Type );
+		break;
+
+	case VMType_Float:
+		StackPushFloat( 0.0f );
+		break;
+
+	case VMType_Object:
+		StackPushObject( ObjectInvalid );
+		break;
+
+	case VMType_Vector:
+		{
+			static const float Zero[ 3 ] = { 0.0f, 0.0f, 0.0f };
+
+			StackPushVector( Zero );
+		}
+		break;
+
+	default:
+		if ((Type < VMType_EngineStructure0) ||
+		    (Type > VMType_EngineStructureLast))
+		{
+			Fault( "Illegal value type." );
+		}
+
+		PushCell( Type );
+		break;
+
+	}
+}
+
+void
+NWScriptVM::TakeSavedState(
+	 SavedState & State
+	)
+/*++
+
+Routine Description:
+
+	This routine takes the most recent saved situation, which STORE_STATE
+	created for the action argument of the action being executed.
+
+Arguments:
+
+	State - Receives the saved situation.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_SavedStates.empty( ))
+		Fault( "Action argument without a saved script situation." );
+
+	State.ResumePC   = m_SavedStates.back( ).ResumePC;
+	State.ObjectSelf = m_SavedStates.back( ).ObjectSelf;
+	State.Globals.swap( m_SavedStates.back( ).Globals );
+	State.Locals.swap( m_SavedStates.back( ).Locals );
+
+	m_SavedStates.pop_back( );
+}
+
+void
+NWScriptVM::QueueSavedState(
+	 SavedState & State
+	)
+/*++
+
+Routine Description:
+
+	This routine queues a saved situation for execution once the script has
+	finished.  The contents of the caller's saved situation are moved.
+
+Arguments:
+
+	State - Supplies the saved situation to queue.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_QueuedStates.resize( m_QueuedStates.size( ) + 1 );
+
+	m_QueuedStates.back( ).ResumePC   = State.ResumePC;
+	m_QueuedStates.back( ).ObjectSelf = State.ObjectSelf;
+	m_QueuedStates.back( ).Globals.swap( State.Globals );
+	m_QueuedStates.back( ).Locals.swap( State.Locals );
+}
+
+void
+NWScriptVM::StubAction(
+	 NWScriptVM & VM,
+	 const ActionDefinition & Action,
+	 ULONG NumArguments,
+	 void * Context
+	)
+/*++
+
+Routine Description:
+
+	This routine is the default action handler.  It discards the arguments and
+	returns the default value of the action's return type.
+
+Arguments:
+
+	VM - Supplies the VM executing the action.
+
+	Action - Supplies the definition of the action.
+
+	NumArguments - Supplies the count of arguments passed.
+
+	Context - Supplies the handler context (unused).
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	(void) Context;
+
+	if (NumArguments > Action.ParameterTypes.size( ))
+		VM.Fault( "Too many arguments for action." );
+
+	for (ULONG i = 0; i < NumArguments; i += 1)
+		VM.StackPopArgument( Action.ParameterTypes[ i ] );
+
+	VM.StackPushDefault( Action.ReturnType );
+}
+
+void
+NWScriptVM::Run(
+	 ULONG PC
+	)
+/*++
+
+Routine Description:
+
+	This routine executes instructions from a given PC until the outermost
+	subroutine returns to the host.
+
+Arguments:
+
+	PC - Supplies the PC to start executing at.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	UCHAR  Opcode;
+	UCHAR  TypeOpcode;
+	LONG   Offset;
+	ULONG  Cells;
+	size_t Index;
+
+	m_Script.SetInstructionPointer( PC );
+
+	for (;;)
+	{
+		m_CurrentPC = m_Script.GetInstructionPointer( );
+
+		if ((m_InstructionLimit != 0) &&
+		    (m_Statistics.Instructions - m_InstructionBase >= m_InstructionLimit))
+		{
+			Fault( "Instruction limit exceeded." );
+		}
+
+		m_Statistics.Instructions += 1;
+
+		m_Script.ReadInstruction( Opcode, TypeOpcode );
+
+		switch (Opcode)
+		{
+
+		case 0x01: // CPDOWNSP
+		case 0x26: // CPDOWNBP
+			Offset = (LONG) m_Script.ReadINT32( );
+			Cells  = (ULONG) (m_Script.ReadINT16( ) / 4);
+
+			if (Cells > m_Stack.size( ))
+				Fault( "Stack underflow." );
+
+			Index = (Opcode == 0x01) ? StackIndex( Offset, Cells ) : BaseIndex( Offset, Cells );
+
+			for (ULONG i = 0; i < Cells; i += 1)
+			{
+				StackCell & Source = m_Stack[ m_Stack.size( ) - Cells + i ];
+
+				if (Index + i == m_Stack.size( ) - Cells + i)
+					continue;
+
+				m_Stack[ Index + i ].Type   = Source.Type;
+				m_Stack[ Index + i ].Int    = Source.Int;
+				m_Stack[ Index + i ].String = Source.String;
+			}
+			break;
+
+		case 0x02: // RSADD
+			{
+				VM_TYPE Type = GetCellType( TypeOpcode );
+
+				if (Type == LastVMType)
+					Fault( "Illegal RSADD type." );
+
+				StackPushDefault( Type );
+			}
+			break;
+
+		case 0x03: // CPTOPSP
+		case 0x27: // CPTOPBP
+			Offset = (LONG) m_Script.ReadINT32( );
+			Cells  = (ULONG) (m_Script.ReadINT16( ) / 4);
+			Index  = (Opcode == 0x03) ? StackIndex( Offset, Cells ) : BaseIndex( Offset, Cells );
+
+			m_Stack.reserve( m_Stack.size( ) + Cells );
+
+			for (ULONG i = 0; i < Cells; i += 1)
+			{
+				m_Stack.push_back( m_Stack[ Index + i ] );
+			}
+
+			if (m_Stack.size( ) > m_Statistics.StackHighWater)
+				m_Statistics.StackHighWater = m_Stack.size( );
+			break;
+
+		case 0x04: // CONST
+			switch (TypeOpcode)
+			{
+
+			case 0x03:
+				StackPushInt( (LONG) m_Script.ReadINT32( ) );
+				break;
+
+			case 0x04:
+				StackPushFloat( m_Script.ReadFLOAT( ) );
+				break;
+
+			case 0x05:
+				StackPushString( m_Script.ReadString( m_Script.ReadINT16( ) ) );
+				break;
+
+			case 0x06:
+				{
+					ULONG Object = m_Script.ReadINT32( );
+
+					//
+					// OBJECT_SELF and OBJECT_INVALID are coded as 0 and 1.
+					//
+
+					if (Object == 0)
+						Object = m_ObjectSelf;
+					else if (Object == 1)
+						Object = ObjectInvalid;
+
+					StackPushObject( Object );
+				}
+				break;
+
+			case 0x12: // location
+				PushCell( (VM_TYPE) TypeOpcode ).Int = (LONG) m_Script.ReadINT32( );
+				break;
+
+			case 0x17: // json
+				{
+					std::string Value = m_Script.ReadString( m_Script.ReadINT16( ) );
+
+					PushCell( (VM_TYPE) TypeOpcode ).String.swap( Value );
+				}
+				break;
+
+			default:
+				Fault( "Illegal CONST type." );
+
+			}
+			break;
+
+		case 0x05: // ACTION
+			{
+				ULONG ActionId = m_Script.ReadINT16( );
+				ULONG NumArgs  = m_Script.ReadINT8( );
+
+				ExecuteAction( ActionId, NumArgs );
+			}
+			break;
+
+		case 0x0B: // EQUAL
+		case 0x0C: // NEQUAL
+			if (TypeOpcode == 0x24)
+				CompareTop( Opcode, (ULONG) (m_Script.ReadINT16( ) / 4) );
+			else
+				CompareTop( Opcode, 1 );
+			break;
+
+		case 0x06: // LOGAND
+		case 0x07: // LOGOR
+		case 0x08: // INCOR
+		case 0x09: // EXCOR
+		case 0x0A: // BOOLAND
+		case 0x0D: // GEQ
+		case 0x0E: // GT
+		case 0x0F: // LT
+		case 0x10: // LEQ
+		case 0x11: // SHLEFT
+		case 0x12: // SHRIGHT
+		case 0x13: // USHRIGHT
+		case 0x14: // ADD
+		case 0x15: // SUB
+		case 0x16: // MUL
+		case 0x17: // DIV
+		case 0x18: // MOD
+			ExecuteBinaryOp( Opcode, TypeOpcode );
+			break;
+
+		case 0x19: // NEG
+			if (TypeOpcode == 0x04)
+			{
+				StackCell & Top = StackTop( VMType_Float );
+
+				Top.Float = -Top.Float;
+			}
+			else
+			{
+				StackCell & Top = StackTop( VMType_Int );
+
+				Top.Int = (LONG) (0 - (ULONG) Top.Int);
+			}
+			break;
+
+		case 0x1A: // COMP
+			{
+				StackCell & Top = StackTop( VMType_Int );
+
+				Top.Int = ~Top.Int;
+			}
+			break;
+
+		case 0x22: // NOT
+			{
+				StackCell & Top = StackTop( VMType_Int );
+
+				Top.Int = (Top.Int == 0) ? 1 : 0;
+			}
+			break;
+
+		case 0x1B: // MOVSP
+			Offset = (LONG) m_Script.ReadINT32( );
+
+			if ((Offset > 0) || ((Offset % 4) != 0))
+				Fault( "Illegal MOVSP offset." );
+
+			Cells = (ULONG) (-Offset / 4);
+
+			if (Cells > m_Stack.size( ))
+				Fault( "Stack underflow." );
+
+			m_Stack.resize( m_Stack.size( ) - Cells );
+			break;
+
+		case 0x1D: // JMP
+			Offset = (LONG) m_Script.ReadINT32( );
+
+			m_Script.SetInstructionPointer( m_CurrentPC + Offset );
+			break;
+
+		case 0x1E: // JSR
+			Offset = (LONG) m_Script.ReadINT32( );
+
+			EnterFunction( m_CurrentPC + Offset, m_Script.GetInstructionPointer( ) );
+			m_Script.SetInstructionPointer( m_CurrentPC + Offset );
+			break;
+
+		case 0x1F: // JZ
+		case 0x25: // JNZ
+			Offset = (LONG) m_Script.ReadINT32( );
+
+			if ((StackPopInt( ) == 0) == (Opcode == 0x1F))
+				m_Script.SetInstructionPointer( m_CurrentPC + Offset );
+			break;
+
+		case 0x20: // RETN
+			{
+				ULONG ReturnPC = m_CallStack.back( ).ReturnPC;
+
+				if (!LeaveFunction( ))
+					return;
+
+				m_Script.SetInstructionPointer( ReturnPC );
+			}
+			break;
+
+		case 0x21: // DESTRUCT
+			{
+				ULONG Size     = (ULONG) (m_Script.ReadINT16( ) / 4);
+				ULONG KeepFrom = (ULONG) (m_Script.ReadINT16( ) / 4);
+				ULONG Keep     = (ULONG) (m_Script.ReadINT16( ) / 4);
+
+				if ((Size > m_Stack.size( )) || (KeepFrom + Keep > Size))
+					Fault( "Illegal DESTRUCT operands." );
+
+				Index = m_Stack.size( ) - Size;
+
+				for (ULONG i = 0; i < Keep; i += 1)
+				{
+					StackCell & Source = m_Stack[ Index + KeepFrom + i ];
+
+					m_Stack[ Index + i ].Type = Source.Type;
+					m_Stack[ Index + i ].Int  = Source.Int;
+					m_Stack[ Index + i ].String.swap( Source.String );
+				}
+
+				m_Stack.resize( Index + Keep );
+			}
+			break;
+
+		case 0x23: // DECISP
+		case 0x24: // INCISP
+		case 0x28: // DECIBP
+		case 0x29: // INCIBP
+			{
+				Offset = (LONG) m_Script.ReadINT32( );
+				Index  = (Opcode <= 0x24) ? StackIndex( Offset, 1 ) : BaseIndex( Offset, 1 );
+
+				StackCell & Cell = m_Stack[ Index ];
+
+				if (Cell.Type != VMType_Int)
+					Fault( "Increment of a value that is not an integer." );
+
+				if ((Opcode == 0x24) || (Opcode == 0x29))
+					Cell.Int = (LONG) ((ULONG) Cell.Int + 1);
+				else
+					Cell.Int = (LONG) ((ULONG) Cell.Int - 1);
+			}
+			break;
+
+		case 0x2A: // SAVEBP
+			{
+				size_t OldBP = m_BP;
+
+				m_BP = m_Stack.size( );
+
+				StackPushInt( (LONG) OldBP );
+			}
+			break;
+
+		case 0x2B: // RESTOREBP
+			{
+				LONG OldBP = StackPopInt( );
+
+				if ((OldBP < 0) || ((size_t) OldBP > m_Stack.size( )))
+					Fault( "Illegal saved BP." );
+
+				m_BP = (size_t) OldBP;
+			}
+			break;
+
+		case 0x2C: // STORE_STATE
+			{
+				ULONG GlobalCells = m_Script.ReadINT32( ) / 4;
+				ULONG LocalCells  = m_Script.ReadINT32( ) / 4;
+
+				if ((GlobalCells > m_BP) || (LocalCells > m_Stack.size( )))
+					Fault( "Illegal STORE_STATE operands." );
+
+				//
+				// The situation resumes past the JMP that follows; the type
+				// operand holds the distance.
+				//
+
+				m_SavedStates.resize( m_SavedStates.size( ) + 1 );
+
+				SavedState & State = m_SavedStates.back( );
+
+				State.ResumePC   = m_CurrentPC + TypeOpcode;
+				State.ObjectSelf = m_ObjectSelf;
+
+				State.Globals.assign(
+					m_Stack.begin( ) + (m_BP - GlobalCells),
+					m_Stack.begin( ) + m_BP);
+				State.Locals.assign(
+					m_Stack.end( ) - LocalCells,
+					m_Stack.end( ));
+			}
+			break;
+
+		case 0x2D: // NOP
+			break;
+
+		default:
+			Fault( "Illegal opcode." );
+
+		}
+	}
+}
+
+void
+NWScriptVM::ExecuteSavedState(
+	 SavedState & State
+	)
+/*++
+
+Routine Description:
+
+	This routine executes a saved situation on a fresh stack, which holds the
+	saved globals (below BP) and the saved locals.
+
+Arguments:
+
+	State - Supplies the saved situation.  Its contents are consumed.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	m_Stack.clear( );
+	m_Stack.swap( State.Globals );
+
+	m_BP         = m_Stack.size( );
+	m_ObjectSelf = State.ObjectSelf;
+
+	m_Stack.insert( m_Stack.end( ), State.Locals.begin( ), State.Locals.end( ) );
+
+	if (m_Stack.size( ) > m_Statistics.StackHighWater)
+		m_Statistics.StackHighWater = m_Stack.size( );
+
+	EnterFunction( State.ResumePC, ReturnToHost );
+	Run( State.ResumePC );
+}
+
+void
+NWScriptVM::EnterFunction(
+	 ULONG PC,
+	 ULONG ReturnPC
+	)
+/*++
+
+Routine Description:
+
+	This routine pushes a call frame for a subroutine call.
+
+Arguments:
+
+	PC - Supplies the address of the subroutine.
+
+	ReturnPC - Supplies the return address, or ReturnToHost.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	CallFrame Frame;
+
+	AccountSegment( );
+
+	Frame.ReturnPC  = ReturnPC;
+	Frame.Function  = GetFunctionIndex( PC );
+	Frame.StartTime = GetTime( );
+	Frame.ChildTime = 0;
+
+	m_Statistics.Functions[ Frame.Function ].Calls += 1;
+	m_FunctionDepth[ Frame.Function ] += 1;
+
+	m_CallStack.push_back( Frame );
+}
+
+bool
+NWScriptVM::LeaveFunction(
+	)
+/*++
+
+Routine Description:
+
+	This routine pops the call frame of the returning subroutine and charges
+	its time.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true if execution continues
+	in the caller, else false if the subroutine returned to the host.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	ULONGLONG Elapsed;
+
+	AccountSegment( );
+
+	CallFrame & Frame = m_CallStack.back( );
+	FunctionStatistics & Function = m_Statistics.Functions[ Frame.Function ];
+
+	Elapsed = GetTime( ) - Frame.StartTime;
+
+	Function.SelfTime += Elapsed - Frame.ChildTime;
+
+	//
+	// Only the outermost activation of a recursive function counts towards
+	// its total time.
+	//
+
+	if (--m_FunctionDepth[ Frame.Function ] == 0)
+		Function.TotalTime += Elapsed;
+
+	if (Frame.ReturnPC == ReturnToHost)
+	{
+		m_CallStack.pop_back( );
+		return false;
+	}
+
+	m_CallStack.pop_back( );
+	m_CallStack.back( ).ChildTime += Elapsed;
+
+	return true;
+}
+
+void
+NWScriptVM::AccountSegment(
+	)
+/*++
+
+Routine Description:
+
+	This routine charges the instructions executed since the last call or
+	return to the function that executed them.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (!m_CallStack.empty( ))
+	{
+		m_Statistics.Functions[ m_CallStack.back( ).Function ].Instructions +=
+			m_Statistics.Instructions - m_SegmentStart;
+	}
+
+	m_SegmentStart = m_Statistics.Instructions;
+}
+
+size_t
+NWScriptVM::GetFunctionIndex(
+	 ULONG PC
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the statistics entry for the subroutine at a PC,
+	creating it on first use.  The subroutine is named from the script's
+	symbol table; a PC within a subroutine (i.e. a resumed saved situation)
+	is named after the enclosing subroutine.
+
+Arguments:
+
+	PC - Supplies the address of the subroutine.
+
+Return Value:
+
+	The routine returns the index of the entry.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	FunctionIndexMap::const_iterator it;
+	FunctionStatistics               Function;
+	char                             Name[ 32 ];
+
+	it = m_FunctionIndex.find( PC );
+
+	if (it != m_FunctionIndex.end( ))
+		return it->second;
+
+	if (!m_Script.GetSymbolName( PC, Function.Name ))
+	{
+		if (m_Script.GetSymbolName( PC, Function.Name, true ))
+		{
+			snprintf(
+				Name,
+				sizeof( Name ),
+				"@%08X",
+				PC + NWScriptReader::NCSHeaderSize);
+
+			Function.Name += Name;
+		}
+		else
+		{
+			snprintf(
+				Name,
+				sizeof( Name ),
+				"sub_%08X",
+				PC + NWScriptReader::NCSHeaderSize);
+
+			Function.Name = Name;
+		}
+	}
+
+	Function.PC           = PC;
+	Function.Calls        = 0;
+	Function.Instructions = 0;
+	Function.SelfTime     = 0;
+	Function.TotalTime    = 0;
+
+	m_Statistics.Functions.push_back( Function );
+	m_FunctionDepth.push_back( 0 );
+
+	m_FunctionIndex.insert(
+		FunctionIndexMap::value_type(
+			PC,
+			m_Statistics.Functions.size( ) - 1));
+
+	return m_Statistics.Functions.size( ) - 1;
+}
+
+void
+NWScriptVM::ExecuteAction(
+	 ULONG ActionId,
+	 ULONG NumArguments
+	)
+/*++
+
+Routine Description:
+
+	This routine dispatches an ACTION instruction to its handler.
+
+Arguments:
+
+	ActionId - Supplies the action ordinal.
+
+	NumArguments - Supplies the count of arguments passed.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (ActionId >= m_Actions.size( ))
+		Fault( "Call to an undefined action." );
+
+	const ActionDefinition & Action = m_Actions[ ActionId ];
+
+	m_Statistics.ActionCalls += 1;
+
+	if (Action.Handler != NULL)
+		Action.Handler( *this, Action, NumArguments, Action.Context );
+	else
+		StubAction( *this, Action, NumArguments, NULL );
+}
+
+void
+NWScriptVM::ExecuteBinaryOp(
+	 UCHAR Opcode,
+	 UCHAR TypeOpcode
+	)
+/*++
+
+Routine Description:
+
+	This routine executes a binary arithmetic, logical or relational
+	instruction (other than EQUAL and NEQUAL).
+
+Arguments:
+
+	Opcode - Supplies the instruction opcode.
+
+	TypeOpcode - Supplies the operand types.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	switch (TypeOpcode)
+	{
+
+	case 0x20: // II
+		{
+			LONG Right = StackPopInt( );
+			StackCell & Left = StackTop( VMType_Int );
+			ULONG Shift = (ULONG) Right & 31;
+
+			switch (Opcode)
+			{
+
+			case 0x06: Left.Int = ((Left.Int != 0) && (Right != 0)) ? 1 : 0; break;
+			case 0x07: Left.Int = ((Left.Int != 0) || (Right != 0)) ? 1 : 0; break;
+			case 0x08: Left.Int |= Right; break;
+			case 0x09: Left.Int ^= Right; break;
+			case 0x0A: Left.Int &= Right; break;
+			case 0x0D: Left.Int = (Left.Int >= Right) ? 1 : 0; break;
+			case 0x0E: Left.Int = (Left.Int > Right) ? 1 : 0; break;
+			case 0x0F: Left.Int = (Left.Int < Right) ? 1 : 0; break;
+			case 0x10: Left.Int = (Left.Int <= Right) ? 1 : 0; break;
+			case 0x11: Left.Int = (LONG) ((ULONG) Left.Int << Shift); break;
+			case 0x12: Left.Int = Left.Int >> Shift; break;
+			case 0x13: Left.Int = (LONG) ((ULONG) Left.Int >> Shift); break;
+			case 0x14: Left.Int = (LONG) ((ULONG) Left.Int + (ULONG) Right); break;
+			case 0x15: Left.Int = (LONG) ((ULONG) Left.Int - (ULONG) Right); break;
+			case 0x16: Left.Int = (LONG) ((ULONG) Left.Int * (ULONG) Right); break;
+
+			case 0x17:
+			case 0x18:
+				if (Right == 0)
+					Fault( "Division by zero." );
+
+				if ((Left.Int == INT_MIN) && (Right == -1))
+					Left.Int = (Opcode == 0x17) ? INT_MIN : 0;
+				else if (Opcode == 0x17)
+					Left.Int /= Right;
+				else
+					Left.Int %= Right;
+				break;
+
+			default:
+				Fault( "Illegal operand types." );
+
+			}
+		}
+		break;
+
+	case 0x21: // FF
+	case 0x25: // IF
+	case 0x26: // FI
+		{
+			float Right;
+			float Left;
+
+			if (TypeOpcode == 0x25)
+				Right = StackPopFloat( );
+			else if (TypeOpcode == 0x26)
+				Right = (float) StackPopInt( );
+			else
+				Right = StackPopFloat( );
+
+			if (TypeOpcode == 0x25)
+				Left = (float) StackPopInt( );
+			else
+				Left = StackPopFloat( );
+
+			switch (Opcode)
+			{
+
+			case 0x0D: StackPushInt( (Left >= Right) ? 1 : 0 ); break;
+			case 0x0E: StackPushInt( (Left > Right) ? 1 : 0 ); break;
+			case 0x0F: StackPushInt( (Left < Right) ? 1 : 0 ); break;
+			case 0x10: StackPushInt( (Left <= Right) ? 1 : 0 ); break;
+			case 0x14: StackPushFloat( Left + Right ); break;
+			case 0x15: StackPushFloat( Left - Right ); break;
+			case 0x16: StackPushFloat( Left * Right ); break;
+
+			case 0x17:
+				if (Right == 0.0f)
+					Fault( "Division by zero." );
+
+				StackPushFloat( Left / Right );
+				break;
+
+			default:
+				Fault( "Illegal operand types." );
+
+			}
+		}
+		break;
+
+	case 0x23: // SS
+		{
+			if (Opcode != 0x14)
+				Fault( "Illegal operand types." );
+
+			std::string Right = StackPopString( );
+
+			StackTop( VMType_String ).String += Right;
+		}
+		break;
+
+	case 0x3A: // VV
+	case 0x3B: // VF
+	case 0x3C: // FV
+		{
+			float Vector[ 3 ];
+			float Other[ 3 ];
+			float Scalar;
+
+			if (TypeOpcode == 0x3A)
+			{
+				StackPopVector( Other );
+				StackPopVector( Vector );
+			}
+			else if (TypeOpcode == 0x3B)
+			{
+				Scalar = StackPopFloat( );
+				StackPopVector( Vector );
+			}
+			else
+			{
+				StackPopVector( Vector );
+				Scalar = StackPopFloat( );
+			}
+
+			for (int i = 0; i < 3; i += 1)
+			{
+				if ((Opcode == 0x14) && (TypeOpcode == 0x3A))
+					Vector[ i ] += Other[ i ];
+				else if ((Opcode == 0x15) && (TypeOpcode == 0x3A))
+					Vector[ i ] -= Other[ i ];
+				else if ((Opcode == 0x16) && (TypeOpcode != 0x3A))
+					Vector[ i ] *= Scalar;
+				else if ((Opcode == 0x17) && (TypeOpcode == 0x3B) && (Scalar != 0.0f))
+					Vector[ i ] /= Scalar;
+				else if (Opcode == 0x17)
+					Fault( "Division by zero." );
+				else
+					Fault( "Illegal operand types." );
+			}
+
+			StackPushVector( Vector );
+		}
+		break;
+
+	default:
+		Fault( "Illegal operand types." );
+
+	}
+}
+
+void
+NWScriptVM::CompareTop(
+	 UCHAR Opcode,
+	 ULONG Cells
+	)
+/*++
+
+Routine Description:
+
+	This routine executes EQUAL or NEQUAL, which compare the two topmost
+	values of a given size and replace them with the integer result.
+
+Arguments:
+
+	Opcode - Supplies the instruction opcode.
+
+	Cells - Supplies the size of each value, in cells.
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	size_t Left;
+	bool   Equal;
+
+	if ((Cells == 0) || (Cells * 2 > m_Stack.size( )))
+		Fault( "Stack underflow." );
+
+	Left  = m_Stack.size( ) - Cells * 2;
+	Equal = true;
+
+	for (ULONG i = 0; (i < Cells) && (Equal); i += 1)
+		Equal = CellsEqual( m_Stack[ Left + i ], m_Stack[ Left + Cells + i ] );
+
+	m_Stack.resize( Left );
+
+	StackPushInt( (Equal == (Opcode == 0x0B)) ? 1 : 0 );
+}
+
+size_t
+NWScriptVM::StackIndex(
+	 LONG Offset,
+	 ULONG Cells
+	) const
+/*++
+
+Routine Description:
+
+	This routine converts an SP-relative byte offset to a stack index.
+
+Arguments:
+
+	Offset - Supplies the (negative) byte offset from the top of stack.
+
+	Cells - Supplies the count of cells that will be accessed.
+
+Return Value:
+
+	The routine returns the stack index.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	LONG Cell;
+
+	if ((Offset >= 0) || ((Offset % 4) != 0))
+		Fault( "Illegal stack offset." );
+
+	Cell = Offset / 4;
+
+	if (((size_t) -Cell > m_Stack.size( )) || ((ULONG) -Cell < Cells))
+		Fault( "Stack offset out of range." );
+
+	return m_Stack.size( ) + Cell;
+}
+
+size_t
+NWScriptVM::BaseIndex(
+	 LONG Offset,
+	 ULONG Cells
+	) const
+/*++
+
+Routine Description:
+
+	This routine converts a BP-relative byte offset to a stack index.
+
+Arguments:
+
+	Offset - Supplies the (negative) byte offset from the base pointer.
+
+	Cells - Supplies the count of cells that will be accessed.
+
+Return Value:
+
+	The routine returns the stack index.  On failure, an std::exception is
+	raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	LONG Cell;
+
+	if ((Offset >= 0) || ((Offset % 4) != 0))
+		Fault( "Illegal base pointer offset." );
+
+	Cell = Offset / 4;
+
+	if (((size_t) -Cell > m_BP) || ((ULONG) -Cell < Cells))
+		Fault( "Base pointer offset out of range." );
+
+	return m_BP + Cell;
+}
+
+NWScriptVM::StackCell &
+NWScriptVM::StackTop(
+	 VM_TYPE Type
+	)
+/*++
+
+Routine Description:
+
+	This routine returns the top of stack, which must hold a value of a given
+	type.
+
+Arguments:
+
+	Type - Supplies the type expected.
+
+Return Value:
+
+	The routine returns the top of stack cell.  On failure, an std::exception
+	is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	if (m_Stack.empty( ))
+		Fault( "Stack underflow." );
+
+	if (m_Stack.back( ).Type != Type)
+		Fault( "Stack value has the wrong type." );
+
+	return m_Stack.back( );
+}
+
+ULONGLONG
+NWScriptVM::GetTime(
+	)
+/*++
+
+Routine Description:
+
+	This routine returns a monotonic time stamp, in nanoseconds.
+
+Arguments:
+
+	None.
+
+Return Value:
+
+	The routine returns the time stamp.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	return (ULONGLONG) std::chrono::duration_cast< std::chrono::nanoseconds >(
+		std::chrono::steady_clock::now( ).time_since_epoch( ) ).count( );
+}
+
+void
+NWScriptVM::Fault(
+	 const char * Message
+	) const
+/*++
+
+Routine Description:
+
+	This routine raises a script execution error for the current instruction.
+
+Arguments:
+
+	Message - Supplies the error description.
+
+Return Value:
+
+	None.  The routine always raises an std::exception.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+	char ErrorMsg[ 300 ];
+
+	snprintf(
+		ErrorMsg,
+		sizeof( ErrorMsg ),
+		"%s (PC %08X)",
+		Message,
+		m_CurrentPC + NWScriptReader::NCSHeaderSize);
+
+	throw std::runtime_error( ErrorMsg );
+}
@@ -0,0 +1,508 @@
+/*++
+
+Module Name:
+
+	NWScriptVM.h
+
+Abstract:
+
+	This module defines the offline NWScript virtual machine.  The VM executes
+	a compiled script (*.ncs) through an NWScriptReader without a game server:
+	engine actions are dispatched through an action table supplied by the
+	caller, and any action without a handler is stubbed (its arguments are
+	popped and a default value of its return type is pushed).
+
+	The VM counts the instructions executed, tracks the stack high-water mark
+	and, at subroutine granularity, the calls, instructions and time spent in
+	each script function (named from the NDB symbols, if loaded).  It is meant
+	for measuring scripts, not for running them in production; there is no
+	object model behind OBJECT_SELF and friends.
+
+--*/
+
+#ifndef _SOURCE_PROGRAMS_NWN2DATALIB_NWSCRIPTVM_H
+#define _SOURCE_PROGRAMS_NWN2DATALIB_NWSCRIPTVM_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <deque>
+#include <unordered_map>
+#include "NWScriptReader.h"
+
+class NWScriptVM
+{
+
+public:
+
+	//
+	// Define the types of values held on the VM stack, and the parameter and
+	// return types of actions.  Vectors (three float cells) and actions (a
+	// saved script situation) only appear in action prototypes.
+	//
+
+	typedef enum _VM_TYPE
+	{
+		VMType_Void,
+		VMType_Int,
+		VMType_Float,
+		VMType_String,
+		VMType_Object,
+		VMType_Vector,
+		VMType_Action,
+
+		//
+		// Engine structures are numbered as in the instruction set (effect,
+		// event, location, talent, itemproperty, ...).
+		//
+
+		VMType_EngineStructure0 = 0x10,
+		VMType_EngineStructureLast = VMType_EngineStructure0 + 9,
+
+		LastVMType
+	} VM_TYPE, * PVM_TYPE;
+
+	//
+	// Define a stack cell.  Engine structures hold an opaque value (JSON
+	// values keep their text in String).
+	//
+
+	struct StackCell
+	{
+		VM_TYPE     Type;
+
+		union
+		{
+			LONG    Int;
+			float   Float;
+			ULONG   Object;
+		};
+
+		std::string String;
+	};
+
+	typedef std::vector< StackCell > StackCellVec;
+
+	//
+	// Define a saved script situation, as created by STORE_STATE for an
+	// action argument (i.e. DelayCommand).
+	//
+
+	struct SavedState
+	{
+		ULONG        ResumePC;
+		ULONG        ObjectSelf;
+		StackCellVec Globals;
+		StackCellVec Locals;
+	};
+
+	struct ActionDefinition;
+
+	//
+	// Define the action handler callback.  The handler pops the arguments of
+	// the action (the first argument is on top of the stack) and pushes its
+	// return value.  An argument of type action is taken with TakeSavedState
+	// instead.  On failure, the handler raises an std::exception.
+	//
+
+	typedef
+	void
+	(* ActionHandler)(
+		 NWScriptVM & VM,
+		 const ActionDefinition & Action,
+		 ULONG NumArguments,
+		 void * Context
+		);
+
+	//
+	// Define an entry of the action table, normally built from the action
+	// prototypes of nwscript.nss.  The handler may be NULL, in which case the
+	// action is stubbed.
+	//
+
+	struct ActionDefinition
+	{
+		ULONG                  ActionId;
+		std::string            Name;
+		VM_TYPE                ReturnType;
+		std::vector< VM_TYPE > ParameterTypes;
+		ActionHandler          Handler;
+		void                 * Context;
+	};
+
+	typedef std::vector< ActionDefinition > ActionDefinitionVec;
+
+	//
+	// Define the execution statistics of a script function.  Times are in
+	// nanoseconds; the self figures exclude the subroutines called.
+	//
+
+	struct FunctionStatistics
+	{
+		std::string Name;
+		ULONG       PC;
+		ULONGLONG   Calls;
+		ULONGLONG   Instructions;
+		ULONGLONG   SelfTime;
+		ULONGLONG   TotalTime;
+	};
+
+	typedef std::vector< FunctionStatistics > FunctionStatisticsVec;
+
+	//
+	// Define the execution statistics of the VM, accumulated over all of the
+	// scripts executed since the last ResetStatistics call.
+	//
+
+	struct Statistics
+	{
+		ULONGLONG             Executions;
+		ULONGLONG             Instructions;
+		ULONGLONG             ActionCalls;
+		size_t                StackHighWater;
+		ULONGLONG             ElapsedTime;
+		FunctionStatisticsVec Functions;
+	};
+
+	//
+	// Define the object id that the instruction set's OBJECT_INVALID constant
+	// evaluates to.
+	//
+
+	enum
+	{
+		ObjectInvalid = 0x7F000000
+	};
+
+	//
+	// Create a VM over a script reader.  The reader (and its symbol table)
+	// must remain valid for the lifetime of the VM.
+	//
+
+	NWScriptVM(
+		 NWScriptReader & Script,
+		 const ActionDefinitionVec & Actions
+		);
+
+	~NWScriptVM(
+		);
+
+	//
+	// Execute the script from its entry point.  Saved situations queued by
+	// action handlers (see QueueSavedState) are executed afterwards, in
+	// order.  The routine returns the value left on the stack by a
+	// StartingConditional script, else zero.
+	//
+	// On failure (i.e. bad instruction, stack underflow, instruction limit
+	// exceeded), an std::exception is raised.
+	//
+
+	LONG
+	Execute(
+		 ULONG ObjectSelf
+		);
+
+	//
+	// Limit the instructions executed by one Execute call.  Zero (the
+	// default) means no limit.
+	//
+
+	inline
+	void
+	SetInstructionLimit(
+		 ULONGLONG InstructionLimit
+		)
+	{
+		m_InstructionLimit = InstructionLimit;
+	}
+
+	//
+	// Return the object that the running script executes on.
+	//
+
+	inline
+	ULONG
+	GetObjectSelf(
+		) const
+	{
+		return m_ObjectSelf;
+	}
+
+	//
+	// Return (and reset) the statistics.
+	//
+
+	void
+	GetStatistics(
+		 Statistics & VMStatistics
+		) const;
+
+	void
+	ResetStatistics(
+		);
+
+	//
+	// Stack access APIs for action handlers.  These APIs raise an
+	// std::exception if the stack does not hold a value of the expected
+	// type.
+	//
+
+	LONG
+	StackPopInt(
+		);
+
+	float
+	StackPopFloat(
+		);
+
+	std::string
+	StackPopString(
+		);
+
+	ULONG
+	StackPopObject(
+		);
+
+	void
+	StackPopVector(
+		 float Vector[ 3 ]
+		);
+
+	StackCell
+	StackPopEngineStructure(
+		 VM_TYPE Type
+		);
+
+	void
+	StackPushInt(
+		 LONG Value
+		);
+
+	void
+	StackPushFloat(
+		 float Value
+		);
+
+	void
+	StackPushString(
+		 const std::string & Value
+		);
+
+	void
+	StackPushObject(
+		 ULONG Value
+		);
+
+	void
+	StackPushVector(
+		 const float Vector[ 3 ]
+		);
+
+	void
+	StackPushEngineStructure(
+		 const StackCell & Value
+		);
+
+	//
+	// Pop an argument of the given type and discard it, or push the default
+	// value of a type.  These are the building blocks of action stubs.
+	//
+
+	void
+	StackPopArgument(
+		 VM_TYPE Type
+		);
+
+	void
+	StackPushDefault(
+		 VM_TYPE Type
+		);
+
+	//
+	// Take the saved situation created for an action argument.  The routine
+	// raises an std::exception if there is none.
+	//
+
+	void
+	TakeSavedState(
+		 SavedState & State
+		);
+
+	//
+	// Queue a saved situation to be executed once the script (and any
+	// situations queued before it) have finished.
+	//
+
+	void
+	QueueSavedState(
+		 SavedState & State
+		);
+
+	//
+	// The default action handler: pops the arguments according to the
+	// prototype and pushes a default value of the return type.
+	//
+
+	static
+	void
+	StubAction(
+		 NWScriptVM & VM,
+		 const ActionDefinition & Action,
+		 ULONG NumArguments,
+		 void * Context
+		);
+
+private:
+
+	//
+	// Define a subroutine call frame, used both for returns and for the per
+	// function statistics.
+	//
+
+	struct CallFrame
+	{
+		ULONG     ReturnPC;
+		size_t    Function;
+		ULONGLONG StartTime;
+		ULONGLONG ChildTime;
+	};
+
+	//
+	// Define the sentinel return address of the outermost frame.
+	//
+
+	enum
+	{
+		ReturnToHost = 0xFFFFFFFF
+	};
+
+	typedef std::unordered_map< ULONG, size_t > FunctionIndexMap;
+
+	void
+	Run(
+		 ULONG PC
+		);
+
+	void
+	ExecuteSavedState(
+		 SavedState & State
+		);
+
+	void
+	EnterFunction(
+		 ULONG PC,
+		 ULONG ReturnPC
+		);
+
+	bool
+	LeaveFunction(
+		);
+
+	void
+	AccountSegment(
+		);
+
+	size_t
+	GetFunctionIndex(
+		 ULONG PC
+		);
+
+	void
+	ExecuteAction(
+		 ULONG ActionId,
+		 ULONG NumArguments
+		);
+
+	void
+	ExecuteBinaryOp(
+		 UCHAR Opcode,
+		 UCHAR TypeOpcode
+		);
+
+	void
+	CompareTop(
+		 UCHAR Opcode,
+		 ULONG Cells
+		);
+
+	size_t
+	StackIndex(
+		 LONG Offset,
+		 ULONG Cells
+		) const;
+
+	size_t
+	BaseIndex(
+		 LONG Offset,
+		 ULONG Cells
+		) const;
+
+	StackCell &
+	StackTop(
+		 VM_TYPE Type
+		);
+
+	inline
+	StackCell &
+	PushCell(
+		 VM_TYPE Type
+		)
+	{
+		m_Stack.resize( m_Stack.size( ) + 1 );
+
+		if (m_Stack.size( ) > m_Statistics.StackHighWater)
+			m_Statistics.StackHighWater = m_Stack.size( );
+
+		m_Stack.back( ).Type = Type;
+		m_Stack.back( ).Int  = 0;
+
+		return m_Stack.back( );
+	}
+
+	static
+	ULONGLONG
+	GetTime(
+		);
+
+	void
+	Fault(
+		 const char * Message
+		) const;
+
+	//
+	// Define the script being executed and the action table.
+	//
+
+	NWScriptReader            & m_Script;
+	const ActionDefinitionVec & m_Actions;
+
+	//
+	// Define the execution state: the value stack, the base pointer, the
+	// subroutine call stack and the saved situations.
+	//
+
+	StackCellVec                m_Stack;
+	size_t                      m_BP;
+	std::vector< CallFrame >    m_CallStack;
+	ULONG                       m_ObjectSelf;
+	ULONG                       m_CurrentPC;
+	std::vector< SavedState >   m_SavedStates;
+	std::deque< SavedState >    m_QueuedStates;
+	ULONGLONG                   m_InstructionLimit;
+	ULONGLONG                   m_InstructionBase;
+
+	//
+	// Define the statistics and the function lookup table for them.
+	//
+
+	Statistics                  m_Statistics;
+	FunctionIndexMap            m_FunctionIndex;
+	std::vector< ULONG >        m_FunctionDepth;
+	ULONGLONG                   m_SegmentStart;
+
+};
+
+#endif
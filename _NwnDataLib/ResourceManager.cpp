@@ -17,6 +17,7 @@ Abstract:
 #include "Precomp.h"
 #include "ResourceManager.h"
 #include "TextOut.h"
+#include <chrono>
 
 
 
@@ -84,7 +85,9 @@ Environment:
 --*/
 : m_TextWriter( TextWriter ),
   m_NextFileHandle( 0 ),
-  m_ResManFlags( 0 )
+  m_ResManFlags( 0 ),
+  m_KeyFileLoadTime( 0 ),
+  m_DiscoverResourcesTime( 0 )
 {
 //	CHAR TempPath[ _MAX_PATH + 1 ];
 //	CHAR TempUnique[ 32 ];
@@ -2143,10 +2146,21 @@ ResourceManager::LoadScriptResources (
 
 	try
 	{
+		std::chrono::steady_clock::time_point Start;
+
+		Start = std::chrono::steady_clock::now( );
+
         if (LoadParams != nullptr && LoadParams->KeyFiles != nullptr)
             LoadFixedKeyFiles( *LoadParams->KeyFiles );
 
+		m_KeyFileLoadTime = (ULONGLONG) std::chrono::duration_cast< std::chrono::nanoseconds >(
+			std::chrono::steady_clock::now( ) - Start ).count( );
+		Start = std::chrono::steady_clock::now( );
+
 		DiscoverResources();
+
+		m_DiscoverResourcesTime = (ULONGLONG) std::chrono::duration_cast< std::chrono::nanoseconds >(
+			std::chrono::steady_clock::now( ) - Start ).count( );
 	}
 	catch (...)
 	{
@@ -439,6 +439,27 @@ public:
 		return m_TempPath;
 	}
 
+	//
+	// Retrieve the time, in nanoseconds, that the last LoadScriptResources
+	// call spent loading the fixed key files and discovering the resources.
+	//
+
+	inline
+	ULONGLONG
+	GetKeyFileLoadTime(
+		) const
+	{
+		return m_KeyFileLoadTime;
+	}
+
+	inline
+	ULONGLONG
+	GetDiscoverResourcesTime(
+		) const
+	{
+		return m_DiscoverResourcesTime;
+	}
+
 //	//
 //	// Return the unique instance differentiator for this resource manager.
 //	//
@@ -1195,6 +1216,13 @@ private:
 
 	unsigned long             m_ResManFlags;
 
+	//
+	// Define the load times of the last LoadScriptResources call.
+	//
+
+	ULONGLONG                 m_KeyFileLoadTime;
+	ULONGLONG                 m_DiscoverResourcesTime;
+
 };
 
 //
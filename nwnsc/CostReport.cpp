@@ -0,0 +1,429 @@
+/*++
+
+Module Name:
+
+    CostReport.cpp
+
+Abstract:
+
+    This module houses the cost report.  See CostReport.h for an overview.
+
+    The JSON report is an object with a "scripts" array; each script has a
+    "functions" array in address order.  The CSV report has one row per
+    function, with the action calls of the function in a single field as
+    "Name=count" pairs separated by semicolons.  A stack depth that is not
+    known (the script did not verify) is null, or empty in CSV.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NscLib/Nsc.h"
+#include "../_NscLib/NscCostAnalyzer.h"
+#include "CostReport.h"
+
+CostReport::CostReport(
+    const std::string & FileName
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new CostReport.
+
+Arguments:
+
+    FileName - Supplies the name of the report file.  The format is CSV if the
+               name ends in .csv, else JSON.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_FileName(FileName),
+  m_Format(FormatJson)
+{
+    if ((FileName.size() >= 4) &&
+        (!stricmp(FileName.c_str() + FileName.size() - 4, ".csv"))) {
+        m_Format = FormatCsv;
+    }
+}
+
+CostReport::~CostReport(
+    )
+/*++
+
+Routine Description:
+
+    This routine cleans up an already-existing CostReport.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+}
+
+void
+CostReport::AddScript(
+    const NscScriptCost & Cost
+    )
+/*++
+
+Routine Description:
+
+    This routine adds the costs of a script to the report.
+
+Arguments:
+
+    Cost - Supplies the costs of the script.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_Scripts.push_back(Cost);
+}
+
+void
+CostReport::Format(
+    std::vector< unsigned char > & Text
+    ) const
+/*++
+
+Routine Description:
+
+    This routine formats the report in the format of the report file.
+
+Arguments:
+
+    Text - Receives the text of the report.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Report;
+
+    if (m_Format == FormatCsv)
+        FormatAsCsv(Report);
+    else
+        FormatAsJson(Report);
+
+    Text.assign(Report.begin(), Report.end());
+}
+
+void
+CostReport::FormatAsJson(
+    std::string & Text
+    ) const
+/*++
+
+Routine Description:
+
+    This routine formats the report as JSON.
+
+Arguments:
+
+    Text - Receives the text of the report.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Number[64];
+
+    Text = "{\n  \"scripts\": [";
+
+    for (size_t i = 0; i < m_Scripts.size(); i += 1) {
+        const NscScriptCost & Script = m_Scripts[i];
+
+        Text += (i != 0) ? ",\n    {\n      \"name\": " : "\n    {\n      \"name\": ";
+        AppendJsonString(Text, Script.strName);
+        Text += ",\n      \"functions\": [";
+
+        for (size_t j = 0; j < Script.asFunctions.size(); j += 1) {
+            const NscFunctionCost & Function = Script.asFunctions[j];
+
+            Text += (j != 0) ? ",\n        {\"name\": " : "\n        {\"name\": ";
+            AppendJsonString(Text, Function.strName);
+
+            snprintf(
+                    Number,
+                    sizeof(Number),
+                    ", \"offset\": %lu, \"bytes\": %lu, \"instructions\": %d",
+                    (unsigned long) Function.nOffset,
+                    (unsigned long) Function.nSize,
+                    Function.nInstructions);
+            Text += Number;
+
+            Text += ",\n         \"opcode_classes\": {";
+
+            for (int Class = 0; Class < NscOpcodeClass__NumClasses; Class += 1) {
+                if (Class != 0)
+                    Text += ", ";
+
+                AppendJsonString(Text, NscCostAnalyzer::GetClassName(Class));
+                snprintf(Number, sizeof(Number), ": %d", Function.anClassCounts[Class]);
+                Text += Number;
+            }
+
+            Text += "},\n         \"actions\": {";
+
+            for (std::map< std::string, int >::const_iterator it = Function.mapActions.begin();
+                 it != Function.mapActions.end();
+                 ++it) {
+                if (it != Function.mapActions.begin())
+                    Text += ", ";
+
+                AppendJsonString(Text, it->first);
+                snprintf(Number, sizeof(Number), ": %d", it->second);
+                Text += Number;
+            }
+
+            Text += "},\n         \"max_stack_bytes\": ";
+
+            if (Function.nMaxStackDepth >= 0) {
+                snprintf(Number, sizeof(Number), "%d", Function.nMaxStackDepth);
+                Text += Number;
+            } else {
+                Text += "null";
+            }
+
+            snprintf(
+                    Number,
+                    sizeof(Number),
+                    ", \"loop_nesting\": %d, \"cost\": %llu}",
+                    Function.nLoopNesting,
+                    (unsigned long long) Function.nCost);
+            Text += Number;
+        }
+
+        Text += (Script.asFunctions.empty()) ? "]\n    }" : "\n      ]\n    }";
+    }
+
+    Text += (m_Scripts.empty()) ? "]\n}\n" : "\n  ]\n}\n";
+}
+
+void
+CostReport::FormatAsCsv(
+    std::string & Text
+    ) const
+/*++
+
+Routine Description:
+
+    This routine formats the report as CSV, one row per function.
+
+Arguments:
+
+    Text - Receives the text of the report.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Number[64];
+
+    Text = "script,function,offset,bytes,instructions";
+
+    for (int Class = 0; Class < NscOpcodeClass__NumClasses; Class += 1) {
+        Text += ",";
+        Text += NscCostAnalyzer::GetClassName(Class);
+    }
+
+    Text += ",max_stack_bytes,loop_nesting,cost,actions\n";
+
+    for (size_t i = 0; i < m_Scripts.size(); i += 1) {
+        const NscScriptCost & Script = m_Scripts[i];
+
+        for (size_t j = 0; j < Script.asFunctions.size(); j += 1) {
+            const NscFunctionCost & Function = Script.asFunctions[j];
+            std::string Actions;
+
+            AppendCsvField(Text, Script.strName);
+            Text += ",";
+            AppendCsvField(Text, Function.strName);
+
+            snprintf(
+                    Number,
+                    sizeof(Number),
+                    ",%lu,%lu,%d",
+                    (unsigned long) Function.nOffset,
+                    (unsigned long) Function.nSize,
+                    Function.nInstructions);
+            Text += Number;
+
+            for (int Class = 0; Class < NscOpcodeClass__NumClasses; Class += 1) {
+                snprintf(Number, sizeof(Number), ",%d", Function.anClassCounts[Class]);
+                Text += Number;
+            }
+
+            Text += ",";
+
+            if (Function.nMaxStackDepth >= 0) {
+                snprintf(Number, sizeof(Number), "%d", Function.nMaxStackDepth);
+                Text += Number;
+            }
+
+            snprintf(
+                    Number,
+                    sizeof(Number),
+                    ",%d,%llu,",
+                    Function.nLoopNesting,
+                    (unsigned long long) Function.nCost);
+            Text += Number;
+
+            for (std::map< std::string, int >::const_iterator it = Function.mapActions.begin();
+                 it != Function.mapActions.end();
+                 ++it) {
+                if (!Actions.empty())
+                    Actions += ";";
+
+                snprintf(Number, sizeof(Number), "=%d", it->second);
+                Actions += it->first;
+                Actions += Number;
+            }
+
+            AppendCsvField(Text, Actions);
+            Text += "\n";
+        }
+    }
+}
+
+void
+CostReport::AppendJsonString(
+    std::string & Text,
+    const std::string & String
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a string to JSON text as a quoted string.
+
+Arguments:
+
+    Text - Supplies the text to append to.
+
+    String - Supplies the string.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Escape[8];
+
+    Text += '"';
+
+    for (std::string::const_iterator it = String.begin(); it != String.end(); ++it) {
+        unsigned char Char = (unsigned char) *it;
+
+        if ((Char == '"') || (Char == '\\')) {
+            Text += '\\';
+            Text += (char) Char;
+        } else if (Char < 0x20) {
+            snprintf(Escape, sizeof(Escape), "\\u%04x", Char);
+            Text += Escape;
+        } else {
+            Text += (char) Char;
+        }
+    }
+
+    Text += '"';
+}
+
+void
+CostReport::AppendCsvField(
+    std::string & Text,
+    const std::string & Field
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a field to CSV text, quoting it if it contains a
+    separator, a quote or a line break.
+
+Arguments:
+
+    Text - Supplies the text to append to.
+
+    Field - Supplies the field.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    if (Field.find_first_of(",\"\r\n") == std::string::npos) {
+        Text += Field;
+        return;
+    }
+
+    Text += '"';
+
+    for (std::string::const_iterator it = Field.begin(); it != Field.end(); ++it) {
+        if (*it == '"')
+            Text += '"';
+
+        Text += *it;
+    }
+
+    Text += '"';
+}
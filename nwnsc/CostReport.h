@@ -0,0 +1,115 @@
+/*++
+
+Module Name:
+
+    CostReport.h
+
+Abstract:
+
+    This module defines the cost report, which collects the static costs of
+    the scripts compiled (or, with -d, disassembled) by a run for the
+    --cost-report option and formats them as JSON or CSV.
+
+    The costs themselves are computed by the compiler (see
+    NscCompiler::NscAnalyzeScriptCost); each function of a script gets its
+    instruction counts by opcode class, its ACTION calls by engine function,
+    its deepest stack, its deepest loop nesting and a static cost estimate.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_COSTREPORT_H
+#define _PROGRAMS_NWNSC_COSTREPORT_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+
+struct NscScriptCost;
+
+class CostReport
+{
+
+public:
+
+    typedef enum _FORMAT
+    {
+        FormatJson,
+        FormatCsv,
+
+        LastFormat
+    } FORMAT, * PFORMAT;
+
+    //
+    // Create a report to be written to a file.  The format is CSV if the
+    // file name ends in .csv, else JSON.
+    //
+
+    CostReport(
+        const std::string & FileName
+        );
+
+    ~CostReport(
+        );
+
+    //
+    // Add the costs of a script.
+    //
+
+    void
+    AddScript(
+        const NscScriptCost & Cost
+        );
+
+    //
+    // Format the report.
+    //
+
+    void
+    Format(
+        std::vector< unsigned char > & Text
+        ) const;
+
+    inline
+    const std::string &
+    GetFileName(
+        ) const
+    {
+        return m_FileName;
+    }
+
+private:
+
+    void
+    FormatAsJson(
+        std::string & Text
+        ) const;
+
+    void
+    FormatAsCsv(
+        std::string & Text
+        ) const;
+
+    static
+    void
+    AppendJsonString(
+        std::string & Text,
+        const std::string & String
+        );
+
+    static
+    void
+    AppendCsvField(
+        std::string & Text,
+        const std::string & Field
+        );
+
+    std::string                       m_FileName;
+    FORMAT                            m_Format;
+    std::vector< NscScriptCost >      m_Scripts;
+
+};
+
+#endif
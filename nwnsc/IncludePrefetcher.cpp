@@ -0,0 +1,576 @@
+/*++
+
+Module Name:
+
+    IncludePrefetcher.cpp
+
+Abstract:
+
+    This module houses the include prefetcher.  In batch and wildcard mode the
+    compiler would otherwise stall on a synchronous disk read each time it
+    discovers a new #include.  The prefetcher reads the input files that are
+    about to be compiled, runs a cheap text scan (no parse) over them and loads
+    the include files they name into the shared resource cache, so that the
+    compile of file N overlaps with the I/O for files N+1..N+k.
+
+    All reads are issued in batches through the batch file I/O backend: the
+    input files of the prefetch window together, then each level of includes
+    together (one batch per include path, preserving search order).
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <vector>
+#include <list>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NwnDataLib/BatchFileIo.h"
+#include "../_NscLib/Nsc.h"
+#include "../_NscLib/NscTrace.h"
+#include "IncludePrefetcher.h"
+
+
+IncludePrefetcher::IncludePrefetcher(
+    const StringVec & IncludePaths,
+    const std::shared_ptr< NscResourceCache > & Cache,
+    BatchFileIo & FileIo,
+    size_t Lookahead
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new IncludePrefetcher.  The background thread
+    is not started until Start is called.
+
+Arguments:
+
+    IncludePaths - Supplies the include search paths, in the same order that
+                   the compiler searches them.
+
+    Cache - Supplies the resource cache shared with the compiler.
+
+    FileIo - Supplies the batch file I/O backend used to read files.
+
+    Lookahead - Supplies how many input files beyond the one currently being
+                compiled may be prefetched.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_IncludePaths( IncludePaths ),
+  m_Cache( Cache ),
+  m_FileIo( FileIo ),
+  m_Lookahead( Lookahead ),
+  m_CompileIndex( 0 ),
+  m_Stopping( false ),
+  m_Prefetched( 0 )
+{
+}
+
+IncludePrefetcher::~IncludePrefetcher(
+    )
+/*++
+
+Routine Description:
+
+    This routine stops the background thread, if it is running.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Stop( );
+}
+
+void
+IncludePrefetcher::AddInputFile(
+    const std::string & InFile
+    )
+/*++
+
+Routine Description:
+
+    This routine queues an input file for prefetching.  Input files must be
+    queued in the order in which they are compiled.
+
+Arguments:
+
+    InFile - Supplies the path to the input file.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::lock_guard< std::mutex > Lock( m_Lock );
+
+    m_InputFiles.push_back( InFile );
+}
+
+void
+IncludePrefetcher::Start(
+    )
+/*++
+
+Routine Description:
+
+    This routine starts the background prefetch thread.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    if (m_Thread.joinable( ))
+        return;
+
+    m_Thread = std::thread( &IncludePrefetcher::PrefetchThread, this );
+}
+
+void
+IncludePrefetcher::Advance(
+    )
+/*++
+
+Routine Description:
+
+    This routine notes that the compiler has started on the next input file,
+    which moves the prefetch window forward by one file.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    {
+        std::lock_guard< std::mutex > Lock( m_Lock );
+
+        m_CompileIndex += 1;
+    }
+
+    m_Wakeup.notify_one( );
+}
+
+bool
+IncludePrefetcher::TakeInputFile(
+    const std::string & InFile,
+    std::vector< unsigned char > & FileContents
+    )
+/*++
+
+Routine Description:
+
+    This routine hands over the contents of an input file that the prefetch
+    thread has already read.  Each prefetched input file may be taken once.
+
+Arguments:
+
+    InFile - Supplies the path to the input file, as queued.
+
+    FileContents - Receives the contents of the input file.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true if the contents were
+    available, else false if the caller must read the file itself.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::lock_guard< std::mutex > Lock( m_Lock );
+    ContentsMap::iterator it = m_InputContents.find( InFile );
+
+    if (it == m_InputContents.end( ))
+        return false;
+
+    FileContents.swap( it->second );
+    m_InputContents.erase( it );
+
+    return true;
+}
+
+void
+IncludePrefetcher::Stop(
+    )
+/*++
+
+Routine Description:
+
+    This routine stops the background prefetch thread and waits for it to
+    exit.  Resources already placed in the cache remain there.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    {
+        std::lock_guard< std::mutex > Lock( m_Lock );
+
+        m_Stopping = true;
+    }
+
+    m_Wakeup.notify_one( );
+
+    if (m_Thread.joinable( ))
+        m_Thread.join( );
+
+    m_InputContents.clear( );
+}
+
+void
+IncludePrefetcher::PrefetchThread(
+    )
+/*++
+
+Routine Description:
+
+    This routine is the body of the background prefetch thread.  It walks the
+    queued input files in compile order, staying at most Lookahead files ahead
+    of the compiler.  Each time the window opens up, every input file in it is
+    read in a single batch, and the includes of those files are prefetched.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode, prefetch thread.
+
+--*/
+{
+    size_t Index = 0;
+
+    NscTrace::SetThreadName( "Include prefetcher" );
+
+    for (;;) {
+        std::vector< BatchFileIo::ReadRequest > Requests;
+        size_t                                  First;
+
+        {
+            std::unique_lock< std::mutex > Lock( m_Lock );
+
+            while ((!m_Stopping) &&
+                   (Index < m_InputFiles.size( )) &&
+                   (Index >= m_CompileIndex + m_Lookahead)) {
+                m_Wakeup.wait( Lock );
+            }
+
+            if ((m_Stopping) || (Index >= m_InputFiles.size( )))
+                break;
+
+            First = Index;
+
+            while ((Index < m_InputFiles.size( )) &&
+                   (Index < m_CompileIndex + m_Lookahead)) {
+                Index += 1;
+            }
+
+            try {
+                Requests.resize( Index - First );
+
+                for (size_t i = First; i < Index; i += 1)
+                    Requests[ i - First ].FileName = m_InputFiles[ i ];
+            }
+            catch (std::exception) {
+                continue;
+            }
+        }
+
+        try {
+            NscTraceScope Trace( "Prefetch", "include" );
+            StringVec IncludeNames;
+
+            m_FileIo.ReadFiles( &Requests[ 0 ], Requests.size( ) );
+
+            for (size_t i = 0; i < Requests.size( ); i += 1) {
+                BatchFileIo::ReadRequest & Request = Requests[ i ];
+
+                if (Request.Status != BatchFileIo::StatusSuccess)
+                    continue;
+
+                if (!Request.Contents.empty( ))
+                    ScanIncludes( &Request.Contents[ 0 ], Request.Contents.size( ), IncludeNames );
+
+                //
+                // Keep the contents for the compiler unless it has already
+                // started on (and hence read) the file itself.
+                //
+
+                std::lock_guard< std::mutex > Lock( m_Lock );
+
+                if (First + i >= m_CompileIndex)
+                    m_InputContents.insert( ContentsMap::value_type( Request.FileName, std::vector< unsigned char >( ) ) ).first->second.swap( Request.Contents );
+            }
+
+            PrefetchIncludes( IncludeNames );
+        }
+        catch (std::exception) {
+            //
+            // Prefetching is purely advisory; the compiler loads anything
+            // that did not make it into the cache itself.
+            //
+        }
+    }
+}
+
+void
+IncludePrefetcher::ScanIncludes(
+    const unsigned char * Text,
+    size_t Length,
+    StringVec & IncludeNames
+    )
+/*++
+
+Routine Description:
+
+    This routine scans script source text for #include "name" lines and
+    collects the include names.  This is a line oriented text scan that
+    mirrors the preprocessor's own #include handling; a stray match (e.g.
+    inside a block comment) merely costs an unneeded prefetch.
+
+Arguments:
+
+    Text - Supplies the script source text.
+
+    Length - Supplies the length, in bytes, of the source text.
+
+    IncludeNames - Receives the include names (without extension) found.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode, prefetch thread.
+
+--*/
+{
+    const char * p = (const char *) Text;
+    const char * End = p + Length;
+
+    while (p < End) {
+        const char * LineEnd = (const char *) memchr( p, '\n', End - p );
+
+        if (LineEnd == nullptr)
+            LineEnd = End;
+
+        while ((p < LineEnd) && ((*p == ' ') || (*p == '\t')))
+            p += 1;
+
+        if ((LineEnd - p > 8) && (strncmp( p, "#include", 8 ) == 0)) {
+            const char * NameStart;
+            const char * NameEnd;
+
+            NameStart = (const char *) memchr( p + 8, '"', LineEnd - (p + 8) );
+
+            if (NameStart != nullptr) {
+                NameStart += 1;
+                NameEnd = (const char *) memchr( NameStart, '"', LineEnd - NameStart );
+
+                if (NameEnd != nullptr) {
+                    std::string Name( NameStart, NameEnd - NameStart );
+                    std::string::size_type Dot = Name.find( '.' );
+
+                    if (Dot != std::string::npos)
+                        Name.erase( Dot );
+
+                    if ((!Name.empty( )) &&
+                        (Name.length( ) <= sizeof( NWN::ResRef32 ))) {
+                        IncludeNames.push_back( Name );
+                    }
+                }
+            }
+        }
+
+        p = LineEnd + 1;
+    }
+}
+
+void
+IncludePrefetcher::PrefetchIncludes(
+    StringVec & IncludeNames
+    )
+/*++
+
+Routine Description:
+
+    This routine loads a set of include files from the include search paths
+    into the resource cache, then does the same for the includes they name,
+    level by level.  For each level, the candidate files on each include path
+    are read in one batch; a name found on an earlier path is not probed on
+    later ones, so the search order matches NscCompiler::LoadResource.  The
+    location recorded also matches what LoadResource records so that include
+    reporting and dependency generation are unaffected.
+
+    Includes that are only available via the resource system (e.g. from a
+    BIF) are left for the compiler, as the resource manager is not safe for
+    use from multiple threads.
+
+Arguments:
+
+    IncludeNames - Supplies the include names, without extension.  The
+                   vector is consumed.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode, prefetch thread.
+
+--*/
+{
+    std::vector< BatchFileIo::ReadRequest > Requests;
+    const char * Ext = ResourceManager::ResTypeToExt( NWN::ResNSS );
+
+    while (!IncludeNames.empty( )) {
+        StringVec Pending;
+        StringVec Nested;
+
+        //
+        // Drop names already handled, either by us or by the compiler.
+        //
+
+        for (StringVec::const_iterator it = IncludeNames.begin( );
+             it != IncludeNames.end( );
+             ++it) {
+            if (!m_Seen.insert( *it ).second)
+                continue;
+
+            if (m_Cache->Contains( ResourceManager::ResRef32FromStr( *it ), NWN::ResNSS ))
+                continue;
+
+            Pending.push_back( *it );
+        }
+
+        for (StringVec::const_iterator Path = m_IncludePaths.begin( );
+             (Path != m_IncludePaths.end( )) && (!Pending.empty( ));
+             ++Path) {
+            std::string Prefix( *Path );
+            StringVec NotFound;
+
+#if defined(_WINDOWS)
+            if (Prefix.back( ) != '\\')
+                Prefix += "\\";
+#else
+            if (Prefix.back( ) != '/')
+                Prefix += "/";
+#endif
+
+            Requests.resize( Pending.size( ) );
+
+            for (size_t i = 0; i < Pending.size( ); i += 1) {
+                Requests[ i ].FileName = Prefix + Pending[ i ] + "." + Ext;
+                Requests[ i ].Contents.clear( );
+            }
+
+            m_FileIo.ReadFiles( &Requests[ 0 ], Requests.size( ) );
+
+            for (size_t i = 0; i < Pending.size( ); i += 1) {
+                BatchFileIo::ReadRequest & Request = Requests[ i ];
+                NscResourceCache::Entry Entry;
+                unsigned char * Contents;
+
+                //
+                // Empty files are left for the compiler to load itself, as
+                // the cache cannot hold an empty buffer.
+                //
+
+                if ((Request.Status != BatchFileIo::StatusSuccess) ||
+                    (Request.Contents.empty( ))) {
+                    NotFound.push_back( Pending[ i ] );
+                    continue;
+                }
+
+                ScanIncludes( &Request.Contents[ 0 ], Request.Contents.size( ), Nested );
+
+                Contents = (unsigned char *) malloc( Request.Contents.size( ) );
+
+                if (Contents == nullptr)
+                    continue;
+
+                memcpy( Contents, &Request.Contents[ 0 ], Request.Contents.size( ) );
+
+                if (m_Cache->Insert(
+                        ResourceManager::ResRef32FromStr( Pending[ i ] ),
+                        NWN::ResNSS,
+                        Contents,
+                        (UINT32) Request.Contents.size( ),
+                        true,
+                        *Path + "/" + Pending[ i ] + "." + Ext,
+                        Entry)) {
+                    m_Prefetched += 1;
+                } else {
+                    free( Contents );
+                }
+            }
+
+            Pending.swap( NotFound );
+        }
+
+        IncludeNames.swap( Nested );
+    }
+}
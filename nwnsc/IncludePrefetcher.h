@@ -0,0 +1,155 @@
+/*++
+
+Module Name:
+
+    IncludePrefetcher.h
+
+Abstract:
+
+    This module defines the include prefetcher, which loads upcoming input
+    files, and the include files they reference, on a background thread while
+    earlier files are being compiled.  Includes go into the compiler's resource
+    cache; input file contents are held until the compiler asks for them.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_INCLUDEPREFETCHER_H
+#define _PROGRAMS_NWNSC_INCLUDEPREFETCHER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+class NscResourceCache;
+class BatchFileIo;
+
+class IncludePrefetcher
+{
+
+public:
+
+    typedef std::vector< std::string > StringVec;
+
+    IncludePrefetcher(
+        const StringVec & IncludePaths,
+        const std::shared_ptr< NscResourceCache > & Cache,
+        BatchFileIo & FileIo,
+        size_t Lookahead
+        );
+
+    ~IncludePrefetcher(
+        );
+
+    //
+    // Queue the next input file (in compile order) for prefetching.
+    //
+
+    void
+    AddInputFile(
+        const std::string & InFile
+        );
+
+    //
+    // Start the background thread.  Input files should be queued first.
+    //
+
+    void
+    Start(
+        );
+
+    //
+    // Note that the compiler has started on the next input file, allowing the
+    // prefetcher to run one more file ahead.
+    //
+
+    void
+    Advance(
+        );
+
+    //
+    // Hand over the contents of an input file if the prefetcher has already
+    // read it.  Returns false if the caller must read the file itself.
+    //
+
+    bool
+    TakeInputFile(
+        const std::string & InFile,
+        std::vector< unsigned char > & FileContents
+        );
+
+    //
+    // Stop the background thread and discard any remaining work.
+    //
+
+    void
+    Stop(
+        );
+
+    inline
+    size_t
+    GetPrefetchedCount(
+        ) const
+    {
+        return m_Prefetched;
+    }
+
+private:
+
+    void
+    PrefetchThread(
+        );
+
+    static
+    void
+    ScanIncludes(
+        const unsigned char * Text,
+        size_t Length,
+        StringVec & IncludeNames
+        );
+
+    void
+    PrefetchIncludes(
+        StringVec & IncludeNames
+        );
+
+    StringVec                            m_IncludePaths;
+    std::shared_ptr< NscResourceCache >  m_Cache;
+    BatchFileIo                        & m_FileIo;
+    size_t                               m_Lookahead;
+
+    //
+    // Input files queued for prefetch, the index of the file currently being
+    // compiled, and the contents of input files read ahead of the compiler.
+    // All are protected by m_Lock.
+    //
+
+    typedef std::map< std::string, std::vector< unsigned char > > ContentsMap;
+
+    StringVec                            m_InputFiles;
+    ContentsMap                          m_InputContents;
+    size_t                               m_CompileIndex;
+    bool                                 m_Stopping;
+    std::mutex                           m_Lock;
+    std::condition_variable              m_Wakeup;
+
+    //
+    // State private to the prefetch thread.
+    //
+
+    std::set< std::string >              m_Seen;
+    std::atomic< size_t >                m_Prefetched;
+    std::thread                          m_Thread;
+
+};
+
+#endif
@@ -0,0 +1,539 @@
+/*++
+
+Module Name:
+
+    OutputWriter.cpp
+
+Abstract:
+
+    This module houses the output writer.  The compile thread hands each set
+    of output files (.ncs, .ndb, .d) to the writer and moves straight on to
+    the next script, while the writer thread:
+
+    - compares each output against the file already on disk (size first,
+      then contents) and skips outputs whose bytes are unchanged, so that
+      their timestamps are preserved and downstream build steps do not re-run;
+
+    - writes changed outputs to a temporary file next to the target and
+      renames it into place, so that a reader never observes a partially
+      written output.
+
+    Everything queued since the last pass is handled as one batch through the
+    batch file I/O backend.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <chrono>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/BatchFileIo.h"
+#include "../_NscLib/NscTrace.h"
+#include "OutputWriter.h"
+
+#if defined(_WINDOWS)
+#include <windows.h>
+#include <process.h>
+#else
+#include <unistd.h>
+#endif
+
+
+OutputWriter::OutputWriter(
+    BatchFileIo & FileIo,
+    size_t MaxPendingFiles
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new OutputWriter.  The background thread is not
+    started until Start is called.
+
+Arguments:
+
+    FileIo - Supplies the batch file I/O backend used to read and write files.
+
+    MaxPendingFiles - Supplies how many output files may be queued before
+                      Submit waits for the writer to catch up.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_FileIo( FileIo ),
+  m_MaxPendingFiles( MaxPendingFiles ),
+  m_InProgress( 0 ),
+  m_Stopping( false ),
+  m_Written( 0 ),
+  m_Unchanged( 0 ),
+  m_WriteTime( 0 )
+{
+    char Suffix[ 32 ];
+
+#if defined(_WINDOWS)
+    snprintf( Suffix, sizeof( Suffix ), ".%lu.tmp", (unsigned long) GetCurrentProcessId( ) );
+#else
+    snprintf( Suffix, sizeof( Suffix ), ".%lu.tmp", (unsigned long) getpid( ) );
+#endif
+
+    m_TempSuffix = Suffix;
+}
+
+OutputWriter::~OutputWriter(
+    )
+/*++
+
+Routine Description:
+
+    This routine writes any remaining output and stops the background thread.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Stop( );
+}
+
+void
+OutputWriter::Start(
+    )
+/*++
+
+Routine Description:
+
+    This routine starts the background writer thread.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    if (m_Thread.joinable( ))
+        return;
+
+    m_Thread = std::thread( &OutputWriter::WriterThread, this );
+}
+
+void
+OutputWriter::Submit(
+    OutputFileVec & Files
+    )
+/*++
+
+Routine Description:
+
+    This routine queues a set of output files for writing.  If the writer
+    thread is not running, the files are written immediately on the calling
+    thread.
+
+Arguments:
+
+    Files - Supplies the output files.  The contents are moved into the queue
+            and the vector is left empty.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    if (!m_Thread.joinable( )) {
+        WriteBatch( Files );
+        Files.clear( );
+        return;
+    }
+
+    {
+        std::unique_lock< std::mutex > Lock( m_Lock );
+
+        while ((m_Queue.size( ) >= m_MaxPendingFiles) && (!m_Stopping))
+            m_Idle.wait( Lock );
+
+        for (OutputFileVec::iterator it = Files.begin( ); it != Files.end( ); ++it) {
+            m_Queue.push_back( OutputFile( ) );
+            m_Queue.back( ).FileName.swap( it->FileName );
+            m_Queue.back( ).Contents.swap( it->Contents );
+            m_Queue.back( ).OpenError  = it->OpenError;
+            m_Queue.back( ).WriteError = it->WriteError;
+        }
+    }
+
+    Files.clear( );
+    m_Wakeup.notify_one( );
+}
+
+void
+OutputWriter::Flush(
+    )
+/*++
+
+Routine Description:
+
+    This routine waits until every queued output file has been written (or
+    has failed).
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::unique_lock< std::mutex > Lock( m_Lock );
+
+    while ((!m_Queue.empty( )) || (m_InProgress != 0))
+        m_Idle.wait( Lock );
+}
+
+size_t
+OutputWriter::ReportFailures(
+    IDebugTextOut * TextOut
+    )
+/*++
+
+Routine Description:
+
+    This routine prints the error messages of output files that failed to be
+    written since the last call, on the calling thread.
+
+Arguments:
+
+    TextOut - Supplies the text out interface used to receive the messages.
+
+Return Value:
+
+    The routine returns the number of failed output files reported.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< std::string > Failures;
+
+    {
+        std::lock_guard< std::mutex > Lock( m_Lock );
+
+        Failures.swap( m_Failures );
+    }
+
+    for (std::vector< std::string >::const_iterator it = Failures.begin( );
+         it != Failures.end( );
+         ++it) {
+        TextOut->WriteText( "%s", it->c_str( ) );
+    }
+
+    return Failures.size( );
+}
+
+void
+OutputWriter::Stop(
+    )
+/*++
+
+Routine Description:
+
+    This routine writes everything still queued, then stops the background
+    thread and waits for it to exit.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    {
+        std::lock_guard< std::mutex > Lock( m_Lock );
+
+        m_Stopping = true;
+    }
+
+    m_Wakeup.notify_one( );
+
+    if (m_Thread.joinable( ))
+        m_Thread.join( );
+}
+
+void
+OutputWriter::WriterThread(
+    )
+/*++
+
+Routine Description:
+
+    This routine is the body of the background writer thread.  It takes
+    everything queued so far as one batch and writes it, until stopped with
+    an empty queue.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode, writer thread.
+
+--*/
+{
+    NscTrace::SetThreadName( "Output writer" );
+
+    for (;;) {
+        OutputFileVec Batch;
+
+        {
+            std::unique_lock< std::mutex > Lock( m_Lock );
+
+            while ((!m_Stopping) && (m_Queue.empty( )))
+                m_Wakeup.wait( Lock );
+
+            if (m_Queue.empty( ))
+                break;
+
+            Batch.swap( m_Queue );
+            m_InProgress = Batch.size( );
+        }
+
+        m_Idle.notify_all( );
+
+        WriteBatch( Batch );
+
+        {
+            std::lock_guard< std::mutex > Lock( m_Lock );
+
+            m_InProgress = 0;
+        }
+
+        m_Idle.notify_all( );
+    }
+}
+
+void
+OutputWriter::WriteBatch(
+    OutputFileVec & Files
+    )
+/*++
+
+Routine Description:
+
+    This routine writes a batch of output files.  Files whose current on-disk
+    contents already match are skipped; the rest are written to temporary
+    files and renamed over their targets.  Failures are recorded for
+    ReportFailures.
+
+Arguments:
+
+    Files - Supplies the output files to write.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< BatchFileIo::ReadRequest > Reads;
+    std::vector< BatchFileIo::WriteRequest > Writes;
+    std::vector< size_t > ReadIndex;
+    std::vector< size_t > WriteIndex;
+    std::vector< bool > Unchanged;
+    std::vector< std::string > Failures;
+    std::chrono::steady_clock::time_point Start = std::chrono::steady_clock::now( );
+    NscTraceScope Trace( "Write output", "output" );
+
+    try {
+        Unchanged.resize( Files.size( ), false );
+
+        //
+        // Only an existing file of exactly the same size can be unchanged, so
+        // only those are read back for comparison.
+        //
+
+        for (size_t i = 0; i < Files.size( ); i += 1) {
+#if defined(_WINDOWS)
+            struct _stat StatBuf;
+
+            if (_stat( Files[ i ].FileName.c_str( ), &StatBuf ) != 0)
+                continue;
+#else
+            struct stat StatBuf;
+
+            if (stat( Files[ i ].FileName.c_str( ), &StatBuf ) != 0)
+                continue;
+#endif
+
+            if ((size_t) StatBuf.st_size != Files[ i ].Contents.size( ))
+                continue;
+
+            if (StatBuf.st_size == 0) {
+                Unchanged[ i ] = true;
+                continue;
+            }
+
+            Reads.push_back( BatchFileIo::ReadRequest( ) );
+            Reads.back( ).FileName = Files[ i ].FileName;
+            ReadIndex.push_back( i );
+        }
+
+        if (!Reads.empty( ))
+            m_FileIo.ReadFiles( &Reads[ 0 ], Reads.size( ) );
+
+        for (size_t i = 0; i < Reads.size( ); i += 1) {
+            if ((Reads[ i ].Status == BatchFileIo::StatusSuccess) &&
+                (Reads[ i ].Contents == Files[ ReadIndex[ i ] ].Contents)) {
+                Unchanged[ ReadIndex[ i ] ] = true;
+            }
+        }
+
+        Reads.clear( );
+
+        //
+        // Write the changed files to their temporary names.
+        //
+
+        for (size_t i = 0; i < Files.size( ); i += 1) {
+            if (Unchanged[ i ]) {
+                m_Unchanged += 1;
+                continue;
+            }
+
+            Writes.push_back( BatchFileIo::WriteRequest( ) );
+            Writes.back( ).FileName = Files[ i ].FileName + m_TempSuffix;
+            Writes.back( ).Data     = (!Files[ i ].Contents.empty( )) ? &Files[ i ].Contents[ 0 ] : nullptr;
+            Writes.back( ).Length   = Files[ i ].Contents.size( );
+            WriteIndex.push_back( i );
+        }
+
+        if (!Writes.empty( ))
+            m_FileIo.WriteFiles( &Writes[ 0 ], Writes.size( ) );
+
+        //
+        // Move each temporary file into place.
+        //
+
+        for (size_t i = 0; i < Writes.size( ); i += 1) {
+            const OutputFile & File = Files[ WriteIndex[ i ] ];
+            const char * Format;
+            char Message[ 1024 ];
+
+            if ((Writes[ i ].Status == BatchFileIo::StatusSuccess) &&
+                (ReplaceOutputFile( Writes[ i ].FileName, File.FileName ))) {
+                m_Written += 1;
+                continue;
+            }
+
+            if (Writes[ i ].Status != BatchFileIo::StatusOpenFailed)
+                remove( Writes[ i ].FileName.c_str( ) );
+
+            Format = (Writes[ i ].Status == BatchFileIo::StatusOpenFailed) ? File.OpenError : File.WriteError;
+
+            snprintf( Message, sizeof( Message ), Format, File.FileName.c_str( ) );
+            Failures.push_back( Message );
+        }
+    }
+    catch (std::exception &e) {
+        Failures.push_back( std::string( "Error: Failed to write output files: " ) + e.what( ) + ".\n" );
+    }
+
+    m_WriteTime += (unsigned long long) std::chrono::duration_cast< std::chrono::nanoseconds >(
+        std::chrono::steady_clock::now( ) - Start ).count( );
+
+    if (!Failures.empty( )) {
+        std::lock_guard< std::mutex > Lock( m_Lock );
+
+        m_Failures.insert( m_Failures.end( ), Failures.begin( ), Failures.end( ) );
+    }
+}
+
+bool
+OutputWriter::ReplaceOutputFile(
+    const std::string & TempFileName,
+    const std::string & FileName
+    )
+/*++
+
+Routine Description:
+
+    This routine atomically replaces an output file with a temporary file.
+
+Arguments:
+
+    TempFileName - Supplies the temporary file holding the new contents.
+
+    FileName - Supplies the output file to replace.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else false
+    on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+#if defined(_WINDOWS)
+    return MoveFileExA(
+        TempFileName.c_str( ),
+        FileName.c_str( ),
+        MOVEFILE_REPLACE_EXISTING) != FALSE;
+#else
+    return rename( TempFileName.c_str( ), FileName.c_str( ) ) == 0;
+#endif
+}
@@ -0,0 +1,176 @@
+/*++
+
+Module Name:
+
+    OutputWriter.h
+
+Abstract:
+
+    This module defines the output writer, which writes compiler output files
+    on a background thread.  Outputs whose contents are unchanged on disk are
+    left alone (preserving their timestamps), and changed outputs are replaced
+    atomically via a temporary file and a rename.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_OUTPUTWRITER_H
+#define _PROGRAMS_NWNSC_OUTPUTWRITER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <thread>
+#include <condition_variable>
+
+class BatchFileIo;
+struct IDebugTextOut;
+
+class OutputWriter
+{
+
+public:
+
+    //
+    // Describes one output file.  The error formats take the file name as
+    // their only argument and are reported if the file could not be created
+    // or written, respectively.
+    //
+
+    struct OutputFile
+    {
+        std::string                  FileName;
+        std::vector< unsigned char > Contents;
+        const char                 * OpenError;
+        const char                 * WriteError;
+    };
+
+    typedef std::vector< OutputFile > OutputFileVec;
+
+    OutputWriter(
+        BatchFileIo & FileIo,
+        size_t MaxPendingFiles
+        );
+
+    ~OutputWriter(
+        );
+
+    //
+    // Start the background thread.
+    //
+
+    void
+    Start(
+        );
+
+    //
+    // Queue a set of output files for writing.  The file contents are taken
+    // over (the vector is left empty).  Blocks while the queue is full.
+    //
+
+    void
+    Submit(
+        OutputFileVec & Files
+        );
+
+    //
+    // Wait for all queued files to be written.
+    //
+
+    void
+    Flush(
+        );
+
+    //
+    // Print the errors of any failed writes since the last call and return
+    // how many there were.
+    //
+
+    size_t
+    ReportFailures(
+        IDebugTextOut * TextOut
+        );
+
+    //
+    // Flush remaining work and stop the background thread.
+    //
+
+    void
+    Stop(
+        );
+
+    inline
+    size_t
+    GetWrittenCount(
+        ) const
+    {
+        return m_Written;
+    }
+
+    inline
+    size_t
+    GetUnchangedCount(
+        ) const
+    {
+        return m_Unchanged;
+    }
+
+    //
+    // Return the time, in nanoseconds, spent writing output files (on the
+    // writer thread, or on the caller's thread if it was not started).
+    //
+
+    inline
+    unsigned long long
+    GetWriteTime(
+        ) const
+    {
+        return m_WriteTime;
+    }
+
+private:
+
+    void
+    WriterThread(
+        );
+
+    void
+    WriteBatch(
+        OutputFileVec & Files
+        );
+
+    static
+    bool
+    ReplaceOutputFile(
+        const std::string & TempFileName,
+        const std::string & FileName
+        );
+
+    BatchFileIo                        & m_FileIo;
+    size_t                               m_MaxPendingFiles;
+    std::string                          m_TempSuffix;
+
+    //
+    // Queued files and failure messages.  All are protected by m_Lock.
+    //
+
+    OutputFileVec                        m_Queue;
+    size_t                               m_InProgress;
+    std::vector< std::string >           m_Failures;
+    bool                                 m_Stopping;
+    std::mutex                           m_Lock;
+    std::condition_variable              m_Wakeup;
+    std::condition_variable              m_Idle;
+
+    std::atomic< size_t >                m_Written;
+    std::atomic< size_t >                m_Unchanged;
+    std::atomic< unsigned long long >    m_WriteTime;
+    std::thread                          m_Thread;
+
+};
+
+#endif
@@ -0,0 +1,1249 @@
+/*++
+
+Module Name:
+
+    ScriptDiff.cpp
+
+Abstract:
+
+    This module houses the script differ.  See ScriptDiff.h for an overview.
+
+    Functions are only split at the routine records of the debug symbols if
+    both scripts have them, so that the function names agree.  Otherwise the
+    script is split at the JSR targets, and the functions are named in the
+    order that the calls reach them from the start of the script rather than
+    by address, which keeps the names stable when functions move.
+
+    The report of a script lists only the functions that differ, with the
+    instruction counts of both sides and the first instruction that differs.
+    Identical scripts are only counted in the summary.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <string>
+#include <vector>
+#include <map>
+#include <algorithm>
+#include <iterator>
+#include <thread>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NwnDataLib/BatchFileIo.h"
+#include "../_NwnDataLib/NWScriptReader.h"
+#include "../_NwnUtilLib/findfirst.h"
+#include "../_NscLib/Nsc.h"
+#include "ScriptDiff.h"
+
+//
+// Define the longest string constant quoted in full by a report.
+//
+
+#define SCRIPTDIFF_MAX_STRING_TEXT 32
+
+
+static
+ULONG
+ReadUInt32(
+    const unsigned char * Data
+    )
+/*++
+
+Routine Description:
+
+    This routine reads a big endian 32-bit operand.
+
+Arguments:
+
+    Data - Supplies the operand bytes.
+
+Return Value:
+
+    The operand value.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    return ((ULONG) Data[0] << 24) |
+           ((ULONG) Data[1] << 16) |
+           ((ULONG) Data[2] << 8) |
+           ((ULONG) Data[3]);
+}
+
+static
+USHORT
+ReadUInt16(
+    const unsigned char * Data
+    )
+/*++
+
+Routine Description:
+
+    This routine reads a big endian 16-bit operand.
+
+Arguments:
+
+    Data - Supplies the operand bytes.
+
+Return Value:
+
+    The operand value.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    return (USHORT) (((USHORT) Data[0] << 8) | (USHORT) Data[1]);
+}
+
+ScriptDiff::ScriptDiff(
+    IDebugTextOut * TextOut,
+    BatchFileIo & FileIo,
+    size_t ThreadCount
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new ScriptDiff.
+
+Arguments:
+
+    TextOut - Supplies the text output that reports are written to.
+
+    FileIo - Supplies the batch file I/O object used to read the scripts.
+
+    ThreadCount - Supplies the number of worker threads to compare scripts
+                  with, else zero to use one per processor.
+
+Return Value:
+
+    None.  Raises an std::exception on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_TextOut(TextOut),
+  m_FileIo(FileIo),
+  m_ThreadCount(ThreadCount),
+  m_NextScript(0)
+{
+    if (m_ThreadCount == 0)
+        m_ThreadCount = std::thread::hardware_concurrency();
+
+    if (m_ThreadCount == 0)
+        m_ThreadCount = 1;
+}
+
+ScriptDiff::~ScriptDiff(
+    )
+/*++
+
+Routine Description:
+
+    This routine cleans up an already-existing ScriptDiff.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+}
+
+bool
+ScriptDiff::DiffDirectories(
+    const std::string & DirA,
+    const std::string & DirB
+    )
+/*++
+
+Routine Description:
+
+    This routine compares the compiled scripts of two directories.  A report
+    is written for each script that differs, followed by a summary.
+
+Arguments:
+
+    DirA - Supplies the first (old) directory.
+
+    DirB - Supplies the second (new) directory.
+
+Return Value:
+
+    The routine returns true if every script is identical or equivalent.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< std::string > NamesA;
+    std::vector< std::string > NamesB;
+    std::vector< std::thread > Workers;
+    ULONG StatusCounts[LastScriptStatus];
+    LONG InstructionDelta;
+
+    m_DirA = DirA;
+    m_DirB = DirB;
+
+#if defined(_WINDOWS)
+    if ((!m_DirA.empty()) && (m_DirA.back() != '\\'))
+        m_DirA.push_back('\\');
+    if ((!m_DirB.empty()) && (m_DirB.back() != '\\'))
+        m_DirB.push_back('\\');
+#else
+    if ((!m_DirA.empty()) && (m_DirA.back() != '/'))
+        m_DirA.push_back('/');
+    if ((!m_DirB.empty()) && (m_DirB.back() != '/'))
+        m_DirB.push_back('/');
+#endif
+
+    //
+    // Pair the scripts of both directories by name.
+    //
+
+    EnumerateScripts(m_DirA, NamesA);
+    EnumerateScripts(m_DirB, NamesB);
+
+    if ((NamesA.empty()) && (NamesB.empty())) {
+        m_TextOut->WriteText(
+                "Error: No compiled scripts in %s or %s.\n",
+                DirA.c_str(),
+                DirB.c_str());
+
+        return false;
+    }
+
+    m_Names.clear();
+
+    std::set_union(
+            NamesA.begin(),
+            NamesA.end(),
+            NamesB.begin(),
+            NamesB.end(),
+            std::back_inserter(m_Names));
+
+    m_Results.clear();
+    m_Results.resize(m_Names.size());
+
+    for (size_t i = 0; i < m_Results.size(); i += 1)
+        m_Results[i].Ready = false;
+
+    m_NextScript = 0;
+
+    //
+    // Start the workers, then write the reports in order as they come in.
+    //
+
+    for (size_t i = 0; i < std::min(m_ThreadCount, m_Names.size()); i += 1)
+        Workers.emplace_back(&ScriptDiff::WorkerThread, this);
+
+    memset(StatusCounts, 0, sizeof(StatusCounts));
+    InstructionDelta = 0;
+
+    for (size_t i = 0; i < m_Results.size(); i += 1) {
+        Result & ScriptResult = m_Results[i];
+
+        {
+            std::unique_lock< std::mutex > Lock(m_Lock);
+
+            m_ResultReady.wait(Lock, [&ScriptResult] { return ScriptResult.Ready; });
+        }
+
+        for (std::vector< std::string >::const_iterator it = ScriptResult.Lines.begin();
+             it != ScriptResult.Lines.end();
+             ++it) {
+            m_TextOut->WriteText("%s", it->c_str());
+        }
+
+        StatusCounts[ScriptResult.Status] += 1;
+        InstructionDelta += ScriptResult.InstructionDelta;
+
+        std::vector< std::string >().swap(ScriptResult.Lines);
+    }
+
+    for (std::vector< std::thread >::iterator it = Workers.begin();
+         it != Workers.end();
+         ++it) {
+        it->join();
+    }
+
+    m_TextOut->WriteText(
+            "%lu script(s): %lu identical, %lu equivalent, %lu changed, %lu only in %s, %lu only in %s, %lu unreadable; %+ld instruction(s)",
+            (unsigned long) m_Names.size(),
+            (unsigned long) StatusCounts[ScriptIdentical],
+            (unsigned long) StatusCounts[ScriptEquivalent],
+            (unsigned long) StatusCounts[ScriptChanged],
+            (unsigned long) StatusCounts[ScriptOnlyInA],
+            DirA.c_str(),
+            (unsigned long) StatusCounts[ScriptOnlyInB],
+            DirB.c_str(),
+            (unsigned long) StatusCounts[ScriptUnreadable],
+            (long) InstructionDelta);
+
+    return (StatusCounts[ScriptChanged] == 0) &&
+           (StatusCounts[ScriptOnlyInA] == 0) &&
+           (StatusCounts[ScriptOnlyInB] == 0) &&
+           (StatusCounts[ScriptUnreadable] == 0);
+}
+
+void
+ScriptDiff::WorkerThread(
+    )
+/*++
+
+Routine Description:
+
+    This routine compares scripts until none are left.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode, worker thread.
+
+--*/
+{
+    for (;;) {
+        size_t ScriptIndex = m_NextScript++;
+
+        if (ScriptIndex >= m_Names.size())
+            break;
+
+        Result ScriptResult;
+
+        ScriptResult.Status = ScriptUnreadable;
+        ScriptResult.InstructionDelta = 0;
+        ScriptResult.Ready = false;
+
+        CompareScript(m_Names[ScriptIndex], ScriptResult);
+
+        {
+            std::lock_guard< std::mutex > Lock(m_Lock);
+
+            m_Results[ScriptIndex].Status = ScriptResult.Status;
+            m_Results[ScriptIndex].InstructionDelta = ScriptResult.InstructionDelta;
+            m_Results[ScriptIndex].Lines.swap(ScriptResult.Lines);
+            m_Results[ScriptIndex].Ready = true;
+        }
+
+        m_ResultReady.notify_all();
+    }
+}
+
+void
+ScriptDiff::CompareScript(
+    const std::string & Name,
+    Result & Result
+    )
+/*++
+
+Routine Description:
+
+    This routine compares the two builds of a script.
+
+Arguments:
+
+    Name - Supplies the name of the script, without the .ncs extension.
+
+    Result - Receives the outcome and the report lines.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Script A;
+    Script B;
+    std::vector< std::string > FunctionLines;
+    std::map< std::string, ULONG > FunctionsB;
+    std::vector< bool > MatchedB;
+    std::string TextA;
+    std::string TextB;
+    ULONG ChangedFunctions;
+    bool UseSymbols;
+
+    if ((!LoadScript(m_DirA + Name, A)) || (!LoadScript(m_DirB + Name, B))) {
+        Result.Status = ScriptUnreadable;
+        AddLine(Result.Lines, "%s: unreadable", Name.c_str());
+        return;
+    }
+
+    if ((A.Present) && (B.Present) && (A.Code == B.Code)) {
+        Result.Status = ScriptIdentical;
+        return;
+    }
+
+    if ((A.Present) && (!Decode(A))) {
+        Result.Status = ScriptUnreadable;
+        AddLine(Result.Lines, "%s: unable to decode %s%s.ncs", Name.c_str(), m_DirA.c_str(), Name.c_str());
+        return;
+    }
+
+    if ((B.Present) && (!Decode(B))) {
+        Result.Status = ScriptUnreadable;
+        AddLine(Result.Lines, "%s: unable to decode %s%s.ncs", Name.c_str(), m_DirB.c_str(), Name.c_str());
+        return;
+    }
+
+    Result.InstructionDelta = (LONG) B.Instructions.size() - (LONG) A.Instructions.size();
+
+    if (!B.Present) {
+        Result.Status = ScriptOnlyInA;
+        AddLine(Result.Lines, "%s: only in %s, %lu instruction(s)", Name.c_str(), m_DirA.c_str(), (unsigned long) A.Instructions.size());
+        return;
+    }
+
+    if (!A.Present) {
+        Result.Status = ScriptOnlyInB;
+        AddLine(Result.Lines, "%s: only in %s, %lu instruction(s)", Name.c_str(), m_DirB.c_str(), (unsigned long) B.Instructions.size());
+        return;
+    }
+
+    //
+    // Split both scripts the same way, then compare the functions by name.
+    //
+
+    UseSymbols = (!A.Symbols.empty()) && (!B.Symbols.empty());
+
+    SplitFunctions(A, UseSymbols);
+    SplitFunctions(B, UseSymbols);
+
+    Normalize(A);
+    Normalize(B);
+
+    for (ULONG i = 0; i < (ULONG) B.Functions.size(); i += 1)
+        FunctionsB[B.Functions[i].Name] = i;
+
+    MatchedB.resize(B.Functions.size(), false);
+    ChangedFunctions = 0;
+
+    for (ULONG i = 0; i < (ULONG) A.Functions.size(); i += 1) {
+        const Function & FunctionA = A.Functions[i];
+        std::map< std::string, ULONG >::const_iterator it = FunctionsB.find(FunctionA.Name);
+
+        if (it == FunctionsB.end()) {
+            AddLine(
+                    FunctionLines,
+                    "    %-32s removed %6lu -> %6lu (%+ld)",
+                    FunctionA.Name.c_str(),
+                    (unsigned long) FunctionA.InstructionCount,
+                    0UL,
+                    -(long) FunctionA.InstructionCount);
+
+            ChangedFunctions += 1;
+            continue;
+        }
+
+        const Function & FunctionB = B.Functions[it->second];
+        ULONG Common = std::min(FunctionA.InstructionCount, FunctionB.InstructionCount);
+        ULONG First;
+
+        MatchedB[it->second] = true;
+
+        for (First = 0; First < Common; First += 1) {
+            if (A.Instructions[FunctionA.FirstInstruction + First].Key !=
+                B.Instructions[FunctionB.FirstInstruction + First].Key)
+                break;
+        }
+
+        if ((First == Common) && (FunctionA.InstructionCount == FunctionB.InstructionCount))
+            continue;
+
+        if (First < FunctionA.InstructionCount)
+            FormatInstruction(A, FunctionA.FirstInstruction + First, TextA);
+        else
+            TextA = "(end)";
+
+        if (First < FunctionB.InstructionCount)
+            FormatInstruction(B, FunctionB.FirstInstruction + First, TextB);
+        else
+            TextB = "(end)";
+
+        AddLine(
+                FunctionLines,
+                "    %-32s changed %6lu -> %6lu (%+ld), first difference at @%lu: %s | %s",
+                FunctionA.Name.c_str(),
+                (unsigned long) FunctionA.InstructionCount,
+                (unsigned long) FunctionB.InstructionCount,
+                (long) FunctionB.InstructionCount - (long) FunctionA.InstructionCount,
+                (unsigned long) First,
+                TextA.c_str(),
+                TextB.c_str());
+
+        ChangedFunctions += 1;
+    }
+
+    for (ULONG i = 0; i < (ULONG) B.Functions.size(); i += 1) {
+        if (MatchedB[i])
+            continue;
+
+        AddLine(
+                FunctionLines,
+                "    %-32s added   %6lu -> %6lu (%+ld)",
+                B.Functions[i].Name.c_str(),
+                0UL,
+                (unsigned long) B.Functions[i].InstructionCount,
+                (long) B.Functions[i].InstructionCount);
+
+        ChangedFunctions += 1;
+    }
+
+    if (ChangedFunctions == 0) {
+        Result.Status = ScriptEquivalent;
+        AddLine(
+                Result.Lines,
+                "%s: equivalent, %lu -> %lu instruction(s) (only the layout differs)",
+                Name.c_str(),
+                (unsigned long) A.Instructions.size(),
+                (unsigned long) B.Instructions.size());
+        return;
+    }
+
+    Result.Status = ScriptChanged;
+    AddLine(
+            Result.Lines,
+            "%s: changed, %lu of %lu function(s) differ, %lu -> %lu instruction(s) (%+ld)",
+            Name.c_str(),
+            (unsigned long) ChangedFunctions,
+            (unsigned long) (A.Functions.size() + std::count(MatchedB.begin(), MatchedB.end(), false)),
+            (unsigned long) A.Instructions.size(),
+            (unsigned long) B.Instructions.size(),
+            (long) Result.InstructionDelta);
+
+    Result.Lines.insert(Result.Lines.end(), FunctionLines.begin(), FunctionLines.end());
+}
+
+bool
+ScriptDiff::LoadScript(
+    const std::string & FileName,
+    Script & Script
+    )
+/*++
+
+Routine Description:
+
+    This routine reads a compiled script and its debug symbols, if any.
+
+Arguments:
+
+    FileName - Supplies the file name of the script, without an extension.
+
+    Script - Receives the script.  Present is false if there is no such
+             script.
+
+Return Value:
+
+    The routine returns false if the script exists but could not be read.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    BatchFileIo::ReadRequest Requests[2];
+
+    Requests[0].FileName = FileName + ".ncs";
+    Requests[1].FileName = FileName + ".ndb";
+
+    m_FileIo.ReadFiles(Requests, 2);
+
+    Script.Present = (Requests[0].Status == BatchFileIo::StatusSuccess);
+
+    if (Requests[0].Status == BatchFileIo::StatusTransferFailed)
+        return false;
+
+    Script.Code.swap(Requests[0].Contents);
+
+    if (Requests[1].Status == BatchFileIo::StatusSuccess)
+        Script.Symbols.swap(Requests[1].Contents);
+
+    return true;
+}
+
+bool
+ScriptDiff::Decode(
+    Script & Script
+    )
+/*++
+
+Routine Description:
+
+    This routine decodes the instruction stream of a script.
+
+Arguments:
+
+    Script - Supplies the script.  Its instructions are decoded.
+
+Return Value:
+
+    The routine returns false if the script is not a well-formed compiled
+    script.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    size_t Offset;
+
+    if ((Script.Code.size() < NWScriptReader::NCSHeaderSize) ||
+        (memcmp(&Script.Code[0], "NCS V1.0", 8) != 0))
+        return false;
+
+    Offset = NWScriptReader::NCSHeaderSize;
+
+    while (Offset < Script.Code.size()) {
+        Instruction Decoded;
+        size_t Length;
+
+        Length = NWScriptReader::GetInstructionLength(
+                &Script.Code[Offset],
+                Script.Code.size() - Offset);
+
+        if (Length == 0)
+            return false;
+
+        Decoded.Offset = (ULONG) Offset;
+        Decoded.Length = (ULONG) Length;
+        Decoded.Function = 0;
+
+        Script.Instructions.push_back(Decoded);
+
+        Offset += Length;
+    }
+
+    return true;
+}
+
+void
+ScriptDiff::SplitFunctions(
+    Script & Script,
+    bool UseSymbols
+    )
+/*++
+
+Routine Description:
+
+    This routine splits a decoded script into functions.
+
+    With debug symbols, every routine record that was compiled starts a
+    function.  Records that lie within an earlier routine (inlined calls at
+    -O2) are skipped.  Without debug symbols, every JSR target starts a
+    function.  The start of the script always starts a function.
+
+Arguments:
+
+    Script - Supplies the script.  Its functions are built and the function of
+             each instruction is set.
+
+    UseSymbols - Supplies a Boolean value indicating true if the routine
+                 records of the debug symbols are to be used.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    struct Routine
+    {
+        ULONG       Start;
+        ULONG       End;
+        std::string Name;
+    };
+
+    std::vector< Routine > Routines;
+    std::vector< ULONG > Starts;
+    std::map< std::string, ULONG > NameUses;
+
+    if (UseSymbols) {
+        const char * Text = (const char *) &Script.Symbols[0];
+        const char * TextEnd = Text + Script.Symbols.size();
+
+        while (Text < TextEnd) {
+            const char * LineEnd = (const char *) memchr(Text, '\n', TextEnd - Text);
+            char Line[600];
+            char Name[260];
+            unsigned int Start;
+            unsigned int End;
+            size_t Length;
+
+            if (LineEnd == nullptr)
+                LineEnd = TextEnd;
+
+            Length = std::min((size_t) (LineEnd - Text), sizeof(Line) - 1);
+            memcpy(Line, Text, Length);
+            Line[Length] = '\0';
+            Text = LineEnd + 1;
+
+            //
+            // Routine records are "f start end argc rettype name".
+            //
+
+            if ((Line[0] != 'f') || (Line[1] != ' '))
+                continue;
+
+            if (sscanf(Line, "f %x %x %*x %*s %259s", &Start, &End, Name) != 3)
+                continue;
+
+            if (Start == 0xFFFFFFFF)
+                continue;
+
+            Routines.resize(Routines.size() + 1);
+            Routines.back().Start = Start;
+            Routines.back().End = End;
+            Routines.back().Name = Name;
+        }
+
+        std::stable_sort(
+                Routines.begin(),
+                Routines.end(),
+                [](const Routine &R1, const Routine &R2) {
+                    if (R1.Start != R2.Start)
+                        return R1.Start < R2.Start;
+
+                    return R1.End > R2.End;
+                });
+
+        ULONG CoveredEnd = 0;
+        std::vector< Routine > Outer;
+
+        for (std::vector< Routine >::const_iterator it = Routines.begin();
+             it != Routines.end();
+             ++it) {
+            if (it->Start < CoveredEnd)
+                continue;
+
+            Outer.push_back(*it);
+            CoveredEnd = it->End;
+        }
+
+        Routines.swap(Outer);
+    } else {
+        for (size_t i = 0; i < Script.Instructions.size(); i += 1) {
+            const Instruction & Decoded = Script.Instructions[i];
+
+            if (Script.Code[Decoded.Offset] != NscCode_JSR)
+                continue;
+
+            Starts.push_back(Decoded.Offset + ReadUInt32(&Script.Code[Decoded.Offset + 2]));
+        }
+
+        std::sort(Starts.begin(), Starts.end());
+        Starts.erase(std::unique(Starts.begin(), Starts.end()), Starts.end());
+
+        for (size_t i = 0; i < Starts.size(); i += 1) {
+            Routines.resize(Routines.size() + 1);
+            Routines.back().Start = Starts[i];
+            Routines.back().End = Starts[i];
+        }
+    }
+
+    //
+    // Drop routines that do not start within the instruction stream, and
+    // make sure that the first instruction belongs to a function.
+    //
+
+    std::vector< Routine > Valid;
+
+    if ((Routines.empty()) || (Routines[0].Start != NWScriptReader::NCSHeaderSize)) {
+        Valid.resize(1);
+        Valid[0].Start = NWScriptReader::NCSHeaderSize;
+        Valid[0].End = NWScriptReader::NCSHeaderSize;
+        Valid[0].Name = (UseSymbols) ? "#start" : "#loader";
+    }
+
+    for (std::vector< Routine >::const_iterator it = Routines.begin();
+         it != Routines.end();
+         ++it) {
+        if ((it->Start < NWScriptReader::NCSHeaderSize) || (it->Start >= Script.Code.size()))
+            continue;
+
+        if ((!Valid.empty()) && (Valid.back().Start == it->Start))
+            continue;
+
+        Valid.push_back(*it);
+    }
+
+    //
+    // Build the functions, each running up to the start of the next.
+    //
+
+    Script.Functions.clear();
+
+    for (size_t i = 0; i < Valid.size(); i += 1) {
+        Instruction Probe;
+        std::vector< Instruction >::const_iterator First;
+        std::vector< Instruction >::const_iterator Last;
+
+        Probe.Offset = Valid[i].Start;
+        First = std::lower_bound(
+                Script.Instructions.begin(),
+                Script.Instructions.end(),
+                Probe,
+                [](const Instruction &I1, const Instruction &I2) {
+                    return I1.Offset < I2.Offset;
+                });
+
+        Probe.Offset = (i + 1 < Valid.size()) ? Valid[i + 1].Start : (ULONG) Script.Code.size();
+        Last = std::lower_bound(
+                First,
+                Script.Instructions.cend(),
+                Probe,
+                [](const Instruction &I1, const Instruction &I2) {
+                    return I1.Offset < I2.Offset;
+                });
+
+        if (First == Last)
+            continue;
+
+        Script.Functions.resize(Script.Functions.size() + 1);
+
+        Function & Split = Script.Functions.back();
+
+        Split.Name = Valid[i].Name;
+        Split.Offset = Valid[i].Start;
+        Split.FirstInstruction = (ULONG) (First - Script.Instructions.cbegin());
+        Split.InstructionCount = (ULONG) (Last - First);
+
+        for (ULONG j = 0; j < Split.InstructionCount; j += 1)
+            Script.Instructions[Split.FirstInstruction + j].Function = (ULONG) Script.Functions.size() - 1;
+    }
+
+    //
+    // Without debug symbols, name the functions in the order that calls reach
+    // them from the start of the script, then name any that are not reached
+    // in address order.
+    //
+
+    if (!UseSymbols) {
+        std::vector< ULONG > Queue;
+        ULONG NextName = 1;
+
+        Queue.push_back(0);
+
+        for (size_t i = 0; i < Queue.size(); i += 1) {
+            const Function & Caller = Script.Functions[Queue[i]];
+
+            for (ULONG j = 0; j < Caller.InstructionCount; j += 1) {
+                const Instruction & Decoded = Script.Instructions[Caller.FirstInstruction + j];
+                ULONG Target;
+
+                if (Script.Code[Decoded.Offset] != NscCode_JSR)
+                    continue;
+
+                Target = Decoded.Offset + ReadUInt32(&Script.Code[Decoded.Offset + 2]);
+
+                for (size_t k = 0; k < Script.Functions.size(); k += 1) {
+                    if ((Script.Functions[k].Offset != Target) || (!Script.Functions[k].Name.empty()))
+                        continue;
+
+                    Script.Functions[k].Name = "sub_" + std::to_string(NextName++);
+                    Queue.push_back((ULONG) k);
+                }
+            }
+        }
+
+        for (size_t i = 0; i < Script.Functions.size(); i += 1) {
+            if (Script.Functions[i].Name.empty())
+                Script.Functions[i].Name = "sub_" + std::to_string(NextName++);
+        }
+    }
+
+    //
+    // Function names must be unique to pair functions.
+    //
+
+    for (size_t i = 0; i < Script.Functions.size(); i += 1) {
+        ULONG Uses = ++NameUses[Script.Functions[i].Name];
+
+        if (Uses > 1)
+            Script.Functions[i].Name += "~" + std::to_string(Uses);
+    }
+}
+
+void
+ScriptDiff::Normalize(
+    Script & Script
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the comparison keys of the instructions of a script.
+    Instructions compare by their bytes, except that branch targets compare
+    by function and instruction index.
+
+Arguments:
+
+    Script - Supplies the split script.  Its instruction keys are set.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Target;
+
+    for (size_t i = 0; i < Script.Instructions.size(); i += 1) {
+        Instruction & Decoded = Script.Instructions[i];
+        const unsigned char * Code = &Script.Code[Decoded.Offset];
+        const NWScriptReader::InstructionDescriptor & Descriptor =
+                NWScriptReader::GetInstructionDescriptor(Code[0]);
+
+        if (Descriptor.Layout != NWScriptReader::InstructionLayout_Branch) {
+            Decoded.Key.assign((const char *) Code, Decoded.Length);
+            continue;
+        }
+
+        FormatTarget(Script, Decoded.Offset + ReadUInt32(&Code[2]), Target);
+
+        Decoded.Key.assign((const char *) Code, 2);
+        Decoded.Key += Target;
+    }
+}
+
+void
+ScriptDiff::FormatInstruction(
+    const Script & Script,
+    ULONG InstructionIndex,
+    std::string & Text
+    )
+/*++
+
+Routine Description:
+
+    This routine formats an instruction for a report, with its branch target
+    normalized as it is compared.
+
+Arguments:
+
+    Script - Supplies the split script.
+
+    InstructionIndex - Supplies the index of the instruction.
+
+    Text - Receives the text of the instruction.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    const Instruction & Decoded = Script.Instructions[InstructionIndex];
+    const unsigned char * Code = &Script.Code[Decoded.Offset];
+    const NWScriptReader::InstructionDescriptor & Descriptor =
+            NWScriptReader::GetInstructionDescriptor(Code[0]);
+    const char * Suffix;
+    char Operands[128];
+    float Float;
+    ULONG FloatBits;
+
+    Text = Descriptor.Mnemonic;
+
+    if (Descriptor.TypeSuffix) {
+        Suffix = NWScriptReader::GetTypeOpcodeSuffix(Code[1]);
+
+        if (Suffix != nullptr) {
+            Text += Suffix;
+        } else {
+            snprintf(Operands, sizeof(Operands), "%02X", Code[1]);
+            Text += Operands;
+        }
+    }
+
+    Operands[0] = '\0';
+
+    switch (Descriptor.Layout) {
+
+        case NWScriptReader::InstructionLayout_Binary:
+            if (Decoded.Length > 2)
+                snprintf(Operands, sizeof(Operands), " %u", ReadUInt16(&Code[2]));
+            break;
+
+        case NWScriptReader::InstructionLayout_StackCopy:
+            snprintf(Operands, sizeof(Operands), " %ld, %u", (long) (LONG) ReadUInt32(&Code[2]), ReadUInt16(&Code[6]));
+            break;
+
+        case NWScriptReader::InstructionLayout_Constant:
+            switch (Code[1]) {
+
+                case 3:
+                    snprintf(Operands, sizeof(Operands), " %ld", (long) (LONG) ReadUInt32(&Code[2]));
+                    break;
+
+                case 4:
+                    FloatBits = ReadUInt32(&Code[2]);
+                    memcpy(&Float, &FloatBits, sizeof(Float));
+                    snprintf(Operands, sizeof(Operands), " %g", (double) Float);
+                    break;
+
+                case 5: {
+                    USHORT Length = ReadUInt16(&Code[2]);
+                    bool Truncated = (Length > SCRIPTDIFF_MAX_STRING_TEXT);
+
+                    snprintf(
+                            Operands,
+                            sizeof(Operands),
+                            " \"%.*s\"%s",
+                            (int) (Truncated ? SCRIPTDIFF_MAX_STRING_TEXT : Length),
+                            (const char *) &Code[4],
+                            Truncated ? "..." : "");
+                }
+                    break;
+
+                default:
+                    snprintf(Operands, sizeof(Operands), " %08lX", (unsigned long) ReadUInt32(&Code[2]));
+                    break;
+
+            }
+            break;
+
+        case NWScriptReader::InstructionLayout_Action:
+            snprintf(Operands, sizeof(Operands), " %u, %u", ReadUInt16(&Code[2]), Code[4]);
+            break;
+
+        case NWScriptReader::InstructionLayout_Int32:
+            snprintf(Operands, sizeof(Operands), " %ld", (long) (LONG) ReadUInt32(&Code[2]));
+            break;
+
+        case NWScriptReader::InstructionLayout_Branch: {
+            std::string Target;
+
+            FormatTarget(Script, Decoded.Offset + ReadUInt32(&Code[2]), Target);
+            Text += " ";
+            Text += Target;
+        }
+            break;
+
+        case NWScriptReader::InstructionLayout_Destruct:
+            snprintf(
+                    Operands,
+                    sizeof(Operands),
+                    " %u, %u, %u",
+                    ReadUInt16(&Code[2]),
+                    ReadUInt16(&Code[4]),
+                    ReadUInt16(&Code[6]));
+            break;
+
+        case NWScriptReader::InstructionLayout_StoreState:
+            snprintf(
+                    Operands,
+                    sizeof(Operands),
+                    " %lu, %lu",
+                    (unsigned long) ReadUInt32(&Code[2]),
+                    (unsigned long) ReadUInt32(&Code[6]));
+            break;
+
+        default:
+            break;
+
+    }
+
+    Text += Operands;
+}
+
+void
+ScriptDiff::FormatTarget(
+    const Script & Script,
+    ULONG TargetOffset,
+    std::string & Text
+    )
+/*++
+
+Routine Description:
+
+    This routine formats a branch target as a function name and the index of
+    the target instruction within the function ("main+@12"), or the name
+    alone for the start of a function.
+
+Arguments:
+
+    Script - Supplies the split script.
+
+    TargetOffset - Supplies the file offset of the branch target.
+
+    Text - Receives the text of the target.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Instruction Probe;
+    std::vector< Instruction >::const_iterator it;
+
+    Probe.Offset = TargetOffset;
+    it = std::lower_bound(
+            Script.Instructions.begin(),
+            Script.Instructions.end(),
+            Probe,
+            [](const Instruction &I1, const Instruction &I2) {
+                return I1.Offset < I2.Offset;
+            });
+
+    if ((it == Script.Instructions.end()) || (it->Offset != TargetOffset)) {
+        Text = "?";
+        return;
+    }
+
+    const Function & Target = Script.Functions[it->Function];
+    ULONG Index = (ULONG) (it - Script.Instructions.begin()) - Target.FirstInstruction;
+
+    Text = Target.Name;
+
+    if (Index != 0)
+        Text += "+@" + std::to_string(Index);
+}
+
+void
+ScriptDiff::AddLine(
+    std::vector< std::string > & Lines,
+    const char * Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a formatted line to a report.
+
+Arguments:
+
+    Lines - Supplies the report lines.  The line is appended.
+
+    Format - Supplies the printf-style format of the line.
+
+    ... - Supplies format inserts.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Line[1024];
+    va_list ap;
+
+    va_start(ap, Format);
+    vsnprintf(Line, sizeof(Line), Format, ap);
+    va_end(ap);
+
+    Lines.push_back(Line);
+}
+
+bool
+ScriptDiff::EnumerateScripts(
+    const std::string & Dir,
+    std::vector< std::string > & Names
+    )
+/*++
+
+Routine Description:
+
+    This routine lists the compiled scripts of a directory.
+
+Arguments:
+
+    Dir - Supplies the directory, with a trailing path separator.
+
+    Names - Receives the sorted script names, without the .ncs extension.
+
+Return Value:
+
+    The routine returns false if the directory has no compiled scripts.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    struct _finddata_t FindData;
+    intptr_t FindHandle;
+    std::string Pattern;
+
+    Names.clear();
+
+    Pattern = Dir + "*.ncs";
+    FindHandle = _findfirst(Pattern.c_str(), &FindData);
+
+    if (FindHandle == -1)
+        return false;
+
+    do {
+        size_t Length;
+
+        if (FindData.attrib & _A_SUBDIR)
+            continue;
+
+        Length = strlen(FindData.name);
+
+        if (Length <= 4)
+            continue;
+
+        Names.push_back(std::string(FindData.name, Length - 4));
+    } while (_findnext(FindHandle, &FindData) == 0);
+
+    _findclose(FindHandle);
+
+    std::sort(Names.begin(), Names.end());
+
+    return !Names.empty();
+}
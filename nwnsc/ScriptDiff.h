@@ -0,0 +1,217 @@
+/*++
+
+Module Name:
+
+    ScriptDiff.h
+
+Abstract:
+
+    This module defines the script differ, which compares two directories of
+    compiled scripts (--diff dirA dirB) by their instruction streams rather
+    than by their bytes.
+
+    Each script is decoded with the NWScriptReader instruction tables and
+    split into functions, using the routine records of the .ndb debug symbols
+    where both sides have them and the JSR targets otherwise.  Functions are
+    paired by name.  Branch displacements are replaced by the index of the
+    target instruction within its function and JSR operands by the name of
+    the callee, so code that merely moved compares equal.
+
+    Scripts are compared on a set of worker threads; the reports are written
+    in name order as soon as each one (and all those before it) is ready.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_SCRIPTDIFF_H
+#define _PROGRAMS_NWNSC_SCRIPTDIFF_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <condition_variable>
+
+class BatchFileIo;
+struct IDebugTextOut;
+
+class ScriptDiff
+{
+
+public:
+
+    //
+    // Define the outcomes of comparing one script.
+    //
+
+    typedef enum _SCRIPT_STATUS
+    {
+        ScriptIdentical,       // Same bytes
+        ScriptEquivalent,      // Same normalized instructions
+        ScriptChanged,
+        ScriptOnlyInA,
+        ScriptOnlyInB,
+        ScriptUnreadable,      // Could not be read or decoded
+
+        LastScriptStatus
+    } SCRIPT_STATUS, * PSCRIPT_STATUS;
+
+    ScriptDiff(
+        IDebugTextOut * TextOut,
+        BatchFileIo & FileIo,
+        size_t ThreadCount = 0
+        );
+
+    ~ScriptDiff(
+        );
+
+    //
+    // Compare the *.ncs files of two directories and report the differences.
+    // Returns true if every script is identical or equivalent.
+    //
+
+    bool
+    DiffDirectories(
+        const std::string & DirA,
+        const std::string & DirB
+        );
+
+private:
+
+    //
+    // Describes a decoded instruction.  The key is the instruction as
+    // compared: the raw bytes, except for branches, whose target is given
+    // relative to the functions of the script.
+    //
+
+    struct Instruction
+    {
+        ULONG                    Offset;
+        ULONG                    Length;
+        ULONG                    Function;
+        std::string              Key;
+    };
+
+    //
+    // Describes a function, a run of consecutive instructions.
+    //
+
+    struct Function
+    {
+        std::string              Name;
+        ULONG                    Offset;
+        ULONG                    FirstInstruction;
+        ULONG                    InstructionCount;
+    };
+
+    //
+    // Describes one side of a comparison.
+    //
+
+    struct Script
+    {
+        bool                         Present;
+        std::vector< unsigned char > Code;
+        std::vector< unsigned char > Symbols;
+        std::vector< Instruction >   Instructions;
+        std::vector< Function >      Functions;
+    };
+
+    //
+    // Describes the comparison of one script.  The report lines are written
+    // by the thread that owns the text output.
+    //
+
+    struct Result
+    {
+        SCRIPT_STATUS                Status;
+        LONG                         InstructionDelta;
+        std::vector< std::string >   Lines;
+        bool                         Ready;
+    };
+
+    void
+    WorkerThread(
+        );
+
+    void
+    CompareScript(
+        const std::string & Name,
+        Result & Result
+        );
+
+    bool
+    LoadScript(
+        const std::string & FileName,
+        Script & Script
+        );
+
+    bool
+    Decode(
+        Script & Script
+        );
+
+    void
+    SplitFunctions(
+        Script & Script,
+        bool UseSymbols
+        );
+
+    void
+    Normalize(
+        Script & Script
+        );
+
+    static
+    void
+    FormatInstruction(
+        const Script & Script,
+        ULONG InstructionIndex,
+        std::string & Text
+        );
+
+    static
+    void
+    FormatTarget(
+        const Script & Script,
+        ULONG TargetOffset,
+        std::string & Text
+        );
+
+    static
+    void
+    AddLine(
+        std::vector< std::string > & Lines,
+        const char * Format,
+        ...
+        );
+
+    static
+    bool
+    EnumerateScripts(
+        const std::string & Dir,
+        std::vector< std::string > & Names
+        );
+
+    IDebugTextOut                   * m_TextOut;
+    BatchFileIo                     & m_FileIo;
+    size_t                            m_ThreadCount;
+
+    //
+    // State of the directory comparison in progress.
+    //
+
+    std::string                       m_DirA;
+    std::string                       m_DirB;
+    std::vector< std::string >        m_Names;
+    std::vector< Result >             m_Results;
+    std::atomic< size_t >             m_NextScript;
+    std::mutex                        m_Lock;
+    std::condition_variable           m_ResultReady;
+
+};
+
+#endif
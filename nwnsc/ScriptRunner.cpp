@@ -0,0 +1,1502 @@
+/*++
+
+Module Name:
+
+    ScriptRunner.cpp
+
+Abstract:
+
+    This module houses the script runner.  See ScriptRunner.h for an overview.
+
+    The mock world is deliberately small and deterministic: Random uses a
+    fixed seed for each execution, local variables live in a map keyed by
+    object, type and name, and saved situations passed to DelayCommand,
+    AssignCommand and ActionDoCommand run, in order, once the script returns.
+    This keeps repeated runs (and runs of differently optimized builds of the
+    same script) comparable.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <cmath>
+#include <stdexcept>
+#include <vector>
+#include <list>
+#include <algorithm>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NscLib/Nsc.h"
+#include "ScriptRunner.h"
+
+//
+// Define the most instructions that one execution of a script may take before
+// it is assumed to be stuck in a loop.
+//
+
+#define SCRIPTRUNNER_INSTRUCTION_LIMIT 100000000
+
+//
+// Define the seed that Random starts from for each execution.
+//
+
+#define SCRIPTRUNNER_RANDOM_SEED 12345
+
+
+static
+NWScriptVM::VM_TYPE
+ConvertType(
+    NscType Type
+    )
+/*++
+
+Routine Description:
+
+    This routine converts a compiler type to a VM type.
+
+Arguments:
+
+    Type - Supplies the compiler type.
+
+Return Value:
+
+    The routine returns the VM type, else LastVMType if the type has no VM
+    equivalent.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    switch (Type) {
+
+        case NscType_Void:
+            return NWScriptVM::VMType_Void;
+
+        case NscType_Integer:
+            return NWScriptVM::VMType_Int;
+
+        case NscType_Float:
+            return NWScriptVM::VMType_Float;
+
+        case NscType_String:
+            return NWScriptVM::VMType_String;
+
+        case NscType_Object:
+            return NWScriptVM::VMType_Object;
+
+        case NscType_Vector:
+            return NWScriptVM::VMType_Vector;
+
+        case NscType_Action:
+            return NWScriptVM::VMType_Action;
+
+        default:
+            if ((Type >= NscType_Engine_0) &&
+                (Type - NscType_Engine_0 <= NWScriptVM::VMType_EngineStructureLast - NWScriptVM::VMType_EngineStructure0)) {
+                return (NWScriptVM::VM_TYPE) (NWScriptVM::VMType_EngineStructure0 + (Type - NscType_Engine_0));
+            }
+
+            return NWScriptVM::LastVMType;
+
+    }
+}
+
+//
+// Mocked actions.  The first argument of an action is on top of the stack.
+//
+
+static
+void
+MockPrintString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+
+    Runner.Print("%s", String.c_str());
+}
+
+static
+void
+MockPrintInteger(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    Runner.Print("%d", (int) VM.StackPopInt());
+}
+
+static
+void
+MockPrintFloat(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    float Value = VM.StackPopFloat();
+    int Width = (int) VM.StackPopInt();
+    int Decimals = (int) VM.StackPopInt();
+
+    Runner.Print("%*.*f", Width, Decimals, Value);
+}
+
+static
+void
+MockPrintObject(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    Runner.Print("%08x", (unsigned) VM.StackPopObject());
+}
+
+static
+void
+MockPrintVector(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    float Vector[3];
+
+    VM.StackPopVector(Vector);
+
+    Runner.Print(
+            "%s%f %f %f",
+            (VM.StackPopInt() != 0) ? "PRINTVECTOR:" : "",
+            Vector[0],
+            Vector[1],
+            Vector[2]);
+}
+
+static
+void
+MockIntToString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    char Text[16];
+
+    snprintf(Text, sizeof(Text), "%d", (int) VM.StackPopInt());
+
+    VM.StackPushString(Text);
+}
+
+static
+void
+MockFloatToString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    char Text[64];
+    float Value = VM.StackPopFloat();
+    int Width = (int) VM.StackPopInt();
+    int Decimals = (int) VM.StackPopInt();
+
+    snprintf(Text, sizeof(Text), "%*.*f", Width, Decimals, Value);
+
+    VM.StackPushString(Text);
+}
+
+static
+void
+MockStringToInt(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushInt((LONG) atoi(VM.StackPopString().c_str()));
+}
+
+static
+void
+MockStringToFloat(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushFloat((float) atof(VM.StackPopString().c_str()));
+}
+
+static
+void
+MockIntToFloat(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushFloat((float) VM.StackPopInt());
+}
+
+static
+void
+MockFloatToInt(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushInt((LONG) VM.StackPopFloat());
+}
+
+static
+void
+MockGetStringLength(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushInt((LONG) VM.StackPopString().size());
+}
+
+static
+void
+MockGetStringLeft(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+    LONG Count = VM.StackPopInt();
+
+    if (Count < 0)
+        Count = 0;
+
+    VM.StackPushString(String.substr(0, (size_t) Count));
+}
+
+static
+void
+MockGetStringRight(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+    LONG Count = VM.StackPopInt();
+
+    if (Count < 0)
+        Count = 0;
+
+    if ((size_t) Count > String.size())
+        Count = (LONG) String.size();
+
+    VM.StackPushString(String.substr(String.size() - (size_t) Count));
+}
+
+static
+void
+MockGetSubString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+    LONG Start = VM.StackPopInt();
+    LONG Count = VM.StackPopInt();
+
+    if ((Start < 0) || ((size_t) Start >= String.size()) || (Count <= 0))
+        VM.StackPushString("");
+    else
+        VM.StackPushString(String.substr((size_t) Start, (size_t) Count));
+}
+
+static
+void
+MockFindSubString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+    std::string SubString = VM.StackPopString();
+    LONG Start = VM.StackPopInt();
+    std::string::size_type Offs;
+
+    Offs = String.find(SubString, (Start < 0) ? 0 : (size_t) Start);
+
+    VM.StackPushInt((Offs == std::string::npos) ? -1 : (LONG) Offs);
+}
+
+static
+void
+MockGetStringUpperCase(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+
+    for (std::string::iterator it = String.begin(); it != String.end(); ++it)
+        *it = (char) toupper((unsigned char) *it);
+
+    VM.StackPushString(String);
+}
+
+static
+void
+MockGetStringLowerCase(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    std::string String = VM.StackPopString();
+
+    for (std::string::iterator it = String.begin(); it != String.end(); ++it)
+        *it = (char) tolower((unsigned char) *it);
+
+    VM.StackPushString(String);
+}
+
+static
+void
+MockAbs(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    LONG Value = VM.StackPopInt();
+
+    VM.StackPushInt((Value < 0) ? (LONG) (0 - (ULONG) Value) : Value);
+}
+
+static
+void
+MockFabs(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushFloat((float) fabs(VM.StackPopFloat()));
+}
+
+static
+void
+MockRandom(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushInt(Runner.Random(VM.StackPopInt()));
+}
+
+static
+void
+MockSetLocalInt(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::StackCell Value;
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Value.Type = NWScriptVM::VMType_Int;
+    Value.Int = VM.StackPopInt();
+
+    Runner.SetLocal(Object, Name, Value);
+}
+
+static
+void
+MockSetLocalFloat(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::StackCell Value;
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Value.Type = NWScriptVM::VMType_Float;
+    Value.Float = VM.StackPopFloat();
+
+    Runner.SetLocal(Object, Name, Value);
+}
+
+static
+void
+MockSetLocalString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::StackCell Value;
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Value.Type = NWScriptVM::VMType_String;
+    Value.Int = 0;
+    Value.String = VM.StackPopString();
+
+    Runner.SetLocal(Object, Name, Value);
+}
+
+static
+void
+MockSetLocalObject(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::StackCell Value;
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Value.Type = NWScriptVM::VMType_Object;
+    Value.Object = VM.StackPopObject();
+
+    Runner.SetLocal(Object, Name, Value);
+}
+
+template< NWScriptVM::VM_TYPE Type >
+static
+void
+MockGetLocal(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Runner.GetLocal(Object, Name, Type, VM);
+}
+
+template< NWScriptVM::VM_TYPE Type >
+static
+void
+MockDeleteLocal(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    ULONG Object = VM.StackPopObject();
+    std::string Name = VM.StackPopString();
+
+    Runner.DeleteLocal(Object, Name, Type);
+}
+
+static
+void
+MockGetIsObjectValid(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushInt((VM.StackPopObject() != NWScriptVM::ObjectInvalid) ? 1 : 0);
+}
+
+static
+void
+MockObjectToString(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    char Text[16];
+
+    snprintf(Text, sizeof(Text), "%x", (unsigned) VM.StackPopObject());
+
+    VM.StackPushString(Text);
+}
+
+static
+void
+MockGetModule(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushObject(ScriptRunner::ObjectModule);
+}
+
+static
+void
+MockGetFirstPC(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushObject(ScriptRunner::ObjectPC);
+}
+
+static
+void
+MockGetFirstPCOwned(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPopInt();
+    VM.StackPushObject(ScriptRunner::ObjectPC);
+}
+
+static
+void
+MockGetNextPC(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPushObject(NWScriptVM::ObjectInvalid);
+}
+
+static
+void
+MockGetNextPCOwned(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    VM.StackPopInt();
+    VM.StackPushObject(NWScriptVM::ObjectInvalid);
+}
+
+static
+void
+MockDelayCommand(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::SavedState State;
+
+    VM.StackPopFloat();
+    VM.TakeSavedState(State);
+    VM.QueueSavedState(State);
+}
+
+static
+void
+MockAssignCommand(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::SavedState State;
+    ULONG Object = VM.StackPopObject();
+
+    VM.TakeSavedState(State);
+
+    State.ObjectSelf = Object;
+
+    VM.QueueSavedState(State);
+}
+
+static
+void
+MockActionDoCommand(
+    ScriptRunner &Runner,
+    NWScriptVM &VM
+)
+{
+    NWScriptVM::SavedState State;
+
+    VM.TakeSavedState(State);
+    VM.QueueSavedState(State);
+}
+
+static const ScriptRunner::MockDefinition g_Mocks[] =
+{
+    {"PrintString",        "v(s)",   MockPrintString},
+    {"PrintInteger",       "v(i)",   MockPrintInteger},
+    {"PrintFloat",         "v(fii)", MockPrintFloat},
+    {"PrintObject",        "v(o)",   MockPrintObject},
+    {"PrintVector",        "v(Vi)",  MockPrintVector},
+    {"IntToString",        "s(i)",   MockIntToString},
+    {"FloatToString",      "s(fii)", MockFloatToString},
+    {"StringToInt",        "i(s)",   MockStringToInt},
+    {"StringToFloat",      "f(s)",   MockStringToFloat},
+    {"IntToFloat",         "f(i)",   MockIntToFloat},
+    {"FloatToInt",         "i(f)",   MockFloatToInt},
+    {"GetStringLength",    "i(s)",   MockGetStringLength},
+    {"GetStringLeft",      "s(si)",  MockGetStringLeft},
+    {"GetStringRight",     "s(si)",  MockGetStringRight},
+    {"GetSubString",       "s(sii)", MockGetSubString},
+    {"FindSubString",      "i(ssi)", MockFindSubString},
+    {"GetStringUpperCase", "s(s)",   MockGetStringUpperCase},
+    {"GetStringLowerCase", "s(s)",   MockGetStringLowerCase},
+    {"abs",                "i(i)",   MockAbs},
+    {"fabs",               "f(f)",   MockFabs},
+    {"Random",             "i(i)",   MockRandom},
+    {"SetLocalInt",        "v(osi)", MockSetLocalInt},
+    {"SetLocalFloat",      "v(osf)", MockSetLocalFloat},
+    {"SetLocalString",     "v(oss)", MockSetLocalString},
+    {"SetLocalObject",     "v(oso)", MockSetLocalObject},
+    {"GetLocalInt",        "i(os)",  MockGetLocal< NWScriptVM::VMType_Int >},
+    {"GetLocalFloat",      "f(os)",  MockGetLocal< NWScriptVM::VMType_Float >},
+    {"GetLocalString",     "s(os)",  MockGetLocal< NWScriptVM::VMType_String >},
+    {"GetLocalObject",     "o(os)",  MockGetLocal< NWScriptVM::VMType_Object >},
+    {"DeleteLocalInt",     "v(os)",  MockDeleteLocal< NWScriptVM::VMType_Int >},
+    {"DeleteLocalFloat",   "v(os)",  MockDeleteLocal< NWScriptVM::VMType_Float >},
+    {"DeleteLocalString",  "v(os)",  MockDeleteLocal< NWScriptVM::VMType_String >},
+    {"DeleteLocalObject",  "v(os)",  MockDeleteLocal< NWScriptVM::VMType_Object >},
+    {"GetIsObjectValid",   "i(o)",   MockGetIsObjectValid},
+    {"ObjectToString",     "s(o)",   MockObjectToString},
+    {"GetModule",          "o()",    MockGetModule},
+    {"GetFirstPC",         "o()",    MockGetFirstPC},
+    {"GetFirstPC",         "o(i)",   MockGetFirstPCOwned},
+    {"GetNextPC",          "o()",    MockGetNextPC},
+    {"GetNextPC",          "o(i)",   MockGetNextPCOwned},
+    {"DelayCommand",       "v(fa)",  MockDelayCommand},
+    {"AssignCommand",      "v(oa)",  MockAssignCommand},
+    {"ActionDoCommand",    "v(a)",   MockActionDoCommand},
+};
+
+
+ScriptRunner::ScriptRunner(
+    NscCompiler & Compiler,
+    int CompilerVersion,
+    IDebugTextOut * TextOut,
+    size_t Iterations
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new ScriptRunner.  The action table is built
+    when the first script is run.
+
+Arguments:
+
+    Compiler - Supplies the compiler context that supplies the action
+               prototypes.
+
+    CompilerVersion - Supplies the BioWare-compatible compiler version number,
+                      used if nwscript.nss has not been parsed yet.
+
+    TextOut - Supplies the text out interface that receives script output and
+              the reports.
+
+    Iterations - Supplies how many times each script is executed.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_Compiler( Compiler ),
+  m_CompilerVersion( CompilerVersion ),
+  m_TextOut( TextOut ),
+  m_Iterations( (Iterations != 0) ? Iterations : 1 ),
+  m_ActionsLoaded( false ),
+  m_PrintEnabled( true ),
+  m_RandomSeed( SCRIPTRUNNER_RANDOM_SEED )
+{
+}
+
+ScriptRunner::~ScriptRunner(
+    )
+/*++
+
+Routine Description:
+
+    This routine deletes the current ScriptRunner object and its associated
+    members.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+}
+
+bool
+ScriptRunner::AddScriptedMock(
+    const char * MockText
+    )
+/*++
+
+Routine Description:
+
+    This routine records a scripted mock, which makes an action return a fixed
+    value.
+
+Arguments:
+
+    MockText - Supplies the mock, as "Name=Value".
+
+Return Value:
+
+    The routine returns a Boolean value indicating true if the mock was
+    recorded, else false if it is malformed.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    const char *Equals = strchr(MockText, '=');
+
+    if ((Equals == nullptr) || (Equals == MockText))
+        return false;
+
+    m_ScriptedMocks.push_back(MockText);
+
+    return true;
+}
+
+bool
+ScriptRunner::RunScript(
+    const char * ScriptName,
+    const std::vector< unsigned char > & Code,
+    const std::vector< unsigned char > & Symbols
+    )
+/*++
+
+Routine Description:
+
+    This routine executes a compiled script the configured number of times
+    and reports the results.  Script output is only printed for the first
+    execution.
+
+Arguments:
+
+    ScriptName - Supplies the name of the script, for the report.
+
+    Code - Supplies the compiled script, including the NCS header.
+
+    Symbols - Supplies the NDB debug symbols of the script.  This may be
+              empty, in which case script functions are named by address.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else false
+    on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    NWScriptVM::Statistics VMStatistics;
+    LONG Result;
+
+    if ((!m_ActionsLoaded) && (!LoadActions()))
+        return false;
+
+    if ((Code.size() < NWScriptReader::NCSHeaderSize) ||
+        (memcmp(&Code[0], "NCS V1.0", 8) != 0)) {
+        m_TextOut->WriteText(
+                "Error: %s is not a compiled script.\n",
+                ScriptName);
+
+        return false;
+    }
+
+    try {
+        NWScriptReader Script(
+                ScriptName,
+                &Code[NWScriptReader::NCSHeaderSize],
+                Code.size() - NWScriptReader::NCSHeaderSize,
+                nullptr,
+                0);
+
+        if (!Symbols.empty())
+            Script.LoadSymbols(&Symbols[0], Symbols.size());
+
+        NWScriptVM VM(Script, m_Actions);
+
+        VM.SetInstructionLimit(SCRIPTRUNNER_INSTRUCTION_LIMIT);
+
+        Result = 0;
+
+        for (size_t i = 0; i < m_Iterations; i += 1) {
+            m_PrintEnabled = (i == 0);
+            m_RandomSeed = SCRIPTRUNNER_RANDOM_SEED;
+            m_LocalVars.clear();
+
+            Result = VM.Execute(ObjectSelf);
+        }
+
+        m_PrintEnabled = true;
+
+        VM.GetStatistics(VMStatistics);
+    }
+    catch (std::exception &e) {
+        m_PrintEnabled = true;
+
+        m_TextOut->WriteText(
+                "Error: Script %s failed: %s\n",
+                ScriptName,
+                e.what());
+
+        return false;
+    }
+
+    ReportStatistics(ScriptName, Result, VMStatistics);
+
+    return true;
+}
+
+void
+ScriptRunner::Print(
+    const char * Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    This routine writes a line of script output, unless output is suppressed for
+    repeated executions.
+
+Arguments:
+
+    Format - Supplies the printf style format string.
+
+    ... - Supplies the format arguments.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    va_list ap;
+
+    if (!m_PrintEnabled)
+        return;
+
+    va_start(ap, Format);
+    m_TextOut->WriteTextV(Format, ap);
+    va_end(ap);
+}
+
+LONG
+ScriptRunner::Random(
+    LONG Range
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the next value of the deterministic random number
+    generator used by the Random mock.
+
+Arguments:
+
+    Range - Supplies the (exclusive) upper bound of the value.
+
+Return Value:
+
+    The routine returns a value in [0, Range), or zero if the range is empty.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_RandomSeed = (m_RandomSeed * 1103515245 + 12345) & 0x7FFFFFFF;
+
+    if (Range <= 0)
+        return 0;
+
+    return (LONG) (m_RandomSeed % (ULONG) Range);
+}
+
+void
+ScriptRunner::SetLocal(
+    ULONG Object,
+    const std::string & Name,
+    const NWScriptVM::StackCell & Value
+    )
+/*++
+
+Routine Description:
+
+    This routine sets a local variable of an object.
+
+Arguments:
+
+    Object - Supplies the object.
+
+    Name - Supplies the name of the variable.
+
+    Value - Supplies the value, which also selects the type of the variable.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    LocalVarKey Key;
+
+    Key.Object = Object;
+    Key.Type = Value.Type;
+    Key.Name = Name;
+
+    m_LocalVars[Key] = Value;
+}
+
+void
+ScriptRunner::GetLocal(
+    ULONG Object,
+    const std::string & Name,
+    NWScriptVM::VM_TYPE Type,
+    NWScriptVM & VM
+    )
+/*++
+
+Routine Description:
+
+    This routine pushes the value of a local variable of an object, or the
+    default value of its type if it is not set.
+
+Arguments:
+
+    Object - Supplies the object.
+
+    Name - Supplies the name of the variable.
+
+    Type - Supplies the type of the variable.
+
+    VM - Supplies the VM that receives the value.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    LocalVarKey Key;
+    LocalVarMap::const_iterator it;
+
+    Key.Object = Object;
+    Key.Type = Type;
+    Key.Name = Name;
+
+    it = m_LocalVars.find(Key);
+
+    if (it == m_LocalVars.end()) {
+        VM.StackPushDefault(Type);
+        return;
+    }
+
+    switch (Type) {
+
+        case NWScriptVM::VMType_Int:
+            VM.StackPushInt(it->second.Int);
+            break;
+
+        case NWScriptVM::VMType_Float:
+            VM.StackPushFloat(it->second.Float);
+            break;
+
+        case NWScriptVM::VMType_String:
+            VM.StackPushString(it->second.String);
+            break;
+
+        default:
+            VM.StackPushObject(it->second.Object);
+            break;
+
+    }
+}
+
+void
+ScriptRunner::DeleteLocal(
+    ULONG Object,
+    const std::string & Name,
+    NWScriptVM::VM_TYPE Type
+    )
+/*++
+
+Routine Description:
+
+    This routine deletes a local variable of an object.
+
+Arguments:
+
+    Object - Supplies the object.
+
+    Name - Supplies the name of the variable.
+
+    Type - Supplies the type of the variable.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    LocalVarKey Key;
+
+    Key.Object = Object;
+    Key.Type = Type;
+    Key.Name = Name;
+
+    m_LocalVars.erase(Key);
+}
+
+bool
+ScriptRunner::LoadActions(
+    )
+/*++
+
+Routine Description:
+
+    This routine builds the action table from the action prototypes of
+    nwscript.nss and binds the mocks to it.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else false
+    on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Signature;
+
+    if (!m_Compiler.NscParseNWScript(m_CompilerVersion, m_TextOut)) {
+        m_TextOut->WriteText(
+                "Error: Unable to load the action prototypes of nwscript.nss.\n");
+
+        return false;
+    }
+
+    m_Actions.clear();
+    m_Bindings.clear();
+
+    for (int ActionId = 0; ; ActionId += 1) {
+        NscPrototypeDefinition Prototype;
+
+        if (!m_Compiler.NscGetActionPrototype(ActionId, Prototype))
+            break;
+
+        m_Actions.resize(m_Actions.size() + 1);
+
+        NWScriptVM::ActionDefinition &Action = m_Actions.back();
+
+        Action.ActionId = (ULONG) ActionId;
+        Action.Name = Prototype.Name;
+        Action.ReturnType = ConvertType(Prototype.ReturnType);
+        Action.Handler = nullptr;
+        Action.Context = nullptr;
+
+        for (NscTypeVec::const_iterator it = Prototype.ParameterTypes.begin();
+             it != Prototype.ParameterTypes.end();
+             ++it) {
+            Action.ParameterTypes.push_back(ConvertType(*it));
+        }
+    }
+
+    //
+    // Bind each mock to the action of the same name, if the prototype matches
+    // what the mock expects.
+    //
+
+    for (NWScriptVM::ActionDefinitionVec::iterator it = m_Actions.begin();
+         it != m_Actions.end();
+         ++it) {
+        GetSignature(*it, Signature);
+
+        for (size_t i = 0; i < sizeof(g_Mocks) / sizeof(g_Mocks[0]); i += 1) {
+            if ((it->Name != g_Mocks[i].Name) || (Signature != g_Mocks[i].Signature))
+                continue;
+
+            m_Bindings.resize(m_Bindings.size() + 1);
+            m_Bindings.back().Runner = this;
+            m_Bindings.back().Mock = &g_Mocks[i];
+
+            it->Handler = MockAction;
+            it->Context = &m_Bindings.back();
+            break;
+        }
+    }
+
+    for (StringVec::const_iterator it = m_ScriptedMocks.begin();
+         it != m_ScriptedMocks.end();
+         ++it) {
+        if (!BindScriptedMock(*it))
+            return false;
+    }
+
+    m_ActionsLoaded = true;
+
+    return true;
+}
+
+bool
+ScriptRunner::BindScriptedMock(
+    const std::string & MockText
+    )
+/*++
+
+Routine Description:
+
+    This routine binds a scripted mock to its action.
+
+Arguments:
+
+    MockText - Supplies the mock, as "Name=Value".
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else false
+    on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Name;
+    std::string Value;
+    std::string::size_type Offs;
+    NWScriptVM::StackCell Cell;
+    char *End;
+
+    Offs = MockText.find('=');
+    Name = MockText.substr(0, Offs);
+    Value = MockText.substr(Offs + 1);
+
+    for (NWScriptVM::ActionDefinitionVec::iterator it = m_Actions.begin();
+         it != m_Actions.end();
+         ++it) {
+        if (it->Name != Name)
+            continue;
+
+        Cell.Type = it->ReturnType;
+        Cell.Int = 0;
+        End = nullptr;
+
+        switch (it->ReturnType) {
+
+            case NWScriptVM::VMType_Int:
+                Cell.Int = (LONG) strtol(Value.c_str(), &End, 0);
+                break;
+
+            case NWScriptVM::VMType_Float:
+                Cell.Float = (float) strtod(Value.c_str(), &End);
+                break;
+
+            case NWScriptVM::VMType_Object:
+                Cell.Object = (ULONG) strtoul(Value.c_str(), &End, 0);
+                break;
+
+            case NWScriptVM::VMType_String:
+                Cell.String = Value;
+                break;
+
+            default:
+                m_TextOut->WriteText(
+                        "Error: Action %s cannot be scripted (unsupported return type).\n",
+                        Name.c_str());
+
+                return false;
+
+        }
+
+        if ((End != nullptr) && ((End == Value.c_str()) || (*End != '\0'))) {
+            m_TextOut->WriteText(
+                    "Error: Invalid value \"%s\" for action %s.\n",
+                    Value.c_str(),
+                    Name.c_str());
+
+            return false;
+        }
+
+        m_Bindings.resize(m_Bindings.size() + 1);
+        m_Bindings.back().Runner = this;
+        m_Bindings.back().Mock = nullptr;
+        m_Bindings.back().Value = Cell;
+
+        it->Handler = ScriptedAction;
+        it->Context = &m_Bindings.back();
+
+        return true;
+    }
+
+    m_TextOut->WriteText(
+            "Error: Unknown action %s in --mock.\n",
+            Name.c_str());
+
+    return false;
+}
+
+void
+ScriptRunner::ReportStatistics(
+    const char * ScriptName,
+    LONG Result,
+    const NWScriptVM::Statistics & VMStatistics
+    )
+/*++
+
+Routine Description:
+
+    This routine reports the execution statistics of a script.  With more than
+    one execution, all figures are per execution.
+
+Arguments:
+
+    ScriptName - Supplies the name of the script.
+
+    Result - Supplies the value returned by the script.
+
+    VMStatistics - Supplies the statistics of the VM.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< const NWScriptVM::FunctionStatistics * > Functions;
+    ULONGLONG Runs;
+
+    Runs = (VMStatistics.Executions != 0) ? VMStatistics.Executions : 1;
+
+    m_TextOut->WriteText(
+            "%s: returned %d; %llu instructions, %llu action calls, stack high-water %lu cells, %.3f ms%s",
+            ScriptName,
+            (int) Result,
+            (unsigned long long) (VMStatistics.Instructions / Runs),
+            (unsigned long long) (VMStatistics.ActionCalls / Runs),
+            (unsigned long) VMStatistics.StackHighWater,
+            (double) VMStatistics.ElapsedTime / Runs / 1000000.0,
+            (Runs > 1) ? " per run" : "");
+
+    //
+    // List the functions, busiest first.
+    //
+
+    for (NWScriptVM::FunctionStatisticsVec::const_iterator it = VMStatistics.Functions.begin();
+         it != VMStatistics.Functions.end();
+         ++it) {
+        Functions.push_back(&*it);
+    }
+
+    std::stable_sort(
+            Functions.begin(),
+            Functions.end(),
+            [](const NWScriptVM::FunctionStatistics *F1, const NWScriptVM::FunctionStatistics *F2) {
+                return F1->Instructions > F2->Instructions;
+            });
+
+    m_TextOut->WriteText(
+            "    %-32s %10s %14s %11s %11s",
+            "Function",
+            "Calls",
+            "Instructions",
+            "Self ms",
+            "Total ms");
+
+    for (size_t i = 0; i < Functions.size(); i += 1) {
+        m_TextOut->WriteText(
+                "    %-32s %10llu %14llu %11.3f %11.3f",
+                Functions[i]->Name.c_str(),
+                (unsigned long long) (Functions[i]->Calls / Runs),
+                (unsigned long long) (Functions[i]->Instructions / Runs),
+                (double) Functions[i]->SelfTime / Runs / 1000000.0,
+                (double) Functions[i]->TotalTime / Runs / 1000000.0);
+    }
+}
+
+void
+ScriptRunner::MockAction(
+    NWScriptVM & VM,
+    const NWScriptVM::ActionDefinition & Action,
+    ULONG NumArguments,
+    void * Context
+    )
+/*++
+
+Routine Description:
+
+    This routine is the action handler of mocked actions.
+
+Arguments:
+
+    VM - Supplies the VM executing the action.
+
+    Action - Supplies the definition of the action.
+
+    NumArguments - Supplies the count of arguments passed.
+
+    Context - Supplies the mock binding.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    MockBinding *Binding = (MockBinding *) Context;
+
+    if (NumArguments != Action.ParameterTypes.size()) {
+        NWScriptVM::StubAction(VM, Action, NumArguments, nullptr);
+        return;
+    }
+
+    Binding->Mock->Proc(*Binding->Runner, VM);
+}
+
+void
+ScriptRunner::ScriptedAction(
+    NWScriptVM & VM,
+    const NWScriptVM::ActionDefinition & Action,
+    ULONG NumArguments,
+    void * Context
+    )
+/*++
+
+Routine Description:
+
+    This routine is the action handler of scripted actions, which discard
+    their arguments and return a fixed value.
+
+Arguments:
+
+    VM - Supplies the VM executing the action.
+
+    Action - Supplies the definition of the action.
+
+    NumArguments - Supplies the count of arguments passed.
+
+    Context - Supplies the mock binding.
+
+Return Value:
+
+    None.  On failure, an std::exception is raised.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    MockBinding *Binding = (MockBinding *) Context;
+
+    if (NumArguments > Action.ParameterTypes.size())
+        throw std::runtime_error("Too many arguments for action.");
+
+    for (ULONG i = 0; i < NumArguments; i += 1)
+        VM.StackPopArgument(Action.ParameterTypes[i]);
+
+    switch (Binding->Value.Type) {
+
+        case NWScriptVM::VMType_Int:
+            VM.StackPushInt(Binding->Value.Int);
+            break;
+
+        case NWScriptVM::VMType_Float:
+            VM.StackPushFloat(Binding->Value.Float);
+            break;
+
+        case NWScriptVM::VMType_String:
+            VM.StackPushString(Binding->Value.String);
+            break;
+
+        default:
+            VM.StackPushObject(Binding->Value.Object);
+            break;
+
+    }
+}
+
+void
+ScriptRunner::GetSignature(
+    const NWScriptVM::ActionDefinition & Action,
+    std::string & Signature
+    )
+/*++
+
+Routine Description:
+
+    This routine formats the signature of an action in the notation of the
+    mock table.
+
+Arguments:
+
+    Action - Supplies the definition of the action.
+
+    Signature - Receives the signature.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    static const char TypeChars[] = "vifsoVa";
+
+    Signature.clear();
+
+    for (size_t i = 0; i <= Action.ParameterTypes.size(); i += 1) {
+        NWScriptVM::VM_TYPE Type = (i == 0) ? Action.ReturnType : Action.ParameterTypes[i - 1];
+
+        if (Type < sizeof(TypeChars) - 1)
+            Signature.push_back(TypeChars[Type]);
+        else if ((Type >= NWScriptVM::VMType_EngineStructure0) && (Type <= NWScriptVM::VMType_EngineStructureLast))
+            Signature.push_back('e');
+        else
+            Signature.push_back('?');
+
+        if (i == 0)
+            Signature.push_back('(');
+    }
+
+    Signature.push_back(')');
+}
@@ -0,0 +1,256 @@
+/*++
+
+Module Name:
+
+    ScriptRunner.h
+
+Abstract:
+
+    This module defines the script runner, which executes compiled scripts on
+    the offline NWScript VM for the --run and --bench modes and reports the
+    instructions executed, the stack high-water mark and the time spent per
+    script function.
+
+    Engine actions are bound through the action prototypes of nwscript.nss.
+    A small set of side-effect free actions (printing, string and math
+    helpers, local variables, DelayCommand and friends) is mocked, and any
+    action may be scripted to return a fixed value (--mock=Name=Value).  All
+    other actions are stubbed and return the default value of their type.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_SCRIPTRUNNER_H
+#define _PROGRAMS_NWNSC_SCRIPTRUNNER_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+#include <list>
+#include <map>
+#include "../_NwnDataLib/NWScriptVM.h"
+
+class NscCompiler;
+struct IDebugTextOut;
+
+class ScriptRunner
+{
+
+public:
+
+    typedef std::vector< std::string > StringVec;
+
+    typedef
+    void
+    (* MockProc)(
+        ScriptRunner & Runner,
+        NWScriptVM & VM
+        );
+
+    //
+    // Describes a mocked action.  The signature gives the return type and
+    // the parameter types ("i(si)"), using v (void), i (int), f (float),
+    // s (string), o (object), V (vector), a (action) and e (any engine
+    // structure).  A mock is only bound to an action with that signature.
+    //
+
+    struct MockDefinition
+    {
+        const char * Name;
+        const char * Signature;
+        MockProc     Proc;
+    };
+
+    //
+    // Define the object ids of the mock world.
+    //
+
+    enum
+    {
+        ObjectSelf   = 0x00000001,
+        ObjectModule = 0x00000002,
+        ObjectPC     = 0x00000003
+    };
+
+    ScriptRunner(
+        NscCompiler & Compiler,
+        int CompilerVersion,
+        IDebugTextOut * TextOut,
+        size_t Iterations
+        );
+
+    ~ScriptRunner(
+        );
+
+    //
+    // Script an action to always return a fixed value, given as "Name=Value".
+    // Returns false if the text is malformed.  The action name and value are
+    // checked against the prototype when the first script runs.
+    //
+
+    bool
+    AddScriptedMock(
+        const char * MockText
+        );
+
+    //
+    // Execute a compiled script (a complete *.ncs file image) the configured
+    // number of times and report the results.  The debug symbols may be
+    // empty.  Returns false if the script could not be executed.
+    //
+
+    bool
+    RunScript(
+        const char * ScriptName,
+        const std::vector< unsigned char > & Code,
+        const std::vector< unsigned char > & Symbols
+        );
+
+    //
+    // Mock world services, used by the mocks.
+    //
+
+    void
+    Print(
+        const char * Format,
+        ...
+        );
+
+    LONG
+    Random(
+        LONG Range
+        );
+
+    void
+    SetLocal(
+        ULONG Object,
+        const std::string & Name,
+        const NWScriptVM::StackCell & Value
+        );
+
+    void
+    GetLocal(
+        ULONG Object,
+        const std::string & Name,
+        NWScriptVM::VM_TYPE Type,
+        NWScriptVM & VM
+        );
+
+    void
+    DeleteLocal(
+        ULONG Object,
+        const std::string & Name,
+        NWScriptVM::VM_TYPE Type
+        );
+
+private:
+
+    //
+    // Describes the binding of a mock or of a scripted value to an action.
+    // The context of the action table entry points here.
+    //
+
+    struct MockBinding
+    {
+        ScriptRunner           * Runner;
+        const MockDefinition   * Mock;
+        NWScriptVM::StackCell    Value;
+    };
+
+    //
+    // Identifies a local variable of an object.
+    //
+
+    struct LocalVarKey
+    {
+        ULONG                    Object;
+        NWScriptVM::VM_TYPE      Type;
+        std::string              Name;
+
+        inline
+        bool
+        operator<(
+            const LocalVarKey & Other
+            ) const
+        {
+            if (Object != Other.Object)
+                return Object < Other.Object;
+
+            if (Type != Other.Type)
+                return Type < Other.Type;
+
+            return Name < Other.Name;
+        }
+    };
+
+    typedef std::map< LocalVarKey, NWScriptVM::StackCell > LocalVarMap;
+
+    bool
+    LoadActions(
+        );
+
+    bool
+    BindScriptedMock(
+        const std::string & MockText
+        );
+
+    void
+    ReportStatistics(
+        const char * ScriptName,
+        LONG Result,
+        const NWScriptVM::Statistics & VMStatistics
+        );
+
+    static
+    void
+    MockAction(
+        NWScriptVM & VM,
+        const NWScriptVM::ActionDefinition & Action,
+        ULONG NumArguments,
+        void * Context
+        );
+
+    static
+    void
+    ScriptedAction(
+        NWScriptVM & VM,
+        const NWScriptVM::ActionDefinition & Action,
+        ULONG NumArguments,
+        void * Context
+        );
+
+    static
+    void
+    GetSignature(
+        const NWScriptVM::ActionDefinition & Action,
+        std::string & Signature
+        );
+
+    NscCompiler                     & m_Compiler;
+    int                               m_CompilerVersion;
+    IDebugTextOut                   * m_TextOut;
+    size_t                            m_Iterations;
+
+    //
+    // The action table, built when the first script runs, and the mock
+    // bindings that its entries point to.
+    //
+
+    bool                              m_ActionsLoaded;
+    NWScriptVM::ActionDefinitionVec   m_Actions;
+    std::list< MockBinding >          m_Bindings;
+    StringVec                         m_ScriptedMocks;
+
+    //
+    // Mock world state, reset for each execution of a script.
+    //
+
+    bool                              m_PrintEnabled;
+    ULONG                             m_RandomSeed;
+    LocalVarMap                       m_LocalVars;
+
+};
+
+#endif
@@ -0,0 +1,648 @@
+/*++
+
+Module Name:
+
+    TimeReport.cpp
+
+Abstract:
+
+    This module houses the time report.  See TimeReport.h for an overview.
+
+    All times are kept in nanoseconds (see NscGetTimestamp) and reported in
+    milliseconds.  The share of a stage is its part of the wall clock time of
+    the run; the output is written on a background thread, so the output
+    writes overlap the other stages.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <algorithm>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NscLib/Nsc.h"
+#include "TimeReport.h"
+
+//
+// Define the names of the stages, as printed and as JSON keys.
+//
+
+static const char * const StageNames[ TimeReport::LastStage ] =
+{
+    "Source load",
+    "Phase 1 parse",
+    "Phase 2 parse",
+    "Code generation",
+    "NDB emission",
+    "Output hand-off",
+    "Include loads"
+};
+
+static const char * const StageKeys[ TimeReport::LastStage ] =
+{
+    "source_load_ms",
+    "phase1_ms",
+    "phase2_ms",
+    "codegen_ms",
+    "ndb_ms",
+    "output_ms",
+    "include_ms"
+};
+
+static const char * const BatchStageNames[ TimeReport::LastBatchStage ] =
+{
+    "Key file load",
+    "Resource discovery",
+    "nwscript.nss init",
+    "Output writes"
+};
+
+static const char * const BatchStageKeys[ TimeReport::LastBatchStage ] =
+{
+    "key_file_load_ms",
+    "discover_resources_ms",
+    "nwscript_init_ms",
+    "output_write_ms"
+};
+
+TimeReport::TimeReport(
+    const std::string & FileName
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new TimeReport and starts the clock of the run.
+
+Arguments:
+
+    FileName - Supplies the name of the JSON report file, if any.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_FileName(FileName),
+  m_StartTime(NscGetTimestamp()),
+  m_EndTime(0),
+  m_FileStartTime(0),
+  m_CacheHits(0),
+  m_CacheMisses(0)
+{
+    memset(m_BatchStages, 0, sizeof(m_BatchStages));
+
+    m_Current.Total = 0;
+    memset(m_Current.Stages, 0, sizeof(m_Current.Stages));
+    m_Current.IncludeLoads = 0;
+    m_Current.IncludeCacheHits = 0;
+
+    m_Totals = m_Current;
+}
+
+TimeReport::~TimeReport(
+    )
+/*++
+
+Routine Description:
+
+    This routine cleans up an already-existing TimeReport.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+}
+
+void
+TimeReport::AddBatchTime(
+    BATCH_STAGE Stage,
+    unsigned long long Time
+    )
+/*++
+
+Routine Description:
+
+    This routine adds to the time of a stage of the run as a whole.
+
+Arguments:
+
+    Stage - Supplies the stage.
+
+    Time - Supplies the time to add, in nanoseconds.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_BatchStages[Stage] += Time;
+}
+
+void
+TimeReport::BeginFile(
+    const std::string & FileName
+    )
+/*++
+
+Routine Description:
+
+    This routine starts timing a file.  Any file still being timed is
+    dropped.
+
+Arguments:
+
+    FileName - Supplies the name of the file.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_Current.FileName = FileName;
+    m_Current.Total = 0;
+    memset(m_Current.Stages, 0, sizeof(m_Current.Stages));
+    m_Current.IncludeLoads = 0;
+    m_Current.IncludeCacheHits = 0;
+
+    m_FileStartTime = NscGetTimestamp();
+}
+
+void
+TimeReport::AddFileTime(
+    STAGE Stage,
+    unsigned long long Time
+    )
+/*++
+
+Routine Description:
+
+    This routine adds to the time of a stage of the current file.
+
+Arguments:
+
+    Stage - Supplies the stage.
+
+    Time - Supplies the time to add, in nanoseconds.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_Current.Stages[Stage] += Time;
+}
+
+void
+TimeReport::EndFile(
+    const NscCompileTimings & Timings
+    )
+/*++
+
+Routine Description:
+
+    This routine finishes timing the current file and adds it to the report.
+    The nwscript.nss initialization done by the compile of the file is moved
+    to the run as a whole.
+
+Arguments:
+
+    Timings - Supplies the stage timings of the compile of the file.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_Current.Stages[StagePhase1] += Timings.Phase1Time;
+    m_Current.Stages[StagePhase2] += Timings.Phase2Time;
+    m_Current.Stages[StageCodeGeneration] += Timings.CodeGenerationTime;
+    m_Current.Stages[StageSymbols] += Timings.SymbolsTime;
+    m_Current.Stages[StageIncludes] += Timings.IncludeTime;
+    m_Current.IncludeLoads += Timings.IncludeLoads;
+    m_Current.IncludeCacheHits += Timings.IncludeCacheHits;
+    m_Current.Total = NscGetTimestamp() - m_FileStartTime - Timings.NWScriptInitTime;
+
+    m_BatchStages[BatchNWScriptInit] += Timings.NWScriptInitTime;
+
+    for (int Stage = 0; Stage < LastStage; Stage += 1)
+        m_Totals.Stages[Stage] += m_Current.Stages[Stage];
+
+    m_Totals.Total += m_Current.Total;
+    m_Totals.IncludeLoads += m_Current.IncludeLoads;
+    m_Totals.IncludeCacheHits += m_Current.IncludeCacheHits;
+
+    m_Files.push_back(m_Current);
+}
+
+void
+TimeReport::SetCacheStatistics(
+    unsigned long long Hits,
+    unsigned long long Misses
+    )
+/*++
+
+Routine Description:
+
+    This routine sets the resource cache counters of the run.
+
+Arguments:
+
+    Hits - Supplies the number of lookups served from the cache.
+
+    Misses - Supplies the number of lookups not served from the cache.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_CacheHits = Hits;
+    m_CacheMisses = Misses;
+}
+
+void
+TimeReport::Finish(
+    )
+/*++
+
+Routine Description:
+
+    This routine stops the clock of the run as a whole.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_EndTime = NscGetTimestamp();
+}
+
+void
+TimeReport::Print(
+    IDebugTextOut * TextOut
+    ) const
+/*++
+
+Routine Description:
+
+    This routine prints the time of each stage of the run and the times of
+    the slowest files.
+
+Arguments:
+
+    TextOut - Supplies the text out interface that receives the report.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< const FileTimes * > Slowest;
+    unsigned long long RunTime;
+    size_t Count;
+
+    RunTime = ((m_EndTime != 0) ? m_EndTime : NscGetTimestamp()) - m_StartTime;
+
+    TextOut->WriteText(
+            "Time report: %lu file(s) compiled in %.3f ms",
+            (unsigned long) m_Files.size(),
+            ToMilliseconds(RunTime));
+
+    TextOut->WriteText("    %-32s %11s %7s", "Stage", "Time (ms)", "Share");
+
+    for (int Stage = 0; Stage < LastBatchStage; Stage += 1) {
+        TextOut->WriteText(
+                "    %-32s %11.3f %6.1f%%",
+                BatchStageNames[Stage],
+                ToMilliseconds(m_BatchStages[Stage]),
+                (RunTime != 0) ? (100.0 * m_BatchStages[Stage] / RunTime) : 0.0);
+    }
+
+    for (int Stage = 0; Stage < LastStage; Stage += 1) {
+        TextOut->WriteText(
+                "    %-32s %11.3f %6.1f%%",
+                StageNames[Stage],
+                ToMilliseconds(m_Totals.Stages[Stage]),
+                (RunTime != 0) ? (100.0 * m_Totals.Stages[Stage] / RunTime) : 0.0);
+    }
+
+    TextOut->WriteText(
+            "    %lu include load(s) (part of the parse phases), %lu from the compiler's cache; resource cache hit rate %.1f%%",
+            m_Totals.IncludeLoads,
+            m_Totals.IncludeCacheHits,
+            ((m_CacheHits + m_CacheMisses) != 0) ? (100.0 * m_CacheHits / (m_CacheHits + m_CacheMisses)) : 0.0);
+
+    if (m_Files.empty())
+        return;
+
+    //
+    // List the slowest files, slowest first.
+    //
+
+    for (FileTimesVec::const_iterator it = m_Files.begin(); it != m_Files.end(); ++it)
+        Slowest.push_back(&*it);
+
+    Count = std::min< size_t >(Slowest.size(), SlowestFiles);
+
+    std::partial_sort(
+            Slowest.begin(),
+            Slowest.begin() + Count,
+            Slowest.end(),
+            [](const FileTimes * Left, const FileTimes * Right) {
+                return Left->Total > Right->Total;
+            });
+
+    TextOut->WriteText(
+            "Slowest %lu file(s), times in ms:",
+            (unsigned long) Count);
+
+    TextOut->WriteText(
+            "    %-32s %9s %9s %9s %9s %9s %9s %9s %9s %9s",
+            "File",
+            "Total",
+            "Load",
+            "Phase 1",
+            "Phase 2",
+            "CodeGen",
+            "NDB",
+            "Output",
+            "Includes",
+            "Loads");
+
+    for (size_t i = 0; i < Count; i += 1) {
+        const FileTimes * Times = Slowest[i];
+
+        TextOut->WriteText(
+                "    %-32s %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9.3f %9lu",
+                Times->FileName.c_str(),
+                ToMilliseconds(Times->Total),
+                ToMilliseconds(Times->Stages[StageSourceLoad]),
+                ToMilliseconds(Times->Stages[StagePhase1]),
+                ToMilliseconds(Times->Stages[StagePhase2]),
+                ToMilliseconds(Times->Stages[StageCodeGeneration]),
+                ToMilliseconds(Times->Stages[StageSymbols]),
+                ToMilliseconds(Times->Stages[StageOutput]),
+                ToMilliseconds(Times->Stages[StageIncludes]),
+                Times->IncludeLoads);
+    }
+}
+
+void
+TimeReport::Format(
+    std::vector< unsigned char > & Text
+    ) const
+/*++
+
+Routine Description:
+
+    This routine formats the report as JSON.  The report has the stages of
+    the run as a whole, the totals of the files and the times of each file
+    in the order they were compiled.
+
+Arguments:
+
+    Text - Receives the text of the report.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Report;
+    char Number[64];
+    unsigned long long RunTime;
+
+    RunTime = ((m_EndTime != 0) ? m_EndTime : NscGetTimestamp()) - m_StartTime;
+
+    snprintf(
+            Number,
+            sizeof(Number),
+            "{\n  \"run_ms\": %.3f,\n  \"batch\": {",
+            ToMilliseconds(RunTime));
+    Report = Number;
+
+    for (int Stage = 0; Stage < LastBatchStage; Stage += 1) {
+        snprintf(
+                Number,
+                sizeof(Number),
+                "%s\"%s\": %.3f",
+                (Stage != 0) ? ", " : "",
+                BatchStageKeys[Stage],
+                ToMilliseconds(m_BatchStages[Stage]));
+        Report += Number;
+    }
+
+    snprintf(
+            Number,
+            sizeof(Number),
+            ", \"cache_hits\": %llu, \"cache_misses\": %llu},\n  \"totals\": ",
+            m_CacheHits,
+            m_CacheMisses);
+    Report += Number;
+
+    AppendJsonTimes(Report, m_Totals);
+
+    Report += ",\n  \"files\": [";
+
+    for (FileTimesVec::const_iterator it = m_Files.begin(); it != m_Files.end(); ++it) {
+        Report += (it != m_Files.begin()) ? ",\n    {\"name\": " : "\n    {\"name\": ";
+        AppendJsonString(Report, it->FileName);
+        Report += ", \"times\": ";
+        AppendJsonTimes(Report, *it);
+        Report += "}";
+    }
+
+    Report += (m_Files.empty()) ? "]\n}\n" : "\n  ]\n}\n";
+
+    Text.assign(Report.begin(), Report.end());
+}
+
+double
+TimeReport::ToMilliseconds(
+    unsigned long long Time
+    )
+/*++
+
+Routine Description:
+
+    This routine converts a time in nanoseconds to milliseconds.
+
+Arguments:
+
+    Time - Supplies the time, in nanoseconds.
+
+Return Value:
+
+    The time in milliseconds.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    return (double) Time / 1000000.0;
+}
+
+void
+TimeReport::AppendJsonString(
+    std::string & Text,
+    const std::string & String
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a string to JSON text as a quoted string.
+
+Arguments:
+
+    Text - Supplies the text to append to.
+
+    String - Supplies the string.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Escape[8];
+
+    Text += '"';
+
+    for (std::string::const_iterator it = String.begin(); it != String.end(); ++it) {
+        unsigned char Char = (unsigned char) *it;
+
+        if ((Char == '"') || (Char == '\\')) {
+            Text += '\\';
+            Text += (char) Char;
+        } else if (Char < 0x20) {
+            snprintf(Escape, sizeof(Escape), "\\u%04x", Char);
+            Text += Escape;
+        } else {
+            Text += (char) Char;
+        }
+    }
+
+    Text += '"';
+}
+
+void
+TimeReport::AppendJsonTimes(
+    std::string & Text,
+    const FileTimes & Times
+    )
+/*++
+
+Routine Description:
+
+    This routine appends the times of a file (or the totals of the files) to
+    JSON text as an object.
+
+Arguments:
+
+    Text - Supplies the text to append to.
+
+    Times - Supplies the times.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char Number[64];
+
+    snprintf(Number, sizeof(Number), "{\"total_ms\": %.3f", ToMilliseconds(Times.Total));
+    Text += Number;
+
+    for (int Stage = 0; Stage < LastStage; Stage += 1) {
+        snprintf(
+                Number,
+                sizeof(Number),
+                ", \"%s\": %.3f",
+                StageKeys[Stage],
+                ToMilliseconds(Times.Stages[Stage]));
+        Text += Number;
+    }
+
+    snprintf(
+            Number,
+            sizeof(Number),
+            ", \"include_loads\": %lu, \"include_cache_hits\": %lu}",
+            Times.IncludeLoads,
+            Times.IncludeCacheHits);
+    Text += Number;
+}
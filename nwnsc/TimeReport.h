@@ -0,0 +1,221 @@
+/*++
+
+Module Name:
+
+    TimeReport.h
+
+Abstract:
+
+    This module defines the time report, which collects where the time of a
+    run goes for the --time-report option.  Each compiled file is timed by
+    stage (source load, the two parse phases, code generation, NDB emission
+    and handing off the output), along with its #include loads and their
+    resource cache hits.  The run as a whole adds the resource manager load,
+    the nwscript.nss initialization and the time spent writing the output.
+
+    The report is printed as a summary and a table of the slowest files, and
+    may also be written as JSON.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSC_TIMEREPORT_H
+#define _PROGRAMS_NWNSC_TIMEREPORT_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+
+struct IDebugTextOut;
+struct NscCompileTimings;
+
+class TimeReport
+{
+
+public:
+
+    //
+    // Define the stages that a file is timed by.  The include loads happen
+    // during the parse phases and are included in their times.
+    //
+
+    typedef enum _STAGE
+    {
+        StageSourceLoad,
+        StagePhase1,
+        StagePhase2,
+        StageCodeGeneration,
+        StageSymbols,
+        StageOutput,
+        StageIncludes,
+
+        LastStage
+    } STAGE, * PSTAGE;
+
+    //
+    // Define the stages of the run as a whole.
+    //
+
+    typedef enum _BATCH_STAGE
+    {
+        BatchKeyFileLoad,
+        BatchDiscoverResources,
+        BatchNWScriptInit,
+        BatchOutputWrite,
+
+        LastBatchStage
+    } BATCH_STAGE, * PBATCH_STAGE;
+
+    enum
+    {
+        SlowestFiles = 10
+    };
+
+    //
+    // Create a report.  If a file name is given, the report is also
+    // formatted as JSON for writing to that file.
+    //
+
+    TimeReport(
+        const std::string & FileName
+        );
+
+    ~TimeReport(
+        );
+
+    //
+    // Add to the time of a stage of the run as a whole.
+    //
+
+    void
+    AddBatchTime(
+        BATCH_STAGE Stage,
+        unsigned long long Time
+        );
+
+    //
+    // Start timing a file.  The file is only added to the report once
+    // EndFile is called.
+    //
+
+    void
+    BeginFile(
+        const std::string & FileName
+        );
+
+    //
+    // Add to the time of a stage of the current file.
+    //
+
+    void
+    AddFileTime(
+        STAGE Stage,
+        unsigned long long Time
+        );
+
+    //
+    // Finish timing the current file, taking the compiler's stage timings.
+    //
+
+    void
+    EndFile(
+        const NscCompileTimings & Timings
+        );
+
+    //
+    // Set the resource cache counters of the run.
+    //
+
+    void
+    SetCacheStatistics(
+        unsigned long long Hits,
+        unsigned long long Misses
+        );
+
+    //
+    // Stop the clock of the run as a whole.
+    //
+
+    void
+    Finish(
+        );
+
+    //
+    // Print the summary and the slowest files.
+    //
+
+    void
+    Print(
+        IDebugTextOut * TextOut
+        ) const;
+
+    //
+    // Format the report as JSON.
+    //
+
+    void
+    Format(
+        std::vector< unsigned char > & Text
+        ) const;
+
+    inline
+    const std::string &
+    GetFileName(
+        ) const
+    {
+        return m_FileName;
+    }
+
+private:
+
+    //
+    // Describes the times of one file, in nanoseconds.
+    //
+
+    struct FileTimes
+    {
+        std::string        FileName;
+        unsigned long long Total;
+        unsigned long long Stages[ LastStage ];
+        unsigned long      IncludeLoads;
+        unsigned long      IncludeCacheHits;
+    };
+
+    typedef std::vector< FileTimes > FileTimesVec;
+
+    static
+    double
+    ToMilliseconds(
+        unsigned long long Time
+        );
+
+    static
+    void
+    AppendJsonString(
+        std::string & Text,
+        const std::string & String
+        );
+
+    static
+    void
+    AppendJsonTimes(
+        std::string & Text,
+        const FileTimes & Times
+        );
+
+    std::string                       m_FileName;
+    unsigned long long                m_StartTime;
+    unsigned long long                m_EndTime;
+    unsigned long long                m_FileStartTime;
+    unsigned long long                m_BatchStages[ LastBatchStage ];
+    unsigned long long                m_CacheHits;
+    unsigned long long                m_CacheMisses;
+    FileTimes                         m_Current;
+    FileTimes                         m_Totals;
+    FileTimesVec                      m_Files;
+
+};
+
+#endif
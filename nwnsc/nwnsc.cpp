@@ -29,10 +29,21 @@ Abstract:
 #include <iostream>
 #include "../_NwnDataLib/TextOut.h"
 #include "../_NwnDataLib/ResourceManager.h"
+#include "../_NwnDataLib/BatchFileIo.h"
 #include "../_NscLib/Nsc.h"
+#include "../_NscLib/NscCompileWorkspace.h"
+#include "../_NscLib/NscCostAnalyzer.h"
+#include "../_NscLib/NscResourceCache.h"
+#include "../_NscLib/NscTrace.h"
 #include "../_NwnUtilLib/findfirst.h"
 #include "../_NwnUtilLib/version.h"
 #include "../_NwnUtilLib/JSON.h"
+#include "CostReport.h"
+#include "IncludePrefetcher.h"
+#include "OutputWriter.h"
+#include "ScriptDiff.h"
+#include "ScriptRunner.h"
+#include "TimeReport.h"
 
 #if defined(__linux__)
 #include <unistd.h>
@@ -180,6 +191,12 @@ public:
 
 PrintfTextOut g_TextOut;
 ResourceManager *g_ResMan;
+IncludePrefetcher *g_Prefetcher;
+BatchFileIo *g_FileIo;
+OutputWriter *g_OutputWriter;
+ScriptRunner *g_ScriptRunner;
+CostReport *g_CostReport;
+TimeReport *g_TimeReport;
 
 std::string ws2s(const std::wstring& wstr)
 {
@@ -846,6 +863,11 @@ Environment:
     // system.
     //
 
+    if ((g_Prefetcher != nullptr) &&
+        (g_Prefetcher->TakeInputFile(InFile, FileContents))) {
+        return true;
+    }
+
     if (!access(InFile.c_str(), 0)) {
         return LoadFileFromDisk(InFile, FileContents);
     } else {
@@ -854,6 +876,57 @@ Environment:
     }
 }
 
+void
+AddScriptCost(
+        NscCompiler &Compiler,
+        const char *ScriptName,
+        const std::vector<unsigned char> &Code,
+        const std::vector<unsigned char> &Symbols
+)
+/*++
+
+Routine Description:
+
+	This routine analyzes the static cost of a compiled script and adds it to
+	the cost report.  A script that cannot be decoded is left out.
+
+Arguments:
+
+	Compiler - Supplies the compiler context that will be used to process the
+	           request.
+
+	ScriptName - Supplies the name of the script.
+
+	Code - Supplies the compiled script.
+
+	Symbols - Supplies the debug symbols of the script, if any.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    NscScriptCost Cost;
+
+    if (!Compiler.NscAnalyzeScriptCost(
+            ScriptName,
+            (!Code.empty()) ? &Code[0] : nullptr,
+            Code.size(),
+            (!Symbols.empty()) ? &Symbols[0] : nullptr,
+            Symbols.size(),
+            Cost)) {
+        LOG(DEBUG) << "No cost report for undecodable script " << ScriptName;
+        return;
+    }
+
+    g_CostReport->AddScript(Cost);
+}
+
 bool
 CompileSourceFile(
         NscCompiler &Compiler,
@@ -896,7 +969,7 @@ Arguments:
 	        messages should be silenced.
 
 	VerifyCode - Supplies a Boolean value that indicates true if generated code
-	             is to be verified with the analyzer/verifier if compilation was
+	             is to be verified with the bytecode verifier if compilation was
 	             successful.
 
 	TextOut - Supplies the text out interface used to receive any diagnostics
@@ -930,7 +1003,7 @@ Environment:
     std::set<std::string> Dependencies;
     NscResult Result;
     std::string FileName;
-    FILE *f;
+    bool NeedSymbols;
 
     char filec[_MAX_FNAME];
 
@@ -941,9 +1014,20 @@ Environment:
     }
 
     //
-    // Execute the main compilation pass.
+    // Execute the main compilation pass.  The code and the debug symbols are
+    // written straight into the output buffers.  Debug symbols are only
+    // generated if they are written out, or if the verifier, the cost report
+    // or the script runner will read them.
     //
 
+    NeedSymbols = (!SuppressDebugSymbols) ||
+                  (VerifyCode) ||
+                  (g_CostReport != nullptr) ||
+                  (g_ScriptRunner != nullptr);
+
+    CNwnVectorStream CodeStream(Code);
+    CNwnVectorStream SymbolsStream(Symbols);
+
     Result = Compiler.NscCompileScript(
             InFile,
             (!InFileContents.empty()) ? &InFileContents[0] : nullptr,
@@ -953,8 +1037,8 @@ Environment:
             IgnoreIncludes,
             TextOut,
             CompilerFlags,
-            Code,
-            Symbols,
+            &CodeStream,
+            NeedSymbols ? &SymbolsStream : nullptr,
             Dependencies);
 
     switch (Result) {
@@ -986,128 +1070,128 @@ Environment:
     }
 
     //
-    // If we compiled successfully, write the results to disk.
+    // If code verification was requested, check the instruction stream before
+    // anything is written.
     //
 
-    FileName = OutBaseFile;
-
-    if (FileName == "SKIP_OUTPUT") {
-        TextOut->WriteText(
-                "Skipped compiled file generation.\n");
-        return true;
-    }
-
-    FileName += ".ncs";
-    f = fopen(FileName.c_str(), "wb");
-
-    if (f == nullptr) {
-        LOG(DEBUG) << "Error Number " << errno;
+    if ((VerifyCode) &&
+        (!Compiler.NscVerifyScript(
+                InFile.RefStr,
+                (!Code.empty()) ? &Code[0] : nullptr,
+                Code.size(),
+                (!Symbols.empty()) ? &Symbols[0] : nullptr,
+                Symbols.size(),
+                TextOut))) {
         TextOut->WriteText(
-                "Error: Unable to open output file %s.\n",
-                FileName.c_str());
+                "Compilation aborted with errors.\n");
 
         return false;
     }
 
-    if (!Code.empty()) {
-        if (fwrite(&Code[0], Code.size(), 1, f) != 1) {
-            fclose(f);
+    //
+    // If a cost report was requested, analyze the code that was generated.
+    //
 
-            TextOut->WriteText(
-                    "Error: Failed to write to output file %s.\n",
-                    FileName.c_str());
+    if (g_CostReport != nullptr)
+        AddScriptCost(Compiler, InFile.RefStr, Code, Symbols);
 
-            return false;
-        }
-    }
-
-    fclose(f);
+    //
+    // If script execution was requested, run the script now.  Its output is
+    // still written below.
+    //
 
-    if (!SuppressDebugSymbols) {
-        FileName = OutBaseFile;
-        FileName += ".ndb";
+    if ((g_ScriptRunner != nullptr) &&
+        (!g_ScriptRunner->RunScript(InFile.RefStr, Code, Symbols))) {
+        return false;
+    }
 
-        f = fopen(FileName.c_str(), "wb");
+    //
+    // If we compiled successfully, write the results to disk.
+    //
 
-        if (f == nullptr) {
-            TextOut->WriteText(
-                    "Error: Failed to open debug symbols file %s.\n",
-                    FileName.c_str());
+    FileName = OutBaseFile;
 
-            return false;
-        }
+    if (FileName == "SKIP_OUTPUT") {
+        TextOut->WriteText(
+                "Skipped compiled file generation.\n");
+        return true;
+    }
 
-        if (!Symbols.empty()) {
-            if (fwrite(&Symbols[0], Symbols.size(), 1, f) != 1) {
-                fclose(f);
+    //
+    // Hand the output files to the output writer, which writes them in the
+    // background (skipping any that are unchanged on disk).
+    //
 
-                TextOut->WriteText(
-                        "Error: Failed to write to debug symbols file %s.\n",
-                        FileName.c_str());
+    OutputWriter::OutputFileVec Files;
 
-                return false;
-            }
-        }
+    Files.resize(1);
+    Files.back().FileName = OutBaseFile + ".ncs";
+    Files.back().Contents.swap(Code);
+    Files.back().OpenError = "Error: Unable to open output file %s.\n";
+    Files.back().WriteError = "Error: Failed to write to output file %s.\n";
 
-        fclose(f);
+    if (!SuppressDebugSymbols) {
+        Files.resize(Files.size() + 1);
+        Files.back().FileName = OutBaseFile + ".ndb";
+        Files.back().Contents.swap(Symbols);
+        Files.back().OpenError = "Error: Failed to open debug symbols file %s.\n";
+        Files.back().WriteError = "Error: Failed to write to debug symbols file %s.\n";
     }
 
     if (CompilerFlags & NscCompilerFlag_GenerateMakeDeps) {
-        FileName = OutBaseFile;
-        FileName += ".d";
-
-        f = fopen(FileName.c_str(), "w");
-
-        if (f == nullptr) {
-            TextOut->WriteText(
-                    "Error: Failed to open dependency file %s.\n",
-                    FileName.c_str());
-
-            return false;
-        }
+        std::string DepsText;
 
         if (!Dependencies.empty()) {
             // NCS primarily depends on the NSS
-            fprintf(f, "%s.ncs: %s.nss ", OutBaseFile.c_str(), OutBaseFile.c_str());
+            DepsText = OutBaseFile + ".ncs: " + OutBaseFile + ".nss ";
 
             // Print all other dependencies
             for (auto& dep : Dependencies)
-                fprintf(f, " \\\n    %s", dep.c_str());
+                DepsText += " \\\n    " + dep;
 
             // Create phony rules for dependencies, so deleting them doesn't
             // require deleting all .d files as well.
             for (auto& dep : Dependencies)
-                fprintf(f, "\n%s:\n", dep.c_str());
+                DepsText += "\n" + dep + ":\n";
         }
 
-        fclose(f);
+        Files.resize(Files.size() + 1);
+        Files.back().FileName = OutBaseFile + ".d";
+        Files.back().Contents.assign(DepsText.begin(), DepsText.end());
+        Files.back().OpenError = "Error: Failed to open dependency file %s.\n";
+        Files.back().WriteError = "Error: Failed to write to dependency file %s.\n";
     }
+
+    UINT64 SubmitStart = NscGetTimestamp();
+
+    g_OutputWriter->Submit(Files);
+
+    if (g_TimeReport != nullptr)
+        g_TimeReport->AddFileTime(TimeReport::StageOutput, NscGetTimestamp() - SubmitStart);
+
     return true;
 }
 
 
 bool
 DisassembleScriptFile(
-        ResourceManager &ResMan,
         NscCompiler &Compiler,
         bool Quiet,
         IDebugTextOut *TextOut,
         const NWN::ResRef32 &InFile,
         const std::vector<unsigned char> &InFileContents,
-        const std::vector<unsigned char> &DbgFileContents,
         const std::string &OutBaseFile
 )
 /*++
 
 Routine Description:
 
-	This routine processes a single input file according to the desired compile
-	or diassemble options.
+	This routine disassembles a single compiled script.  The disassembly is
+	produced from the script image in memory and handed to the output writer;
+	no other files are written.
 
 Arguments:
 
-	ResMan - Supplies the resource manager to use to service file load requests.
-
 	NscCompiler - Supplies the compiler context that will be used to process the
 	              request.
 
@@ -1121,9 +1205,6 @@ Arguments:
 
 	InFileContents - Supplies the contents of the input file.
 
-	DbgFileContents - Supplies the contents of the associated debug symbols, if
-	                  any could be located.  This may be empty.
-
 	OutBaseFile - Supplies the base name (potentially including path) of the
 	              output file.  No extension is present.
 
@@ -1141,11 +1222,6 @@ Environment:
 --*/
 {
     std::string Disassembly;
-    std::string FileName;
-    std::string ScriptTempFile;
-    std::string SymbolsTempFile;
-    FILE *f;
-    std::list<NscPrototypeDefinition> ActionPrototypes;
 
     if (!Quiet) {
         TextOut->WriteText(
@@ -1162,101 +1238,19 @@ Environment:
             InFileContents.size(),
             Disassembly);
 
-    FileName = OutBaseFile;
-    FileName += ".pcode";
-
-    f = fopen(FileName.c_str(), "wt");
-
-    if (f == nullptr) {
-        TextOut->WriteText(
-                "Error: Unable to open disassembly file %s.\n",
-                FileName.c_str());
-
-        return false;
-    }
-
-    if (!Disassembly.empty()) {
-        if (fwrite(&Disassembly[0], Disassembly.size(), 1, f) != 1) {
-            fclose(f);
-
-            TextOut->WriteText(
-                    "Error: Failed to write to disassembly file %s.\n",
-                    FileName.c_str());
-
-            return false;
-        }
-    }
-
-    fclose(f);
-
-    //
-    // Now attempt to raise the script to the high level IR and print the IR out
-    // as well.
     //
-    // The script analyzer only operates on disk files, and the input file may
-    // have come from the resource system, so we'll need to write it back out to
-    // a temporary location first.
+    // Hand the disassembly to the output writer, as for compiler output.
     //
 
-    FileName = ResMan.GetResTempPath();
-    FileName += "NWNScriptCompilerTempScript.ncs";
+    OutputWriter::OutputFileVec Files;
 
-    f = fopen(FileName.c_str(), "wb");
+    Files.resize(1);
+    Files.back().FileName = OutBaseFile + ".pcode";
+    Files.back().Contents.assign(Disassembly.begin(), Disassembly.end());
+    Files.back().OpenError = "Error: Unable to open disassembly file %s.\n";
+    Files.back().WriteError = "Error: Failed to write to disassembly file %s.\n";
 
-    if (f == nullptr) {
-        TextOut->WriteText(
-                "Error: Unable to open script temporary file %s.\n",
-                FileName.c_str());
-
-        return false;
-    }
-
-    if (!InFileContents.empty()) {
-        if (fwrite(&InFileContents[0], InFileContents.size(), 1, f) != 1) {
-            fclose(f);
-
-            TextOut->WriteText(
-                    "Error: Failed to write to script temporary file %s.\n",
-                    FileName.c_str());
-
-            return false;
-        }
-    }
-
-    ScriptTempFile = FileName;
-
-    fclose(f);
-
-    if (!DbgFileContents.empty()) {
-        FileName = ResMan.GetResTempPath();
-        FileName += "NWNScriptCompilerTempScript.ndb";
-
-        f = fopen(FileName.c_str(), "wb");
-
-        if (f == nullptr) {
-            TextOut->WriteText(
-                    "Error: Unable to open symbols temporary file %s.\n",
-                    FileName.c_str());
-
-            return false;
-        }
-
-        if (!DbgFileContents.empty()) {
-            if (fwrite(&DbgFileContents[0], DbgFileContents.size(), 1, f) != 1) {
-                fclose(f);
-
-                TextOut->WriteText(
-                        "Error: Failed to write to symbols temporary file %s.\n",
-                        FileName.c_str());
-
-                return false;
-            }
-        }
-
-        fclose(f);
-
-        SymbolsTempFile = FileName;
-    }
+    g_OutputWriter->Submit(Files);
 
     return true;
 }
@@ -1309,8 +1303,8 @@ Arguments:
 	        messages should be silenced.
 
 	VerifyCode - Supplies a Boolean value that indicates true if generated code
-	             is to be verified with the analyzer/verifier if compilation was
-	             successful.
+	             is to be verified with the bytecode verifier if compilation was
+	             successful, or before a script is disassembled.
 
 	TextOut - Supplies the text out interface used to receive any diagnostics
 	          issued.
@@ -1339,11 +1333,25 @@ Environment:
     NWN::ResRef32 FileResRef;
     NWN::ResType FileResType;
     std::vector<unsigned char> InFileContents;
+    UINT64 LoadStart;
+    NscTraceScope Trace((Compile) ? "Compile" : "Disassemble", "compile", InFile.c_str());
+
+    //
+    // Let the include prefetcher (if any) move on to the files that follow.
+    //
+
+    if (g_Prefetcher != nullptr)
+        g_Prefetcher->Advance();
 
     //
     // Pull in the input file first.
     //
 
+    if ((Compile) && (g_TimeReport != nullptr))
+        g_TimeReport->BeginFile(InFile);
+
+    LoadStart = NscGetTimestamp();
+
     if (!LoadInputFile(
             ResMan,
             TextOut,
@@ -1362,7 +1370,12 @@ Environment:
     //
 
     if (Compile) {
-        return CompileSourceFile(
+        bool Compiled;
+
+        if (g_TimeReport != nullptr)
+            g_TimeReport->AddFileTime(TimeReport::StageSourceLoad, NscGetTimestamp() - LoadStart);
+
+        Compiled = CompileSourceFile(
                 Compiler,
                 CompilerVersion,
                 Optimize,
@@ -1376,6 +1389,10 @@ Environment:
                 InFileContents,
                 OutBaseFile);
 
+        if (g_TimeReport != nullptr)
+            g_TimeReport->EndFile(Compiler.NscGetCompileTimings());
+
+        return Compiled;
     } else {
         std::vector<unsigned char> DbgFileContents;
         std::string DbgFileName;
@@ -1405,14 +1422,33 @@ Environment:
             }
         }
 
+        if ((VerifyCode) &&
+            (!Compiler.NscVerifyScript(
+                    FileResRef.RefStr,
+                    (!InFileContents.empty()) ? &InFileContents[0] : nullptr,
+                    InFileContents.size(),
+                    (!DbgFileContents.empty()) ? &DbgFileContents[0] : nullptr,
+                    DbgFileContents.size(),
+                    TextOut))) {
+            return false;
+        }
+
+        if (g_CostReport != nullptr)
+            AddScriptCost(Compiler, FileResRef.RefStr, InFileContents, DbgFileContents);
+
+        if (g_ScriptRunner != nullptr) {
+            return g_ScriptRunner->RunScript(
+                    FileResRef.RefStr,
+                    InFileContents,
+                    DbgFileContents);
+        }
+
         return DisassembleScriptFile(
-                ResMan,
                 Compiler,
                 Quiet,
                 TextOut,
                 FileResRef,
                 InFileContents,
-                DbgFileContents,
                 OutBaseFile);
     }
 }
@@ -1466,8 +1502,8 @@ Arguments:
 	        messages should be silenced.
 
 	VerifyCode - Supplies a Boolean value that indicates true if generated code
-	             is to be verified with the analyzer/verifier if compilation was
-	             successful.
+	             is to be verified with the bytecode verifier if compilation was
+	             successful, or before a script is disassembled.
 
 	Flags - Supplies control flags that alter the behavior of the operation.
 	        Legal values are drawn from the NSCD_FLAGS enumeration.
@@ -1632,6 +1668,99 @@ Environment:
     return Status;
 }
 
+void
+QueuePrefetchInputFiles(
+        IncludePrefetcher &Prefetcher,
+        const std::vector<std::string> &InFiles
+)
+/*++
+
+Routine Description:
+
+	This routine queues the input files for include prefetching, in the same
+	order in which they will be compiled.  Wildcard input files are expanded
+	the same way ProcessWildcardInputFile expands them.
+
+Arguments:
+
+	Prefetcher - Supplies the include prefetcher to queue the files with.
+
+	InFiles - Supplies the input files (possibly containing wildcards).
+
+Return Value:
+
+	None.  On failure, an std::exception is raised.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    for (std::vector<std::string>::const_iterator it = InFiles.begin();
+         it != InFiles.end();
+         ++it) {
+        if (it->find_first_of("*?") == std::string::npos) {
+            Prefetcher.AddInputFile(*it);
+            continue;
+        }
+
+        struct _finddata_t FindData;
+        intptr_t FindHandle;
+        std::string WildcardRoot;
+
+#if defined(_WINDOWS)
+        char Drive[ _MAX_DRIVE ];
+        char Dir[ _MAX_DIR ];
+
+        if (_splitpath_s(
+            it->c_str( ),
+            Drive,
+            _MAX_DRIVE,
+            Dir,
+            _MAX_DIR,
+            nullptr,
+            0,
+            nullptr,
+            0))
+        {
+            continue;
+        }
+
+        WildcardRoot = Drive;
+        WildcardRoot += Dir;
+
+        if ((WildcardRoot.length() > 0) && (WildcardRoot.back() != '\\'))
+            WildcardRoot.push_back('\\');
+#else
+        char *dirc = strdup(it->c_str());
+
+        if (dirc == nullptr)
+            continue;
+
+        WildcardRoot = dirname(dirc);
+        free(dirc);
+
+        if (WildcardRoot.back() != '/')
+            WildcardRoot.push_back('/');
+#endif
+
+        FindHandle = _findfirst(it->c_str(), &FindData);
+
+        if (FindHandle == -1)
+            continue;
+
+        do {
+            if (FindData.attrib & _A_SUBDIR)
+                continue;
+
+            Prefetcher.AddInputFile(WildcardRoot + FindData.name);
+        } while (!_findnext(FindHandle, &FindData));
+
+        _findclose(FindHandle);
+    }
+}
+
 bool
 LoadResponseFile(
         int argc,
@@ -1787,6 +1916,18 @@ Environment:
     int ReturnCode = 0;
     bool VerifyCode = false;
     bool Usage = false;
+    bool IoBackendSet = false;
+    BatchFileIo::BACKEND IoBackend = BatchFileIo::BackendSync;
+    bool RunScripts = false;
+    unsigned long RunIterations = 1;
+    std::vector<std::string> Mocks;
+    std::string CostReportFile;
+    bool TimeReportEnabled = false;
+    std::string TimeReportFile;
+    std::string TraceFile;
+    bool DiffScripts = false;
+    std::string DiffDirA;
+    std::string DiffDirB;
     unsigned long Errors = 0;
     unsigned long Flags = NscDFlag_StopOnError;
     UINT32 CompilerFlags = 0;
@@ -1828,7 +1969,80 @@ Environment:
             // If it's a switch, consume it.  Otherwise it is an input file.
             //
 
-            if (argv[i][0] == '-') {
+            if ((argv[i][0] == '-') && (argv[i][1] == '-')) {
+                const char *Option;
+
+                Option = &argv[i][2];
+
+                if (!strncmp(Option, "io=", 3)) {
+                    if (!BatchFileIo::ParseBackendName(Option + 3, IoBackend)) {
+                        g_TextOut.WriteText("Error: Unrecognized I/O backend \"%s\".\n", Option + 3);
+                        Error = true;
+                        break;
+                    }
+
+                    IoBackendSet = true;
+                } else if (!strcmp(Option, "run")) {
+                    RunScripts = true;
+                } else if (!strncmp(Option, "bench=", 6)) {
+                    RunIterations = strtoul(Option + 6, nullptr, 10);
+
+                    if (RunIterations == 0) {
+                        g_TextOut.WriteText("Error: Invalid iteration count \"%s\".\n", Option + 6);
+                        Error = true;
+                        break;
+                    }
+
+                    RunScripts = true;
+                } else if (!strncmp(Option, "mock=", 5)) {
+                    Mocks.push_back(Option + 5);
+                } else if (!strncmp(Option, "cost-report=", 12)) {
+                    CostReportFile = Option + 12;
+
+                    if (CostReportFile.empty()) {
+                        g_TextOut.WriteText("Error: Malformed arguments.\n");
+                        Error = true;
+                        break;
+                    }
+                } else if (!strcmp(Option, "time-report")) {
+                    TimeReportEnabled = true;
+                } else if (!strncmp(Option, "time-report=", 12)) {
+                    TimeReportFile = Option + 12;
+
+                    if (TimeReportFile.empty()) {
+                        g_TextOut.WriteText("Error: Malformed arguments.\n");
+                        Error = true;
+                        break;
+                    }
+
+                    TimeReportEnabled = true;
+                } else if (!strcmp(Option, "trace")) {
+                    if (i + 1 >= argc) {
+                        g_TextOut.WriteText("Error: Malformed arguments.\n");
+                        Error = true;
+                        break;
+                    }
+
+                    TraceFile = argv[i + 1];
+                    i += 1;
+                } else if (!strcmp(Option, "diff")) {
+                    if (i + 2 >= argc) {
+                        g_TextOut.WriteText("Error: Malformed arguments.\n");
+                        Error = true;
+                        break;
+                    }
+
+                    DiffDirA = argv[i + 1];
+                    DiffDirB = argv[i + 2];
+                    DiffScripts = true;
+
+                    i += 2;
+                } else {
+                    g_TextOut.WriteText("Error: Unrecognized option \"%s\".\n", argv[i]);
+                    Error = true;
+                    break;
+                }
+            } else if (argv[i][0] == '-') {
                 const char *Switches;
                 char Switch;
 
@@ -2005,6 +2219,21 @@ Environment:
                             Optimize = true;
                             break;
 
+                        case 'O': {
+                            int Level = 1;
+
+                            if (isdigit((wint_t) (unsigned) *Switches))
+                                Level = *Switches++ - '0';
+
+                            Optimize = (Level > 0);
+
+                            if (Level >= 2)
+                                CompilerFlags |= NscCompilerFlag_OptimizeLevel2;
+                            else
+                                CompilerFlags &= ~(NscCompilerFlag_OptimizeLevel2);
+                        }
+                            break;
+
                         case 'c':
                             IgnoreIncludes = false;
                             break;
@@ -2132,17 +2361,42 @@ Environment:
     } while (!Error);
 
 
-    if ((Usage) || (Error) || (InFiles.empty())) {
+    if ((Usage) || (Error) || ((InFiles.empty()) && (!DiffScripts))) {
         g_TextOut.WriteText(
                 "\nUsage: version %s - built %s %s\n\n"
-                        "nwnsc [-degjklorsqvwyM] [-b batchoutdir] [-h homedir] [-i pathspec] [-n installdir]\n"
-                        "      [-m mode] [-x errprefix] [-r outfile] infile [infile...]\n\n"
+                        "nwnsc [-adegjklorsqvwyM] [-Olevel] [-b batchoutdir] [-h homedir] [-i pathspec] [-n installdir]\n"
+                        "      [-m mode] [-x errprefix] [-r outfile] [--io=backend] [--run] [--bench=N]\n"
+                        "      [--mock=Name=Value] [--cost-report=file] [--time-report[=file]]\n"
+                        "      [--trace file] infile [infile...]\n"
+                        "nwnsc [--io=backend] --diff dirA dirB\n\n"
                         "  -b batchoutdir - Supplies the location where batch mode places output files\n"
                         "  -h homedir     - Per-user NWN home directory (i.e. Documents\\Neverwinter Nights)\n"
                         "  -i pathspec    - Semicolon separated list of folders to search for additional includes\n"
                         "  -n installdir  - Neverwinter Nights install folder. Use to load base game includes\n"
                         "  -m mode        - Compiler mode 1.69 or 1.74 - (default 1.74) \n"
-                        "  -x errprefix   - Prefix string to prepend to compiler errors (default \"Error\")\n\n"
+                        "  -x errprefix   - Prefix string to prepend to compiler errors (default \"Error\")\n"
+                        "  --io=backend   - File I/O backend: sync, threads, uring or auto (default: auto in\n"
+                        "                   batch mode, else sync)\n"
+                        "  --run          - Execute each script on the offline VM (after compiling it, or\n"
+                        "                   directly with -d) and report instructions, stack use and time\n"
+                        "                   per function.  Engine actions are mocked or stubbed\n"
+                        "  --bench=N      - As --run, but execute each script N times and report averages\n"
+                        "  --mock=Name=Value - Make the action Name always return Value under --run\n"
+                        "  --cost-report=file - Write the static cost of each function of each script\n"
+                        "                   (instructions by opcode class, actions called, deepest stack\n"
+                        "                   and loop nesting) to file, as CSV if it ends in .csv, else JSON\n"
+                        "  --time-report[=file] - Report the time spent in each stage of the compilation\n"
+                        "                   (resource load, parsing, code generation, output) and the\n"
+                        "                   slowest files, and write the times of each file to file as\n"
+                        "                   JSON\n"
+                        "  --trace file   - Record the file compiles, include loads, parse phases and\n"
+                        "                   code generation of each thread to file in Chrome trace\n"
+                        "                   format (for chrome://tracing or Perfetto)\n"
+                        "  --diff dirA dirB - Compare the compiled scripts of two directories function by\n"
+                        "                   function, ignoring code that only moved, and report the\n"
+                        "                   differences and instruction count changes\n\n"
+                        "  -a - Verify the compiled (or, with -d, the disassembled) script: branch\n"
+                        "       targets, stack depths and calls against the .ndb prototypes\n"
                         "  -d - Disassemble the script (overrides default compile\n"
                         "  -c - Compile includes\n"
                         "  -e - Enable non-BioWare extensions\n"
@@ -2150,7 +2404,10 @@ Environment:
                         "  -j - Show where include file are being sourced from\n"
                         "  -k - Show preprocessed source text to console output\n"
                         "  -l - Load base game resources - not required with -n\n"
-                        "  -o - Optimize the compiled script\n"
+                        "  -o - Optimize the compiled script (includes a peephole pass over the NCS\n"
+                        "       code, so output differs from releases without it)\n"
+                        "  -O<level> - Optimization level: -O0 none, -O1 same as -o, -O2 also applies\n"
+                        "       optimizations that trade code size for speed (e.g. switch dispatch)\n"
                         "  -p - Dump internal PCode for compiled script contributions\n"
                         "  -q - Silence most messages\n"
                         "  -r - Filename for output file\n"
@@ -2200,6 +2457,28 @@ Environment:
 
     el::Loggers::reconfigureLogger("default", defaultConf);
 
+    //
+    // Comparing compiled scripts needs neither the resource manager nor the
+    // compiler.
+    //
+
+    if (DiffScripts) {
+        std::unique_ptr<BatchFileIo> DiffFileIo;
+
+        DiffFileIo = BatchFileIo::Create((IoBackendSet) ? IoBackend : BatchFileIo::BackendAuto);
+
+        ScriptDiff Differ(&g_TextOut, *DiffFileIo);
+
+        ReturnCode = (Differ.DiffDirectories(DiffDirA, DiffDirB)) ? 0 : 1;
+
+        if (g_Log != nullptr) {
+            fclose(g_Log);
+            g_Log = nullptr;
+        }
+
+        return ReturnCode;
+    }
+
     //
     // Create the resource manager context and load the module, if we are to
     // load one.
@@ -2221,6 +2500,24 @@ Environment:
         return 0;
     }
 
+    //
+    // If a trace or a time report was requested, start recording before the
+    // game resources are loaded.
+    //
+
+    if (!TraceFile.empty()) {
+        NscTrace::SetThreadName("nwnsc");
+        NscTrace::Start();
+    }
+
+    std::unique_ptr<TimeReport> Times;
+
+    if (TimeReportEnabled) {
+        Times.reset(new TimeReport(TimeReportFile));
+
+        g_TimeReport = Times.get();
+    }
+
     if (LoadResources) {
         //
         // If we're to load game resources, then do so now.
@@ -2238,6 +2535,8 @@ Environment:
         if (HomeDir.empty())
             HomeDir = GetNwnHomePath(CompilerVersion, Quiet);
 
+        NscTraceScope Trace("Load game resources", "resources");
+
         LoadScriptResources(
                 *g_ResMan,
                 HomeDir,
@@ -2245,6 +2544,11 @@ Environment:
                 Erf16,
                 CompilerVersion);
 
+        if (Times) {
+            Times->AddBatchTime(TimeReport::BatchKeyFileLoad, g_ResMan->GetKeyFileLoadTime());
+            Times->AddBatchTime(TimeReport::BatchDiscoverResources, g_ResMan->GetDiscoverResourcesTime());
+        }
+
         if (CompilerVersion >= 174) {
             std::string Override = InstallDir + "ovr";
 
@@ -2273,6 +2577,100 @@ Environment:
 
     Compiler.NscSetResourceCacheEnabled(true);
 
+    //
+    // If scripts are to be executed, create the script runner, which binds
+    // the engine actions through the compiler's nwscript.nss prototypes.
+    //
+
+    std::unique_ptr<ScriptRunner> Runner;
+
+    if (RunScripts) {
+        Runner.reset(new ScriptRunner(
+                Compiler,
+                CompilerVersion,
+                &g_TextOut,
+                RunIterations));
+
+        for (std::vector<std::string>::const_iterator it = Mocks.begin();
+             it != Mocks.end();
+             ++it) {
+            if (!Runner->AddScriptedMock(it->c_str())) {
+                g_TextOut.WriteText("Error: Malformed mock \"%s\" (expected Name=Value).\n", it->c_str());
+                return -1;
+            }
+        }
+
+        g_ScriptRunner = Runner.get();
+    }
+
+    //
+    // If a cost report was requested, collect the costs of the scripts as
+    // they are processed.  The report is written once all are done.
+    //
+
+    std::unique_ptr<CostReport> Costs;
+
+    if (!CostReportFile.empty()) {
+        Costs.reset(new CostReport(CostReportFile));
+
+        g_CostReport = Costs.get();
+    }
+
+    //
+    // In batch or wildcard mode, prefetch the includes of upcoming input files
+    // into the resource cache on a background thread.
+    //
+
+    std::unique_ptr<IncludePrefetcher> Prefetcher;
+    std::unique_ptr<BatchFileIo> FileIo;
+    bool BatchMode;
+
+    BatchMode = ((InFiles.size() > 1) ||
+                 ((InFiles.size() == 1) && (InFiles[0].find_first_of("*?") != std::string::npos)));
+
+    //
+    // Select the file I/O backend.  Batching reads and writes only pays off
+    // when there are many files to touch, so a single input file uses plain
+    // synchronous I/O unless a backend was requested explicitly.
+    //
+
+    if (!IoBackendSet)
+        IoBackend = (BatchMode) ? BatchFileIo::BackendAuto : BatchFileIo::BackendSync;
+
+    FileIo = BatchFileIo::Create(IoBackend);
+    g_FileIo = FileIo.get();
+
+    LOG(DEBUG) << "File I/O backend: " << BatchFileIo::GetBackendName(FileIo->GetBackend());
+
+    //
+    // Compiler output is written on a background thread, which leaves outputs
+    // that are unchanged on disk untouched.
+    //
+
+    std::unique_ptr<OutputWriter> Writer(new OutputWriter(*FileIo, 256));
+
+    Writer->Start();
+    g_OutputWriter = Writer.get();
+
+    if ((Compile) && (BatchMode)) {
+        try {
+            Prefetcher.reset(new IncludePrefetcher(
+                    SearchPaths,
+                    Compiler.NscGetResourceCache(),
+                    *FileIo,
+                    8));
+
+            QueuePrefetchInputFiles(*Prefetcher, InFiles);
+
+            Prefetcher->Start();
+            g_Prefetcher = Prefetcher.get();
+        }
+        catch (std::exception &e) {
+            LOG(DEBUG) << "Include prefetch disabled: " << e.what();
+            Prefetcher.reset();
+        }
+    }
+
     //
     // Process each of the input files in turn.
     //
@@ -2372,6 +2770,14 @@ Environment:
                     ThisOutFile);
         }
 
+        //
+        // Output write failures are reported asynchronously, and count as
+        // errors against whichever input file is being processed.
+        //
+
+        if (Writer->ReportFailures(&g_TextOut) != 0)
+            Status = false;
+
         if (!Status) {
             ReturnCode = -1;
 
@@ -2384,6 +2790,24 @@ Environment:
         }
     }
 
+    Writer->Flush();
+
+    if (Writer->ReportFailures(&g_TextOut) != 0) {
+        ReturnCode = -1;
+        Errors += 1;
+    }
+
+    if (Times) {
+        NscResourceCache::Statistics CacheStats;
+
+        Compiler.NscGetResourceCache()->GetStatistics(CacheStats);
+
+        Times->AddBatchTime(TimeReport::BatchOutputWrite, Writer->GetWriteTime());
+        Times->SetCacheStatistics(CacheStats.Hits, CacheStats.Misses);
+        Times->Finish();
+        Times->Print(&g_TextOut);
+    }
+
 #if defined(_WINDOWS)
     if (!Quiet)
     {
@@ -2405,6 +2829,88 @@ Environment:
     if (Errors > 1)
         g_TextOut.WriteText("%lu error(s) processing input files.\n", Errors);
 
+    if (Prefetcher) {
+        g_Prefetcher = nullptr;
+        Prefetcher->Stop();
+
+        LOG(DEBUG) << "Prefetched " << Prefetcher->GetPrefetchedCount() << " include file(s)";
+    }
+
+    if (Costs) {
+        OutputWriter::OutputFileVec Files;
+
+        Files.resize(1);
+        Files.back().FileName = Costs->GetFileName();
+        Files.back().OpenError = "Error: Unable to open cost report file %s.\n";
+        Files.back().WriteError = "Error: Failed to write to cost report file %s.\n";
+
+        Costs->Format(Files.back().Contents);
+        Writer->Submit(Files);
+    }
+
+    if (!TraceFile.empty()) {
+        OutputWriter::OutputFileVec Files;
+        std::string Trace;
+
+        NscTrace::Stop();
+        NscTrace::Format(Trace);
+
+        Files.resize(1);
+        Files.back().FileName = TraceFile;
+        Files.back().Contents.assign(Trace.begin(), Trace.end());
+        Files.back().OpenError = "Error: Unable to open trace file %s.\n";
+        Files.back().WriteError = "Error: Failed to write to trace file %s.\n";
+
+        Writer->Submit(Files);
+    }
+
+    if ((Times) && (!Times->GetFileName().empty())) {
+        OutputWriter::OutputFileVec Files;
+
+        Files.resize(1);
+        Files.back().FileName = Times->GetFileName();
+        Files.back().OpenError = "Error: Unable to open time report file %s.\n";
+        Files.back().WriteError = "Error: Failed to write to time report file %s.\n";
+
+        Times->Format(Files.back().Contents);
+        Writer->Submit(Files);
+    }
+
+    //
+    // The reports are written after the compile loop checked for its last
+    // output write failures, so check for failures writing them now.
+    //
+
+    Writer->Flush();
+
+    if (Writer->ReportFailures(&g_TextOut) != 0)
+        ReturnCode = -1;
+
+    g_TimeReport = nullptr;
+    g_CostReport = nullptr;
+    g_ScriptRunner = nullptr;
+    g_OutputWriter = nullptr;
+    Writer->Stop();
+
+    LOG(DEBUG) << "Wrote " << Writer->GetWrittenCount() << " output file(s), "
+               << Writer->GetUnchangedCount() << " unchanged";
+
+    NscCompileWorkspace::Statistics WorkspaceStats;
+
+    Compiler.NscGetCompileWorkspace().GetStatistics(WorkspaceStats);
+
+    LOG(DEBUG) << "Compile workspace: " << WorkspaceStats.Compiles << " compile(s), "
+               << WorkspaceStats.CodeAllocations << " code buffer, "
+               << WorkspaceStats.SymbolTableAllocations << " symbol table, "
+               << WorkspaceStats.PStackEntryAllocations << " parser entry, "
+               << WorkspaceStats.LineTableAllocations << " line table and "
+               << WorkspaceStats.DebugTextAllocations << " debug text allocation(s), "
+               << WorkspaceStats.Shrinks << " shrink(s)";
+
+    Writer.reset();
+    g_FileIo = nullptr;
+    FileIo.reset();
+
     if (g_Log != nullptr) {
         fclose(g_Log);
         g_Log = nullptr;
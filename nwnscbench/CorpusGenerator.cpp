@@ -0,0 +1,2347 @@
+/*++
+
+Module Name:
+
+    CorpusGenerator.cpp
+
+Abstract:
+
+    This module houses the benchmark corpus generator.  See
+    CorpusGenerator.h for an overview.
+
+    All randomness comes from a private xorshift generator rather than the
+    C or C++ library, whose generators and distributions differ between
+    platforms.  The KEY and BIF files are written little endian byte by
+    byte for the same reason.
+
+--*/
+
+#include <cstdio>
+#include <cstdarg>
+#include <cctype>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "../_NwnDataLib/TextOut.h"
+#include "CorpusGenerator.h"
+
+#ifndef _countof
+#define _countof(array) (sizeof(array)/sizeof(array[0]))
+#endif
+
+//
+// Define the words that generated names are made of.
+//
+
+static const char * const NameWords[ ] =
+{
+    "Ability",   "Action",    "Area",      "Armor",     "Attack",
+    "Camera",    "Class",     "Creature",  "Damage",    "Door",
+    "Effect",    "Encounter", "Faction",   "Feat",      "Gold",
+    "Item",      "Journal",   "Light",     "Local",     "Lock",
+    "Map",       "Module",    "Object",    "Party",     "Placeable",
+    "Race",      "Skill",     "Sound",     "Spell",     "Store",
+    "Tile",      "Trap",      "Trigger",   "Visual",    "Waypoint",
+    "Weather"
+};
+
+static const char * const ActionVerbs[ ] =
+{
+    "Get",       "Set",       "Apply",     "Clear",     "Create",
+    "Destroy",   "Play",      "Remove",    "Count",     "Action"
+};
+
+//
+// Define the declarations that every generated nwscript.nss starts with.
+// Generated code calls these by name.
+//
+
+static const char CoreDeclarations[ ] =
+    "#define ENGINE_NUM_STRUCTURES 5\n"
+    "#define ENGINE_STRUCTURE_0 effect\n"
+    "#define ENGINE_STRUCTURE_1 event\n"
+    "#define ENGINE_STRUCTURE_2 location\n"
+    "#define ENGINE_STRUCTURE_3 talent\n"
+    "#define ENGINE_STRUCTURE_4 itemproperty\n"
+    "\n"
+    "int TRUE = 1;\n"
+    "int FALSE = 0;\n"
+    "\n"
+    "// Get an integer between 0 and nMaxInteger-1.\n"
+    "int Random(int nMaxInteger);\n"
+    "\n"
+    "// Output sString to the log file.\n"
+    "void PrintString(string sString);\n"
+    "\n"
+    "// Output nInteger to the log file.\n"
+    "void PrintInteger(int nInteger);\n"
+    "\n"
+    "// Output fFloat to the log file.\n"
+    "void PrintFloat(float fFloat, int nWidth=18, int nDecimals=9);\n"
+    "\n"
+    "// Convert nInteger into a string.\n"
+    "string IntToString(int nInteger);\n"
+    "\n"
+    "// Convert sNumber into an integer.\n"
+    "int StringToInt(string sNumber);\n"
+    "\n"
+    "// Get the length of sString.\n"
+    "int GetStringLength(string sString);\n"
+    "\n"
+    "// Convert nInteger into a floating point number.\n"
+    "float IntToFloat(int nInteger);\n"
+    "\n"
+    "// Convert fFloat into the nearest integer.\n"
+    "int FloatToInt(float fFloat);\n"
+    "\n"
+    "// Get the first PC in the player list.\n"
+    "object GetFirstPC();\n"
+    "\n"
+    "// Get the next PC in the player list.\n"
+    "object GetNextPC();\n"
+    "\n"
+    "// Returns TRUE if oObject is a valid object.\n"
+    "int GetIsObjectValid(object oObject);\n"
+    "\n"
+    "// Set oObject's local integer variable sVarName to nValue.\n"
+    "void SetLocalInt(object oObject, string sVarName, int nValue);\n"
+    "\n"
+    "// Get oObject's local integer variable sVarName.\n"
+    "int GetLocalInt(object oObject, string sVarName);\n"
+    "\n"
+    "// Set oObject's local string variable sVarName to sValue.\n"
+    "void SetLocalString(object oObject, string sVarName, string sValue);\n"
+    "\n"
+    "// Get oObject's local string variable sVarName.\n"
+    "string GetLocalString(object oObject, string sVarName);\n"
+    "\n"
+    "// Create a vector with the specified values for x, y and z.\n"
+    "vector Vector(float x=0.0f, float y=0.0f, float z=0.0f);\n"
+    "\n"
+    "// Create a location.\n"
+    "location Location(object oArea, vector vPosition, float fOrientation);\n"
+    "\n"
+    "// Get the area that oTarget is currently in.\n"
+    "object GetArea(object oTarget);\n"
+    "\n"
+    "// Create a Damage effect.\n"
+    "effect EffectDamage(int nDamageAmount, int nDamageType=0, int nDamagePower=0);\n"
+    "\n"
+    "// Apply eEffect to oTarget.\n"
+    "void ApplyEffectToObject(int nDurationType, effect eEffect, object oTarget, float fDuration=0.0f);\n"
+    "\n"
+    "// Delay aActionToDelay by fSeconds.\n"
+    "void DelayCommand(float fSeconds, action aActionToDelay);\n"
+    "\n"
+    "// Assign aActionToAssign to oActionSubject.\n"
+    "void AssignCommand(object oActionSubject, action aActionToAssign);\n"
+    "\n";
+
+static const char * const ParameterPrefixes[ ] =
+{
+    "",     "n",    "f",    "s",    "o",    "v",
+    "e",    "ev",   "l",    "t",    "ip"
+};
+
+static const char * const CoreActions[ ] =
+{
+    "Random",            "PrintString",       "PrintInteger",
+    "PrintFloat",        "IntToString",       "StringToInt",
+    "GetStringLength",   "IntToFloat",        "FloatToInt",
+    "GetFirstPC",        "GetNextPC",         "GetIsObjectValid",
+    "SetLocalInt",       "GetLocalInt",       "SetLocalString",
+    "GetLocalString",    "Vector",            "Location",
+    "GetArea",           "EffectDamage",      "ApplyEffectToObject",
+    "DelayCommand",      "AssignCommand"
+};
+
+//
+// Define the size of each part of the corpus at a scale of 1.
+//
+
+enum
+{
+    NWScriptConstants     = 4000,
+    NWScriptActions       = 1000,
+    FlatFunctions         = 400,
+    TreeDepth             = 5,      // Plus the scale
+    TreeFunctions         = 3,
+    ChainLength           = 32,
+    DefineCount           = 600,
+    DefineFunctions       = 100,
+    SwitchCases           = 2000,
+    NestedDepth           = 256,
+    NestedCallDepth       = 64,
+    NestedBlockDepth      = 32,
+    NestedTernaryDepth    = 48,
+    MaxIndent             = 16,
+    MaxCallees            = 32
+};
+
+CorpusGenerator::CorpusGenerator(
+    unsigned long Seed,
+    unsigned long Scale
+    )
+/*++
+
+Routine Description:
+
+    This routine constructs a new CorpusGenerator.
+
+Arguments:
+
+    Seed - Supplies the seed of the corpus.
+
+    Scale - Supplies the size multiplier of the corpus (at least 1).
+
+Return Value:
+
+    The newly constructed object.
+
+Environment:
+
+    User mode.
+
+--*/
+: m_Seed( Seed ),
+  m_State( 0 ),
+  m_Scale( Scale != 0 ? Scale : 1 )
+{
+}
+
+CorpusGenerator::~CorpusGenerator(
+    )
+/*++
+
+Routine Description:
+
+    This routine cleans up an already-existing CorpusGenerator object.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+}
+
+void
+CorpusGenerator::Generate(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates the source files of the corpus.  Generating again
+    gives the same files.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    //
+    // Mix the seed so that nearby seeds give unrelated corpora; the
+    // xorshift state must not be zero.
+    //
+
+    m_State = (m_Seed + 1) * 0x9E3779B97F4A7C15ULL;
+
+    if (m_State == 0)
+        m_State = 0x9E3779B97F4A7C15ULL;
+
+    m_SourceFiles.clear();
+    m_Identifiers.clear();
+    m_IntConstants.clear();
+    m_ScriptConstants.clear();
+    m_Actions.clear();
+
+    GenerateNWScript();
+    GenerateFlatScript();
+    GenerateIncludeTree();
+    GenerateDefineScript();
+    GenerateSwitchScript();
+    GenerateNestedScript();
+}
+
+bool
+CorpusGenerator::WriteSourceFiles(
+    const std::string & Directory,
+    IDebugTextOut * TextOut
+    ) const
+/*++
+
+Routine Description:
+
+    This routine writes the generated source files to a directory.
+
+Arguments:
+
+    Directory - Supplies the directory to write to, which must exist.
+
+    TextOut - Supplies the text out interface that receives errors.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else
+    false on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    for (SourceFileVec::const_iterator it = m_SourceFiles.begin();
+         it != m_SourceFiles.end();
+         ++it) {
+        if (!WriteFile(
+                Directory + "/" + it->Name + ".nss",
+                it->Text.data(),
+                it->Text.size(),
+                TextOut)) {
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool
+CorpusGenerator::WriteKeyFile(
+    const std::string & Directory,
+    const std::string & KeyName,
+    unsigned long BifCount,
+    unsigned long ResourcesPerBif,
+    StringVec & ResourceNames,
+    IDebugTextOut * TextOut
+    ) const
+/*++
+
+Routine Description:
+
+    This routine writes a KEY file and the BIF files that it indexes.  Each
+    BIF holds a number of small scripts, and the KEY file names the BIF
+    files relative to the directory, i.e. the directory is the installation
+    directory of the KEY file.
+
+Arguments:
+
+    Directory - Supplies the directory to write to, which must exist.
+
+    KeyName - Supplies the name of the KEY file, without extension.
+
+    BifCount - Supplies the number of BIF files.
+
+    ResourcesPerBif - Supplies the number of scripts in each BIF file.
+
+    ResourceNames - Receives the resource names of the scripts.
+
+    TextOut - Supplies the text out interface that receives errors.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else
+    false on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::vector< unsigned char > Key;
+    std::vector< unsigned char > FileTable;
+    std::vector< unsigned char > NameTable;
+    std::vector< unsigned char > KeyTable;
+    unsigned long                FileTableOffset;
+    unsigned long                NameTableOffset;
+
+    ResourceNames.clear();
+
+    //
+    // The KEY file is laid out as the header, the BIF file table, the BIF
+    // file names and then the resource table.
+    //
+
+    FileTableOffset = 64;
+    NameTableOffset = FileTableOffset + BifCount * 12;
+
+    for (unsigned long Bif = 0; Bif < BifCount; Bif += 1) {
+        std::vector< unsigned char > BifData;
+        std::vector< unsigned char > BifTable;
+        std::string                  BifName;
+        char                         Name[ 64 ];
+        unsigned long                DataOffset;
+
+        snprintf(Name, sizeof(Name), "%s_%02lu.bif", KeyName.c_str(), Bif);
+        BifName = Name;
+
+        //
+        // Build the resources of the BIF.  The data follows the 20 byte
+        // header and the resource table.
+        //
+
+        DataOffset = 20 + ResourcesPerBif * 16;
+
+        for (unsigned long i = 0; i < ResourcesPerBif; i += 1) {
+            std::string Text;
+
+            snprintf(Name, sizeof(Name), "bres%06lu", Bif * ResourcesPerBif + i);
+            ResourceNames.push_back(Name);
+
+            Append(
+                Text,
+                "// %s\n"
+                "void main()\n"
+                "{\n"
+                "    PrintString(\"%s\");\n"
+                "}\n",
+                Name,
+                Name);
+
+            AppendUlong(BifTable, (Bif << 20) | i);
+            AppendUlong(BifTable, DataOffset + (unsigned long) BifData.size());
+            AppendUlong(BifTable, (unsigned long) Text.size());
+            AppendUlong(BifTable, 2009); // NWN::ResNSS
+
+            BifData.insert(BifData.end(), Text.begin(), Text.end());
+
+            //
+            // Add the resource to the KEY resource table: a 16 character
+            // resref, the type and the resource id.
+            //
+
+            memset(Name + strlen(Name), 0, sizeof(Name) - strlen(Name));
+            KeyTable.insert(KeyTable.end(), Name, Name + 16);
+            AppendUshort(KeyTable, 2009);
+            AppendUlong(KeyTable, (Bif << 20) | i);
+        }
+
+        std::vector< unsigned char > BifFile;
+
+        BifFile.insert(BifFile.end(), "BIFFV1  ", "BIFFV1  " + 8);
+        AppendUlong(BifFile, ResourcesPerBif);
+        AppendUlong(BifFile, 0);
+        AppendUlong(BifFile, 20);
+        BifFile.insert(BifFile.end(), BifTable.begin(), BifTable.end());
+        BifFile.insert(BifFile.end(), BifData.begin(), BifData.end());
+
+        if (!WriteFile(Directory + "/" + BifName, &BifFile[0], BifFile.size(), TextOut))
+            return false;
+
+        //
+        // Add the BIF to the file table.  The name length includes the
+        // terminator, as in the game's own KEY files.
+        //
+
+        AppendUlong(FileTable, (unsigned long) BifFile.size());
+        AppendUlong(FileTable, NameTableOffset + (unsigned long) NameTable.size());
+        AppendUshort(FileTable, (unsigned short) (BifName.size() + 1));
+        AppendUshort(FileTable, 1);
+
+        NameTable.insert(NameTable.end(), BifName.begin(), BifName.end());
+        NameTable.push_back(0);
+    }
+
+    Key.insert(Key.end(), "KEY V1  ", "KEY V1  " + 8);
+    AppendUlong(Key, BifCount);
+    AppendUlong(Key, (unsigned long) ResourceNames.size());
+    AppendUlong(Key, FileTableOffset);
+    AppendUlong(Key, NameTableOffset + (unsigned long) NameTable.size());
+    AppendUlong(Key, 125);  // Build year, fixed to keep the file stable
+    AppendUlong(Key, 1);
+    Key.resize(64, 0);
+
+    Key.insert(Key.end(), FileTable.begin(), FileTable.end());
+    Key.insert(Key.end(), NameTable.begin(), NameTable.end());
+    Key.insert(Key.end(), KeyTable.begin(), KeyTable.end());
+
+    return WriteFile(Directory + "/" + KeyName + ".key", &Key[0], Key.size(), TextOut);
+}
+
+unsigned long
+CorpusGenerator::Random(
+    unsigned long Range
+    )
+/*++
+
+Routine Description:
+
+    This routine draws the next pseudo-random number of the corpus.
+
+Arguments:
+
+    Range - Supplies the number of values to draw from.
+
+Return Value:
+
+    A number from 0 to Range - 1 (0 if Range is 0).
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    unsigned long long Value;
+
+    m_State ^= m_State >> 12;
+    m_State ^= m_State << 25;
+    m_State ^= m_State >> 27;
+
+    Value = (m_State * 0x2545F4914F6CDD1DULL) >> 32;
+
+    if (Range == 0)
+        return 0;
+
+    return (unsigned long) (Value % Range);
+}
+
+bool
+CorpusGenerator::Chance(
+    unsigned long Percent
+    )
+/*++
+
+Routine Description:
+
+    This routine draws a pseudo-random event of a given probability.
+
+Arguments:
+
+    Percent - Supplies the probability of the event, in percent.
+
+Return Value:
+
+    True if the event happens.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    return Random(100) < Percent;
+}
+
+void
+CorpusGenerator::Append(
+    std::string & Text,
+    const char * Format,
+    ...
+    )
+/*++
+
+Routine Description:
+
+    This routine appends formatted text to a string.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Format - Supplies the printf style format of the text.
+
+    ... - Supplies the format inserts.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    char    Buffer[ 512 ];
+    va_list ap;
+    int     Length;
+
+    va_start(ap, Format);
+    Length = vsnprintf(Buffer, sizeof(Buffer), Format, ap);
+    va_end(ap);
+
+    if (Length < 0)
+        throw std::runtime_error("Failed to format corpus text.");
+
+    if ((size_t) Length < sizeof(Buffer)) {
+        Text.append(Buffer, (size_t) Length);
+        return;
+    }
+
+    std::vector< char > Large((size_t) Length + 1);
+
+    va_start(ap, Format);
+    vsnprintf(&Large[0], Large.size(), Format, ap);
+    va_end(ap);
+
+    Text.append(&Large[0], (size_t) Length);
+}
+
+void
+CorpusGenerator::Indent(
+    std::string & Text,
+    unsigned long Depth
+    )
+/*++
+
+Routine Description:
+
+    This routine appends the indentation of a nesting depth.  Very deep
+    nesting is indented no further, so that the lines stay short.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Depth - Supplies the nesting depth.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    if (Depth > MaxIndent)
+        Depth = MaxIndent;
+
+    Text.append(Depth * 4, ' ');
+}
+
+const char *
+CorpusGenerator::GetTypeName(
+    VALUE_TYPE Type
+    )
+/*++
+
+Routine Description:
+
+    This routine returns the NWScript name of a type.
+
+Arguments:
+
+    Type - Supplies the type.
+
+Return Value:
+
+    The name of the type.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    static const char * const TypeNames[ LastType ] =
+    {
+        "void",
+        "int",
+        "float",
+        "string",
+        "object",
+        "vector",
+        "effect",
+        "event",
+        "location",
+        "talent",
+        "itemproperty"
+    };
+
+    return TypeNames[ Type ];
+}
+
+std::string
+CorpusGenerator::MakeName(
+    const char * Prefix,
+    unsigned long Index
+    )
+/*++
+
+Routine Description:
+
+    This routine makes an identifier of two random words.  The index keeps
+    the identifier unique.
+
+Arguments:
+
+    Prefix - Supplies the start of the identifier.
+
+    Index - Supplies the unique index of the identifier.
+
+Return Value:
+
+    The identifier.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string Name( Prefix );
+    const char * First;
+    const char * Second;
+
+    First = NameWords[ Random(_countof(NameWords)) ];
+    Second = NameWords[ Random(_countof(NameWords)) ];
+
+    Append(Name, "%s%s%lu", First, Second, Index);
+
+    return Name;
+}
+
+void
+CorpusGenerator::AppendArgument(
+    std::string & Text,
+    VALUE_TYPE Type,
+    FunctionScope & Scope
+    )
+/*++
+
+Routine Description:
+
+    This routine appends an argument expression of a given type.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Type - Supplies the type of the argument.
+
+    Scope - Supplies the function being generated.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    switch (Type) {
+
+        case TypeInt:
+            AppendIntExpression(Text, Scope, 1);
+            break;
+
+        case TypeFloat:
+            if (Chance(50)) {
+                Text += "IntToFloat(";
+                AppendIntLeaf(Text, Scope);
+                Text += ")";
+            } else {
+                Append(Text, "%lu.5f", Random(100));
+            }
+            break;
+
+        case TypeString:
+            if (Chance(50)) {
+                Text += "IntToString(";
+                AppendIntLeaf(Text, Scope);
+                Text += ")";
+            } else {
+                Append(Text, "\"%s\"", NameWords[ Random(_countof(NameWords)) ]);
+            }
+            break;
+
+        case TypeObject:
+            switch (Random(3)) {
+                case 0: Text += "OBJECT_SELF"; break;
+                case 1: Text += "OBJECT_INVALID"; break;
+                default: Text += "GetFirstPC()"; break;
+            }
+            break;
+
+        case TypeVector:
+            Append(Text, "Vector(%lu.0f, %lu.0f, 0.0f)", Random(100), Random(100));
+            break;
+
+        case TypeEffect:
+            Text += "EffectDamage(";
+            AppendIntLeaf(Text, Scope);
+            Text += ")";
+            break;
+
+        case TypeLocation:
+            Text += "Location(GetArea(OBJECT_SELF), Vector(), 0.0f)";
+            break;
+
+        default:
+            throw std::runtime_error("Unsupported argument type.");
+
+    }
+}
+
+void
+CorpusGenerator::AppendIntLeaf(
+    std::string & Text,
+    FunctionScope & Scope
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a simple int expression: a variable, a literal, a
+    constant or an action call.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Scope - Supplies the function being generated.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    unsigned long Kind;
+
+    //
+    // Scripts with constants of their own (defines or const globals) use
+    // them more than anything else.
+    //
+
+    if (!m_ScriptConstants.empty() && Chance(40)) {
+        Text += m_ScriptConstants[ Random((unsigned long) m_ScriptConstants.size()) ];
+        return;
+    }
+
+    Kind = Random(10);
+
+    if ((Kind < 4) && !Scope.IntVariables.empty()) {
+        Text += Scope.IntVariables[ Random((unsigned long) Scope.IntVariables.size()) ];
+    } else if ((Kind < 8) && !m_IntConstants.empty() && Chance(50)) {
+        Text += m_IntConstants[ Random((unsigned long) m_IntConstants.size()) ];
+    } else if (Kind < 9) {
+        Append(Text, "%lu", Random(1000));
+    } else {
+        switch (Random(3)) {
+            case 0:
+                Append(Text, "Random(%lu)", Random(100) + 1);
+                break;
+            case 1:
+                Append(Text, "GetLocalInt(OBJECT_SELF, \"%s\")", NameWords[ Random(_countof(NameWords)) ]);
+                break;
+            default:
+                Append(Text, "GetStringLength(\"%s\")", NameWords[ Random(_countof(NameWords)) ]);
+                break;
+        }
+    }
+}
+
+void
+CorpusGenerator::AppendIntExpression(
+    std::string & Text,
+    FunctionScope & Scope,
+    unsigned long Depth
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a random int expression.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Scope - Supplies the function being generated.
+
+    Depth - Supplies the greatest nesting depth of the expression.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    static const char * const BinaryOps[ ] =
+    {
+        "+", "-", "*", "&", "|", "^", "<<", ">>",
+        "==", "!=", "<", ">=", "&&", "||"
+    };
+    static const char * const UnaryOps[ ] =
+    {
+        "-", "~", "!"
+    };
+
+    if ((Depth == 0) || Chance(30)) {
+        AppendIntLeaf(Text, Scope);
+        return;
+    }
+
+    switch (Random(9)) {
+
+        case 6:
+            Text += UnaryOps[ Random(_countof(UnaryOps)) ];
+            Text += "(";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Text += ")";
+            break;
+
+        case 7:
+            Text += "(";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Text += " ? ";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Text += " : ";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Text += ")";
+            break;
+
+        case 8:
+            Text += "(";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Append(Text, " %s %lu)", Chance(50) ? "/" : "%", Random(9) + 1);
+            break;
+
+        default:
+            Text += "(";
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Append(Text, " %s ", BinaryOps[ Random(_countof(BinaryOps)) ]);
+            AppendIntExpression(Text, Scope, Depth - 1);
+            Text += ")";
+            break;
+
+    }
+}
+
+void
+CorpusGenerator::AppendNestedExpression(
+    std::string & Text,
+    FunctionScope & Scope,
+    unsigned long Depth,
+    unsigned long Level
+    )
+/*++
+
+Routine Description:
+
+    This routine appends an int expression that nests to a given depth.  At
+    each level one operand nests further and the other is simple, so the
+    size of the expression grows with its depth only.  Each level starts a
+    new line.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Scope - Supplies the function being generated.
+
+    Depth - Supplies the remaining nesting depth.
+
+    Level - Supplies the current nesting depth, for indentation.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    static const char * const BinaryOps[ ] =
+    {
+        "+", "-", "*", "&", "|", "^", "<", "==", "&&", "||"
+    };
+
+    if (Depth == 0) {
+        AppendIntLeaf(Text, Scope);
+        return;
+    }
+
+    switch (Random(6)) {
+
+        case 0:
+            Text += "(";
+            AppendIntLeaf(Text, Scope);
+            Text += " ?\n";
+            Indent(Text, Level + 1);
+            AppendNestedExpression(Text, Scope, Depth - 1, Level + 1);
+            Text += " : ";
+            AppendIntLeaf(Text, Scope);
+            Text += ")";
+            break;
+
+        case 1:
+            Text += "-(\n";
+            Indent(Text, Level + 1);
+            AppendNestedExpression(Text, Scope, Depth - 1, Level + 1);
+            Text += ")";
+            break;
+
+        case 2:
+        case 3:
+            Text += "(\n";
+            Indent(Text, Level + 1);
+            AppendNestedExpression(Text, Scope, Depth - 1, Level + 1);
+            Append(Text, " %s ", BinaryOps[ Random(_countof(BinaryOps)) ]);
+            AppendIntLeaf(Text, Scope);
+            Text += ")";
+            break;
+
+        default:
+            Text += "(";
+            AppendIntLeaf(Text, Scope);
+            Append(Text, " %s\n", BinaryOps[ Random(_countof(BinaryOps)) ]);
+            Indent(Text, Level + 1);
+            AppendNestedExpression(Text, Scope, Depth - 1, Level + 1);
+            Text += ")";
+            break;
+
+    }
+}
+
+void
+CorpusGenerator::AppendStatement(
+    std::string & Text,
+    FunctionScope & Scope,
+    unsigned long Depth
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a random statement to a function.  The function
+    has the variables nResult, i, sText and fValue (see AppendFunction).
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Scope - Supplies the function being generated.
+
+    Depth - Supplies the block nesting depth of the statement (1 for the
+            body of the function).
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    static const char * const AssignOps[ ] =
+    {
+        "=", "+=", "-=", "*=", "|=", "^="
+    };
+    unsigned long Kind;
+
+    Kind = Random(14);
+
+    //
+    // Locals are only declared in the body of the function, so that every
+    // variable in the scope stays visible.  Compound statements only nest
+    // a few levels.
+    //
+
+    if ((Kind == 0) && (Depth > 1))
+        Kind = 1;
+
+    if ((Kind == 2 || Kind == 3 || Kind == 4 || Kind == 10 || Kind == 13) && (Depth > 3))
+        Kind = 1;
+
+    if ((Kind == 7) && Scope.Callees.empty())
+        Kind = 1;
+
+    Indent(Text, Depth);
+
+    switch (Kind) {
+
+        case 0: {
+            std::string Name;
+
+            Append(Name, "nLocal%lu", Scope.Locals++);
+            Append(Text, "int %s = ", Name.c_str());
+            AppendIntExpression(Text, Scope, 3);
+            Text += ";\n";
+
+            Scope.IntVariables.push_back(Name);
+        }
+            break;
+
+        case 2:
+            Text += "if (";
+            AppendIntExpression(Text, Scope, 2);
+            Text += ")\n";
+            Indent(Text, Depth);
+            Text += "{\n";
+            AppendStatement(Text, Scope, Depth + 1);
+            if (Chance(50))
+                AppendStatement(Text, Scope, Depth + 1);
+            Indent(Text, Depth);
+            Text += "}\n";
+
+            if (Chance(50)) {
+                Indent(Text, Depth);
+                Text += "else\n";
+                Indent(Text, Depth);
+                Text += "{\n";
+                AppendStatement(Text, Scope, Depth + 1);
+                Indent(Text, Depth);
+                Text += "}\n";
+            }
+            break;
+
+        case 3:
+            Text += "for (i = 0; i < ";
+            AppendIntLeaf(Text, Scope);
+            Text += "; i++)\n";
+            Indent(Text, Depth);
+            Text += "{\n";
+            AppendStatement(Text, Scope, Depth + 1);
+            AppendStatement(Text, Scope, Depth + 1);
+            Indent(Text, Depth);
+            Text += "}\n";
+            break;
+
+        case 4:
+            Append(Text, "while (nResult > %lu)\n", Random(100));
+            Indent(Text, Depth);
+            Text += "{\n";
+            Indent(Text, Depth + 1);
+            Text += "nResult = nResult / 2 - 1;\n";
+            AppendStatement(Text, Scope, Depth + 1);
+            Indent(Text, Depth);
+            Text += "}\n";
+            break;
+
+        case 5:
+            Append(Text, "SetLocalInt(OBJECT_SELF, \"%s\", ", NameWords[ Random(_countof(NameWords)) ]);
+            AppendIntExpression(Text, Scope, 2);
+            Text += ");\n";
+            break;
+
+        case 6:
+            Text += "sText = sText + IntToString(";
+            AppendIntExpression(Text, Scope, 2);
+            Text += ");\n";
+            break;
+
+        case 7:
+            Append(Text, "nResult += %s(", Scope.Callees[ Random((unsigned long) Scope.Callees.size()) ].c_str());
+            AppendIntExpression(Text, Scope, 1);
+            Text += ", ";
+            AppendIntLeaf(Text, Scope);
+            Text += ");\n";
+            break;
+
+        case 8: {
+            const Action * Called = nullptr;
+
+            //
+            // Call an action of the generated nwscript.nss that returns an
+            // int or nothing.
+            //
+
+            for (unsigned long Try = 0; Try < 8 && !m_Actions.empty(); Try += 1) {
+                const Action & Candidate = m_Actions[ Random((unsigned long) m_Actions.size()) ];
+
+                if (Candidate.Callable &&
+                    (Candidate.ReturnType == TypeInt || Candidate.ReturnType == TypeVoid)) {
+                    Called = &Candidate;
+                    break;
+                }
+            }
+
+            if (Called == nullptr) {
+                Text += "PrintInteger(nResult);\n";
+                break;
+            }
+
+            if (Called->ReturnType == TypeInt)
+                Text += "nResult += ";
+
+            Text += Called->Name;
+            Text += "(";
+
+            for (size_t i = 0; i < Called->ParameterTypes.size(); i += 1) {
+                if (i != 0)
+                    Text += ", ";
+
+                AppendArgument(Text, Called->ParameterTypes[ i ], Scope);
+            }
+
+            Text += ");\n";
+        }
+            break;
+
+        case 9:
+            Text += "ApplyEffectToObject(0, EffectDamage(";
+            AppendIntLeaf(Text, Scope);
+            Text += ", 0, 0), OBJECT_SELF, 0.0f);\n";
+            break;
+
+        case 10: {
+            unsigned long Cases = 2 + Random(4);
+
+            Text += "switch (nResult & 7)\n";
+            Indent(Text, Depth);
+            Text += "{\n";
+
+            for (unsigned long i = 0; i < Cases; i += 1) {
+                Indent(Text, Depth + 1);
+                Append(Text, "case %lu:\n", i);
+                AppendStatement(Text, Scope, Depth + 2);
+                Indent(Text, Depth + 2);
+                Text += "break;\n";
+            }
+
+            Indent(Text, Depth + 1);
+            Text += "default:\n";
+            Indent(Text, Depth + 2);
+            Text += "break;\n";
+            Indent(Text, Depth);
+            Text += "}\n";
+        }
+            break;
+
+        case 11:
+            Text += "fValue = fValue * 0.5f + IntToFloat(";
+            AppendIntLeaf(Text, Scope);
+            Text += ");\n";
+            break;
+
+        case 12:
+            Text += "if (GetIsObjectValid(GetFirstPC()))\n";
+            Indent(Text, Depth + 1);
+            Append(Text, "SetLocalString(OBJECT_SELF, \"%s\", sText);\n", NameWords[ Random(_countof(NameWords)) ]);
+            break;
+
+        case 13:
+            Text += "do\n";
+            Indent(Text, Depth);
+            Text += "{\n";
+            AppendStatement(Text, Scope, Depth + 1);
+            Indent(Text, Depth + 1);
+            Text += "nResult++;\n";
+            Indent(Text, Depth);
+            Append(Text, "} while (nResult < %lu);\n", Random(1000));
+            break;
+
+        default:
+            Append(Text, "%s %s ", Scope.IntVariables[ 2 + Random((unsigned long) Scope.IntVariables.size() - 2) ].c_str(), AssignOps[ Random(_countof(AssignOps)) ]);
+            AppendIntExpression(Text, Scope, 3);
+            Text += ";\n";
+            break;
+
+    }
+}
+
+void
+CorpusGenerator::AppendFunction(
+    std::string & Text,
+    const std::string & Name,
+    FunctionScope & Scope
+    )
+/*++
+
+Routine Description:
+
+    This routine appends an ordinary function: int Name(int nA, int nB), made
+    of a few locals and random statements.  The function may call the
+    callees of the scope.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Name - Supplies the name of the function.
+
+    Scope - Supplies the callees of the function; the rest of the scope is
+            set up here.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    unsigned long Statements;
+
+    Scope.IntVariables.clear();
+    Scope.IntVariables.push_back("nA");
+    Scope.IntVariables.push_back("nB");
+    Scope.IntVariables.push_back("nResult");
+    Scope.IntVariables.push_back("i");
+    Scope.Locals = 0;
+
+    Append(
+        Text,
+        "int %s(int nA, int nB)\n"
+        "{\n"
+        "    int nResult = nA;\n"
+        "    int i;\n"
+        "    string sText = \"%s\";\n"
+        "    float fValue = 0.0f;\n"
+        "\n",
+        Name.c_str(),
+        NameWords[ Random(_countof(NameWords)) ]);
+
+    Statements = 4 + Random(9);
+
+    for (unsigned long i = 0; i < Statements; i += 1)
+        AppendStatement(Text, Scope, 1);
+
+    Text +=
+        "\n"
+        "    PrintString(sText);\n"
+        "    return nResult + FloatToInt(fValue);\n"
+        "}\n"
+        "\n";
+}
+
+void
+CorpusGenerator::AppendMain(
+    std::string & Text,
+    const StringVec & Functions
+    )
+/*++
+
+Routine Description:
+
+    This routine appends the main function of a script, which calls a list
+    of int (int, int) functions.
+
+Arguments:
+
+    Text - Supplies the string to append to.
+
+    Functions - Supplies the functions to call.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Text +=
+        "void main()\n"
+        "{\n"
+        "    int nTotal = 0;\n"
+        "\n";
+
+    for (StringVec::const_iterator it = Functions.begin();
+         it != Functions.end();
+         ++it) {
+        Append(Text, "    nTotal += %s(nTotal, %lu);\n", it->c_str(), Random(16));
+    }
+
+    Text +=
+        "\n"
+        "    PrintInteger(nTotal);\n"
+        "}\n";
+}
+
+void
+CorpusGenerator::AppendUshort(
+    std::vector< unsigned char > & Data,
+    unsigned short Value
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a little endian 16-bit value to a buffer.
+
+Arguments:
+
+    Data - Supplies the buffer to append to.
+
+    Value - Supplies the value.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    Data.push_back((unsigned char) (Value & 0xFF));
+    Data.push_back((unsigned char) ((Value >> 8) & 0xFF));
+}
+
+void
+CorpusGenerator::AppendUlong(
+    std::vector< unsigned char > & Data,
+    unsigned long Value
+    )
+/*++
+
+Routine Description:
+
+    This routine appends a little endian 32-bit value to a buffer.
+
+Arguments:
+
+    Data - Supplies the buffer to append to.
+
+    Value - Supplies the value.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    for (int i = 0; i < 4; i += 1)
+        Data.push_back((unsigned char) ((Value >> (i * 8)) & 0xFF));
+}
+
+bool
+CorpusGenerator::WriteFile(
+    const std::string & FileName,
+    const void * Data,
+    size_t Size,
+    IDebugTextOut * TextOut
+    )
+/*++
+
+Routine Description:
+
+    This routine writes a file of the corpus.
+
+Arguments:
+
+    FileName - Supplies the path of the file.
+
+    Data - Supplies the contents of the file.
+
+    Size - Supplies the size of the contents.
+
+    TextOut - Supplies the text out interface that receives errors.
+
+Return Value:
+
+    The routine returns a Boolean value indicating true on success, else
+    false on failure.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    FILE * f;
+    bool   Written;
+
+    f = fopen(FileName.c_str(), "wb");
+
+    if (f == nullptr) {
+        TextOut->WriteText("Error: Unable to open %s.\n", FileName.c_str());
+        return false;
+    }
+
+    Written = (Size == 0) || (fwrite(Data, Size, 1, f) == 1);
+
+    if (fclose(f) != 0)
+        Written = false;
+
+    if (!Written) {
+        TextOut->WriteText("Error: Failed to write %s.\n", FileName.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+void
+CorpusGenerator::AddSourceFile(
+    const std::string & Name,
+    const std::string & Text,
+    bool IsScript
+    )
+/*++
+
+Routine Description:
+
+    This routine adds a generated source file to the corpus.
+
+Arguments:
+
+    Name - Supplies the resource name of the file.
+
+    Text - Supplies the source text.
+
+    IsScript - Supplies true if the file is a script to compile.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    m_SourceFiles.push_back(SourceFile());
+    m_SourceFiles.back().Name = Name;
+    m_SourceFiles.back().Text = Text;
+    m_SourceFiles.back().IsScript = IsScript;
+}
+
+void
+CorpusGenerator::GenerateNWScript(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates nwscript.nss: the engine structures, a fixed set
+    of actions that generated code calls, and groups of constants and
+    actions in the style of the game's own declarations.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    unsigned long Constants = NWScriptConstants * m_Scale;
+    unsigned long Actions = NWScriptActions * m_Scale;
+    unsigned long Group = 0;
+
+    Append(
+        Text,
+        "// nwscript.nss generated by nwnscbench (seed %lu, scale %lu)\n"
+        "\n",
+        (unsigned long) m_Seed,
+        m_Scale);
+
+    Text += CoreDeclarations;
+
+    m_Identifiers.insert(m_Identifiers.end(), CoreActions, CoreActions + _countof(CoreActions));
+
+    //
+    // Generate the constants in groups that share a prefix.  Most are int
+    // constants; a few groups are float or string constants.
+    //
+
+    for (unsigned long i = 0; i < Constants; Group += 1) {
+        std::string   Prefix;
+        unsigned long Count = 8 + Random(40);
+        unsigned long Kind = Random(20);
+
+        for (const char * p = NameWords[ Random(_countof(NameWords)) ]; *p; p += 1)
+            Prefix += (char) toupper((unsigned char) *p);
+
+        Append(Text, "// %s constants.\n", NameWords[ Random(_countof(NameWords)) ]);
+
+        for (unsigned long j = 0; j < Count && i < Constants; j += 1, i += 1) {
+            std::string Name( Prefix );
+
+            Append(Name, "_");
+
+            for (const char * p = NameWords[ Random(_countof(NameWords)) ]; *p; p += 1)
+                Name += (char) toupper((unsigned char) *p);
+
+            Append(Name, "_%lu", i);
+
+            if (Kind == 0) {
+                Append(Text, "float %s = %lu.%luf;\n", Name.c_str(), j, Random(100));
+            } else if (Kind == 1) {
+                Append(Text, "string %s = \"%s%lu\";\n", Name.c_str(), NameWords[ Random(_countof(NameWords)) ], j);
+            } else {
+                if (Kind < 5)
+                    Append(Text, "int %s = 0x%08lx;\n", Name.c_str(), 1UL << (j % 31));
+                else
+                    Append(Text, "int %s = %lu;\n", Name.c_str(), j);
+
+                m_IntConstants.push_back(Name);
+            }
+
+            m_Identifiers.push_back(Name);
+        }
+
+        Text += "\n";
+    }
+
+    //
+    // Generate the actions.  Each has a comment, as in the game's
+    // declarations, and may have defaulted trailing parameters.
+    //
+
+    for (unsigned long i = 0; i < Actions; i += 1) {
+        Action        NewAction;
+        unsigned long Parameters = Random(7);
+        unsigned long Defaulted = Random(4);
+        StringVec     Names;
+
+        NewAction.Name = MakeName(ActionVerbs[ Random(_countof(ActionVerbs)) ], i);
+        NewAction.Callable = true;
+
+        switch (Random(12)) {
+            case 0: case 1: case 2: case 3: NewAction.ReturnType = TypeInt; break;
+            case 4: case 5: case 6: NewAction.ReturnType = TypeVoid; break;
+            case 7: NewAction.ReturnType = TypeFloat; break;
+            case 8: NewAction.ReturnType = TypeString; break;
+            case 9: NewAction.ReturnType = TypeObject; break;
+            case 10: NewAction.ReturnType = TypeEffect; break;
+            default: NewAction.ReturnType = (Random(2) == 0) ? TypeLocation : TypeItemProperty; break;
+        }
+
+        for (unsigned long j = 0; j < Parameters; j += 1) {
+            VALUE_TYPE Type;
+
+            switch (Random(25)) {
+                case 0: case 1: case 2: case 3: case 4:
+                case 5: case 6: case 7: case 8: case 9: Type = TypeInt; break;
+                case 10: case 11: case 12: case 13: case 14: Type = TypeObject; break;
+                case 15: case 16: case 17: Type = TypeString; break;
+                case 18: case 19: case 20: Type = TypeFloat; break;
+                case 21: Type = TypeVector; break;
+                case 22: Type = TypeEffect; break;
+                case 23: Type = TypeLocation; break;
+                default: Type = (Random(2) == 0) ? TypeTalent : TypeItemProperty; break;
+            }
+
+            if (Type == TypeTalent || Type == TypeItemProperty)
+                NewAction.Callable = false;
+
+            NewAction.ParameterTypes.push_back(Type);
+        }
+
+        //
+        // Write the comment and the prototype.
+        //
+
+        Append(
+            Text,
+            "// %s the %s of the %s.\n",
+            ActionVerbs[ Random(_countof(ActionVerbs)) ],
+            NameWords[ Random(_countof(NameWords)) ],
+            NameWords[ Random(_countof(NameWords)) ]);
+
+        for (unsigned long j = 0; j < Parameters; j += 1) {
+            std::string Name;
+
+            Append(Name, "%s%s", ParameterPrefixes[ NewAction.ParameterTypes[ j ] ], NameWords[ Random(_countof(NameWords)) ]);
+
+            for (StringVec::const_iterator it = Names.begin(); it != Names.end(); ++it) {
+                if (*it == Name) {
+                    Append(Name, "%lu", j);
+                    break;
+                }
+            }
+
+            Names.push_back(Name);
+            Append(Text, "// - %s: %s value\n", Name.c_str(), NameWords[ Random(_countof(NameWords)) ]);
+        }
+
+        Append(Text, "%s %s(", GetTypeName(NewAction.ReturnType), NewAction.Name.c_str());
+
+        //
+        // Only a trailing run of int, float, string and object parameters
+        // can have defaults.
+        //
+
+        unsigned long FirstDefault = Parameters;
+
+        while (FirstDefault > 0 && Parameters - FirstDefault < Defaulted) {
+            VALUE_TYPE Type = NewAction.ParameterTypes[ FirstDefault - 1 ];
+
+            if (Type != TypeInt && Type != TypeFloat && Type != TypeString && Type != TypeObject)
+                break;
+
+            FirstDefault -= 1;
+        }
+
+        for (unsigned long j = 0; j < Parameters; j += 1) {
+            VALUE_TYPE Type = NewAction.ParameterTypes[ j ];
+
+            Append(Text, "%s%s %s", j != 0 ? ", " : "", GetTypeName(Type), Names[ j ].c_str());
+
+            if (j < FirstDefault)
+                continue;
+
+            switch (Type) {
+                case TypeInt:
+                    if (!m_IntConstants.empty() && Chance(50))
+                        Append(Text, "=%s", m_IntConstants[ Random((unsigned long) m_IntConstants.size()) ].c_str());
+                    else
+                        Append(Text, "=%lu", Random(10));
+                    break;
+                case TypeFloat: Text += "=0.0f"; break;
+                case TypeString: Text += "=\"\""; break;
+                default: Text += (Random(2) == 0) ? "=OBJECT_SELF" : "=OBJECT_INVALID"; break;
+            }
+        }
+
+        Text += ");\n\n";
+
+        m_Identifiers.push_back(NewAction.Name);
+        m_Actions.push_back(NewAction);
+    }
+
+    AddSourceFile("nwscript", Text, false);
+}
+
+void
+CorpusGenerator::GenerateFlatScript(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates bench_flat: one large script of many ordinary
+    functions, with a structure and a few constant globals.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    StringVec     Functions;
+    FunctionScope Scope;
+    unsigned long Count = FlatFunctions * m_Scale;
+
+    Text +=
+        "// bench_flat: a large flat script.\n"
+        "\n"
+        "struct FlatState\n"
+        "{\n"
+        "    int    nCount;\n"
+        "    float  fScale;\n"
+        "    string sName;\n"
+        "};\n"
+        "\n";
+
+    for (unsigned long i = 0; i < 16; i += 1) {
+        std::string Name;
+
+        Append(Name, "FLAT_LIMIT_%lu", i);
+        Append(Text, "const int %s = %lu;\n", Name.c_str(), Random(1000));
+
+        m_ScriptConstants.push_back(Name);
+    }
+
+    Text +=
+        "\n"
+        "struct FlatState FlatMakeState(int nCount)\n"
+        "{\n"
+        "    struct FlatState stState;\n"
+        "\n"
+        "    stState.nCount = nCount;\n"
+        "    stState.fScale = IntToFloat(nCount) * 0.5f;\n"
+        "    stState.sName = IntToString(nCount);\n"
+        "    return stState;\n"
+        "}\n"
+        "\n";
+
+    //
+    // The functions use the first few of the constant globals.
+    //
+
+    m_ScriptConstants.resize(4);
+
+    for (unsigned long i = 0; i < Count; i += 1) {
+        std::string Name = MakeName("Flat", i);
+
+        Scope.Callees.assign(
+            Functions.size() > MaxCallees ? Functions.end() - MaxCallees : Functions.begin(),
+            Functions.end());
+
+        AppendFunction(Text, Name, Scope);
+        Functions.push_back(Name);
+    }
+
+    m_ScriptConstants.clear();
+
+    Text +=
+        "void FlatUseState(int nCount)\n"
+        "{\n"
+        "    struct FlatState stState = FlatMakeState(nCount);\n"
+        "\n"
+        "    PrintString(stState.sName);\n"
+        "    PrintFloat(stState.fScale);\n"
+        "}\n"
+        "\n";
+
+    AppendMain(Text, Functions);
+    Text.insert(Text.size() - 2, "\n    FlatUseState(nTotal);\n");
+
+    AddSourceFile("bench_flat", Text, true);
+}
+
+void
+CorpusGenerator::GenerateIncludeTree(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates bench_tree, which includes the root of a binary
+    tree of include files and the head of a long chain of include files.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    StringVec     Functions;
+    StringVec     Next;
+    FunctionScope Scope;
+    unsigned long Chain = ChainLength * m_Scale;
+
+    //
+    // Generate the chain from its end, so that each link can call the
+    // function of the link that it includes.
+    //
+
+    for (unsigned long i = Chain; i > 0; i -= 1) {
+        std::string ChainText;
+        std::string Name;
+
+        Append(ChainText, "// bchain_%03lu: link %lu of an include chain.\n\n", i - 1, i - 1);
+
+        if (i < Chain)
+            Append(ChainText, "#include \"bchain_%03lu\"\n\n", i);
+
+        Name = MakeName("Chain", i - 1);
+        Scope.Callees = Next;
+        AppendFunction(ChainText, Name, Scope);
+
+        Next.assign(1, Name);
+
+        Name.clear();
+        Append(Name, "bchain_%03lu", i - 1);
+        AddSourceFile(Name, ChainText, false);
+    }
+
+    GenerateIncludeNode(0, 0, TreeDepth + m_Scale, Functions);
+
+    Text +=
+        "// bench_tree: a script on a deep tree of include files.\n"
+        "\n"
+        "#include \"btree_0_0\"\n"
+        "#include \"bchain_000\"\n"
+        "\n";
+
+    Functions.insert(Functions.end(), Next.begin(), Next.end());
+    AppendMain(Text, Functions);
+
+    AddSourceFile("bench_tree", Text, true);
+}
+
+void
+CorpusGenerator::GenerateIncludeNode(
+    unsigned long Depth,
+    unsigned long Index,
+    unsigned long MaxDepth,
+    StringVec & Functions
+    )
+/*++
+
+Routine Description:
+
+    This routine generates an include file of the include tree and the
+    files below it.  The functions of a file call those of its children.
+
+Arguments:
+
+    Depth - Supplies the depth of the file in the tree.
+
+    Index - Supplies the index of the file within its depth.
+
+    MaxDepth - Supplies the depth of the leaves of the tree.
+
+    Functions - Receives the functions of the file and of the files below
+                it.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    std::string   Name;
+    StringVec     Children;
+    FunctionScope Scope;
+
+    Append(Text, "// btree_%lu_%lu: include tree node.\n\n", Depth, Index);
+
+    if (Depth < MaxDepth) {
+        for (unsigned long Child = Index * 2; Child < Index * 2 + 2; Child += 1) {
+            GenerateIncludeNode(Depth + 1, Child, MaxDepth, Children);
+            Append(Text, "#include \"btree_%lu_%lu\"\n", Depth + 1, Child);
+        }
+
+        Text += "\n";
+    }
+
+    Scope.Callees = Children;
+
+    for (unsigned long i = 0; i < TreeFunctions; i += 1) {
+        std::string Function;
+
+        Append(Function, "Tree%lu_%lu_", Depth, Index);
+        Function = MakeName(Function.c_str(), i);
+
+        AppendFunction(Text, Function, Scope);
+        Functions.push_back(Function);
+    }
+
+    Functions.insert(Functions.end(), Children.begin(), Children.end());
+
+    Append(Name, "btree_%lu_%lu", Depth, Index);
+    AddSourceFile(Name, Text, false);
+}
+
+void
+CorpusGenerator::GenerateDefineScript(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates bench_defines, which declares many #defines and
+    uses them throughout, with functions in taken and skipped #ifdef
+    blocks.  The script needs the preprocessor extension.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    StringVec     Functions;
+    FunctionScope Scope;
+    unsigned long Count = DefineCount * m_Scale;
+    unsigned long FunctionCount = DefineFunctions * m_Scale;
+
+    Text += "// bench_defines: a script that leans on the preprocessor.\n\n";
+
+    for (unsigned long i = 0; i < Count; i += 1) {
+        std::string Name;
+
+        switch (Random(4)) {
+            case 0:
+                Append(Name, "BENCH_MASK_%lu", i);
+                Append(Text, "#define %s 0x%04lx\n", Name.c_str(), Random(0x10000));
+                break;
+            case 1:
+                Append(Name, "BENCH_SUM_%lu", i);
+                Append(Text, "#define %s (%lu + %lu)\n", Name.c_str(), Random(100), Random(100));
+                break;
+            default:
+                Append(Name, "BENCH_LIMIT_%lu", i);
+                Append(Text, "#define %s %lu\n", Name.c_str(), Random(1000));
+                break;
+        }
+
+        m_ScriptConstants.push_back(Name);
+    }
+
+    Text +=
+        "\n"
+        "#ifdef BENCH_MISSING\n"
+        "#define BENCH_ENABLED 0\n"
+        "#else\n"
+        "#define BENCH_ENABLED 1\n"
+        "#endif\n"
+        "\n";
+
+    for (unsigned long i = 0; i < FunctionCount; i += 1) {
+        std::string Name = MakeName("Define", i);
+        bool        Skipped = Chance(20);
+
+        Scope.Callees.assign(
+            Functions.size() > MaxCallees ? Functions.end() - MaxCallees : Functions.begin(),
+            Functions.end());
+
+        if (Skipped)
+            Append(Text, "#ifdef BENCH_MISSING_%lu\n", i);
+        else
+            Append(Text, "#ifdef %s\n", m_ScriptConstants[ Random((unsigned long) m_ScriptConstants.size()) ].c_str());
+
+        AppendFunction(Text, Name, Scope);
+        Text += "#endif\n\n";
+
+        if (!Skipped)
+            Functions.push_back(Name);
+    }
+
+    m_ScriptConstants.clear();
+
+    AppendMain(Text, Functions);
+    Text.insert(Text.size() - 2, "\n    nTotal += BENCH_ENABLED;\n");
+
+    AddSourceFile("bench_defines", Text, true);
+}
+
+void
+CorpusGenerator::GenerateSwitchScript(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates bench_switch: a switch over sparse, shuffled case
+    values, a dense switch whose cases nest smaller switches, and runs of
+    stacked and fall-through cases.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string                  Text;
+    std::vector< unsigned long > Values;
+    FunctionScope                Scope;
+    unsigned long                Cases = SwitchCases * m_Scale;
+
+    Scope.IntVariables.push_back("nValue");
+    Scope.IntVariables.push_back("nResult");
+
+    Text +=
+        "// bench_switch: huge switch statements.\n"
+        "\n"
+        "int SwitchSparse(int nValue)\n"
+        "{\n"
+        "    int nResult = 0;\n"
+        "\n"
+        "    switch (nValue)\n"
+        "    {\n";
+
+    //
+    // Make unique sparse values and shuffle them.
+    //
+
+    for (unsigned long i = 0; i < Cases; i += 1)
+        Values.push_back(i * 37 + Random(37));
+
+    for (size_t i = Values.size(); i > 1; i -= 1)
+        std::swap(Values[ i - 1 ], Values[ Random((unsigned long) i) ]);
+
+    for (unsigned long i = 0; i < Cases; i += 1) {
+        Append(Text, "        case %s%lu:\n", (Values[ i ] & 1) ? "-" : "", Values[ i ]);
+
+        //
+        // Stack some labels on the next case, and let some cases fall
+        // through.
+        //
+
+        if (Chance(10))
+            continue;
+
+        Text += "            nResult = ";
+        AppendIntExpression(Text, Scope, 2);
+        Text += ";\n";
+
+        if (Chance(10))
+            continue;
+
+        if (Chance(10))
+            Text += "            return nResult;\n";
+        else
+            Text += "            break;\n";
+    }
+
+    Text +=
+        "        default:\n"
+        "            nResult = -1;\n"
+        "            break;\n"
+        "    }\n"
+        "\n"
+        "    return nResult;\n"
+        "}\n"
+        "\n"
+        "int SwitchDense(int nValue)\n"
+        "{\n"
+        "    int nResult = 0;\n"
+        "\n"
+        "    switch (nValue)\n"
+        "    {\n";
+
+    for (unsigned long i = 0; i < Cases / 2; i += 1) {
+        Append(Text, "        case %lu:\n", i);
+
+        if (Chance(5)) {
+            Text +=
+                "            switch (nValue & 7)\n"
+                "            {\n";
+
+            for (unsigned long j = 0; j < 8; j += 1) {
+                Append(Text, "                case %lu:\n", j);
+                Text += "                    nResult = ";
+                AppendIntExpression(Text, Scope, 1);
+                Text += ";\n";
+                Text += "                    break;\n";
+            }
+
+            Text += "            }\n";
+        } else {
+            Text += "            nResult = ";
+            AppendIntExpression(Text, Scope, 2);
+            Text += ";\n";
+        }
+
+        Text += "            break;\n";
+    }
+
+    Text +=
+        "    }\n"
+        "\n"
+        "    return nResult;\n"
+        "}\n"
+        "\n"
+        "void main()\n"
+        "{\n"
+        "    int nTotal = 0;\n"
+        "    int i;\n"
+        "\n"
+        "    for (i = 0; i < 64; i++)\n"
+        "    {\n"
+        "        nTotal += SwitchSparse(i * 37);\n"
+        "        nTotal += SwitchDense(i);\n"
+        "    }\n"
+        "\n"
+        "    PrintInteger(nTotal);\n"
+        "}\n";
+
+    AddSourceFile("bench_switch", Text, true);
+}
+
+void
+CorpusGenerator::GenerateNestedScript(
+    )
+/*++
+
+Routine Description:
+
+    This routine generates bench_nested: deeply nested expressions, nested
+    calls, nested ternaries and deeply nested blocks.
+
+Arguments:
+
+    None.
+
+Return Value:
+
+    None.
+
+Environment:
+
+    User mode.
+
+--*/
+{
+    std::string   Text;
+    StringVec     Functions;
+    FunctionScope Scope;
+
+    Scope.IntVariables.push_back("nA");
+    Scope.IntVariables.push_back("nB");
+
+    Text +=
+        "// bench_nested: deeply nested code.\n"
+        "\n"
+        "int NestedStep(int nValue)\n"
+        "{\n"
+        "    return nValue * 3 + 1;\n"
+        "}\n"
+        "\n";
+
+    //
+    // Nested expressions of growing depth.
+    //
+
+    for (unsigned long i = 0; i < 4 * m_Scale; i += 1) {
+        std::string   Name;
+        unsigned long Depth = NestedDepth >> (3 - (i % 4));
+
+        Append(Name, "NestedExpression%lu", i);
+        Append(Text, "int %s(int nA, int nB)\n{\n    return ", Name.c_str());
+        AppendNestedExpression(Text, Scope, Depth, 1);
+        Text += ";\n}\n\n";
+
+        Functions.push_back(Name);
+    }
+
+    //
+    // Nested ternaries.
+    //
+
+    Text += "int NestedTernary(int nA, int nB)\n{\n    return ";
+
+    for (unsigned long i = 0; i < NestedTernaryDepth; i += 1) {
+        Append(Text, "(nA > %lu) ? ", Random(1000));
+        AppendIntExpression(Text, Scope, 1);
+        Text += " :\n";
+        Indent(Text, 2);
+    }
+
+    Text += "nB;\n}\n\n";
+    Functions.push_back("NestedTernary");
+
+    //
+    // Nested calls.
+    //
+
+    Text += "int NestedCalls(int nA, int nB)\n{\n    return ";
+
+    for (unsigned long i = 0; i < NestedCallDepth; i += 1) {
+        Text += "NestedStep(\n";
+        Indent(Text, i + 2);
+    }
+
+    Text += "nA + nB";
+    Text.append(NestedCallDepth, ')');
+    Text += ";\n}\n\n";
+    Functions.push_back("NestedCalls");
+
+    //
+    // Nested blocks, alternating between the kinds of compound statement.
+    //
+
+    Text += "int NestedBlocks(int nA, int nB)\n{\n    int nResult = nA;\n    int i;\n\n";
+
+    for (unsigned long i = 0; i < NestedBlockDepth; i += 1) {
+        Indent(Text, i + 1);
+
+        switch (i % 4) {
+            case 0:
+                Append(Text, "if (nResult != %lu)\n", Random(1000));
+                break;
+            case 1:
+                Append(Text, "for (i = 0; i < %lu; i++)\n", Random(8) + 1);
+                break;
+            case 2:
+                Append(Text, "while (nResult > %lu)\n", Random(1000));
+                break;
+            default:
+                Text += "do\n";
+                break;
+        }
+
+        Indent(Text, i + 1);
+        Text += "{\n";
+        Indent(Text, i + 2);
+        Append(Text, "nResult = nResult + nB - %lu;\n", Random(16));
+    }
+
+    for (unsigned long i = NestedBlockDepth; i > 0; i -= 1) {
+        Indent(Text, i);
+
+        if ((i - 1) % 4 == 3)
+            Append(Text, "} while (nResult < %lu);\n", Random(1000));
+        else
+            Text += "}\n";
+    }
+
+    Text += "\n    return nResult;\n}\n\n";
+    Functions.push_back("NestedBlocks");
+
+    AppendMain(Text, Functions);
+
+    AddSourceFile("bench_nested", Text, true);
+}
@@ -0,0 +1,340 @@
+/*++
+
+Module Name:
+
+    CorpusGenerator.h
+
+Abstract:
+
+    This module defines the benchmark corpus generator, which produces a
+    deterministic set of NWScript sources for nwnscbench.  The corpus is
+    made of an nwscript.nss sized declaration file and scripts that each
+    stress one part of the compiler:
+
+    - a large flat script of many ordinary functions,
+    - a deep tree (and a long chain) of include files,
+    - a script that leans on #define and #ifdef,
+    - a script with huge switch statements, and
+    - a script of deeply nested expressions, calls and blocks.
+
+    The generator also writes a KEY file and its BIF files that index a set
+    of small scripts, for timing the KEY/BIF resource index.
+
+    The same seed and scale always produce the same corpus, byte for byte,
+    on every platform, so that timings taken on different builds compare.
+
+--*/
+
+#ifndef _PROGRAMS_NWNSCBENCH_CORPUSGENERATOR_H
+#define _PROGRAMS_NWNSCBENCH_CORPUSGENERATOR_H
+
+#ifdef _MSC_VER
+#pragma once
+#endif
+
+#include <string>
+#include <vector>
+
+struct IDebugTextOut;
+
+class CorpusGenerator
+{
+
+public:
+
+    typedef std::vector< std::string > StringVec;
+
+    //
+    // Describes a generated source file.  Scripts have a main function and
+    // are compiled; the other files are only included.
+    //
+
+    struct SourceFile
+    {
+        std::string Name;   // Resource name, without extension
+        std::string Text;
+        bool        IsScript;
+    };
+
+    typedef std::vector< SourceFile > SourceFileVec;
+
+    //
+    // Create a generator.  The scale multiplies the size of every part of
+    // the corpus; a scale of 1 gives an nwscript.nss about the size of the
+    // game's own.
+    //
+
+    CorpusGenerator(
+        unsigned long Seed,
+        unsigned long Scale
+        );
+
+    ~CorpusGenerator(
+        );
+
+    //
+    // Generate the source files of the corpus.
+    //
+
+    void
+    Generate(
+        );
+
+    //
+    // Write the source files to a directory, which must exist.
+    //
+
+    bool
+    WriteSourceFiles(
+        const std::string & Directory,
+        IDebugTextOut * TextOut
+        ) const;
+
+    //
+    // Write a KEY file (KeyName.key) and its BIF files to a directory, which
+    // must exist.  Every BIF holds ResourcesPerBif small scripts; the names
+    // of all of them are returned.
+    //
+
+    bool
+    WriteKeyFile(
+        const std::string & Directory,
+        const std::string & KeyName,
+        unsigned long BifCount,
+        unsigned long ResourcesPerBif,
+        StringVec & ResourceNames,
+        IDebugTextOut * TextOut
+        ) const;
+
+    inline
+    const SourceFileVec &
+    GetSourceFiles(
+        ) const
+    {
+        return m_SourceFiles;
+    }
+
+    //
+    // Return the names declared by the generated nwscript.nss, i.e. an
+    // identifier set of realistic size and shape.
+    //
+
+    inline
+    const StringVec &
+    GetIdentifiers(
+        ) const
+    {
+        return m_Identifiers;
+    }
+
+private:
+
+    //
+    // Define the types used in generated code.  The engine types follow the
+    // ENGINE_STRUCTURE_n defines of the generated nwscript.nss.
+    //
+
+    typedef enum _VALUE_TYPE
+    {
+        TypeVoid,
+        TypeInt,
+        TypeFloat,
+        TypeString,
+        TypeObject,
+        TypeVector,
+        TypeEffect,
+        TypeEvent,
+        TypeLocation,
+        TypeTalent,
+        TypeItemProperty,
+
+        LastType
+    } VALUE_TYPE, * PVALUE_TYPE;
+
+    typedef std::vector< VALUE_TYPE > TypeVec;
+
+    //
+    // Describes an action declared by the generated nwscript.nss.  Actions
+    // that take only simple arguments may be called by generated code.
+    //
+
+    struct Action
+    {
+        std::string Name;
+        VALUE_TYPE  ReturnType;
+        TypeVec     ParameterTypes;
+        bool        Callable;
+    };
+
+    typedef std::vector< Action > ActionVec;
+
+    //
+    // Describes the state of the function being generated.
+    //
+
+    struct FunctionScope
+    {
+        StringVec     IntVariables;
+        StringVec     Callees;  // Earlier user functions, int (int, int)
+        unsigned long Locals;
+    };
+
+    unsigned long
+    Random(
+        unsigned long Range
+        );
+
+    bool
+    Chance(
+        unsigned long Percent
+        );
+
+    static
+    void
+    Append(
+        std::string & Text,
+        const char * Format,
+        ...
+        );
+
+    static
+    void
+    Indent(
+        std::string & Text,
+        unsigned long Depth
+        );
+
+    static
+    const char *
+    GetTypeName(
+        VALUE_TYPE Type
+        );
+
+    std::string
+    MakeName(
+        const char * Prefix,
+        unsigned long Index
+        );
+
+    void
+    AppendArgument(
+        std::string & Text,
+        VALUE_TYPE Type,
+        FunctionScope & Scope
+        );
+
+    void
+    AppendIntLeaf(
+        std::string & Text,
+        FunctionScope & Scope
+        );
+
+    void
+    AppendIntExpression(
+        std::string & Text,
+        FunctionScope & Scope,
+        unsigned long Depth
+        );
+
+    void
+    AppendNestedExpression(
+        std::string & Text,
+        FunctionScope & Scope,
+        unsigned long Depth,
+        unsigned long Level
+        );
+
+    void
+    AppendStatement(
+        std::string & Text,
+        FunctionScope & Scope,
+        unsigned long Depth
+        );
+
+    void
+    AppendFunction(
+        std::string & Text,
+        const std::string & Name,
+        FunctionScope & Scope
+        );
+
+    void
+    AppendMain(
+        std::string & Text,
+        const StringVec & Functions
+        );
+
+    static
+    void
+    AppendUshort(
+        std::vector< unsigned char > & Data,
+        unsigned short Value
+        );
+
+    static
+    void
+    AppendUlong(
+        std::vector< unsigned char > & Data,
+        unsigned long Value
+        );
+
+    static
+    bool
+    WriteFile(
+        const std::string & FileName,
+        const void * Data,
+        size_t Size,
+        IDebugTextOut * TextOut
+        );
+
+    void
+    AddSourceFile(
+        const std::string & Name,
+        const std::string & Text,
+        bool IsScript
+        );
+
+    void
+    GenerateNWScript(
+        );
+
+    void
+    GenerateFlatScript(
+        );
+
+    void
+    GenerateIncludeTree(
+        );
+
+    void
+    GenerateIncludeNode(
+        unsigned long Depth,
+        unsigned long Index,
+        unsigned long MaxDepth,
+        StringVec & Functions
+        );
+
+    void
+    GenerateDefineScript(
+        );
+
+    void
+    GenerateSwitchScript(
+        );
+
+    void
+    GenerateNestedScript(
+        );
+
+    unsigned long long                m_Seed;
+    unsigned long long                m_State;
+    unsigned long                     m_Scale;
+    SourceFileVec                     m_SourceFiles;
+    StringVec                         m_Identifiers;
+    StringVec                         m_IntConstants;
+    StringVec                         m_ScriptConstants;
+    ActionVec                         m_Actions;
+
+};
+
+#endif
@@ -0,0 +1,1381 @@
+/*++
+
+Module Name:
+
+    nwnscbench.cpp
+
+Abstract:
+
+    This module houses the main entry point of the compiler benchmark.  The
+    benchmark generates a deterministic corpus (see CorpusGenerator.h) and
+    times the stages of the compiler on it:
+
+    - lexing, through the phase 1 lexer of the compiler context,
+    - symbol table insertion and lookup, scoped as the compiler scopes them,
+    - the nwscript.nss initialization of a new compiler,
+    - the phase 1 and phase 2 parse, code generation and NDB emission,
+    - disassembly of the compiled scripts, and
+    - loading and looking up a KEY/BIF resource index.
+
+    Each benchmark reports its time per iteration, its throughput and the
+    heap allocations it made.  Allocations are counted by replacing the
+    global operator new, so allocations made with malloc (e.g. by the
+    symbol tables and the stream classes) are not included.
+
+--*/
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cstdarg>
+#include <atomic>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include <set>
+#include <memory>
+#include "../_NwnDataLib/TextOut.h"
+#include "../_NwnDataLib/ResourceManager.h"
+#include "../_NscLib/Nsc.h"
+#include "../_NscLib/NscContext.h"
+#include "CorpusGenerator.h"
+
+#if defined(_WINDOWS)
+#include <direct.h>
+#else
+#include <sys/stat.h>
+#include <sys/types.h>
+#include <errno.h>
+#endif
+
+#include "../_NwnUtilLib/easylogging++.h"
+
+INITIALIZE_EASYLOGGINGPP
+
+extern CNscContext *g_pCtx;
+
+//
+// Count the heap allocations made through operator new.
+//
+
+static std::atomic< unsigned long long > g_Allocations( 0 );
+static std::atomic< unsigned long long > g_AllocatedBytes( 0 );
+
+void *
+operator new(
+    size_t Size
+    )
+{
+    void * p;
+
+    g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    g_AllocatedBytes.fetch_add(Size, std::memory_order_relaxed);
+
+    p = malloc(Size != 0 ? Size : 1);
+
+    if (p == nullptr)
+        throw std::bad_alloc();
+
+    return p;
+}
+
+void *
+operator new[](
+    size_t Size
+    )
+{
+    return operator new(Size);
+}
+
+void *
+operator new(
+    size_t Size,
+    const std::nothrow_t &
+    ) noexcept
+{
+    g_Allocations.fetch_add(1, std::memory_order_relaxed);
+    g_AllocatedBytes.fetch_add(Size, std::memory_order_relaxed);
+
+    return malloc(Size != 0 ? Size : 1);
+}
+
+void *
+operator new[](
+    size_t Size,
+    const std::nothrow_t & NoThrow
+    ) noexcept
+{
+    return operator new(Size, NoThrow);
+}
+
+//
+// Release a block allocated by the operator new replacements above.  Every
+// replaceable form of operator delete is replaced, so that each block is
+// released by the allocator that made it.
+//
+
+static
+void
+ReleaseAllocation(
+    void * p
+    )
+{
+    free(p);
+}
+
+void
+operator delete(
+    void * p
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+void
+operator delete[](
+    void * p
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+void
+operator delete(
+    void * p,
+    const std::nothrow_t &
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+void
+operator delete[](
+    void * p,
+    const std::nothrow_t &
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+#if defined(__cpp_sized_deallocation)
+
+void
+operator delete(
+    void * p,
+    size_t
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+void
+operator delete[](
+    void * p,
+    size_t
+    ) noexcept
+{
+    ReleaseAllocation(p);
+}
+
+#endif
+
+//
+// Define the debug text output interface.
+//
+
+class PrintfTextOut : public IDebugTextOut {
+
+public:
+
+    inline
+    PrintfTextOut() {}
+
+    inline
+    ~PrintfTextOut() {}
+
+    inline
+    virtual
+    void
+    WriteText(
+            const char *fmt, ...) {
+        va_list ap;
+
+        va_start(ap, fmt);
+        WriteTextV(fmt, ap);
+        va_end(ap);
+    }
+
+    inline
+    virtual
+    void
+    WriteTextV(
+            const char *fmt,
+            va_list ap
+    ) {
+        char buf[8193];
+
+        vsnprintf(buf, sizeof(buf), fmt, ap);
+
+        puts(buf);
+    }
+
+};
+
+//
+// Describes the result of a benchmark.  Times are in nanoseconds and totals
+// cover all of the timed iterations.
+//
+
+typedef struct _BENCH_RESULT {
+    std::string        Name;
+    unsigned long      Iterations;
+    unsigned long long Time;
+    unsigned long long Bytes;
+    unsigned long long Items;
+    const char       * ItemName;
+    bool               CountsAllocations;
+    unsigned long long Allocations;
+    unsigned long long AllocatedBytes;
+} BENCH_RESULT, *PBENCH_RESULT;
+
+typedef std::vector<BENCH_RESULT> BenchResultVec;
+
+//
+// Describes a compiled script of the corpus.
+//
+
+typedef struct _COMPILED_SCRIPT {
+    std::string          Name;
+    std::vector<UINT8>   Code;
+    std::vector<UINT8>   Symbols;
+} COMPILED_SCRIPT, *PCOMPILED_SCRIPT;
+
+typedef std::vector<COMPILED_SCRIPT> CompiledScriptVec;
+
+//
+// Describes the measurement of a benchmark in progress.
+//
+
+class BenchMeasurement {
+
+public:
+
+    inline
+    BenchMeasurement(
+            BENCH_RESULT &Result
+    )
+            : m_Result(Result),
+              m_Allocations(g_Allocations.load()),
+              m_AllocatedBytes(g_AllocatedBytes.load()),
+              m_Start(NscGetTimestamp()) {
+    }
+
+    inline
+    ~BenchMeasurement() {
+        m_Result.Time += NscGetTimestamp() - m_Start;
+        m_Result.Allocations += g_Allocations.load() - m_Allocations;
+        m_Result.AllocatedBytes += g_AllocatedBytes.load() - m_AllocatedBytes;
+    }
+
+private:
+
+    BENCH_RESULT       &m_Result;
+    unsigned long long  m_Allocations;
+    unsigned long long  m_AllocatedBytes;
+    unsigned long long  m_Start;
+
+};
+
+PrintfTextOut g_TextOut;
+
+
+void
+InitializeResult(
+        BENCH_RESULT &Result,
+        const char *Name,
+        const char *ItemName,
+        unsigned long Iterations
+)
+/*++
+
+Routine Description:
+
+	This routine sets up an empty benchmark result.
+
+Arguments:
+
+	Result - Supplies the result to set up.
+
+	Name - Supplies the name of the benchmark.
+
+	ItemName - Supplies what the items of the benchmark are.
+
+	Iterations - Supplies the number of timed iterations.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    Result.Name = Name;
+    Result.Iterations = Iterations;
+    Result.Time = 0;
+    Result.Bytes = 0;
+    Result.Items = 0;
+    Result.ItemName = ItemName;
+    Result.CountsAllocations = true;
+    Result.Allocations = 0;
+    Result.AllocatedBytes = 0;
+}
+
+
+bool
+CreateCorpusDirectory(
+        const std::string &Directory
+)
+/*++
+
+Routine Description:
+
+	This routine creates the corpus directory, if it does not exist yet.
+
+Arguments:
+
+	Directory - Supplies the path of the directory.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+#if defined(_WINDOWS)
+    if (_mkdir(Directory.c_str()) != 0 && errno != EEXIST)
+        return false;
+#else
+    if (mkdir(Directory.c_str(), 0755) != 0 && errno != EEXIST)
+        return false;
+#endif
+
+    return true;
+}
+
+
+unsigned long long
+LexScript(
+        NscCompiler &Compiler,
+        const CorpusGenerator::SourceFile &Script
+)
+/*++
+
+Routine Description:
+
+	This routine runs the phase 1 lexer of the compiler over a script, as the
+	parser would, and discards the tokens.  Include files are lexed where the
+	script includes them.
+
+Arguments:
+
+	Compiler - Supplies the compiler, which must have parsed nwscript.nss.
+
+	Script - Supplies the script to lex.
+
+Return Value:
+
+	The number of tokens of the script.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    NscCompilerState *State = Compiler.NscGetCompilerState();
+    CNscContext Ctx(&Compiler);
+    CNscPStackEntry *Value;
+    unsigned long long Tokens = 0;
+    std::string FileName = Script.Name + ".nss";
+
+    State->m_sWorkspace.BeginCompile();
+    Ctx.SetWorkspace(&State->m_sWorkspace);
+    Ctx.SetLoader(&Compiler);
+    Ctx.LoadSymbolTable(&State->m_sNscNWScript);
+    Ctx.SetPreprocessorEnabled(State->m_fEnableExtensions);
+
+    g_pCtx = &Ctx;
+
+    Ctx.AddStream(new CNwnMemoryStream(
+            FileName.c_str(),
+            (unsigned char *) Script.Text.data(),
+            Script.Text.size(),
+            false));
+    Ctx.SetupPreprocessor();
+
+    while (Ctx.yylex(&Value) > 0) {
+        Tokens += 1;
+
+        if (Value != nullptr)
+            Ctx.FreePStackEntry(Value);
+    }
+
+    g_pCtx = nullptr;
+
+    return Tokens;
+}
+
+
+bool
+CompileScript(
+        NscCompiler &Compiler,
+        const CorpusGenerator::SourceFile &Script,
+        bool Optimize,
+        UINT32 CompilerFlags,
+        COMPILED_SCRIPT &Compiled
+)
+/*++
+
+Routine Description:
+
+	This routine compiles a script of the corpus from memory.
+
+Arguments:
+
+	Compiler - Supplies the compiler.
+
+	Script - Supplies the script to compile.
+
+	Optimize - Supplies true to optimize the script.
+
+	CompilerFlags - Supplies the compiler flags (NscCompilerFlag_*).
+
+	Compiled - Receives the compiled script.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    NWN::ResRef32 ScriptName;
+    std::set<std::string> Dependencies;
+
+    ScriptName = ResourceManager::ResRef32FromStr(Script.Name);
+
+    Compiled.Name = Script.Name;
+
+    if (Compiler.NscCompileScript(
+            ScriptName,
+            Script.Text.data(),
+            Script.Text.size(),
+            174,
+            Optimize,
+            false,
+            &g_TextOut,
+            CompilerFlags,
+            Compiled.Code,
+            Compiled.Symbols,
+            Dependencies) != NscResult_Success) {
+        g_TextOut.WriteText(
+                "Error: Failed to compile corpus script %s.\n",
+                Script.Name.c_str());
+        return false;
+    }
+
+    return true;
+}
+
+
+void
+RunLexBenchmark(
+        NscCompiler &Compiler,
+        const CorpusGenerator::SourceFileVec &Files,
+        unsigned long Iterations,
+        BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine times the lexer over the scripts of the corpus.
+
+Arguments:
+
+	Compiler - Supplies the compiler, which must have parsed nwscript.nss.
+
+	Files - Supplies the corpus.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Results - Receives the result.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Result;
+
+    InitializeResult(Result, "Lex", "tokens", Iterations);
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        for (CorpusGenerator::SourceFileVec::const_iterator it = Files.begin();
+             it != Files.end();
+             ++it) {
+            if (!it->IsScript)
+                continue;
+
+            //
+            // The first pass warms up the resource cache and is not timed.
+            //
+
+            if (i == 0) {
+                LexScript(Compiler, *it);
+                continue;
+            }
+
+            BenchMeasurement Measure(Result);
+
+            Result.Items += LexScript(Compiler, *it);
+            Result.Bytes += it->Text.size();
+        }
+    }
+
+    Results.push_back(Result);
+}
+
+
+void
+RunSymbolTableBenchmark(
+        const CorpusGenerator::StringVec &Identifiers,
+        unsigned long Iterations,
+        BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine times the symbol table with the identifiers of the generated
+	nwscript.nss.  The identifiers are added as globals and looked up; then,
+	as the compiler does for each function body, a scope is opened with a
+	fence, locals are added and looked up along with globals and misses, and
+	the scope is closed again.
+
+Arguments:
+
+	Identifiers - Supplies the identifiers.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Results - Receives the result.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Result;
+    std::vector<std::string> Locals;
+    std::vector<std::string> Misses;
+
+    InitializeResult(Result, "Symbol table", "operations", Iterations);
+
+    for (size_t i = 0; i < 64; i += 1) {
+        char Name[32];
+
+        snprintf(Name, sizeof(Name), "nLocal%lu", (unsigned long) i);
+        Locals.push_back(Name);
+    }
+
+    for (size_t i = 0; i < Identifiers.size(); i += 1)
+        Misses.push_back(Identifiers[i] + "_");
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        BENCH_RESULT Warmup;
+        BENCH_RESULT &Target = (i == 0) ? Warmup : Result;
+        unsigned long long Found = 0;
+        unsigned long long Operations = 0;
+
+        Warmup = Result;
+
+        {
+            BenchMeasurement Measure(Target);
+            CNscSymbolTable Table;
+
+            for (size_t j = 0; j < Identifiers.size(); j += 1)
+                Table.Add(Identifiers[j].c_str(), NscSymType_Variable);
+
+            for (size_t j = 0; j < Identifiers.size(); j += 1)
+                Found += (Table.Find(Identifiers[j].c_str()) != nullptr);
+
+            Operations += Identifiers.size() * 2;
+
+            //
+            // Scope a function body per 16 globals.
+            //
+
+            for (size_t j = 0; j + 16 <= Identifiers.size(); j += 16) {
+                NscSymbolFence Fence;
+
+                Table.GetFence(&Fence);
+
+                for (size_t k = 0; k < Locals.size(); k += 1)
+                    Table.Add(Locals[k].c_str(), NscSymType_Variable);
+
+                for (size_t k = 0; k < Locals.size(); k += 1)
+                    Found += (Table.Find(Locals[k].c_str()) != nullptr);
+
+                for (size_t k = j; k < j + 16; k += 1) {
+                    Found += (Table.Find(Identifiers[k].c_str()) != nullptr);
+                    Found += (Table.Find(Misses[k].c_str()) != nullptr);
+                }
+
+                Table.RestoreFence(&Fence);
+
+                Operations += Locals.size() * 2 + 32;
+            }
+
+            Table.Reset();
+        }
+
+        Target.Items += Operations;
+
+        if (Found == 0)
+            g_TextOut.WriteText("Warning: No symbols were found.\n");
+    }
+
+    Results.push_back(Result);
+}
+
+
+bool
+RunInitializeBenchmark(
+        ResourceManager &ResMan,
+        const std::vector<std::string> &IncludePaths,
+        const CorpusGenerator &Corpus,
+        unsigned long Iterations,
+        BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine times the nwscript.nss initialization of new compilers.  The
+	allocations include those of creating the compiler and compiling an empty
+	script.
+
+Arguments:
+
+	ResMan - Supplies the resource manager of the compilers.
+
+	IncludePaths - Supplies the include paths, which find nwscript.nss.
+
+	Corpus - Supplies the corpus.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Results - Receives the result.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Result;
+    CorpusGenerator::SourceFile Empty;
+    size_t NWScriptSize = 0;
+
+    InitializeResult(Result, "nwscript.nss initialization", "declarations", Iterations);
+
+    Empty.Name = "bench_empty";
+    Empty.Text = "void main()\n{\n}\n";
+    Empty.IsScript = true;
+
+    for (CorpusGenerator::SourceFileVec::const_iterator it = Corpus.GetSourceFiles().begin();
+         it != Corpus.GetSourceFiles().end();
+         ++it) {
+        if (it->Name == "nwscript")
+            NWScriptSize = it->Text.size();
+    }
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        BENCH_RESULT Warmup;
+        BENCH_RESULT &Target = (i == 0) ? Warmup : Result;
+        unsigned long long Time;
+        UINT64 InitTime;
+
+        Warmup = Result;
+        Time = Result.Time;
+
+        {
+            BenchMeasurement Measure(Target);
+            NscCompiler Compiler(ResMan, true);
+            COMPILED_SCRIPT Compiled;
+
+            Compiler.NscSetIncludePaths(IncludePaths);
+
+            if (!CompileScript(Compiler, Empty, false, 0, Compiled))
+                return false;
+
+            InitTime = Compiler.NscGetCompileTimings().NWScriptInitTime;
+        }
+
+        //
+        // Only the initialization is timed, not the rest of the compile.
+        //
+
+        Target.Time = Time + InitTime;
+        Target.Items += Corpus.GetIdentifiers().size();
+        Target.Bytes += NWScriptSize;
+    }
+
+    Results.push_back(Result);
+    return true;
+}
+
+
+bool
+RunCompileBenchmark(
+        NscCompiler &Compiler,
+        const CorpusGenerator::SourceFileVec &Files,
+        unsigned long Iterations,
+        bool Optimize,
+        UINT32 CompilerFlags,
+        BenchResultVec &Results,
+        CompiledScriptVec &Compiled
+)
+/*++
+
+Routine Description:
+
+	This routine times the compilation of the scripts of the corpus, in total
+	and by stage.  The stages come from the compiler's own timings; their
+	allocations cannot be told apart and are reported with the total.
+
+Arguments:
+
+	Compiler - Supplies the compiler.
+
+	Files - Supplies the corpus.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Optimize - Supplies true to optimize the scripts.
+
+	CompilerFlags - Supplies the compiler flags (NscCompilerFlag_*).
+
+	Results - Receives the results.
+
+	Compiled - Receives the compiled scripts.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Total;
+    BENCH_RESULT Stages[4];
+    static const char *StageNames[4] = {
+            "  Phase 1 parse",
+            "  Phase 2 parse",
+            "  Code generation",
+            "  NDB emission"
+    };
+
+    InitializeResult(Total, "Compile", "scripts", Iterations);
+
+    for (size_t i = 0; i < 4; i += 1) {
+        InitializeResult(Stages[i], StageNames[i], "scripts", Iterations);
+        Stages[i].CountsAllocations = false;
+    }
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        for (CorpusGenerator::SourceFileVec::const_iterator it = Files.begin();
+             it != Files.end();
+             ++it) {
+            COMPILED_SCRIPT Script;
+            BENCH_RESULT Warmup;
+            BENCH_RESULT &Target = (i == 0) ? Warmup : Total;
+
+            if (!it->IsScript)
+                continue;
+
+            Warmup = Total;
+
+            {
+                BenchMeasurement Measure(Target);
+
+                if (!CompileScript(Compiler, *it, Optimize, CompilerFlags, Script))
+                    return false;
+            }
+
+            if (i == 0) {
+                Compiled.push_back(Script);
+                continue;
+            }
+
+            const NscCompileTimings &Timings = Compiler.NscGetCompileTimings();
+            UINT64 Times[4] = {
+                    Timings.Phase1Time,
+                    Timings.Phase2Time,
+                    Timings.CodeGenerationTime,
+                    Timings.SymbolsTime
+            };
+
+            Total.Items += 1;
+            Total.Bytes += it->Text.size();
+
+            for (size_t j = 0; j < 4; j += 1) {
+                Stages[j].Time += Times[j];
+                Stages[j].Items += 1;
+                Stages[j].Bytes += it->Text.size();
+            }
+        }
+    }
+
+    Results.push_back(Total);
+    Results.insert(Results.end(), Stages, Stages + 4);
+    return true;
+}
+
+
+void
+RunDisassembleBenchmark(
+        NscCompiler &Compiler,
+        const CompiledScriptVec &Compiled,
+        unsigned long Iterations,
+        BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine times the disassembly of the compiled scripts of the corpus.
+
+Arguments:
+
+	Compiler - Supplies the compiler.
+
+	Compiled - Supplies the compiled scripts.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Results - Receives the result.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Result;
+
+    InitializeResult(Result, "Disassemble", "scripts", Iterations);
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        for (CompiledScriptVec::const_iterator it = Compiled.begin();
+             it != Compiled.end();
+             ++it) {
+            BENCH_RESULT Warmup;
+            BENCH_RESULT &Target = (i == 0) ? Warmup : Result;
+            std::string Disassembly;
+
+            Warmup = Result;
+
+            BenchMeasurement Measure(Target);
+
+            Compiler.NscDisassembleScript(
+                    (!it->Code.empty()) ? &it->Code[0] : nullptr,
+                    it->Code.size(),
+                    Disassembly);
+
+            Target.Items += 1;
+            Target.Bytes += it->Code.size();
+        }
+    }
+
+    Results.push_back(Result);
+}
+
+
+bool
+RunKeyIndexBenchmark(
+        const std::string &Directory,
+        const std::string &KeyName,
+        const CorpusGenerator::StringVec &ResourceNames,
+        unsigned long Iterations,
+        BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine times loading the generated KEY/BIF index into a new
+	resource manager, and then opening and reading every resource it
+	indexes in a shuffled order.
+
+Arguments:
+
+	Directory - Supplies the directory of the KEY and BIF files.
+
+	KeyName - Supplies the name of the KEY file, without extension.
+
+	ResourceNames - Supplies the names of the indexed resources.
+
+	Iterations - Supplies the number of timed iterations.
+
+	Results - Receives the results.
+
+Return Value:
+
+	The routine returns a Boolean value indicating true on success, else false
+	on failure.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    BENCH_RESULT Load;
+    BENCH_RESULT Lookup;
+    std::vector<NWN::ResRef32> Names;
+    std::string InstallDir(Directory);
+    std::vector<unsigned char> Buffer;
+
+    InitializeResult(Load, "KEY/BIF index load", "resources", Iterations);
+    InitializeResult(Lookup, "KEY/BIF lookup", "lookups", Iterations);
+
+    //
+    // Shuffle the lookups with a fixed stride, so that they do not follow
+    // the order of the index.
+    //
+
+    for (size_t i = 0; i < ResourceNames.size(); i += 1) {
+        size_t Index = (i * 7919) % ResourceNames.size();
+
+        Names.push_back(ResourceManager::ResRef32FromStr(ResourceNames[Index]));
+    }
+
+#if defined(_WINDOWS)
+    if (InstallDir.back() != '\\')
+        InstallDir.push_back('\\');
+#else
+    if (InstallDir.back() != '/')
+        InstallDir.push_back('/');
+#endif
+
+    for (unsigned long i = 0; i <= Iterations; i += 1) {
+        BENCH_RESULT LoadWarmup;
+        BENCH_RESULT LookupWarmup;
+        BENCH_RESULT &LoadTarget = (i == 0) ? LoadWarmup : Load;
+        BENCH_RESULT &LookupTarget = (i == 0) ? LookupWarmup : Lookup;
+        std::unique_ptr<ResourceManager> ResMan;
+        ResourceManager::ModuleLoadParams LoadParams;
+        ResourceManager::StringVec KeyFiles;
+
+        LoadWarmup = Load;
+        LookupWarmup = Lookup;
+
+        ZeroMemory(&LoadParams, sizeof(LoadParams));
+
+        LoadParams.SearchOrder = ResourceManager::ModSearch_PrefDirectory;
+        LoadParams.ResManFlags = ResourceManager::ResManFlagNoGranny2 |
+                                 ResourceManager::ResManFlagErf16 |
+                                 ResourceManager::ResManFlagBaseResourcesOnly;
+
+        KeyFiles.push_back(KeyName);
+        LoadParams.KeyFiles = &KeyFiles;
+
+        {
+            BenchMeasurement Measure(LoadTarget);
+
+            ResMan.reset(new ResourceManager(&g_TextOut));
+            ResMan->LoadScriptResources("", InstallDir, &LoadParams);
+        }
+
+        LoadTarget.Items += ResourceNames.size();
+
+        {
+            BenchMeasurement Measure(LookupTarget);
+
+            for (size_t j = 0; j < Names.size(); j += 1) {
+                ResourceManager::FileHandle Handle;
+                size_t Size;
+                size_t Read;
+
+                Handle = ResMan->OpenFile(Names[j], NWN::ResNSS);
+
+                if (Handle == ResourceManager::INVALID_FILE) {
+                    g_TextOut.WriteText(
+                            "Error: Resource %s is missing from the KEY/BIF index.\n",
+                            ResourceNames[(j * 7919) % ResourceNames.size()].c_str());
+                    return false;
+                }
+
+                Size = ResMan->GetEncapsulatedFileSize(Handle);
+                Buffer.resize(Size);
+
+                if (Size != 0)
+                    ResMan->ReadEncapsulatedFile(Handle, 0, Size, &Read, &Buffer[0]);
+
+                ResMan->CloseFile(Handle);
+
+                LookupTarget.Bytes += Size;
+            }
+        }
+
+        LookupTarget.Items += Names.size();
+    }
+
+    Results.push_back(Load);
+    Results.push_back(Lookup);
+    return true;
+}
+
+
+void
+PrintResults(
+        const BenchResultVec &Results
+)
+/*++
+
+Routine Description:
+
+	This routine prints the benchmark results as a table.
+
+Arguments:
+
+	Results - Supplies the results.
+
+Return Value:
+
+	None.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    g_TextOut.WriteText(
+            "%-28s %10s %10s %14s %-12s %12s %12s",
+            "Benchmark",
+            "ms/iter",
+            "MB/s",
+            "Items/s",
+            "",
+            "Allocs/iter",
+            "KB/iter");
+
+    for (BenchResultVec::const_iterator it = Results.begin();
+         it != Results.end();
+         ++it) {
+        double Seconds = (double) it->Time / 1000000000.0;
+        double Iterations = (double) (it->Iterations != 0 ? it->Iterations : 1);
+        char Throughput[32];
+        char Allocations[32];
+        char AllocatedKb[32];
+
+        if (it->Bytes != 0 && Seconds > 0.0) {
+            snprintf(Throughput, sizeof(Throughput), "%10.2f",
+                     (double) it->Bytes / (1024.0 * 1024.0) / Seconds);
+        } else {
+            snprintf(Throughput, sizeof(Throughput), "%10s", "-");
+        }
+
+        if (it->CountsAllocations) {
+            snprintf(Allocations, sizeof(Allocations), "%12.0f",
+                     (double) it->Allocations / Iterations);
+            snprintf(AllocatedKb, sizeof(AllocatedKb), "%12.1f",
+                     (double) it->AllocatedBytes / 1024.0 / Iterations);
+        } else {
+            snprintf(Allocations, sizeof(Allocations), "%12s", "-");
+            snprintf(AllocatedKb, sizeof(AllocatedKb), "%12s", "-");
+        }
+
+        g_TextOut.WriteText(
+                "%-28s %10.3f %s %14.0f %-12s %s %s",
+                it->Name.c_str(),
+                (double) it->Time / 1000000.0 / Iterations,
+                Throughput,
+                Seconds > 0.0 ? (double) it->Items / Seconds : 0.0,
+                it->ItemName,
+                Allocations,
+                AllocatedKb);
+    }
+}
+
+
+bool
+BenchmarkSelected(
+        const std::string &Filter,
+        const char *Name
+)
+/*++
+
+Routine Description:
+
+	This routine checks whether a benchmark was selected with -f.
+
+Arguments:
+
+	Filter - Supplies the -f filter (empty to run all benchmarks).
+
+	Name - Supplies the name of the benchmark.
+
+Return Value:
+
+	True if the benchmark is to run.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    return Filter.empty() || strstr(Name, Filter.c_str()) != nullptr;
+}
+
+
+int
+main(
+        int argc,
+        char **argv
+)
+/*++
+
+Routine Description:
+
+	This routine is the entry point routine for the benchmark.
+
+Arguments:
+
+	argc - Supplies the count of arguments.
+
+	argv - Supplies the argument array.
+
+Return Value:
+
+	The routine returns zero on success, else one.
+
+Environment:
+
+	User mode.
+
+--*/
+{
+    std::string Directory("nwnscbench_corpus");
+    std::string Filter;
+    unsigned long Seed = 1;
+    unsigned long Scale = 1;
+    unsigned long Iterations = 5;
+    bool GenerateOnly = false;
+    bool Optimize = true;
+    UINT32 CompilerFlags = NscCompilerFlag_OptimizeLevel2;
+    bool Error = false;
+
+    //
+    // Keep the compiler's logging quiet, as the compiler driver does by
+    // default, so that logging is not timed along with the compiler.
+    //
+
+    el::Configurations defaultConf;
+    defaultConf.setToDefault();
+    defaultConf.set(el::Level::Info,
+                    el::ConfigurationType::Enabled, "false");
+    defaultConf.set(el::Level::Warning,
+                    el::ConfigurationType::Enabled, "false");
+    defaultConf.set(el::Level::Debug,
+                    el::ConfigurationType::Enabled, "false");
+    defaultConf.set(el::Level::Trace,
+                    el::ConfigurationType::Enabled, "false");
+    defaultConf.set(el::Level::Global, el::ConfigurationType::ToFile, "false");
+    el::Loggers::reconfigureLogger("default", defaultConf);
+
+    for (int i = 1; i < argc && !Error; i += 1) {
+        const char *Arg = argv[i];
+
+        if (!strcmp(Arg, "-o") && i + 1 < argc) {
+            Directory = argv[++i];
+        } else if (!strcmp(Arg, "-n") && i + 1 < argc) {
+            Iterations = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(Arg, "-s") && i + 1 < argc) {
+            Seed = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(Arg, "-x") && i + 1 < argc) {
+            Scale = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(Arg, "-f") && i + 1 < argc) {
+            Filter = argv[++i];
+        } else if (!strcmp(Arg, "-g")) {
+            GenerateOnly = true;
+        } else if (!strcmp(Arg, "-O0")) {
+            Optimize = false;
+            CompilerFlags &= ~(NscCompilerFlag_OptimizeLevel2);
+        } else if (!strcmp(Arg, "-O1")) {
+            Optimize = true;
+            CompilerFlags &= ~(NscCompilerFlag_OptimizeLevel2);
+        } else if (!strcmp(Arg, "-O2")) {
+            Optimize = true;
+            CompilerFlags |= NscCompilerFlag_OptimizeLevel2;
+        } else {
+            Error = true;
+        }
+    }
+
+    if (Error || Iterations == 0 || Scale == 0) {
+        g_TextOut.WriteText(
+                "Usage: nwnscbench [-o dir] [-n iterations] [-s seed] [-x scale]\n"
+                "                  [-f filter] [-g] [-O0|-O1|-O2]\n"
+                "\n"
+                "  -o dir        Generate the corpus into dir (default nwnscbench_corpus)\n"
+                "  -n count      Time count iterations of each benchmark (default 5)\n"
+                "  -s seed       Seed of the corpus (default 1)\n"
+                "  -x scale      Size multiplier of the corpus (default 1)\n"
+                "  -f filter     Only run the benchmarks whose name contains filter\n"
+                "  -g            Only generate the corpus\n"
+                "  -O0|-O1|-O2   Optimization level of the compile benchmark (default 2)\n");
+        return 1;
+    }
+
+    //
+    // Generate the corpus and write it out; the compiler finds the include
+    // files and nwscript.nss there.
+    //
+
+    CorpusGenerator Corpus(Seed, Scale);
+    CorpusGenerator::StringVec ResourceNames;
+    unsigned long long SourceBytes = 0;
+
+    Corpus.Generate();
+
+    if (!CreateCorpusDirectory(Directory)) {
+        g_TextOut.WriteText("Error: Unable to create directory %s.\n", Directory.c_str());
+        return 1;
+    }
+
+    if (!Corpus.WriteSourceFiles(Directory, &g_TextOut) ||
+        !Corpus.WriteKeyFile(Directory, "bench", 4 * Scale, 2500, ResourceNames, &g_TextOut)) {
+        return 1;
+    }
+
+    for (CorpusGenerator::SourceFileVec::const_iterator it = Corpus.GetSourceFiles().begin();
+         it != Corpus.GetSourceFiles().end();
+         ++it) {
+        SourceBytes += it->Text.size();
+    }
+
+    g_TextOut.WriteText(
+            "Corpus: %lu source files, %.2f MB, %lu indexed resources (seed %lu, scale %lu) in %s",
+            (unsigned long) Corpus.GetSourceFiles().size(),
+            (double) SourceBytes / (1024.0 * 1024.0),
+            (unsigned long) ResourceNames.size(),
+            Seed,
+            Scale,
+            Directory.c_str());
+
+    if (GenerateOnly)
+        return 0;
+
+    try {
+        ResourceManager ResMan(&g_TextOut);
+        std::vector<std::string> IncludePaths(1, Directory);
+        NscCompiler Compiler(ResMan, true);
+        BenchResultVec Results;
+        CompiledScriptVec Compiled;
+
+        Compiler.NscSetIncludePaths(IncludePaths);
+        Compiler.NscSetResourceCacheEnabled(true);
+
+        //
+        // Compile the scripts once whatever was selected: the compiler must
+        // have parsed nwscript.nss before lexing, and the disassembler needs
+        // the compiled code.
+        //
+
+        {
+            BenchResultVec Unused;
+
+            if (!RunCompileBenchmark(Compiler, Corpus.GetSourceFiles(), 0, Optimize, CompilerFlags, Unused,
+                                     Compiled)) {
+                return 1;
+            }
+        }
+
+        if (BenchmarkSelected(Filter, "Lex"))
+            RunLexBenchmark(Compiler, Corpus.GetSourceFiles(), Iterations, Results);
+
+        if (BenchmarkSelected(Filter, "Symbol table"))
+            RunSymbolTableBenchmark(Corpus.GetIdentifiers(), Iterations, Results);
+
+        if (BenchmarkSelected(Filter, "nwscript.nss initialization") &&
+            !RunInitializeBenchmark(ResMan, IncludePaths, Corpus, Iterations, Results)) {
+            return 1;
+        }
+
+        if (BenchmarkSelected(Filter, "Compile")) {
+            CompiledScriptVec Unused;
+
+            if (!RunCompileBenchmark(Compiler, Corpus.GetSourceFiles(), Iterations, Optimize, CompilerFlags,
+                                     Results, Unused)) {
+                return 1;
+            }
+        }
+
+        if (BenchmarkSelected(Filter, "Disassemble"))
+            RunDisassembleBenchmark(Compiler, Compiled, Iterations, Results);
+
+        if (BenchmarkSelected(Filter, "KEY/BIF") &&
+            !RunKeyIndexBenchmark(Directory, "bench", ResourceNames, Iterations, Results)) {
+            return 1;
+        }
+
+        PrintResults(Results);
+    }
+    catch (std::exception &e) {
+        g_TextOut.WriteText("Error: Exception '%s' during benchmark.\n", e.what());
+        return 1;
+    }
+
+    return 0;
+}
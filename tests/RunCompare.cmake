@@ -0,0 +1,39 @@
+#
+# Compile a script of scripts/ at -O0, -O1 and -O2, verifying the code (-a),
+# and execute it on the offline VM (--run).  The test fails if a compile,
+# verification or execution fails, or if the script output or result at -O1
+# or -O2 differs from that at -O0.
+#
+# Run with cmake -P, with NWNSC (the compiler), SCRIPTS (the script directory),
+# SCRIPT (the script name, without .nss) and OUTDIR (the output directory) set.
+#
+
+foreach(Level 0 1 2)
+    execute_process(
+        COMMAND ${NWNSC} -q -e -a -O${Level} -i ${SCRIPTS}
+                -r ${OUTDIR}/${SCRIPT}-O${Level}.ncs --run
+                ${SCRIPTS}/${SCRIPT}.nss
+        RESULT_VARIABLE Result
+        OUTPUT_VARIABLE Output
+        ERROR_VARIABLE Output
+        TIMEOUT 30)
+
+    if(NOT Result EQUAL 0)
+        message(FATAL_ERROR "${SCRIPT} failed at -O${Level}:\n${Output}")
+    endif()
+
+    #
+    # Keep the script output and the result.  The instruction counts and the
+    # function table differ between levels.
+    #
+
+    string(REGEX REPLACE "; [0-9]+ instructions[^\n]*" "" Output "${Output}")
+    string(REGEX REPLACE "\n    [^\n]*" "" Output "${Output}")
+
+    if(Level EQUAL 0)
+        set(Expected "${Output}")
+    elseif(NOT Output STREQUAL Expected)
+        message(FATAL_ERROR "${SCRIPT} output at -O${Level} differs from -O0:\n"
+                "-O0:\n${Expected}\n-O${Level}:\n${Output}")
+    endif()
+endforeach()